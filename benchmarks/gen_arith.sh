@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# gen_arith: print an scl program whose loop body is made of wide arithmetic
+# expressions over many live variables, plus one deeply right-nested
+# expression over array elements, used to benchmark expression evaluation
+# and register pressure.
+#
+# Usage: gen_arith.sh [variables] [statements] [iterations] > arith.scl
+#
+
+VARS=${1:-12}
+STMTS=${2:-24}
+ITERS=${3:-200000}
+
+echo '-include "io.scl"'
+echo
+
+i=0
+while [ "$i" -lt "$VARS" ]; do
+  echo "int v$i = $((i * 3 + 1))"
+  i=$((i + 1))
+done
+
+echo "int w[16]"
+echo "int k = 0"
+echo "while k < 16 {"
+echo "  w[k] = k + 1"
+echo "  k = k + 1"
+echo "}"
+echo
+
+echo "int deep = 0"
+echo "k = 0"
+echo "while k < $ITERS {"
+
+i=0
+while [ "$i" -lt "$STMTS" ]; do
+  d=$((i % VARS))
+  a=$(((i * 5 + 1) % VARS))
+  b=$(((i * 7 + 2) % VARS))
+  c=$(((i * 11 + 3) % VARS))
+  e=$(((i * 13 + 4) % VARS))
+  f=$(((i * 17 + 5) % VARS))
+  echo "  v$d = ((v$a + v$b) * (v$c - k) + (v$e - v$f) * (v$a + 3)) % 1000 + (v$b * v$c - v$e) / 7"
+  i=$((i + 1))
+done
+
+expr="w[15]"
+i=14
+while [ "$i" -ge 0 ]; do
+  if [ $((i % 2)) -eq 0 ]; then op="*"; else op="+"; fi
+  expr="w[$i] $op ($expr)"
+  i=$((i - 1))
+done
+echo "  deep = deep + ($expr) % 1000"
+
+echo "  k = k + 1"
+echo "}"
+echo
+
+echo "int sum = deep"
+i=0
+while [ "$i" -lt "$VARS" ]; do
+  echo "sum = sum + v$i"
+  i=$((i + 1))
+done
+echo 'fasm "output_int %d", sum'
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# gen_array_access: print an scl program with many arrays and thousands of
+# array accesses, used to benchmark how codegen scales with array accesses.
+#
+# Usage: gen_array_access.sh [arrays] [accesses] > array_access.scl
+#
+
+ARRAYS=${1:-200}
+ACCESSES=${2:-5000}
+
+echo '-include "io.scl"'
+echo
+
+i=0
+while [ "$i" -lt "$ARRAYS" ]; do
+  echo "int a$i[8]"
+  i=$((i + 1))
+done
+
+echo "int sum = 0"
+echo "int i = 0"
+echo "while i < 8 {"
+
+i=0
+while [ "$i" -lt "$ACCESSES" ]; do
+  dst=$((i % ARRAYS))
+  src=$(((i * 7 + 3) % ARRAYS))
+  echo "  a$dst[i] = a$src[i] + i"
+  i=$((i + 1))
+done
+
+echo "  sum = sum + a0[i]"
+echo "  i = i + 1"
+echo "}"
+echo
+echo 'fasm "output_int %d", sum'
@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# gen_array_loops: print an scl program that runs counted loops over arrays
+# (fill, scale, sum, dot product and a short fixed-size loop) many times,
+# used to benchmark loop unrolling.
+#
+# The program prints a checksum.
+#
+# Usage: gen_array_loops.sh [length] [repeat] > array_loops.scl
+#
+
+LENGTH=${1:-64}
+REPEAT=${2:-20000}
+
+echo '-include "io.scl"'
+echo
+
+echo "int a[$LENGTH]"
+echo "int b[$LENGTH]"
+echo "int c[4]"
+echo "int n = $LENGTH"
+echo "fasm \"cmp qword [rbp - %d], 0\", n"
+echo "int sum = 0"
+echo "int r = 0"
+echo "while r < $REPEAT {"
+echo "  int i = 0"
+echo "  while i < n {"
+echo "    a[i] = i + r"
+echo "    i = i + 1"
+echo "  }"
+echo "  i = 0"
+echo "  while i < $LENGTH {"
+echo "    b[i] = a[i] * 3"
+echo "    i = i + 1"
+echo "  }"
+echo "  i = 0"
+echo "  while i < n {"
+echo "    sum = sum + a[i] * b[i]"
+echo "    i = i + 1"
+echo "  }"
+echo "  i = $LENGTH - 1"
+echo "  while i >= 0 {"
+echo "    sum = sum + b[i]"
+echo "    i = i - 2"
+echo "  }"
+echo "  int k = 0"
+echo "  while k < 4 {"
+echo "    c[k] = c[k] + sum"
+echo "    k = k + 1"
+echo "  }"
+echo "  sum = sum % 1000000007"
+echo "  r = r + 1"
+echo "}"
+echo
+echo "sum = sum + c[0] + c[1] + c[2] + c[3]"
+echo 'fasm "output_int %d", sum'
@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# gen_branches: print an scl program made of nested loops whose bodies are
+# mostly if statements, used to benchmark how conditions are lowered to
+# compares and branches.
+#
+# Usage: gen_branches.sh [conditions] [iterations] > branches.scl
+#
+
+CONDS=${1:-16}
+ITERS=${2:-20000}
+
+echo '-include "io.scl"'
+echo
+
+i=0
+while [ "$i" -lt "$CONDS" ]; do
+  echo "int c$i = 0"
+  i=$((i + 1))
+done
+
+echo "int i = 0"
+echo "while i < $ITERS {"
+echo "  int j = 0"
+echo "  while j < 64 {"
+
+i=0
+while [ "$i" -lt "$CONDS" ]; do
+  case $((i % 4)) in
+  0) cond="j < $((i * 4))" ;;
+  1) cond="$((i * 3)) >= j" ;;
+  2) cond="c$i != j" ;;
+  3) cond="c$((i - 1)) == 0" ;;
+  esac
+  echo "    if $cond {"
+  echo "      c$i = c$i + 1"
+  echo "    }"
+  i=$((i + 1))
+done
+
+echo "    j = j + 1"
+echo "  }"
+echo "  i = i + 1"
+echo "}"
+echo
+
+echo "int sum = 0"
+i=0
+while [ "$i" -lt "$CONDS" ]; do
+  echo "sum = sum + c$i"
+  i=$((i + 1))
+done
+echo 'fasm "output_int %d", sum'
@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# gen_common: print an scl program whose loop recomputes the same values:
+# an array element read several times per statement, a quotient and the
+# product that checks it, and the same expressions again inside an if they
+# dominate, used to benchmark common subexpression elimination.
+#
+# The program prints a checksum.
+#
+# Usage: gen_common.sh [terms] [iterations] > common.scl
+#
+
+TERMS=${1:-8}
+ITERATIONS=${2:-200000}
+
+echo '-include "io.scl"'
+echo
+
+i=0
+while [ "$i" -lt "$TERMS" ]; do
+  echo "int a$i[8] = {$((i + 1)), $((i + 2)), $((i + 3)), $((i + 4)), $((i + 5)), $((i + 6)), $((i + 7)), $((i + 8))}"
+  echo "int d$i = $((i + 3))"
+  i=$((i + 1))
+done
+
+echo "int sum = 0"
+echo "int i = 0"
+echo "while i < $ITERATIONS {"
+echo "  int j = i % 8"
+i=0
+while [ "$i" -lt "$TERMS" ]; do
+  echo "  int q$i = i / d$i"
+  echo "  int m$i = q$i * d$i"
+  echo "  int x$i = a$i[j] * a$i[j] + i / d$i"
+  echo "  if m$i == i {"
+  echo "    sum = sum + a$i[j] * a$i[j] + i / d$i"
+  echo "  }"
+  echo "  sum = sum + x$i"
+  i=$((i + 1))
+done
+echo "  sum = sum % 1000000007"
+echo "  i = i + 1"
+echo "}"
+echo
+echo 'fasm "output_int %d", sum'
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# gen_const_ops: print an scl program that multiplies, divides and takes the
+# remainder of every x in [-range, range] by constants, and checks each
+# result against the same operation on a variable divisor (pinned to memory
+# by a fasm statement, so it always takes the generic imul / idiv path).
+#
+# The program prints the number of mismatches (expected 0) and a checksum.
+#
+# Usage: gen_const_ops.sh [range] [repeat] > const_ops.scl
+#
+
+RANGE=${1:-2000}
+REPEAT=${2:-50}
+CONSTS="2 4 8 64 1024 3 5 9 7 10 1000 -2 -8 -16 -3 -7"
+
+echo '-include "io.scl"'
+echo
+
+n=0
+for c in $CONSTS; do
+  case $c in
+  -*) echo "int d$n = 0 - ${c#-}" ;;
+  *) echo "int d$n = $c" ;;
+  esac
+  echo "fasm \"cmp qword [rbp - %d], 0\", d$n"
+  n=$((n + 1))
+done
+
+echo "int bad = 0"
+echo "int sum = 0"
+echo "int r = 0"
+echo "while r < $REPEAT {"
+echo "  int x = 0 - $RANGE"
+echo "  while x <= $RANGE {"
+
+n=0
+for c in $CONSTS; do
+  case $c in
+  -*) lit="(0 - ${c#-})" ;;
+  *) lit="$c" ;;
+  esac
+  for op in "*" "/" "%"; do
+    echo "    int f = x $op $lit"
+    echo "    int g = x $op d$n"
+    echo "    if f != g {"
+    echo "      bad = bad + 1"
+    echo "    }"
+    echo "    sum = sum + f * x"
+  done
+  n=$((n + 1))
+done
+
+echo "    x = x + 1"
+echo "  }"
+echo "  r = r + 1"
+echo "}"
+echo
+echo 'fasm "output_int %d", bad'
+echo 'fasm "output_int %d", sum'
@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# gen_constants: print an scl program configured by variables that are
+# assigned once (sizes, a mode, debug flags) and only read afterwards. The
+# hot loop branches on them and divides by values computed from them, so
+# it is only cheap once their constants reach it.
+#
+# The program prints a checksum.
+#
+# Usage: gen_constants.sh [flags] [repeat] > constants.scl
+#
+
+FLAGS=${1:-8}
+REPEAT=${2:-200000}
+
+echo '-include "io.scl"'
+echo
+
+echo "int width = 16"
+echo "int height = 9"
+echo "int mode = 2"
+echo "int area = width * height"
+echo "int step = area / 12"
+i=0
+while [ $i -lt $FLAGS ]; do
+  echo "int debug$i = 0"
+  i=$((i + 1))
+done
+echo "if mode == 1 {"
+echo "  step = 1"
+echo "}"
+echo "int sum = 0"
+echo "int r = 0"
+echo "while r < $REPEAT {"
+echo "  int x = r + width"
+i=0
+while [ $i -lt $FLAGS ]; do
+  echo "  if debug$i != 0 {"
+  echo "    x = x * $((i + 3))"
+  echo "    sum = sum - x / $((i + 2))"
+  echo "  }"
+  echo "  if mode == 2 {"
+  echo "    x = x + x / step"
+  echo "  }"
+  i=$((i + 1))
+done
+echo "  sum = sum + x % area"
+echo "  r = r + 1"
+echo "}"
+echo
+echo 'fasm "output_int %d", sum'
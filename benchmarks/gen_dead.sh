@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# gen_dead: print an scl program full of dead code: debug flags folded to
+# constants, variables assigned but never read, statements after goto and
+# continue, and stores overwritten before they are read, used to benchmark
+# dead code elimination. Compile it with --stats to see the removed bytes.
+#
+# The program prints a checksum.
+#
+# Usage: gen_dead.sh [blocks] [iterations] > dead.scl
+#
+
+BLOCKS=${1:-50}
+ITERATIONS=${2:-100000}
+
+echo '-include "io.scl"'
+echo
+
+echo "int debug = 0"
+echo "int sum = 0"
+echo "int i = 0"
+i=0
+while [ "$i" -lt "$BLOCKS" ]; do
+  echo "int scratch$i = 0"
+  echo "int last$i = 0"
+  i=$((i + 1))
+done
+
+echo "while i < $ITERATIONS {"
+i=0
+while [ "$i" -lt "$BLOCKS" ]; do
+  echo "  scratch$i = i * $((i + 3)) + sum"
+  echo "  last$i = i + $i"
+  echo "  last$i = i - $i"
+  echo "  if debug == 1 {"
+  echo "    fasm \"output_int %d\", last$i"
+  echo "  }"
+  echo "  sum = sum + last$i"
+  i=$((i + 1))
+done
+echo "  sum = sum % 1000000007"
+echo "  i = i + 1"
+echo "  continue"
+echo "  sum = 0"
+echo "}"
+
+echo "goto :done"
+echo "sum = sum + 1"
+echo ":done"
+echo
+echo 'fasm "output_int %d", sum'
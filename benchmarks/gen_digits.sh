@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# gen_digits: print an scl program that walks the decimal digits of every
+# number in [0, count) with / 10 and % 10, like examples/count_digits.scl,
+# in bases 10, 100 and 7 to exercise division by constants that are not
+# powers of two.
+#
+# The program prints the total digit count and the total digit sum.
+#
+# Usage: gen_digits.sh [count] [repeat] > digits.scl
+#
+
+COUNT=${1:-200000}
+REPEAT=${2:-10}
+
+echo '-include "io.scl"'
+echo
+echo "int digits = 0"
+echo "int sum = 0"
+echo "int r = 0"
+echo "while r < $REPEAT {"
+echo "  int i = 0"
+echo "  while i < $COUNT {"
+
+for base in 10 100 7; do
+  echo "    int n$base = i * 1000003"
+  echo "    while n$base != 0 {"
+  echo "      sum = sum + n$base % $base"
+  echo "      n$base = n$base / $base"
+  echo "      digits = digits + 1"
+  echo "    }"
+done
+
+echo "    i = i + 1"
+echo "  }"
+echo "  r = r + 1"
+echo "}"
+echo
+echo 'fasm "output_int %d", digits'
+echo 'fasm "output_int %d", sum'
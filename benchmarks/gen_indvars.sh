@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# gen_indvars: print an scl program whose loops multiply their counters
+# (squares, multiples by a constant and by a variable) and count to a
+# bound only the exit test reads, the shape induction variable strength
+# reduction turns into additions.
+#
+# Usage: gen_indvars.sh [iterations] [passes] > indvars.scl
+#
+
+ITERS=${1:-10000}
+PASSES=${2:-2000}
+
+echo '-include "io.scl"'
+echo
+echo "int scale = 7"
+echo "int total = 0"
+echo "int pass = 0"
+echo "while pass < $PASSES {"
+echo "  int i = 0"
+echo "  while i < $ITERS {"
+echo "    int sq = i * i"
+echo "    int by_const = i * 13"
+echo "    int by_var = i * scale"
+echo "    total = total + sq + by_const + by_var"
+echo "    i = i + 1"
+echo "  }"
+echo "  int root = 0"
+echo "  int square = 0"
+echo "  while square <= pass {"
+echo "    root = root + 1"
+echo "    square = root * root"
+echo "  }"
+echo "  total = total + root"
+echo "  scale = scale + 1"
+echo "  pass = pass + 1"
+echo "}"
+echo
+
+echo 'fasm "output_int %d", total'
@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# gen_invariant: print an scl program whose inner loop is full of
+# loop-invariant work: expressions over variables pinned to memory by fasm
+# statements, reads of array elements that are not written in the loop and
+# a bound reloaded on every test, used to benchmark loop-invariant code
+# motion.
+#
+# The program prints a checksum.
+#
+# Usage: gen_invariant.sh [terms] [outer] [inner] > invariant.scl
+#
+
+TERMS=${1:-8}
+OUTER=${2:-2000}
+INNER=${3:-1000}
+
+echo '-include "io.scl"'
+echo
+
+echo "int t[$TERMS]"
+i=0
+while [ "$i" -lt "$TERMS" ]; do
+  echo "int a$i = $((i * 7 + 3))"
+  echo "fasm \"cmp qword [rbp - %d], 0\", a$i"
+  echo "t[$i] = $((i + 2))"
+  i=$((i + 1))
+done
+
+echo "int bound = $INNER"
+echo "fasm \"cmp qword [rbp - %d], 0\", bound"
+echo "int sum = 0"
+echo "int o = 0"
+echo "while o < $OUTER {"
+echo "  int j = 0"
+echo "  while j < bound {"
+
+i=0
+while [ "$i" -lt "$TERMS" ]; do
+  next=$(((i + 1) % TERMS))
+  echo "    sum = sum + (a$i * a$next + t[$i]) / $((i + 3)) + j"
+  i=$((i + 1))
+done
+
+echo "    j = j + 1"
+echo "  }"
+echo "  sum = sum % 1000000007"
+echo "  o = o + 1"
+echo "}"
+echo
+echo 'fasm "output_int %d", sum'
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# gen_layout: print an scl program whose hot loop is interleaved with
+# checks that never fire, each guarding a block of fasm output calls, so
+# block placement has cold code to move out of the loop.
+#
+# Usage: gen_layout.sh [checks] [iterations] > layout.scl
+#
+
+CHECKS=${1:-16}
+ITERS=${2:-200000}
+
+echo '-include "io.scl"'
+echo
+
+echo "int sum = 0"
+echo "int errors = 0"
+echo "int i = 0"
+echo "while i < $ITERS {"
+echo "  int x = i % 1000"
+
+c=0
+while [ "$c" -lt "$CHECKS" ]; do
+  echo "  sum = sum + x * $((c + 1))"
+  echo "  if sum < 0 {"
+  echo "    fasm \"output_int %d\", sum"
+  echo "    fasm \"output_int %d\", x"
+  echo "    fasm \"output_int %d\", i"
+  echo "    errors = errors + 1"
+  echo "  }"
+  echo "  x = x + $c"
+  c=$((c + 1))
+done
+
+echo "  i = i + 1"
+echo "}"
+echo
+
+echo "int result = sum + errors"
+echo 'fasm "output_int %d", result'
@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# gen_pgo: print an scl program whose branches go against the static
+# guesses: == tests that almost never hold, short ifs inside the hot loop
+# that almost always go the same way, and inner loops that run once or
+# twice per entry. Used to compare a build guided by a profile against the
+# plain one.
+#
+# Usage: gen_pgo.sh [checks] [iterations] > pgo.scl
+#
+
+CHECKS=${1:-16}
+ITERS=${2:-200000}
+
+echo '-include "io.scl"'
+echo
+echo "int sum = 0"
+echo "int hits = 0"
+echo "int inner = 0"
+echo "int i = 0"
+echo "while i < $ITERS {"
+echo "  int x = i % 256"
+
+c=0
+while [ "$c" -lt "$CHECKS" ]; do
+  echo "  if x == $((c * 7 % 256)) {"
+  echo "    hits = hits + 1"
+  echo "  }"
+  echo "  if x < 255 {"
+  echo "    sum = sum + $((c + 1))"
+  echo "  }"
+  c=$((c + 1))
+done
+
+echo "  int trips = x % 2 + 1"
+echo "  int j = 0"
+echo "  while j < trips {"
+echo "    inner = inner + j + x"
+echo "    j = j + 1"
+echo "  }"
+echo "  i = i + 1"
+echo "}"
+echo
+
+echo "int result = sum + hits + inner"
+echo 'fasm "output_int %d", result'
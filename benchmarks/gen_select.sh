@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# gen_select: print an scl program that runs short ifs over array elements
+# (counting, minimum / maximum, picking a value). Used to benchmark
+# branchless lowering against plain branches:
+# - random: pseudo-random elements, the branches are taken about half the
+#   time with no pattern a predictor could learn.
+# - sorted: even elements in increasing order, every branch goes the same
+#   way for long runs and is predicted well.
+#
+# Usage: gen_select.sh [elements] [passes] [random|sorted] > select.scl
+#
+
+SIZE=${1:-4096}
+PASSES=${2:-2000}
+DATA=${3:-random}
+
+echo '-include "io.scl"'
+echo
+echo "int a[$SIZE]"
+echo "int seed = 12345"
+echo "int k = 0"
+echo "while k < $SIZE {"
+if [ "$DATA" = sorted ]; then
+  echo "  a[k] = k * 500 / $SIZE * 2"
+else
+  echo "  seed = (seed * 1103515245 + 12345) % 2147483648"
+  echo "  a[k] = seed / 65536 % 1000"
+fi
+echo "  k = k + 1"
+echo "}"
+echo
+
+echo "int above = 0"
+echo "int even = 0"
+echo "int low = 1000"
+echo "int high = 0"
+echo "int picked = 0"
+echo "int pass = 0"
+echo "while pass < $PASSES {"
+echo "  k = 0"
+echo "  while k < $SIZE {"
+echo "    int x = a[k]"
+echo "    if x >= 500 {"
+echo "      above = above + 1"
+echo "    }"
+echo "    int r = x % 2"
+echo "    if r == 0 {"
+echo "      even = even + 1"
+echo "    }"
+echo "    if x < low {"
+echo "      low = x"
+echo "    }"
+echo "    if x > high {"
+echo "      high = x"
+echo "    }"
+echo "    if x > pass {"
+echo "      picked = k + 1"
+echo "    }"
+echo "    k = k + 1"
+echo "  }"
+echo "  pass = pass + 1"
+echo "}"
+echo
+
+echo "int result = above + even + low + high + picked"
+echo 'fasm "output_int %d", result'
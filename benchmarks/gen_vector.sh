@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# gen_vector: print an scl program that runs element-wise loops over arrays
+# (scale and add, clamp, sum and max) many times, used to benchmark loop
+# vectorization. Run it with and without --avx2.
+#
+# The program prints a checksum.
+#
+# Usage: gen_vector.sh [length] [repeat] > vector.scl
+#
+
+LENGTH=${1:-256}
+REPEAT=${2:-20000}
+
+echo '-include "io.scl"'
+echo
+
+echo "int a[$LENGTH]"
+echo "int b[$LENGTH]"
+echo "int c[$LENGTH]"
+echo "int n = $LENGTH"
+echo "fasm \"cmp qword [rbp - %d], 0\", n"
+echo "int i = 0"
+echo "while i < n {"
+echo "  a[i] = i * 7 % 1000"
+echo "  b[i] = i * 13 % 1000"
+echo "  i = i + 1"
+echo "}"
+echo "int sum = 0"
+echo "int max = 0"
+echo "int r = 0"
+echo "while r < $REPEAT {"
+echo "  i = 0"
+echo "  while i < n {"
+echo "    c[i] = a[i] * 3 + b[i] - r"
+echo "    i = i + 1"
+echo "  }"
+echo "  i = 0"
+echo "  while i < n {"
+echo "    if c[i] > 2000 {"
+echo "      c[i] = 2000"
+echo "    }"
+echo "    i = i + 1"
+echo "  }"
+echo "  i = 0"
+echo "  while i < n {"
+echo "    sum = sum + c[i]"
+echo "    i = i + 1"
+echo "  }"
+echo "  i = 0"
+echo "  while i < n {"
+echo "    if c[i] > max {"
+echo "      max = c[i]"
+echo "    }"
+echo "    i = i + 1"
+echo "  }"
+echo "  r = r + 1"
+echo "}"
+echo
+echo "sum = sum % 1000000007 + max"
+echo 'fasm "output_int %d", sum'
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# time_runs: run every binary a number of times and print the best wall
+# clock time of each, in milliseconds, next to what it printed. Fails if
+# the binaries do not all print the same thing.
+#
+# Usage: time_runs.sh <runs> <binary>...
+#
+
+RUNS=$1
+shift
+
+expected=
+status=0
+for bin in "$@"; do
+  best=
+  i=0
+  while [ $i -lt "$RUNS" ]; do
+    start=$(date +%s%N)
+    out=$($bin | tr '\n' ' ')
+    end=$(date +%s%N)
+    ms=$(((end - start) / 1000000))
+    if [ -z "$best" ] || [ $ms -lt "$best" ]; then
+      best=$ms
+    fi
+    i=$((i + 1))
+  done
+  printf '  %-40s %6d ms   %s\n' "$bin" "$best" "$out"
+
+  if [ -z "$expected" ]; then
+    expected=$out
+  elif [ "$out" != "$expected" ]; then
+    echo "  $bin printed something else than $1" >&2
+    status=1
+  fi
+done
+exit $status
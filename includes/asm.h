@@ -0,0 +1,174 @@
+/*
+ * asm: structured x86-64 instruction list. Codegen appends to it, the
+ * peephole pass rewrites it and it is only turned into FASM text at the end.
+ */
+
+#ifndef ASM_H
+#define ASM_H
+
+#include "ds/dynamic_array.h"
+#include "x86.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * @enum asm_opcode: enumeration of the instructions codegen emits.
+ */
+typedef enum asm_opcode {
+  ASM_NOP = 0,   // deleted instruction, not printed
+  ASM_LABEL,     // .bb<dst.block>:
+  ASM_ALIGN,     // align dst.imm
+  ASM_RAW,       // verbatim line (inline fasm)
+  ASM_MOV,
+  ASM_MOVZX,
+  ASM_LEA,
+  ASM_XOR,
+  ASM_ADD,
+  ASM_SUB,
+  ASM_AND,
+  ASM_SHL,
+  ASM_SAR,
+  ASM_SHR,
+  ASM_NEG,
+  ASM_IMUL,
+  ASM_IMUL_WIDE, // one operand imul: rdx:rax = rax * dst
+  ASM_CQO,
+  ASM_IDIV,
+  ASM_CMP,
+  ASM_TEST,
+  ASM_SETCC,
+  ASM_CMOV, // dst = src when cond holds, src a register or memory
+  ASM_JMP,
+  ASM_JCC,
+  ASM_PUSH,
+  ASM_POP,
+  ASM_RET,
+} asm_opcode;
+
+/*
+ * @enum asm_cond: condition codes of jcc / setcc / cmov (signed comparisons).
+ */
+typedef enum asm_cond {
+  ASM_CC_E = 0,
+  ASM_CC_NE,
+  ASM_CC_L,
+  ASM_CC_LE,
+  ASM_CC_G,
+  ASM_CC_GE,
+} asm_cond;
+
+/*
+ * @enum asm_operand_kind: what an operand refers to.
+ */
+typedef enum asm_operand_kind {
+  ASM_NONE = 0,
+  ASM_REG,
+  ASM_IMM,
+  ASM_MEM,   // [base + index*scale + disp]
+  ASM_BLOCK, // label of an IR block
+} asm_operand_kind;
+
+/*
+ * @struct asm_operand: one instruction operand.
+ */
+typedef struct asm_operand {
+  asm_operand_kind kind;
+  unsigned int size; // <-- 1, 4 or 8 bytes, ASM_REG / ASM_MEM (0: lea)
+  x86_reg reg;       // <-- ASM_REG, base of ASM_MEM
+  int index;         // <-- index register of ASM_MEM, -1 for none
+  unsigned int scale;
+  long imm;     // <-- ASM_IMM value, ASM_MEM displacement
+  size_t block; // <-- ASM_BLOCK id
+} asm_operand;
+
+/*
+ * @struct asm_instr: one instruction (or label / directive).
+ */
+typedef struct asm_instr {
+  asm_opcode op;
+  asm_cond cond; // <-- ASM_JCC / ASM_SETCC / ASM_CMOV
+  asm_operand dst;
+  asm_operand src;
+  char *text; // <-- ASM_RAW, owned by the instruction
+} asm_instr;
+
+/*
+ * @brief: make a register operand.
+ *
+ * @param size: 1, 4 or 8, selects al / eax / rax.
+ */
+asm_operand asm_reg(x86_reg reg, unsigned int size);
+
+/*
+ * @brief: make an immediate operand.
+ */
+asm_operand asm_imm(long value);
+
+/*
+ * @brief: make a memory operand [base + index*scale + disp].
+ *
+ * @param index: index register, -1 for none.
+ * @param size: access size in bytes (byte / dword / qword), 0 for an address
+ * that is not accessed (lea).
+ */
+asm_operand asm_mem(x86_reg base, int index, unsigned int scale, long disp,
+                    unsigned int size);
+
+/*
+ * @brief: make an operand naming the label of an IR block.
+ */
+asm_operand asm_block(size_t id);
+
+/*
+ * @brief: check whether two operands are the same register / memory
+ * location / immediate / label.
+ */
+bool asm_operand_equal(asm_operand a, asm_operand b);
+
+/*
+ * @brief: get the condition that holds exactly when cond does not.
+ */
+asm_cond asm_cond_negate(asm_cond cond);
+
+/*
+ * @brief: append an instruction to a dynamic_array of asm_instr.
+ */
+void asm_emit(dynamic_array *code, asm_opcode op, asm_operand dst,
+              asm_operand src);
+
+/*
+ * @brief: append a jcc / setcc.
+ */
+void asm_emit_cond(dynamic_array *code, asm_opcode op, asm_cond cond,
+                   asm_operand dst);
+
+/*
+ * @brief: append a verbatim line, text is copied.
+ */
+void asm_emit_raw(dynamic_array *code, const char *text);
+
+/*
+ * @brief: check whether an instruction ends straight-line code (jumps and
+ * ret). Labels start it again.
+ */
+bool asm_is_jump(asm_instr *instr);
+
+/*
+ * @brief: print the instructions as FASM source to stdout.
+ */
+void asm_print(dynamic_array *code);
+
+/*
+ * @brief: estimate the encoded size of an instruction list in bytes, with
+ * jumps made short wherever they reach. Inline fasm lines are not counted,
+ * their size is unknown before fasm expands its macros.
+ */
+size_t asm_code_size(dynamic_array *code);
+
+/*
+ * @brief: free an instruction list and the text it owns.
+ */
+void asm_free(dynamic_array *code);
+
+#endif // !ASM_H
@@ -48,6 +48,7 @@ typedef struct array_literal_node {
 typedef struct term_node {
   term_kind kind;
   size_t line;
+  type type;
   union {
     token_value value;
     variable identifier;
@@ -82,6 +83,7 @@ typedef enum expr_kind {
 typedef struct expr_node {
   expr_kind kind;
   size_t line;
+  type type;
   union {
     term_node term;
     struct {
@@ -239,6 +241,7 @@ typedef struct instr_node {
  */
 typedef struct program_node {
   size_t loop_counter;
+  size_t frame_size;
   dynamic_array instrs;
 } program_node;
 
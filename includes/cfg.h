@@ -0,0 +1,99 @@
+/*
+ * cfg: control-flow graph of the IR, with dominators, post-dominators and
+ * natural loops.
+ */
+
+#ifndef CFG_H
+#define CFG_H
+
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * @struct cfg_loop: a natural loop, the union of every back edge into the
+ * same header.
+ */
+typedef struct cfg_loop {
+  ir_block *header;
+  bitset blocks;         // <-- layout positions of the blocks in the loop
+  dynamic_array latches; // <-- size_t, sources of the back edges
+  dynamic_array exits;   // <-- size_t, loop blocks with a successor outside
+  size_t depth;          // <-- 1 for an outermost loop
+  size_t parent;         // <-- index in cfg.loops, SIZE_MAX if outermost
+} cfg_loop;
+
+/*
+ * @struct cfg: predecessors, dominators and loops of an ir_program. Blocks
+ * are referred to by their layout position (ir_block.index).
+ *
+ * Post-dominators are rooted at a virtual exit numbered block_count, which
+ * every block without a successor (ret) leads to.
+ */
+typedef struct cfg {
+  size_t block_count;
+  dynamic_array *preds; // <-- size_t, one array per block
+  size_t *idom;         // <-- immediate dominator, SIZE_MAX if unreachable
+  size_t *ipdom;        // <-- immediate post-dominator, SIZE_MAX if the block
+                        //     never reaches the exit (an endless loop)
+  size_t *rpo;          // <-- reachable blocks in reverse postorder
+  size_t rpo_count;
+  dynamic_array loops; // <-- cfg_loop, inner loops before their parents
+  size_t *loop_of;     // <-- innermost loop of every block, SIZE_MAX if none
+} cfg;
+
+/*
+ * @brief: build the graph of a program. Renumbers the blocks first; the cfg
+ * is stale as soon as a terminator or the layout changes.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param g: pointer to an uninitialized cfg.
+ */
+void cfg_build(ir_program *ir, cfg *g);
+
+/*
+ * @brief: free everything cfg_build allocated.
+ */
+void cfg_free(cfg *g);
+
+/*
+ * @brief: check whether a block can be reached from the entry.
+ */
+bool cfg_reachable(cfg *g, size_t block);
+
+/*
+ * @brief: check whether every path from the entry to b goes through a. A
+ * block dominates itself.
+ */
+bool cfg_dominates(cfg *g, size_t a, size_t b);
+
+/*
+ * @brief: check whether every path from b to the exit goes through a. A
+ * block post-dominates itself.
+ */
+bool cfg_post_dominates(cfg *g, size_t a, size_t b);
+
+/*
+ * @brief: get the loop at an index of cfg.loops.
+ */
+cfg_loop *cfg_loop_at(cfg *g, size_t index);
+
+/*
+ * @brief: get how many loops a block is in, 0 outside of any loop.
+ */
+size_t cfg_loop_depth(cfg *g, size_t block);
+
+/*
+ * @brief: print the graph in graphviz dot syntax. Loops are nested
+ * clusters, back edges are bold, and every block is labeled with its
+ * instruction count, its immediate dominator and post-dominator.
+ *
+ * @param ir: pointer to the ir_program the graph was built on.
+ * @param g: pointer to a cfg.
+ */
+void cfg_print_dot(ir_program *ir, cfg *g);
+
+#endif // !CFG_H
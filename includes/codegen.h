@@ -1,33 +1,106 @@
 /*
- * codegen: converts the simple-compiler AST to Assembly.
+ * codegen: lowers the simple-compiler IR to x86-64 FASM assembly.
  */
 
 #ifndef CODEGEN
 #define CODEGEN
 
-#include "ast.h"
-#include "ds/ht.h"
-#include "ds/stack.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/peephole.h"
+#include "profile.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * @enum codegen_branchless: which short ifs are lowered without a branch.
+ */
+typedef enum codegen_branchless {
+  BRANCHLESS_NEVER = 0,
+  BRANCHLESS_LOOPS, // <-- ifs inside loops, where a mispredicted branch costs
+                    //     the most (the default from -O1)
+  BRANCHLESS_ALWAYS,
+} codegen_branchless;
+
+/*
+ * With a profile, a branch that goes the same way in all but less than one
+ * in CODEGEN_PREDICTABLE of its runs stays a branch, the predictor gets it
+ * right.
+ */
+#define CODEGEN_PREDICTABLE 16
+
+/*
+ * @struct codegen_options: how to lower a program.
+ */
+typedef struct codegen_options {
+  codegen_branchless branchless;
+  bool align_loops; // <-- align 16 in front of every loop head
+  bool peephole;    // <-- run peephole_optimize on the code
+  const profile *profile; // <-- measured branches, if-converted only when
+                          //     they go both ways often enough, or NULL
+  const char *profile_file; // <-- instrumented builds: file the counters are
+                            //     written to on exit, NULL otherwise
+  uint64_t checksum;        // <-- instrumented builds: profile_checksum
+  size_t counters;          // <-- instrumented builds: profile_instrument
+} codegen_options;
+
+/*
+ * @struct codegen_stats: what codegen produced for main.
+ */
+typedef struct codegen_stats {
+  peephole_stats peephole;
+  size_t branchless; // <-- ifs lowered to cmov / setcc
+  size_t code_bytes; // <-- estimated size of main, inline fasm excluded
+} codegen_stats;
 
 /*
- * @brief: evaluate a constant expression to extract integer value
+ * @brief: lower an IR program to a list of x86 instructions for main and
+ * run the peephole pass on it if the options ask for it, without writing
+ * anything.
+ *
+ * Every vreg must already have a register or a frame slot (see regalloc.h).
+ * rax is the only scratch register, and the callee-saved registers handed
+ * out by the allocator are saved in the prologue.
  *
- * @param expr: pointer to an expr_node
- * @param errors: counter variable to increment when an error is encountered.
+ * An if whose body only assigns a register vreg (if x == y { v = 0 }) is
+ * if-converted when branchless allows it: the value is computed next to
+ * the cmp and a cmov keeps it only when the body would have run, counters
+ * (v = v + 1) add a setcc instead. Both run the body's work every time,
+ * which is cheaper than a branch the predictor keeps getting wrong. With a
+ * profile, BRANCHLESS_LOOPS converts the ifs that ran and went each way at
+ * least once in CODEGEN_PREDICTABLE runs instead, wherever they are.
  *
- * @return: the integer value of the constant expression
+ * Profile counters (IR_COUNT) become an add to their qword. A branch with
+ * a counter goes to its target through a stub at the end of main that
+ * counts the run first.
+ *
+ * @param ir: pointer to the ir_program of main.
+ * @param code: receives the asm_instr list, free it with asm_free.
+ * @param options: which ifs to if-convert, the profile, whether to align
+ * loops and run the peephole pass.
+ * @param stats: receives the peephole statistics and the number of ifs
+ * converted, code_bytes is left alone. May be NULL.
  */
-int evaluate_const_expr(expr_node *expr, unsigned int *errors);
+void codegen_build(ir_program *ir, dynamic_array *code,
+                   const codegen_options *options, codegen_stats *stats);
 
 /*
- * @brief: convert a dynamic_array of instructions to FASM assembly.
+ * @brief: emit FASM assembly for an IR program and assemble it.
+ *
+ * The instructions come from codegen_build and are written out with the
+ * program entry point and data segment around them. An instrumented build
+ * gets its counters in the data segment, _start writes them to
+ * profile_file after main returns.
  *
- * @param program: basically a wrapper around a dynamic_array of instructions.
- * @param variables: hash table of variables.
+ * @param ir: pointer to the ir_program of main.
  * @param filename: filename needed for output file.
- * @param errors: counter variable to increment when an error is encountered.
+ * @param options: see codegen_build.
+ * @param stats: receives the codegen_build statistics and code size, may be
+ * NULL.
  */
-void instrs_to_asm(program_node *program, ht *variables, stack *loops,
-                   const char *filename, unsigned int *errors);
+void ir_to_asm(ir_program *ir, const char *filename,
+               const codegen_options *options, codegen_stats *stats);
 
 #endif // !CODEGEN
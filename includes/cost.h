@@ -0,0 +1,133 @@
+/*
+ * cost: static cost model of the generated code, estimates the cycles one
+ * iteration of every loop takes on a given microarchitecture from a table
+ * of instruction latencies and throughputs, in the spirit of llvm-mca.
+ *
+ * Usage:
+ * const cost_arch *arch = cost_find_arch("skylake");
+ * cost_report report;
+ * cost_analyze(ir, &code, arch, &report);
+ * cost_print(&report);
+ * cost_report_free(&report);
+ */
+
+#ifndef COST_H
+#define COST_H
+
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+#include <stddef.h>
+
+/*
+ * Microarchitecture --analyze-cost uses without a name.
+ */
+#define COST_DEFAULT_ARCH "skylake"
+
+/*
+ * @enum cost_unit: the execution resources an instruction competes for.
+ */
+typedef enum cost_unit {
+  COST_UNIT_ALU = 0,
+  COST_UNIT_MUL,
+  COST_UNIT_DIV,
+  COST_UNIT_LOAD,
+  COST_UNIT_STORE,
+  COST_UNIT_BRANCH,
+  COST_UNIT_VEC,
+  COST_UNIT_SHUFFLE,
+  COST_UNIT_COUNT,
+} cost_unit;
+
+/*
+ * @struct cost_arch: latencies and throughputs of one microarchitecture.
+ */
+typedef struct cost_arch {
+  const char *name;
+  unsigned int width;               // <-- uops issued per cycle
+  double per_cycle[COST_UNIT_COUNT]; // <-- instructions a unit takes per
+                                     //     cycle, below 1 for the divider
+  unsigned int alu_latency;
+  unsigned int mul_latency;
+  unsigned int div_latency; // <-- 64 bit idiv
+  unsigned int div_uops;
+  unsigned int load_latency; // <-- L1 hit, or store forwarded
+  unsigned int vec_latency;
+  unsigned int vec_mul_latency; // <-- pmulld
+  unsigned int vec_mul_uops;
+  unsigned int cross_latency; // <-- shuffles across 128 bit lanes
+} cost_arch;
+
+/*
+ * @struct cost_loop: the estimate for one loop.
+ */
+typedef struct cost_loop {
+  size_t line;  // <-- source line of the back edge test
+  size_t depth; // <-- 1 for an outermost loop
+  size_t instrs;
+  size_t uops;
+  size_t unknown; // <-- inline fasm lines the model does not know
+  double issue;   // <-- cycles to issue the uops
+  double pressure[COST_UNIT_COUNT]; // <-- cycles every unit is busy
+  double chain; // <-- cycles of the longest dependency between iterations
+  double cycles;     // <-- estimate, the largest of the bounds above
+  const char *bound; // <-- name of that bound
+} cost_loop;
+
+/*
+ * @struct cost_report: the estimates for a program.
+ */
+typedef struct cost_report {
+  const cost_arch *arch;
+  dynamic_array loops; // <-- cost_loop, in source order
+} cost_report;
+
+/*
+ * @brief: find a microarchitecture by name.
+ *
+ * @return: the table, NULL if there is none with that name.
+ */
+const cost_arch *cost_find_arch(const char *name);
+
+/*
+ * @brief: list the known microarchitectures, comma separated.
+ */
+const char *cost_arch_names(void);
+
+/*
+ * @brief: estimate the cycles per iteration of every loop of a program.
+ *
+ * An iteration runs every instruction of the blocks whose innermost loop
+ * it is once, inner loops are estimated on their own. Its cost is the
+ * largest of three bounds:
+ * - issue: the uops over the issue width. cmp / test and the jcc after it
+ *   fuse into one uop, a 64 bit idiv is microcoded.
+ * - units: every instruction keeps a unit busy for 1 / per_cycle cycles,
+ *   with memory operands also taking a load or store slot. idiv blocks the
+ *   divider for many cycles.
+ * - dependency chain: the growth per iteration of the latest result when
+ *   the loop body runs over and over with unlimited resources, so values
+ *   carried from one iteration to the next (through registers, the flags
+ *   or frame slots, with store forwarding) are on it.
+ * Branches are taken to be predicted, element and pointer accesses to
+ * never alias.
+ *
+ * @param ir: pointer to the ir_program the code was generated from.
+ * @param code: asm_instr list built by codegen_build.
+ * @param arch: table of the microarchitecture.
+ * @param report: receives the estimates, free it with cost_report_free.
+ */
+void cost_analyze(ir_program *ir, dynamic_array *code, const cost_arch *arch,
+                  cost_report *report);
+
+/*
+ * @brief: print a report, one loop per line in source order.
+ */
+void cost_print(cost_report *report);
+
+/*
+ * @brief: free the loops of a report.
+ */
+void cost_report_free(cost_report *report);
+
+#endif // !COST_H
@@ -11,9 +11,10 @@
 #ifndef CSTATE_H
 #define CSTATE_H
 
+#include "codegen.h"
 #include "ds/dynamic_array.h"
 #include "ds/ht.h"
-#include "ds/stack.h"
+#include "ir.h"
 #include "parser.h"
 
 #include <stdbool.h>
@@ -38,6 +39,86 @@ typedef struct coptions {
    * Weather an include directory was specified in the command.
    */
   bool include_dir_specified;
+
+  /*
+   * Print the IR of the program before it is lowered to assembly.
+   */
+  bool emit_ir;
+
+  /*
+   * Print the control-flow graph of the program in graphviz dot syntax.
+   */
+  bool emit_cfg;
+
+  /*
+   * Print optimization statistics after compiling.
+   */
+  bool stats;
+
+  /*
+   * Copies of the body in an unrolled loop, 1 disables partial unrolling.
+   */
+  size_t unroll_factor;
+
+  /*
+   * Instructions the unrolled copies of one loop may add.
+   */
+  size_t unroll_budget;
+
+  /*
+   * Vectorize loops with 8 lanes of AVX2 instead of 4 of SSE2.
+   */
+  bool avx2;
+
+  /*
+   * Optimization level, picks the passes when passes is NULL.
+   */
+  unsigned int opt_level;
+
+  /*
+   * Comma separated names of the IR passes to run, in order.
+   */
+  const char *passes;
+
+  /*
+   * Name of the IR pass to print the IR after.
+   */
+  const char *print_after;
+
+  /*
+   * Comma separated passes to print the remarks of, "" for all of them, NULL
+   * for none: rpass for what the passes did, rpass_missed for what they left
+   * alone.
+   */
+  const char *rpass;
+  const char *rpass_missed;
+
+  /*
+   * File to write every optimization remark to as JSON.
+   */
+  const char *remarks_json;
+
+  /*
+   * Which ifs codegen lowers to cmov / setcc instead of a branch.
+   */
+  codegen_branchless branchless;
+
+  /*
+   * Microarchitecture to estimate the cost of every loop on, NULL for none.
+   */
+  const char *analyze_cost;
+
+  /*
+   * Build a binary that counts how often its blocks and branches run and
+   * writes the counts to profile_file (default <output>.profile) on exit.
+   */
+  bool profile_generate;
+  const char *profile_file;
+
+  /*
+   * Profile to guide the optimizations with, NULL for none.
+   */
+  const char *profile_use;
 } coptions;
 
 /*
@@ -84,7 +165,7 @@ typedef struct cstate {
   parser *parser;
   program_node *program;
   ht *variables;
-  stack *loops;
+  ir_program *ir;
 } cstate;
 
 /*
@@ -0,0 +1,83 @@
+/*
+ * bitset: fixed size set of small integers, used by the dataflow analyses.
+ */
+
+#ifndef BITSET_H
+#define BITSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * @struct bitset: represents a set of integers in [0, nbits).
+ */
+typedef struct bitset {
+  size_t nbits;
+  size_t nwords;
+  unsigned long *words;
+} bitset;
+
+/*
+ * @brief: initialize an empty bitset.
+ *
+ * @param b: pointer to an uninitialized bitset.
+ * @param nbits: number of elements the set can hold.
+ */
+void bitset_init(bitset *b, size_t nbits);
+
+/*
+ * @brief: free the storage of a bitset.
+ */
+void bitset_free(bitset *b);
+
+void bitset_set(bitset *b, size_t i);
+
+void bitset_clear(bitset *b, size_t i);
+
+bool bitset_test(const bitset *b, size_t i);
+
+/*
+ * @brief: remove every element.
+ */
+void bitset_clear_all(bitset *b);
+
+/*
+ * @brief: add every element.
+ */
+void bitset_set_all(bitset *b);
+
+/*
+ * @brief: copy src into dst, both must have the same size.
+ */
+void bitset_copy(bitset *dst, const bitset *src);
+
+/*
+ * @brief: dst |= src.
+ *
+ * @return: true if dst changed.
+ */
+bool bitset_union(bitset *dst, const bitset *src);
+
+/*
+ * @brief: dst &= src.
+ *
+ * @return: true if dst changed.
+ */
+bool bitset_intersect(bitset *dst, const bitset *src);
+
+/*
+ * @brief: dst &= ~src.
+ */
+void bitset_subtract(bitset *dst, const bitset *src);
+
+/*
+ * @brief: check whether two bitsets hold the same elements.
+ */
+bool bitset_equal(const bitset *a, const bitset *b);
+
+/*
+ * @brief: count the elements of the set.
+ */
+size_t bitset_count(const bitset *b);
+
+#endif // !BITSET_H
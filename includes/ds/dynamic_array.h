@@ -14,6 +14,8 @@ void dynamic_array_init(dynamic_array *da, size_t size);
 
 int dynamic_array_get(dynamic_array *da, size_t index, void *item);
 
+void *dynamic_array_at(dynamic_array *da, size_t index);
+
 int dynamic_array_set(dynamic_array *da, size_t index, void *item);
 
 int dynamic_array_append(dynamic_array *da, void *item);
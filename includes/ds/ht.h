@@ -57,6 +57,9 @@ void ht_insert(ht *table, const char *key, const void *value);
  *
  * @param table: pointer to an initialized ht (hash table) struct.
  * @param key: key string literal
+ *
+ * @return: pointer to the stored value, stable until the key is deleted or
+ * re-inserted.
  */
 void *ht_search(ht *table, const char *key);
 
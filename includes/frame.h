@@ -0,0 +1,21 @@
+/*
+ * frame: stack frame layout for the simple-compiler. Assigns every scalar and
+ * array a slot in main's stack frame exactly once, after semantic analysis.
+ */
+
+#ifndef FRAME
+#define FRAME
+
+#include "ast.h"
+
+/*
+ * @brief: assign a frame offset to every declared variable and array,
+ * including the ones declared inside nested blocks. The offsets are stored in
+ * the symbol table entries (variable.stack_offset) and the total, 16 byte
+ * aligned frame size in program->frame_size.
+ *
+ * @param program: pointer to a semantically checked program_node.
+ */
+void frame_layout(program_node *program);
+
+#endif // !FRAME
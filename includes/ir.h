@@ -0,0 +1,338 @@
+/*
+ * ir: linear three-address intermediate representation for the
+ * simple-compiler.
+ *
+ * The AST is lowered into a list of basic blocks. Every block holds a linear
+ * array of instructions and ends in exactly one terminator (jmp, br or ret).
+ * Values live in an unbounded set of typed virtual registers (vregs) and
+ * named variables are only touched through explicit load / store
+ * instructions.
+ */
+
+#ifndef IR_H
+#define IR_H
+
+#include "ast.h"
+#include "ds/dynamic_array.h"
+#include "ds/ht.h"
+#include "var.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * @enum ir_opcode: enumeration of all the IR instructions.
+ */
+typedef enum ir_opcode {
+  IR_NOP = 0,
+  IR_MOV,        // dst = a
+  IR_ADD,        // dst = a + b
+  IR_SUB,        // dst = a - b
+  IR_MUL,        // dst = a * b
+  IR_MULHI,      // dst = (a * b) >> 64 (signed 128 bit product, high half)
+  IR_DIV,        // dst = a / b (signed)
+  IR_MOD,        // dst = a % b (signed)
+  IR_AND,        // dst = a & b
+  IR_SHL,        // dst = a << b (b immediate)
+  IR_SAR,        // dst = a >> b (arithmetic, b immediate)
+  IR_SHR,        // dst = a >> b (logical, b immediate)
+  IR_CMP,        // dst = (a rel b) ? 1 : 0
+  IR_LOAD,       // dst = var
+  IR_STORE,      // var = a
+  IR_ADDR,       // dst = &var
+  IR_LOAD_PTR,   // dst = *a
+  IR_STORE_PTR,  // *a = b
+  IR_LOAD_ELEM,  // dst = var[a]
+  IR_STORE_ELEM, // var[a] = b
+  IR_VLOAD,      // vdst = var[a .. a + lanes)
+  IR_VSTORE,     // var[a .. a + lanes) = b
+  IR_VSPLAT,     // vdst = a in every lane
+  IR_VADD,       // vdst = a + b, lane by lane
+  IR_VSUB,       // vdst = a - b
+  IR_VMUL,       // vdst = a * b (low 32 bits)
+  IR_VAND,       // vdst = a & b
+  IR_VANDN,      // vdst = ~a & b
+  IR_VOR,        // vdst = a | b
+  IR_VXOR,       // vdst = a ^ b
+  IR_VSHL,       // vdst = a << b (b immediate)
+  IR_VSHR,       // vdst = a >> b (logical, b immediate)
+  IR_VCMPEQ,     // vdst = (a == b) ? -1 : 0
+  IR_VCMPGT,     // vdst = (a > b) ? -1 : 0 (signed)
+  IR_VMAXU,      // vdst = max(a, b) (unsigned, avx2 only)
+  IR_VMINU,      // vdst = min(a, b) (unsigned, avx2 only)
+  IR_VSUMQ,      // vdst = a + zero extended lanes of b, in 64 bit lanes
+  IR_VHSUM,      // dst = sum of the 64 bit lanes of a
+  IR_VHMAXU,     // dst = max of the lanes of a (unsigned)
+  IR_VHMINU,     // dst = min of the lanes of a (unsigned)
+  IR_COUNT,      // profile counter a (immediate) += 1, instrumented builds
+  IR_FASM,       // inline fasm, var is the optional parameter
+  IR_JMP,        // goto target
+  IR_BR,         // if (a rel b) goto target else goto alt
+  IR_RET,        // return from main
+} ir_opcode;
+
+/*
+ * @enum ir_operand_kind: what an operand refers to.
+ */
+typedef enum ir_operand_kind {
+  IR_OPERAND_NONE = 0,
+  IR_OPERAND_VREG,
+  IR_OPERAND_IMM,
+  IR_OPERAND_VEC,
+} ir_operand_kind;
+
+/*
+ * @struct ir_operand: a virtual register, an immediate or a vector
+ * register. Vector registers are xmm / ymm registers handed out by the
+ * vectorizer itself, they never live across a block it did not make.
+ */
+typedef struct ir_operand {
+  ir_operand_kind kind;
+  union {
+    size_t vreg;
+    long imm;
+    size_t vec;
+  };
+} ir_operand;
+
+/*
+ * @struct ir_instr: represents one three-address instruction.
+ */
+typedef struct ir_instr {
+  ir_opcode op;
+  type type;   // <-- type of the produced (or stored) value
+  size_t line; // <-- source line the instruction was lowered from
+
+  ir_operand dst;
+  ir_operand a;
+  ir_operand b;
+
+  rel_kind rel;        // <-- IR_CMP / IR_BR
+  unsigned int lanes;  // <-- vector instructions: 32 bit lanes, 4 or 8
+  variable *var;       // <-- symbol for variable / array / fasm instructions
+  const char *content; // <-- IR_FASM only
+
+  struct ir_block *target; // <-- IR_JMP / IR_BR
+  struct ir_block *alt;    // <-- IR_BR fallthrough-if-false
+  size_t counter; // <-- IR_BR of instrumented builds: profile counter of the
+                  //     times it goes to target, 0 if not counted
+} ir_instr;
+
+/*
+ * @struct ir_block: represents a basic block.
+ */
+typedef struct ir_block {
+  size_t id;
+  size_t origin;        // <-- id of the block this one is a copy of, its own
+                        //     id if it is not a copy
+  size_t index;         // <-- layout position, refreshed by ir_renumber
+  const char *label;    // <-- user label this block starts, if any
+  dynamic_array instrs; // <-- ir_instr, the last one is the terminator
+} ir_block;
+
+/*
+ * @struct ir_vreg: a virtual register and where it ended up.
+ */
+typedef struct ir_vreg {
+  type type;
+  variable *var;       // <-- promoted variable this vreg holds, if any
+  int reg;             // <-- x86_reg assigned by regalloc, -1 if in memory
+  size_t stack_offset; // <-- frame slot [rbp - stack_offset] when reg == -1
+} ir_vreg;
+
+/*
+ * @struct ir_program: the IR for a whole program (there is only main).
+ */
+typedef struct ir_program {
+  dynamic_array blocks;  // <-- ir_block *, in layout order, [0] is the entry
+  dynamic_array vregs;   // <-- ir_vreg
+  dynamic_array defines; // <-- const char *, fasm_define contents
+  size_t block_count;    // <-- next block id
+  size_t frame_size;     // <-- bytes of frame used by variables and spills
+} ir_program;
+
+/*
+ * @brief: allocate an empty IR program.
+ *
+ * @param frame_size: size of the variable area laid out by frame_layout.
+ *
+ * @return: malloc'd ir_program, free it with ir_free.
+ */
+ir_program *ir_new(size_t frame_size);
+
+/*
+ * @brief: free an IR program and all of its blocks.
+ *
+ * @param ir: pointer to an ir_program.
+ */
+void ir_free(ir_program *ir);
+
+/*
+ * @brief: make a deep copy of an IR program, e.g. to try the rest of the
+ * pipeline on it. Variables and fasm text are shared with the original.
+ *
+ * @param ir: pointer to an ir_program.
+ *
+ * @return: malloc'd ir_program, free it with ir_free.
+ */
+ir_program *ir_clone(ir_program *ir);
+
+/*
+ * @brief: create a new, empty basic block. It is not placed in the layout.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param label: optional user label name.
+ *
+ * @return: pointer to the malloc'd block.
+ */
+ir_block *ir_block_new(ir_program *ir, const char *label);
+
+/*
+ * @brief: append a block to the end of the layout.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param block: block created by ir_block_new.
+ */
+void ir_place_block(ir_program *ir, ir_block *block);
+
+/*
+ * @brief: insert a block into the layout in front of the block at index.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param index: layout position the block will take.
+ * @param block: block created by ir_block_new.
+ */
+void ir_insert_block(ir_program *ir, size_t index, ir_block *block);
+
+/*
+ * @brief: remove the block at a layout position and free it. Nothing may
+ * jump to it anymore.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param index: layout position.
+ */
+void ir_remove_block(ir_program *ir, size_t index);
+
+/*
+ * @brief: get the block at a layout position.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param index: layout position.
+ *
+ * @return: pointer to the block, NULL if index is out of bounds.
+ */
+ir_block *ir_block_at(ir_program *ir, size_t index);
+
+/*
+ * @brief: allocate a fresh virtual register.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param t: type of the value it will hold.
+ *
+ * @return: a vreg operand.
+ */
+ir_operand ir_new_vreg(ir_program *ir, type t);
+
+/*
+ * @brief: get the information of a virtual register.
+ */
+ir_vreg *ir_vreg_at(ir_program *ir, size_t vreg);
+
+/*
+ * @brief: make an immediate operand.
+ */
+ir_operand ir_imm(long value);
+
+/*
+ * @brief: make a vector register operand.
+ */
+ir_operand ir_vec(size_t reg);
+
+/*
+ * @brief: get the terminator of a block.
+ *
+ * @param block: pointer to an ir_block.
+ *
+ * @return: pointer to the terminator, NULL if the block is not terminated.
+ */
+ir_instr *ir_terminator(ir_block *block);
+
+/*
+ * @brief: check whether an opcode ends a basic block.
+ */
+bool ir_is_terminator(ir_opcode op);
+
+/*
+ * @brief: get the successors of a block from its terminator.
+ *
+ * @param block: pointer to an ir_block.
+ * @param succ: receives up to two successors.
+ *
+ * @return: number of successors.
+ */
+size_t ir_successors(ir_block *block, ir_block *succ[2]);
+
+/*
+ * @brief: check whether a block holds a fasm statement.
+ */
+bool ir_has_fasm(ir_block *block);
+
+/*
+ * @brief: store the layout position of every block in block->index.
+ */
+void ir_renumber(ir_program *ir);
+
+/*
+ * @brief: count the instructions of the program (terminators included).
+ */
+size_t ir_instr_count(ir_program *ir);
+
+/*
+ * @brief: count the definitions of every vreg.
+ *
+ * @return: malloc'd array indexed by vreg.
+ */
+size_t *ir_def_counts(ir_program *ir);
+
+/*
+ * @brief: count the reads of every vreg.
+ *
+ * @return: malloc'd array indexed by vreg.
+ */
+size_t *ir_use_counts(ir_program *ir);
+
+/*
+ * @brief: collect the names of the variables whose address is taken.
+ *
+ * @return: ht of bool keyed by name, free it with ht_del_ht.
+ */
+ht *ir_address_taken(ir_program *ir);
+
+/*
+ * @brief: evaluate a relational operator on two constants.
+ */
+bool ir_rel_holds(rel_kind rel, long a, long b);
+
+/*
+ * @brief: get the operator to use once the operands of rel are swapped.
+ */
+rel_kind ir_rel_swap(rel_kind rel);
+
+/*
+ * @brief: get the operator that holds exactly when rel does not.
+ */
+rel_kind ir_rel_negate(rel_kind rel);
+
+/*
+ * @brief: check whether an operand is a given vreg.
+ */
+bool ir_is_vreg(ir_operand op, size_t vreg);
+
+/*
+ * @brief: print the IR in a human readable form to stdout.
+ *
+ * @param ir: pointer to an ir_program.
+ */
+void ir_print(ir_program *ir);
+
+#endif // !IR_H
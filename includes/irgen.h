@@ -0,0 +1,24 @@
+/*
+ * irgen: lowers the simple-compiler AST to the linear three-address IR.
+ */
+
+#ifndef IRGEN_H
+#define IRGEN_H
+
+#include "ast.h"
+#include "ir.h"
+
+/*
+ * @brief: lower a semantically checked, laid out program to IR.
+ *
+ * Every structured construct (if, loops, break / continue, goto / labels)
+ * becomes explicit basic blocks joined by jmp / br terminators. Code that
+ * follows an unconditional jump is kept in its own (unreachable) block.
+ *
+ * @param program: pointer to a program_node, after frame_layout.
+ *
+ * @return: malloc'd ir_program, free it with ir_free.
+ */
+ir_program *ir_from_ast(program_node *program);
+
+#endif // !IRGEN_H
@@ -0,0 +1,106 @@
+/*
+ * counted: recognizes loops whose iterations are counted by an induction
+ * variable, and builds the blocks that run a transformed copy of one in
+ * front of the original. Shared by the unroller and the vectorizer.
+ */
+
+#ifndef COUNTED_H
+#define COUNTED_H
+
+#include "cfg.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * @struct counted_loop: a loop whose iterations are counted by an induction
+ * variable.
+ */
+typedef struct counted_loop {
+  ir_block **blocks; // <-- blocks of the loop, in layout order
+  size_t count;
+  size_t header;         // <-- position of the header in blocks
+  size_t latch;          // <-- position of the latch in blocks
+  ir_block *exit;        // <-- where the back edge test leaves to
+  dynamic_array entries; // <-- size_t, layout positions entering the loop
+  size_t iv;
+  long step;
+  rel_kind rel; // <-- the loop goes on while iv rel bound
+  ir_operand bound;
+  size_t line; // <-- source line of the back edge test
+} counted_loop;
+
+/*
+ * @brief: check whether a loop of the graph contains no other loop.
+ */
+bool counted_innermost(cfg *g, size_t index);
+
+/*
+ * @brief: recognize a counted innermost loop.
+ *
+ * A loop is counted when its only back edge is `br iv rel bound` with a
+ * bound that does not change in the loop, and its only update of iv is
+ * `iv = iv + step` on every iteration, step going towards the bound (< and
+ * <= count up, > and >= count down).
+ *
+ * @param ir: pointer to an ir_program.
+ * @param g: graph of the program.
+ * @param index: index of the loop in g->loops.
+ * @param cl: receives the loop, free it with counted_free.
+ *
+ * @return: false if the loop is not counted, cl needs no freeing then.
+ */
+bool counted_analyze(ir_program *ir, cfg *g, size_t index, counted_loop *cl);
+
+/*
+ * @brief: free what counted_analyze allocated.
+ */
+void counted_free(counted_loop *cl);
+
+/*
+ * @brief: get the position of a block in the loop, SIZE_MAX if it is not
+ * part of it.
+ */
+size_t counted_position(counted_loop *cl, ir_block *block);
+
+/*
+ * @brief: make a block ending in br a rel b, target, alt.
+ */
+ir_block *counted_test_block(ir_program *ir, counted_loop *cl, ir_operand a,
+                             rel_kind rel, ir_operand b, ir_block *target,
+                             ir_block *alt);
+
+/*
+ * @brief: make the blocks deciding whether a copy of the loop that runs
+ * several iterations per trip can be entered: at least distance / step + 1
+ * iterations must be left.
+ *
+ * guard: br bound in range, pre, header   (bound in a vreg only)
+ * pre:   limit = bound - distance
+ *        br iv rel limit, NULL, header
+ *
+ * The target of pre is left for the caller to fill in.
+ *
+ * @param guard: receives the guard, NULL if the bound is a constant.
+ * @param pre: receives pre.
+ * @param limit: receives the limit, an immediate or a new vreg.
+ *
+ * @return: false if the limit would overflow, nothing is made then.
+ */
+bool counted_enter(ir_program *ir, counted_loop *cl, long distance,
+                   ir_block **guard, ir_block **pre, ir_operand *limit);
+
+/*
+ * @brief: send every edge entering the loop to another block.
+ */
+void counted_redirect_entries(ir_program *ir, counted_loop *cl, ir_block *to);
+
+/*
+ * @brief: insert blocks into the layout in front of the loop header.
+ */
+void counted_insert_before(ir_program *ir, counted_loop *cl, ir_block **blocks,
+                           size_t count);
+
+#endif // !COUNTED_H
@@ -0,0 +1,43 @@
+/*
+ * dce: dead code elimination, removes branches that cannot go both ways,
+ * blocks that cannot run and computations nobody reads.
+ */
+
+#ifndef DCE_H
+#define DCE_H
+
+#include "ir.h"
+
+#include <stddef.h>
+
+/*
+ * @struct dce_stats: what the pass removed from a program.
+ */
+typedef struct dce_stats {
+  size_t branches; // <-- constant branches turned into jumps
+  size_t blocks;   // <-- unreachable blocks
+  size_t stores;   // <-- stores to memory nothing reads
+  size_t instrs;   // <-- instructions computing an unused vreg
+} dce_stats;
+
+/*
+ * @brief: remove dead code, until nothing changes anymore.
+ *
+ * - a br comparing two immediates (an if whose condition folded) becomes a
+ *   jmp to the side that is taken.
+ * - blocks that cannot be reached from the entry are removed, except the
+ *   ones holding a fasm statement: its text may define a label that another
+ *   fasm statement jumps to.
+ * - an instruction without side effects whose vreg is dead afterwards is
+ *   removed, so is a variable assigned but never read.
+ * - a store to a variable (or array) in memory is removed when nothing ever
+ *   reads it, or when it is overwritten later in the same block before any
+ *   possible read. fasm statements and pointer accesses count as reading
+ *   every variable.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param stats: receives the removed counts.
+ */
+void eliminate_dead_code(ir_program *ir, dce_stats *stats);
+
+#endif // !DCE_H
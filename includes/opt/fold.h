@@ -0,0 +1,26 @@
+/*
+ * fold: AST level constant folding and algebraic simplification. Runs after
+ * semantic analysis, so every node already carries its type.
+ */
+
+#ifndef FOLD
+#define FOLD
+
+#include "ast.h"
+
+/*
+ * @brief: fold constant subtrees and simplify every expression in the program,
+ * in place.
+ *
+ * - constant int / char subtrees are evaluated, as long as the result is
+ *   representable by the literal and no division by zero is involved.
+ * - identities are removed: x + 0, x - 0, x * 1, x / 1 become x, x * 0 and
+ *   x - x become 0 (only when x cannot trap).
+ * - commutative operations get their constant operand on the right, which
+ *   lets chains like (x + 1) + 2 collapse to x + 3.
+ *
+ * @param program: pointer to a semantically checked program_node.
+ */
+void fold_program(program_node *program);
+
+#endif // !FOLD
@@ -0,0 +1,28 @@
+/*
+ * fuse: compare-and-branch fusion, moves the comparison a branch tests
+ * into the branch itself.
+ */
+
+#ifndef FUSE_H
+#define FUSE_H
+
+#include "ir.h"
+
+#include <stddef.h>
+
+/*
+ * @brief: rewrite "c = cmp a rel b; br c != 0" as "br a rel b" (and
+ * "br c == 0" as the negated rel), dropping c.
+ *
+ * Only a cmp in the same block as the branch, read by nothing else and
+ * whose operands do not change before the branch, is moved. Codegen then
+ * emits cmp directly followed by jcc, which macro-fuse, instead of setcc +
+ * movzx + test + jcc.
+ *
+ * @param ir: pointer to an ir_program.
+ *
+ * @return: number of branches fused.
+ */
+size_t fuse_branches(ir_program *ir);
+
+#endif // !FUSE_H
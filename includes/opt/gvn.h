@@ -0,0 +1,46 @@
+/*
+ * gvn: global value numbering, reuses values that were already computed
+ * instead of computing them again.
+ */
+
+#ifndef GVN_H
+#define GVN_H
+
+#include "ir.h"
+
+#include <stddef.h>
+
+/*
+ * @struct gvn_stats: how many instructions reused an earlier value.
+ */
+typedef struct gvn_stats {
+  size_t local;  // <-- the value was computed earlier in the same block
+  size_t global; // <-- the value was computed in a dominating block
+} gvn_stats;
+
+/*
+ * @brief: number the values of a program walking its dominator tree, and
+ * replace every instruction that computes a value which is already
+ * available by a copy of it, or drop it when both vregs have a single
+ * definition.
+ *
+ * - arithmetic, compares, addresses and loads are numbered, x + y and y + x
+ *   get the same number.
+ * - a store makes the stored value available to later loads of the same
+ *   variable or array element.
+ * - loads stay available until a store to the variable (any element for an
+ *   array), a store through a pointer if its address is taken, or a fasm
+ *   statement. Loads through a pointer are invalidated by every store.
+ * - a loaded or stored value is only reused a few instructions further:
+ *   loading it again is cheaper than the spill keeping it in a register
+ *   for longer may cost.
+ * - a block only inherits loads and vregs defined more than once from its
+ *   immediate dominator when that is its only predecessor; from other
+ *   dominators it only inherits values over vregs with a single definition.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param stats: receives the reused counts.
+ */
+void number_values(ir_program *ir, gvn_stats *stats);
+
+#endif // !GVN_H
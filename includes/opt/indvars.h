@@ -0,0 +1,57 @@
+/*
+ * indvars: induction variable strength reduction and elimination, keeps
+ * multiples and squares of a loop counter up to date with additions instead
+ * of multiplying on every iteration.
+ */
+
+#ifndef INDVARS_H
+#define INDVARS_H
+
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+#include <stddef.h>
+
+/*
+ * @struct indvars_stats: what the pass did to a program.
+ */
+typedef struct indvars_stats {
+  size_t reduced;    // <-- multiplications replaced by an induction variable
+  size_t eliminated; // <-- counters replaced in their exit test and removed
+} indvars_stats;
+
+/*
+ * @brief: strength-reduce the induction variables of every loop that has a
+ * preheader.
+ *
+ * A basic induction variable i is a vreg whose every definition in the
+ * loop is i = i + c, with the same constant c each time. A multiplication
+ * in the loop is reduced when it is:
+ * - i * x with x an immediate or a vreg the loop does not write: a new
+ *   vreg j = i * x is computed in the preheader and gets j = j + x * c
+ *   right after every update of i.
+ * - i * i: j = i * i and d = 2 * c * i + c * c are computed in the
+ *   preheader, every update of i is followed by j = j + d; d = d + 2 * c * c
+ *   (sqr = sqr + 2 * sqrt + 1 for a counter going up by one).
+ * The multiplication itself becomes a move from j. Additions wrap around
+ * like the multiplications did, so j always equals the product.
+ *
+ * Afterwards a counter whose only uses are its updates and the back edge
+ * test `br i rel n` of its loop is eliminated: the test becomes
+ * `br j rel' x * n` on a reduced j = i * x with constant x, and i goes
+ * away. That needs i to start from a constant, n to be one, and x * i not
+ * to overflow for any value i takes.
+ *
+ * Multiplications by powers of two are shifts by then (see strength.h)
+ * and kept, a shift is as cheap as the addition. Array elements are
+ * addressed with a scaled index, which costs nothing either.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param stats: receives the counts.
+ * @param remarks: receives a remark per reduced multiplication and
+ * eliminated counter, or NULL.
+ */
+void reduce_induction_variables(ir_program *ir, indvars_stats *stats,
+                                dynamic_array *remarks);
+
+#endif // !INDVARS_H
@@ -0,0 +1,93 @@
+/*
+ * layout: block placement, orders the blocks of main so the likely
+ * successor of every branch falls through and the blocks that rarely run
+ * end up behind the rest of the code.
+ */
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "cfg.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "profile.h"
+
+#include <stddef.h>
+
+/*
+ * A block is cold when it runs less than once per LAYOUT_COLD_RATIO runs
+ * of the header of its innermost loop (of the entry outside of loops), or
+ * never.
+ */
+#define LAYOUT_COLD_RATIO 16
+
+/*
+ * @struct block_weights: how often the blocks of a program run, indexed by
+ * block id.
+ */
+typedef struct block_weights {
+  size_t count;  // <-- entries in each array, ir_program.block_count
+  double *freq;  // <-- runs of every block per run of the entry
+  double *taken; // <-- IR_BR blocks: probability of going to the target
+} block_weights;
+
+/*
+ * @struct layout_stats: what the pass did to a program.
+ */
+typedef struct layout_stats {
+  size_t cold;        // <-- blocks moved behind the rest of main
+  double fall_before; // <-- share of the estimated (or measured) control
+                      //     transfers that fell through to the next block
+  double fall_after;  // <-- the same after placement
+} layout_stats;
+
+/*
+ * @brief: estimate how often the blocks run. Every branch gets the
+ * probability the profile measured for it, or, if the profile never saw
+ * it run, one from the first heuristic that applies to it:
+ * - a branch on two constants always goes the same way.
+ * - leaving the innermost loop of the branch: 1 in 32.
+ * - going to a block with a fasm statement (output, an error message) the
+ *   other successor does not have: 1 in 32.
+ * - going to a block that returns: 1 in 32.
+ * - an == test holds 3 times in 8, a != test 5 times in 8.
+ * - otherwise both ways are equally likely.
+ * Frequencies follow from the probabilities, innermost loops first: a loop
+ * header runs 1 / (1 - p) times per entry into the loop, p being the
+ * probability of getting back to it from the header.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param g: its cfg.
+ * @param prof: measured branches, may be NULL.
+ * @param w: receives the weights, free them with block_weights_free.
+ */
+void layout_estimate(ir_program *ir, cfg *g, const profile *prof,
+                     block_weights *w);
+
+/*
+ * @brief: free the arrays of block weights.
+ */
+void block_weights_free(block_weights *w);
+
+/*
+ * @brief: reorder the blocks of a program.
+ *
+ * Blocks are merged into chains along the edges, heaviest edge first
+ * (Pettis-Hansen), so the likely successor of a block is laid out right
+ * after it and the jump to it disappears. A short if body stays between
+ * its branch and the join, where codegen can still lower it without a
+ * branch. The entry stays first, the other chains follow the one with the
+ * heaviest edge into them. Cold blocks are chained among themselves only
+ * and go last, in source order.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param prof: measured branches, weights are estimated where it is NULL
+ * or does not know a branch (see layout_estimate).
+ * @param stats: receives the counts.
+ * @param remarks: receives a remark per run of blocks moved to the end, or
+ * NULL.
+ */
+void layout_blocks(ir_program *ir, const profile *prof, layout_stats *stats,
+                   dynamic_array *remarks);
+
+#endif // !LAYOUT_H
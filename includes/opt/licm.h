@@ -0,0 +1,71 @@
+/*
+ * licm: loop-invariant code motion, hoists computations whose operands do
+ * not change inside a loop into a preheader block in front of it.
+ */
+
+#ifndef LICM_H
+#define LICM_H
+
+#include "cfg.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+#include <stddef.h>
+
+/*
+ * @struct licm_loop_stats: what was hoisted out of one loop.
+ */
+typedef struct licm_loop_stats {
+  size_t line;  // <-- source line of the statement entering the loop
+  size_t depth; // <-- 1 for an outermost loop
+  size_t hoisted;
+} licm_loop_stats;
+
+/*
+ * @struct licm_stats: what the pass did to a program.
+ */
+typedef struct licm_stats {
+  size_t hoisted;
+  size_t preheaders;   // <-- blocks inserted in front of a loop header
+  dynamic_array loops; // <-- licm_loop_stats, in source order
+} licm_stats;
+
+/*
+ * @brief: hoist loop-invariant instructions into the preheader of every
+ * natural loop, innermost loops first so an outer loop can hoist what an
+ * inner one moved out again.
+ *
+ * An instruction is hoisted when it is the only definition of its vreg in
+ * the program and its operands are not written inside the loop:
+ * - arithmetic, compares and addresses always.
+ * - loads of a variable or an array element when the loop does not store to
+ *   it, has no fasm statement, and has no store through a pointer if the
+ *   address of the variable is taken.
+ * - loads through a pointer when the loop does not write memory at all.
+ *
+ * Instructions that may fault (idiv by a register, element and pointer
+ * loads) are only hoisted from blocks that run on every iteration, so they
+ * never execute when the original program would not have run them.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param stats: receives the hoisted counts, free it with licm_stats_free.
+ */
+void hoist_loop_invariants(ir_program *ir, licm_stats *stats);
+
+/*
+ * @brief: get the preheader of a loop: its only outside predecessor, if
+ * that block has no other successor. Every loop has one after
+ * hoist_loop_invariants.
+ *
+ * @param layout: maps the layout positions of g to blocks.
+ *
+ * @return: pointer to the block, NULL if there is none.
+ */
+ir_block *licm_preheader(ir_block **layout, cfg *g, cfg_loop *loop);
+
+/*
+ * @brief: free the per-loop counts of a licm_stats.
+ */
+void licm_stats_free(licm_stats *stats);
+
+#endif // !LICM_H
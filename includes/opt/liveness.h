@@ -0,0 +1,35 @@
+/*
+ * liveness: backward dataflow analysis of live virtual registers.
+ */
+
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include "ds/bitset.h"
+#include "ir.h"
+
+/*
+ * @struct liveness: live vregs at the boundaries of every block, indexed by
+ * the layout position of the block (ir_block.index).
+ */
+typedef struct liveness {
+  size_t block_count;
+  bitset *live_in;
+  bitset *live_out;
+} liveness;
+
+/*
+ * @brief: compute live-in / live-out sets for every block. Renumbers the
+ * blocks first.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param lv: pointer to an uninitialized liveness struct.
+ */
+void liveness_compute(ir_program *ir, liveness *lv);
+
+/*
+ * @brief: free the sets of a liveness struct.
+ */
+void liveness_free(liveness *lv);
+
+#endif // !LIVENESS_H
@@ -0,0 +1,59 @@
+/*
+ * peephole: sliding window clean-up of the x86 instruction list built by
+ * codegen, right before it is printed.
+ */
+
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "ds/dynamic_array.h"
+
+#include <stddef.h>
+
+/*
+ * @enum peephole_pattern: the rewrites the pass knows about.
+ */
+typedef enum peephole_pattern {
+  PEEPHOLE_PUSH_POP = 0, // push x; pop y        -> mov y, x
+  PEEPHOLE_SELF_MOVE,    // mov r, r             -> (removed)
+  PEEPHOLE_STORE_LOAD,   // mov [m], r; mov s, [m] -> mov [m], r; mov s, r
+  PEEPHOLE_ZERO_IDIOM,   // mov r, 0             -> xor r32, r32
+  PEEPHOLE_SHORT_IMM,    // mov r64, imm         -> mov r32, imm
+  PEEPHOLE_TEST_ZERO,    // cmp r, 0             -> test r, r
+  PEEPHOLE_JUMP_THREAD,  // jmp L; L: jmp M      -> jmp M
+  PEEPHOLE_BRANCH_OVER,  // jcc L; jmp M; L:     -> jncc M
+  PEEPHOLE_JUMP_NEXT,    // jmp L; L:            -> (removed)
+  PEEPHOLE_UNREACHABLE,  // jmp L; ...           -> (removed up to a label)
+  PEEPHOLE_PATTERN_COUNT
+} peephole_pattern;
+
+/*
+ * @struct peephole_stats: what the pass did to one instruction list.
+ */
+typedef struct peephole_stats {
+  size_t before; // <-- instructions in, labels and directives excluded
+  size_t after;
+  size_t hits[PEEPHOLE_PATTERN_COUNT];
+} peephole_stats;
+
+/*
+ * @brief: get the name of a pattern, as reported by --stats.
+ */
+const char *peephole_pattern_name(peephole_pattern pattern);
+
+/*
+ * @brief: rewrite a dynamic_array of asm_instr in place until no pattern
+ * applies anymore.
+ *
+ * Rewrites stay inside straight-line code: a label, a jump or an inline
+ * fasm statement ends the window. The flags are only assumed dead where
+ * nothing reads them before the next instruction that sets them, which
+ * holds for codegen output (cmp is always directly followed by its jcc /
+ * setcc).
+ *
+ * @param code: instructions produced by codegen.
+ * @param stats: receives the hit counts, may be NULL.
+ */
+void peephole_optimize(dynamic_array *code, peephole_stats *stats);
+
+#endif // !PEEPHOLE_H
@@ -0,0 +1,191 @@
+/*
+ * pipeline: pass manager for the optimizations, runs the IR passes of an
+ * optimization level (or a list given by name) in order, tells codegen
+ * which of its own passes to run, and records what every IR pass did and
+ * how long it took.
+ *
+ * Usage:
+ * pipeline p;
+ * pipeline_init(&p, level, NULL);
+ * pipeline_stats stats;
+ * pipeline_stats_init(&stats);
+ * pipeline_run(&p, ir, 0, p.count, &stats);
+ * ...
+ * pipeline_stats_free(&stats);
+ * pipeline_free(&p);
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/dce.h"
+#include "opt/gvn.h"
+#include "opt/indvars.h"
+#include "opt/layout.h"
+#include "opt/licm.h"
+#include "opt/remarks.h"
+#include "opt/sccp.h"
+#include "opt/unroll.h"
+#include "opt/vectorize.h"
+#include "profile.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Optimization level sclc uses without -O.
+ */
+#define PIPELINE_DEFAULT_LEVEL 2
+#define PIPELINE_MAX_LEVEL 2
+
+/*
+ * @enum pipeline_pass: the passes, in the order of the full pipeline. The
+ * last two work on the assembly and run in codegen, wherever they are in
+ * the list.
+ */
+typedef enum pipeline_pass {
+  PASS_FUSE = 0,
+  PASS_ROTATE,
+  PASS_PROMOTE,
+  PASS_SCCP,
+  PASS_DCE,
+  PASS_STRENGTH,
+  PASS_LICM,
+  PASS_INDVARS,
+  PASS_VECTORIZE,
+  PASS_UNROLL,
+  PASS_GVN,
+  PASS_LAYOUT,
+  PASS_ALIGN,    // <-- align 16 in front of loop heads
+  PASS_PEEPHOLE, // <-- peephole_optimize on the code of main
+  PASS_COUNT,
+} pipeline_pass;
+
+/*
+ * @struct pipeline: the passes to run and their options.
+ */
+typedef struct pipeline {
+  pipeline_pass *passes;
+  size_t count;
+  size_t unroll_factor;
+  size_t unroll_budget;
+  bool avx2;
+  const profile *profile; // <-- counters for layout and unroll, or NULL
+  int print_after; // <-- pass to print the IR after, -1 for none
+} pipeline;
+
+/*
+ * @struct pipeline_timing: one pass that ran.
+ */
+typedef struct pipeline_timing {
+  pipeline_pass pass;
+  double ms; // <-- wall time
+  size_t instrs_before;
+  size_t instrs_after;
+  size_t blocks_before;
+  size_t blocks_after;
+} pipeline_timing;
+
+/*
+ * @struct pipeline_stats: what the passes did to a program. The counts of a
+ * pass that did not run stay 0.
+ */
+typedef struct pipeline_stats {
+  bool ran[PASS_COUNT];
+  size_t fused;
+  size_t rotated;
+  size_t promoted;
+  sccp_stats sccp;
+  dce_stats dce;
+  size_t reduced;
+  licm_stats licm;
+  indvars_stats indvars;
+  vectorize_stats vectorize;
+  unroll_stats unroll;
+  gvn_stats gvn;
+  layout_stats layout;
+  dynamic_array timings; // <-- pipeline_timing, in the order passes ran
+  dynamic_array remarks; // <-- remark, in the order passes made them
+} pipeline_stats;
+
+/*
+ * @brief: get the name of a pass, as --passes and --print-after take it.
+ */
+const char *pipeline_pass_name(pipeline_pass pass);
+
+/*
+ * @brief: check whether a pass is one codegen runs (align, peephole).
+ * pipeline_run only marks those as ran, the caller hands them to codegen
+ * through codegen_options.
+ */
+bool pipeline_in_codegen(pipeline_pass pass);
+
+/*
+ * @brief: find a pass by its name.
+ *
+ * @return: the pass, or -1 if there is none with that name.
+ */
+int pipeline_find_pass(const char *name, size_t length);
+
+/*
+ * @brief: check a comma separated list of pass names.
+ *
+ * @return: NULL if every name is a pass, else a malloc'd copy of the first
+ * one that is not.
+ */
+char *pipeline_check_list(const char *list);
+
+/*
+ * @brief: set up the passes of an optimization level:
+ * - 0: none, the IR goes to the register allocator as it was generated
+ *   and codegen neither aligns loops nor runs the peephole pass.
+ * - 1: the cheap ones: fuse, rotate, promote, dce, strength, align and
+ *   peephole.
+ * - 2: everything.
+ *
+ * @param p: pointer to an uninitialized pipeline.
+ * @param level: optimization level, 0 to PIPELINE_MAX_LEVEL.
+ * @param list: comma separated pass names replacing the ones of the level,
+ * already checked with pipeline_check_list, or NULL.
+ */
+void pipeline_init(pipeline *p, unsigned int level, const char *list);
+
+/*
+ * @brief: get the position of the first run of a pass in a pipeline.
+ *
+ * @return: the position, p->count if the pass does not run.
+ */
+size_t pipeline_position(pipeline *p, pipeline_pass pass);
+
+/*
+ * @brief: run the passes at positions [from, to) of a pipeline.
+ *
+ * @param p: pointer to a pipeline.
+ * @param ir: pointer to an ir_program.
+ * @param from: position of the first pass to run.
+ * @param to: position after the last one.
+ * @param stats: receives the counts and timings. NULL for a silent run on
+ * a scratch copy: the counts are dropped and print_after is ignored.
+ */
+void pipeline_run(pipeline *p, ir_program *ir, size_t from, size_t to,
+                  pipeline_stats *stats);
+
+/*
+ * @brief: zero the counts of a pipeline_stats before its first run.
+ */
+void pipeline_stats_init(pipeline_stats *stats);
+
+/*
+ * @brief: free the per-loop reports, timings and remarks of a
+ * pipeline_stats.
+ */
+void pipeline_stats_free(pipeline_stats *stats);
+
+/*
+ * @brief: free the pass list of a pipeline.
+ */
+void pipeline_free(pipeline *p);
+
+#endif // !PIPELINE_H
@@ -0,0 +1,29 @@
+/*
+ * promote: keep scalar variables in virtual registers instead of memory.
+ */
+
+#ifndef PROMOTE_H
+#define PROMOTE_H
+
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+/*
+ * @brief: promote every scalar variable whose address never escapes to a
+ * virtual register of its own.
+ *
+ * A variable stays pinned to its frame slot when it is an array, when its
+ * address is taken with &x, or when it is the parameter of a fasm statement
+ * (the fasm text addresses it as [rbp - offset]). Loads and stores of the
+ * other variables become register moves, which are then coalesced into the
+ * instructions around them, and the variables that may be read before being
+ * written are zeroed on entry (the frame used to start out zeroed).
+ *
+ * @param ir: pointer to an ir_program.
+ * @param remarks: receives a remark per variable, or NULL.
+ *
+ * @return: number of promoted variables.
+ */
+size_t promote_variables(ir_program *ir, dynamic_array *remarks);
+
+#endif // !PROMOTE_H
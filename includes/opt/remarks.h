@@ -0,0 +1,76 @@
+/*
+ * remarks: optimization remarks, one line per thing a pass did or could not
+ * do, keyed to the source line it is about.
+ *
+ * Usage:
+ * dynamic_array remarks;
+ * dynamic_array_init(&remarks, sizeof(remark));
+ * remark_add(&remarks, REMARK_PASSED, "strength", line, "division by %ld "
+ *            "strength-reduced", d);
+ * ...
+ * remarks_print(&remarks, filename, "", NULL);
+ * remarks_free(&remarks);
+ */
+
+#ifndef REMARKS_H
+#define REMARKS_H
+
+#include "ds/dynamic_array.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * @enum remark_kind: whether a remark is about something a pass did, or
+ * something it looked at and left alone.
+ */
+typedef enum remark_kind {
+  REMARK_PASSED = 0,
+  REMARK_MISSED,
+} remark_kind;
+
+/*
+ * @struct remark: one optimization remark.
+ */
+typedef struct remark {
+  remark_kind kind;
+  const char *pass; // <-- name of the pass, as --passes takes it
+  size_t line;      // <-- source line, 0 if unknown
+  char *message;    // <-- malloc'd
+} remark;
+
+/*
+ * @brief: add a remark, formatted like printf.
+ *
+ * @param remarks: dynamic_array of remark, or NULL to drop it.
+ */
+void remark_add(dynamic_array *remarks, remark_kind kind, const char *pass,
+                size_t line, const char *format, ...);
+
+/*
+ * @brief: print remarks in source line order, as
+ * `file:line: remark: message [-Rpass=pass]`.
+ *
+ * @param passed: comma separated passes whose passed remarks are printed, ""
+ * for all of them, NULL for none.
+ * @param missed: the same for missed remarks.
+ */
+void remarks_print(dynamic_array *remarks, const char *filename,
+                   const char *passed, const char *missed);
+
+/*
+ * @brief: write every remark to a file as JSON:
+ * {"file": ..., "remarks": [{"kind": "passed" | "missed", "pass": ...,
+ * "line": ..., "message": ...}, ...]}, in source line order.
+ *
+ * @return: false if the file could not be written.
+ */
+bool remarks_write_json(dynamic_array *remarks, const char *filename,
+                        const char *path);
+
+/*
+ * @brief: free the messages of the remarks and the array.
+ */
+void remarks_free(dynamic_array *remarks);
+
+#endif // !REMARKS_H
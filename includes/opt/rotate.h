@@ -0,0 +1,38 @@
+/*
+ * rotate: loop rotation, turns loops that test their condition at the top
+ * into a guard in front of the loop plus a test at the bottom.
+ */
+
+#ifndef ROTATE_H
+#define ROTATE_H
+
+#include "ir.h"
+
+#include <stddef.h>
+
+/*
+ * @brief: rotate every loop whose header only computes a branch that
+ * either stays in the loop or leaves it:
+ *
+ *   head: br cond, body, end; body: ...; jmp head; end
+ *
+ * becomes
+ *
+ *   head: br cond, body, end; body: ...; test: br cond, body, end; end
+ *
+ * The test block is a copy of the header placed after the last block of
+ * the loop, and every back edge goes to it instead. The header is left as
+ * the guard, so an iteration runs one conditional branch instead of a
+ * conditional branch plus a jump back to the top, and body becomes the
+ * header of the loop.
+ *
+ * A header with a fasm statement, or whose values are read outside of it,
+ * is left alone.
+ *
+ * @param ir: pointer to an ir_program.
+ *
+ * @return: number of loops rotated.
+ */
+size_t rotate_loops(ir_program *ir);
+
+#endif // !ROTATE_H
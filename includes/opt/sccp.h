@@ -0,0 +1,52 @@
+/*
+ * sccp: sparse conditional constant propagation (Wegman and Zadeck), finds
+ * the vregs holding the same constant on every path that can run, and the
+ * branches that can only go one way.
+ */
+
+#ifndef SCCP_H
+#define SCCP_H
+
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+#include <stddef.h>
+
+/*
+ * @struct sccp_stats: what the pass did to a program.
+ */
+typedef struct sccp_stats {
+  size_t constants; // <-- vreg operands replaced by their constant
+  size_t folded;    // <-- instructions turned into a move of their result
+  size_t branches;  // <-- branches turned into jumps
+  size_t phis;      // <-- phis of the SSA form
+  size_t copies;    // <-- moves leaving SSA form took
+} sccp_stats;
+
+/*
+ * @brief: propagate constants through the SSA form of a program.
+ *
+ * Values start out unknown and only get worse (a constant, then varying)
+ * as the blocks that can run are discovered: a branch whose operands are
+ * constant only makes its taken side executable, and a phi only meets the
+ * values of the edges that were found executable. So `int n = 10` that is
+ * never reassigned is 10 everywhere, and a variable assigned in an if that
+ * can never be taken keeps its constant after it.
+ *
+ * Afterwards, in the blocks that can run, uses of a constant vreg become
+ * immediates, instructions computing a constant become a move of it, and
+ * constant branches become jumps, which leaves the dead side to
+ * eliminate_dead_code. Only constants that fit a sign extended imm32 are
+ * substituted, as x86 cannot store wider immediates to memory.
+ *
+ * Programs with a fasm statement that may define a label are left alone,
+ * another fasm statement could jump to it behind the graph's back.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param stats: receives the counts.
+ * @param remarks: receives a remark per folded branch, or NULL.
+ */
+void propagate_constants(ir_program *ir, sccp_stats *stats,
+                         dynamic_array *remarks);
+
+#endif // !SCCP_H
@@ -0,0 +1,74 @@
+/*
+ * ssa: static single assignment form of the IR, every vreg defined more than
+ * once gets a new version per definition and phis where versions meet.
+ *
+ * Usage:
+ * ssa_form ssa;
+ * ssa_build(ir, &ssa);
+ * ... analyze and rewrite the program, the graph must not change ...
+ * ssa_destroy(ir, &ssa);
+ */
+
+#ifndef SSA_H
+#define SSA_H
+
+#include "cfg.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+#include <stddef.h>
+
+/*
+ * @struct ssa_phi: a phi at the top of a block, dst takes the argument of the
+ * edge the block was entered through.
+ */
+typedef struct ssa_phi {
+  size_t dst;       // <-- version the phi defines
+  size_t vreg;      // <-- vreg it is a version of
+  ir_operand *args; // <-- one per predecessor, in the order of cfg.preds
+} ssa_phi;
+
+/*
+ * @struct ssa_form: the phis and versions of a program in SSA form. The
+ * instructions themselves are renamed in place.
+ */
+typedef struct ssa_form {
+  cfg g;                // <-- graph the form was built on
+  dynamic_array *phis;  // <-- ssa_phi, one array per block (layout position)
+  size_t *origin;       // <-- vreg every version stands for, by vreg
+  size_t vreg_count;    // <-- vregs of the program before the versions
+  size_t phi_count;
+  size_t copies; // <-- moves ssa_destroy inserted for phis
+} ssa_form;
+
+/*
+ * @brief: put a program in SSA form (Cytron et al.): phis are placed on the
+ * iterated dominance frontier of the definitions of a vreg, where it is
+ * live (pruned SSA), then a walk of the dominator tree renames every
+ * definition and use.
+ *
+ * Vregs with a single definition keep their name. A use no definition
+ * reaches keeps the original vreg, which no longer has a definition then.
+ * Blocks the entry does not reach are left alone.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param ssa: pointer to an uninitialized ssa_form.
+ */
+void ssa_build(ir_program *ir, ssa_form *ssa);
+
+/*
+ * @brief: leave SSA form and free the phis.
+ *
+ * Versions are coalesced back into the vreg they stand for, so a phi whose
+ * arguments are all versions of its own vreg costs nothing. This holds as
+ * long as the passes in between kept the form conventional (versions of a
+ * vreg never live at the same time), e.g. by only replacing uses with
+ * constants and removing edges. Any other argument is copied at the end of
+ * its predecessor, on a new block when the edge is critical.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param ssa: pointer to an ssa_form built by ssa_build.
+ */
+void ssa_destroy(ir_program *ir, ssa_form *ssa);
+
+#endif // !SSA_H
@@ -0,0 +1,49 @@
+/*
+ * strength: replace multiplication, division and modulo by constants with
+ * shifts, masks and multiplications.
+ */
+
+#ifndef STRENGTH_H
+#define STRENGTH_H
+
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * @brief: compute the magic number of a signed 64 bit division by d
+ * (Granlund-Montgomery / Hacker's Delight): for every x,
+ * x / d == (mulhi(x, multiplier) [+ or - x] >> shift) + sign bit.
+ *
+ * @param d: divisor, |d| >= 3 and not a power of two.
+ * @param multiplier: receives the magic multiplier.
+ * @param shift: receives the shift applied to the high half.
+ *
+ * @return: false if d is not such a divisor.
+ */
+bool strength_signed_magic(long d, long *multiplier, unsigned int *shift);
+
+/*
+ * @brief: rewrite x * c, x / c and x % c by constants.
+ *
+ * - x * 2^k becomes x << k.
+ * - x / 2^k adds 2^k - 1 to negative dividends before the arithmetic shift,
+ *   so the quotient rounds toward zero like idiv.
+ * - x % 2^k masks the biased dividend and removes the bias again, so the
+ *   remainder keeps the sign of x like idiv.
+ * - a negative constant negates the result (x % -c is x % c).
+ * - x / d for any other d (|d| >= 3) becomes a multiply-high by a magic
+ *   number, a shift and a sign fix-up, x % d becomes x - (x / d) * d.
+ *
+ * x * 3 / 5 / 9 are left to codegen, which emits lea for them.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param remarks: receives a remark per rewritten instruction, or NULL.
+ *
+ * @return: number of rewritten instructions.
+ */
+size_t strength_reduce(ir_program *ir, dynamic_array *remarks);
+
+#endif // !STRENGTH_H
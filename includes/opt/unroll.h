@@ -0,0 +1,71 @@
+/*
+ * unroll: loop unrolling, runs several iterations of a counted loop per
+ * trip through it to save the test and jump in between.
+ */
+
+#ifndef UNROLL_H
+#define UNROLL_H
+
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "profile.h"
+
+#include <stddef.h>
+
+/*
+ * Default number of copies of the body in an unrolled loop.
+ */
+#define UNROLL_DEFAULT_FACTOR 4
+
+/*
+ * Default number of instructions the copies of one loop may add. A fasm
+ * statement counts as UNROLL_FASM_WEIGHT, its macro usually expands to
+ * many instructions.
+ */
+#define UNROLL_DEFAULT_BUDGET 128
+#define UNROLL_FASM_WEIGHT 16
+
+/*
+ * @struct unroll_stats: what the pass did to a program.
+ */
+typedef struct unroll_stats {
+  size_t full;    // <-- loops replaced by a copy of every iteration
+  size_t partial; // <-- loops given an unrolled copy and a remainder loop
+  size_t added;   // <-- instructions added, with fasm weighted
+} unroll_stats;
+
+/*
+ * @brief: unroll the counted innermost loops of a program.
+ *
+ * A loop is counted when its only back edge is `br iv rel bound` with a
+ * bound that does not change in the loop, and its only update of iv is
+ * `iv = iv + step` on every iteration, step going towards the bound (< and
+ * <= count up, > and >= count down).
+ *
+ * - when iv starts from a constant and the bound is one, the number of
+ *   iterations is known: if all of them fit the budget, the loop is
+ *   replaced by that many copies of its body and no test at all.
+ * - otherwise the loop gets a copy with factor bodies in front of it, which
+ *   only tests the bound after the last body, against
+ *   bound - (factor - 1) * step. The original loop runs the iterations
+ *   that are left over.
+ *
+ * The factor is lowered until the copies fit the budget. Loops with a fasm
+ * statement that may define a label are left alone, and so are the loops
+ * of an instrumented build.
+ *
+ * With a profile, loops that never ran are left alone, and a partially
+ * unrolled loop gets no more copies than the trips it made per entry.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param factor: copies of the body per trip, 1 disables partial unrolling.
+ * @param budget: instructions the copies of one loop may add.
+ * @param prof: measured trips, may be NULL.
+ * @param stats: receives the unrolled counts.
+ * @param remarks: receives a remark per innermost loop, or NULL.
+ */
+void unroll_loops(ir_program *ir, size_t factor, size_t budget,
+                  const profile *prof, unroll_stats *stats,
+                  dynamic_array *remarks);
+
+#endif // !UNROLL_H
@@ -0,0 +1,64 @@
+/*
+ * vectorize: loop vectorization, runs 4 (SSE2) or 8 (AVX2) iterations of a
+ * counted loop over arrays at once in the lanes of a vector register.
+ */
+
+#ifndef VECTORIZE_H
+#define VECTORIZE_H
+
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * @struct vectorize_loop_stats: what happened to one innermost loop.
+ */
+typedef struct vectorize_loop_stats {
+  size_t line;        // <-- source line of the back edge test
+  const char *reason; // <-- why it was not vectorized, NULL if it was
+} vectorize_loop_stats;
+
+/*
+ * @struct vectorize_stats: what the pass did to a program.
+ */
+typedef struct vectorize_stats {
+  size_t vectorized;
+  size_t rejected;
+  unsigned int lanes;  // <-- elements per vector iteration
+  dynamic_array loops; // <-- vectorize_loop_stats, one per innermost loop
+} vectorize_stats;
+
+/*
+ * @brief: vectorize the counted innermost loops of a program.
+ *
+ * A loop is vectorized when it counts up by one, and every array element
+ * it touches is the one of the iteration (a[i], i being the counter), so
+ * iterations only depend on each other through reductions:
+ * - element-wise add, sub, mul, and, shifts by a constant, and stores of
+ *   the results, on 32 bit lanes (a stored element keeps 32 bits anyway).
+ * - `if x rel y` around stores, turned into a compare and a blend. x and y
+ *   must be elements or constants / values that fit 32 bits unsigned, as
+ *   elements are zero extended when loaded.
+ * - `s = s + a[i]` sums, kept in 64 bit lanes.
+ * - `if a[i] > m { m = a[i] }` max and min reductions.
+ *
+ * The vector loop runs while a full vector of iterations is left and the
+ * original loop runs the ones left over, or all of them when the vector
+ * loop cannot be entered. Loops with a fasm statement, a pointer access,
+ * another store to a variable, a division or a value carried to the next
+ * iteration are left alone.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param avx2: use 8 lanes of AVX2 instead of 4 of SSE2.
+ * @param stats: receives the report, free it with vectorize_stats_free.
+ */
+void vectorize_loops(ir_program *ir, bool avx2, vectorize_stats *stats);
+
+/*
+ * @brief: free the per-loop report of a vectorize_stats.
+ */
+void vectorize_stats_free(vectorize_stats *stats);
+
+#endif // !VECTORIZE_H
@@ -0,0 +1,111 @@
+/*
+ * profile: profile guided optimization. An instrumented build counts how
+ * often every block runs and every branch goes to its target, and writes
+ * the counters to a file when the program exits. A later build of the same
+ * program reads them back to steer block layout, unrolling, if-conversion
+ * and register allocation.
+ *
+ * Usage:
+ * sclc --profile-generate prog.scl       (./prog writes prog.profile)
+ * ./prog
+ * sclc --profile-use=prog.profile prog.scl
+ *
+ * Counters belong to the blocks as IR generation creates them, a copy of a
+ * block counts as the block it was copied from (see ir_block.origin), and
+ * a branch is looked up by the blocks it goes to, so the counts still
+ * apply after the passes copied blocks or swapped the ways of a branch.
+ * The file carries a checksum of that CFG, so the counts of an edited
+ * program are caught instead of applied to the wrong blocks.
+ *
+ * File layout, every field a little endian u64:
+ * PROFILE_MAGIC, checksum, n, runs of blocks 0 .. n - 1, times the branches
+ * of blocks 0 .. n - 1 went to their target.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "ir.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * "SCLCPROF" read as a little endian u64.
+ */
+#define PROFILE_MAGIC 0x464f5250434c4353ull
+
+/*
+ * @struct profile: the counters of one run of an instrumented build.
+ */
+typedef struct profile {
+  uint64_t checksum;  // <-- profile_checksum of the measured program
+  size_t block_count; // <-- blocks of it after IR generation
+  uint64_t *runs;     // <-- runs of every block, indexed by block id
+  uint64_t *taken;    // <-- IR_BR blocks: runs that went to the target
+  size_t *target;     // <-- IR_BR blocks: ids of the target and the other
+  size_t *alt;        //     successor, SIZE_MAX for other blocks (see
+                      //     profile_match)
+} profile;
+
+/*
+ * @brief: hash the CFG of a program right after IR generation: its blocks,
+ * their sizes, terminators and successors (FNV-1a).
+ */
+uint64_t profile_checksum(ir_program *ir);
+
+/*
+ * @brief: add the counters to a program right after IR generation. Every
+ * block starts with `count id`, counter block_count + id counts the runs
+ * of a branch that go to its target (ir_instr.counter), codegen lowers
+ * both to an add to a qword of the data segment.
+ *
+ * @return: number of counters, 2 * ir->block_count.
+ */
+size_t profile_instrument(ir_program *ir);
+
+/*
+ * @brief: read the counters an instrumented build wrote.
+ *
+ * @return: false if the file is missing, truncated or no profile.
+ */
+bool profile_read(const char *path, profile *prof);
+
+/*
+ * @brief: check that a profile was recorded for a program, right after IR
+ * generation, and note where the branches of the program go.
+ *
+ * @return: false if the profile is stale.
+ */
+bool profile_match(profile *prof, ir_program *ir);
+
+/*
+ * @brief: free the counters of a profile.
+ */
+void profile_free(profile *prof);
+
+/*
+ * @brief: look up how often a block ran, or the block it was copied from.
+ *
+ * @param prof: the profile, may be NULL.
+ *
+ * @return: false if there is no profile or the block was created after IR
+ * generation.
+ */
+bool profile_runs(const profile *prof, const ir_block *block, uint64_t *runs);
+
+/*
+ * @brief: look up how often a block went on to a successor, both matched
+ * by the blocks they were copied from. A successor created later that only
+ * jumps on stands for the block it jumps to.
+ *
+ * @param prof: the profile, may be NULL.
+ *
+ * @return: false if the profile does not know the edge: the block did not
+ * end in a branch after IR generation, or to leads nowhere it knows.
+ */
+bool profile_edge(const profile *prof, const ir_block *block, ir_block *to,
+                  uint64_t *count);
+
+#endif // !PROFILE_H
@@ -0,0 +1,45 @@
+/*
+ * regalloc: linear scan register allocation of IR virtual registers.
+ */
+
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "ir.h"
+#include "profile.h"
+
+#include <stddef.h>
+
+/*
+ * @struct regalloc_stats: summary of one allocation.
+ */
+typedef struct regalloc_stats {
+  size_t intervals; // <-- vregs that are live somewhere
+  size_t in_registers;
+  size_t spilled;
+} regalloc_stats;
+
+/*
+ * @brief: assign a physical register or a frame slot to every vreg.
+ *
+ * Each vreg gets one live interval over the linear block order, widened by
+ * the liveness sets at block boundaries. Intervals are scanned by start
+ * point; when the registers run out, the interval ending last is spilled,
+ * or with a profile the one whose uses run least often.
+ * rax is left to the code generator as its scratch register. An interval
+ * that is live across a fasm statement may only use a register fasm leaves
+ * alone (r12-r15), and one live across an idiv or a multiply-high (or used
+ * as a divisor) may not use rdx. Immediate operands of those are moved to a
+ * vreg first.
+ *
+ * The result is stored in ir_vreg.reg / ir_vreg.stack_offset, spill slots
+ * are appended to ir->frame_size.
+ *
+ * @param ir: pointer to an ir_program.
+ * @param prof: measured block runs, may be NULL.
+ * @param stats: receives the summary, may be NULL.
+ */
+void regalloc_linear_scan(ir_program *ir, const profile *prof,
+                          regalloc_stats *stats);
+
+#endif // !REGALLOC_H
@@ -12,7 +12,9 @@
 
 /*
  * @brief: go through all the variables and labels in the parse tree and check
- * for any erorrs.
+ * for any erorrs. This is a single traversal which also caches the resolved
+ * symbol of every variable reference and the type of every term / expression
+ * on the AST nodes, so codegen never has to look anything up again.
  *
  * @param instrs: pointer to the dynamic_array of instructions.
  * @param variables: pointer to hash table of variable.
@@ -20,11 +20,24 @@ typedef struct variable {
   type type;
   char *name;
   size_t line;
+
+  /*
+   * Frame slot assigned by the frame layout phase: the variable lives at
+   * [rbp - stack_offset] and occupies size bytes, aligned to align bytes.
+   */
   size_t stack_offset;
+  size_t size;
+  size_t align;
 
   bool is_array;
   size_t dimensions;
   size_t *dimension_sizes;
+
+  /*
+   * Symbol table entry this reference resolves to, filled in by semantic
+   * analysis so later stages never have to look the name up again.
+   */
+  struct variable *symbol;
 } variable;
 
 /*
@@ -37,28 +50,16 @@ typedef struct variable {
 int get_type_size(type t);
 
 /*
- * @brief: check if a certain variable exists in a dynamic_array of variables.
+ * @brief: resolve a variable reference against the symbol table and cache the
+ * resolved entry in var_to_find->symbol.
  *
  * @param variables: pointer to hash table of variables.
- * @param var_to_find: pointer to a variable struct which we intend to find in
- * the dynamic_array.
- * @param errors: counter variable to increment when an error is encountered.
- *
- * @return: int
- */
-size_t get_var_stack_offset(ht *variables, variable *var_to_find,
-                            unsigned int *errors);
-
-/*
- * @brief: check for a variable's type by its name / identifier and line data.
- *
- * @param variables: pointer to hash table of variable.
- * @param var_to_find: pointer to a variable struct which we intend to find in
- * the dynamic_array.
+ * @param var_to_find: pointer to the variable reference to resolve.
  * @param errors: counter variable to increment when an error is encountered.
  *
- * @return: data type of the variable (enumeration)
+ * @return: pointer to the symbol table entry, NULL if it is undeclared.
  */
-type get_var_type(ht *variables, variable *var_to_find, unsigned int *errors);
+variable *resolve_variable(ht *variables, variable *var_to_find,
+                           unsigned int *errors);
 
 #endif // !VARE
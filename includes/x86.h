@@ -0,0 +1,76 @@
+/*
+ * x86: x86-64 register file description shared by the register allocator and
+ * the code generator.
+ */
+
+#ifndef X86_H
+#define X86_H
+
+#include <stdbool.h>
+
+/*
+ * @enum x86_reg: general purpose registers, in encoding order.
+ */
+typedef enum x86_reg {
+  RAX = 0,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+  X86_REG_COUNT
+} x86_reg;
+
+/*
+ * Vector registers: xmm0-xmm15, or their 256 bit ymm forms. The code
+ * generator uses the ones from X86_VEC_SCRATCH up as scratch, the others
+ * are handed out by the vectorizer.
+ */
+#define X86_VEC_COUNT 16
+#define X86_VEC_SCRATCH 12
+
+/*
+ * @brief: name of the 64 bit register.
+ */
+const char *x86_reg64(x86_reg reg);
+
+/*
+ * @brief: name of the low 32 bits of a register.
+ */
+const char *x86_reg32(x86_reg reg);
+
+/*
+ * @brief: name of the low 8 bits of a register.
+ */
+const char *x86_reg8(x86_reg reg);
+
+/*
+ * @brief: name of a vector register, xmm for 4 lanes of 32 bits and ymm for
+ * 8 of them.
+ */
+const char *x86_vec(unsigned int reg, unsigned int lanes);
+
+/*
+ * @brief: check whether the System V ABI makes a register callee-saved.
+ */
+bool x86_is_callee_saved(x86_reg reg);
+
+/*
+ * @brief: check whether a register survives a fasm statement.
+ *
+ * Inline fasm (and the io.scl helpers it calls) may use any register but
+ * rbp, rsp and r12-r15: parse_uint writes rbx and syscall writes rcx / r11.
+ */
+bool x86_survives_fasm(x86_reg reg);
+
+#endif // !X86_H
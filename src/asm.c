@@ -0,0 +1,451 @@
+#include "asm.h"
+#include "ds/dynamic_array.h"
+#include "utils.h"
+#include "x86.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+asm_operand asm_reg(x86_reg reg, unsigned int size) {
+  return (asm_operand){.kind = ASM_REG, .size = size, .reg = reg, .index = -1};
+}
+
+asm_operand asm_imm(long value) {
+  return (asm_operand){.kind = ASM_IMM, .index = -1, .imm = value};
+}
+
+asm_operand asm_mem(x86_reg base, int index, unsigned int scale, long disp,
+                    unsigned int size) {
+  return (asm_operand){.kind = ASM_MEM,
+                       .size = size,
+                       .reg = base,
+                       .index = index,
+                       .scale = scale,
+                       .imm = disp};
+}
+
+asm_operand asm_block(size_t id) {
+  return (asm_operand){.kind = ASM_BLOCK, .index = -1, .block = id};
+}
+
+bool asm_operand_equal(asm_operand a, asm_operand b) {
+  if (a.kind != b.kind)
+    return false;
+
+  switch (a.kind) {
+  case ASM_NONE:
+    return true;
+  case ASM_REG:
+    return a.reg == b.reg && a.size == b.size;
+  case ASM_IMM:
+    return a.imm == b.imm;
+  case ASM_MEM:
+    return a.reg == b.reg && a.index == b.index &&
+           (a.index < 0 || a.scale == b.scale) && a.imm == b.imm &&
+           a.size == b.size;
+  case ASM_BLOCK:
+    return a.block == b.block;
+  }
+  return false;
+}
+
+asm_cond asm_cond_negate(asm_cond cond) {
+  switch (cond) {
+  case ASM_CC_E:
+    return ASM_CC_NE;
+  case ASM_CC_NE:
+    return ASM_CC_E;
+  case ASM_CC_L:
+    return ASM_CC_GE;
+  case ASM_CC_LE:
+    return ASM_CC_G;
+  case ASM_CC_G:
+    return ASM_CC_LE;
+  case ASM_CC_GE:
+    return ASM_CC_L;
+  }
+  return cond;
+}
+
+void asm_emit(dynamic_array *code, asm_opcode op, asm_operand dst,
+              asm_operand src) {
+  asm_instr instr = {.op = op, .dst = dst, .src = src};
+  dynamic_array_append(code, &instr);
+}
+
+void asm_emit_cond(dynamic_array *code, asm_opcode op, asm_cond cond,
+                   asm_operand dst) {
+  asm_instr instr = {.op = op, .cond = cond, .dst = dst};
+  dynamic_array_append(code, &instr);
+}
+
+void asm_emit_raw(dynamic_array *code, const char *text) {
+  asm_instr instr = {.op = ASM_RAW,
+                     .text = scu_format_string("%s", (char *)text)};
+  dynamic_array_append(code, &instr);
+}
+
+bool asm_is_jump(asm_instr *instr) {
+  return instr->op == ASM_JMP || instr->op == ASM_JCC || instr->op == ASM_RET;
+}
+
+/*
+ * @brief: get the mnemonic of an opcode, without the condition code.
+ */
+static const char *asm_opcode_str(asm_opcode op) {
+  switch (op) {
+  case ASM_MOV:
+    return "mov";
+  case ASM_MOVZX:
+    return "movzx";
+  case ASM_LEA:
+    return "lea";
+  case ASM_XOR:
+    return "xor";
+  case ASM_ADD:
+    return "add";
+  case ASM_SUB:
+    return "sub";
+  case ASM_AND:
+    return "and";
+  case ASM_SHL:
+    return "shl";
+  case ASM_SAR:
+    return "sar";
+  case ASM_SHR:
+    return "shr";
+  case ASM_NEG:
+    return "neg";
+  case ASM_IMUL:
+  case ASM_IMUL_WIDE:
+    return "imul";
+  case ASM_CQO:
+    return "cqo";
+  case ASM_IDIV:
+    return "idiv";
+  case ASM_CMP:
+    return "cmp";
+  case ASM_TEST:
+    return "test";
+  case ASM_SETCC:
+    return "set";
+  case ASM_CMOV:
+    return "cmov";
+  case ASM_JMP:
+    return "jmp";
+  case ASM_JCC:
+    return "j";
+  case ASM_PUSH:
+    return "push";
+  case ASM_POP:
+    return "pop";
+  case ASM_RET:
+    return "ret";
+  default:
+    return "?";
+  }
+}
+
+/*
+ * @brief: get the suffix of a condition code.
+ */
+static const char *asm_cond_str(asm_cond cond) {
+  switch (cond) {
+  case ASM_CC_E:
+    return "e";
+  case ASM_CC_NE:
+    return "ne";
+  case ASM_CC_L:
+    return "l";
+  case ASM_CC_LE:
+    return "le";
+  case ASM_CC_G:
+    return "g";
+  case ASM_CC_GE:
+    return "ge";
+  }
+  return "?";
+}
+
+/*
+ * @brief: print one operand.
+ */
+static void asm_print_operand(asm_operand op) {
+  switch (op.kind) {
+  case ASM_NONE:
+    break;
+
+  case ASM_REG:
+    printf("%s", op.size == 1   ? x86_reg8(op.reg)
+                 : op.size == 4 ? x86_reg32(op.reg)
+                                : x86_reg64(op.reg));
+    break;
+
+  case ASM_IMM:
+    printf("%ld", op.imm);
+    break;
+
+  case ASM_MEM:
+    if (op.size)
+      printf("%s ", op.size == 1   ? "byte"
+                    : op.size == 4 ? "dword"
+                                   : "qword");
+    printf("[%s", x86_reg64(op.reg));
+    if (op.index >= 0)
+      printf(" + %s*%u", x86_reg64(op.index), op.scale);
+    if (op.imm)
+      printf(" %c %ld", op.imm < 0 ? '-' : '+', op.imm < 0 ? -op.imm : op.imm);
+    printf("]");
+    break;
+
+  case ASM_BLOCK:
+    printf(".bb%zu", op.block);
+    break;
+  }
+}
+
+void asm_print(dynamic_array *code) {
+  for (size_t i = 0; i < code->count; i++) {
+    asm_instr *instr = dynamic_array_at(code, i);
+
+    switch (instr->op) {
+    case ASM_NOP:
+      continue;
+    case ASM_LABEL:
+      printf(".bb%zu:\n", instr->dst.block);
+      continue;
+    case ASM_ALIGN:
+      printf("    align %ld\n", instr->dst.imm);
+      continue;
+    case ASM_RAW:
+      printf("    %s\n", instr->text);
+      continue;
+    default:
+      break;
+    }
+
+    printf("    %s", asm_opcode_str(instr->op));
+    if (instr->op == ASM_JCC || instr->op == ASM_SETCC ||
+        instr->op == ASM_CMOV)
+      printf("%s", asm_cond_str(instr->cond));
+
+    if (instr->dst.kind != ASM_NONE) {
+      printf(" ");
+      asm_print_operand(instr->dst);
+    }
+    if (instr->src.kind != ASM_NONE) {
+      printf(", ");
+      asm_print_operand(instr->src);
+    }
+    printf("\n");
+  }
+}
+
+/*
+ * @brief: check whether a value fits a sign extended 8 / 32 bit field.
+ */
+static bool fits_int8(long value) { return value >= -128 && value <= 127; }
+
+static bool fits_int32(long value) {
+  return value >= -2147483648L && value <= 2147483647L;
+}
+
+/*
+ * @brief: get the size of the REX prefix of an instruction: needed for 64
+ * bit operands, for r8-r15, and for the byte registers sil / dil / spl /
+ * bpl.
+ */
+static size_t rex_size(asm_instr *instr, bool default_64) {
+  asm_operand ops[2] = {instr->dst, instr->src};
+  bool rex = false;
+
+  for (int i = 0; i < 2; i++) {
+    asm_operand op = ops[i];
+    if (op.kind == ASM_REG) {
+      rex |= op.reg >= R8;
+      rex |= op.size == 8 && !default_64;
+      rex |= op.size == 1 && op.reg >= RSP && op.reg <= RDI;
+    } else if (op.kind == ASM_MEM) {
+      rex |= op.reg >= R8 || op.index >= R8;
+      rex |= op.size == 8 && !default_64;
+    }
+  }
+  return rex ? 1 : 0;
+}
+
+/*
+ * @brief: get the size of the ModRM byte and what follows it (SIB and
+ * displacement) for a register or memory operand.
+ */
+static size_t modrm_size(asm_operand op) {
+  if (op.kind != ASM_MEM)
+    return 1;
+
+  size_t size = 1;
+  if (op.index >= 0 || op.reg == RSP || op.reg == R12)
+    size++; // <-- SIB
+
+  if (op.imm == 0 && op.reg != RBP && op.reg != R13)
+    return size;
+  return size + (fits_int8(op.imm) ? 1 : 4);
+}
+
+/*
+ * @brief: get the size of an immediate operand of an arithmetic instruction,
+ * which takes a sign extended imm8 when the value fits.
+ */
+static size_t alu_imm_size(asm_operand dst, long imm) {
+  if (fits_int8(imm))
+    return 1;
+  return dst.size == 1 ? 1 : 4;
+}
+
+/*
+ * @brief: estimate the encoded size of one instruction, with short (rel8)
+ * or near (rel32) jumps.
+ */
+static size_t instr_size(asm_instr *instr, bool near) {
+  asm_operand dst = instr->dst;
+  asm_operand src = instr->src;
+  size_t rex = rex_size(instr, false);
+
+  switch (instr->op) {
+  case ASM_NOP:
+  case ASM_LABEL:
+  case ASM_ALIGN:
+  case ASM_RAW:
+    return 0;
+
+  case ASM_MOV:
+    if (src.kind == ASM_IMM) {
+      if (dst.kind == ASM_REG && dst.size == 8 && !fits_int32(src.imm))
+        return 10; // <-- movabs
+      if (dst.kind == ASM_REG && dst.size != 8)
+        return rex + 1 + (dst.size == 1 ? 1 : 4);
+      return rex + 1 + modrm_size(dst) + (dst.size == 1 ? 1 : 4);
+    }
+    return rex + 1 + modrm_size(dst.kind == ASM_MEM ? dst : src);
+
+  case ASM_MOVZX:
+    return rex + 2 + modrm_size(src);
+
+  case ASM_LEA:
+    return rex + 1 + modrm_size(src);
+
+  case ASM_XOR:
+  case ASM_ADD:
+  case ASM_SUB:
+  case ASM_AND:
+  case ASM_CMP:
+    if (src.kind == ASM_IMM) {
+      size_t imm = alu_imm_size(dst, src.imm);
+      if (imm != 1 && dst.kind == ASM_REG && dst.reg == RAX)
+        return rex + 1 + imm; // <-- short form on rax
+      return rex + 1 + modrm_size(dst) + imm;
+    }
+    return rex + 1 + modrm_size(dst.kind == ASM_MEM ? dst : src);
+
+  case ASM_TEST:
+    if (src.kind == ASM_IMM)
+      return rex + 1 + modrm_size(dst) + (dst.size == 1 ? 1 : 4);
+    return rex + 1 + modrm_size(dst);
+
+  case ASM_SHL:
+  case ASM_SAR:
+  case ASM_SHR:
+    return rex + 1 + modrm_size(dst) + (src.imm == 1 ? 0 : 1);
+
+  case ASM_NEG:
+  case ASM_IMUL_WIDE:
+  case ASM_IDIV:
+    return rex + 1 + modrm_size(dst);
+
+  case ASM_IMUL:
+    if (src.kind == ASM_IMM)
+      return rex + 1 + modrm_size(dst) + (fits_int8(src.imm) ? 1 : 4);
+    return rex + 2 + modrm_size(src);
+
+  case ASM_CQO:
+    return 2;
+
+  case ASM_SETCC:
+    return rex + 2 + modrm_size(dst);
+
+  case ASM_CMOV:
+    return rex + 2 + modrm_size(src);
+
+  case ASM_JMP:
+    return near ? 5 : 2;
+
+  case ASM_JCC:
+    return near ? 6 : 2;
+
+  case ASM_PUSH:
+  case ASM_POP:
+    return rex_size(instr, true) + 1;
+
+  case ASM_RET:
+    return 1;
+  }
+  return 0;
+}
+
+size_t asm_code_size(dynamic_array *code) {
+  size_t n = code->count;
+  bool *near = scu_checked_malloc((n + 1) * sizeof(bool));
+  size_t *offset = scu_checked_malloc((n + 1) * sizeof(size_t));
+
+  size_t max_block = 0;
+  for (size_t i = 0; i < n; i++) {
+    asm_instr *instr = dynamic_array_at(code, i);
+    if (instr->op == ASM_LABEL && instr->dst.block > max_block)
+      max_block = instr->dst.block;
+  }
+  size_t *label = scu_checked_malloc((max_block + 1) * sizeof(size_t));
+
+  // start with short jumps and widen the ones that do not reach, like an
+  // assembler does, until nothing changes
+  size_t total = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    total = 0;
+    for (size_t i = 0; i < n; i++) {
+      asm_instr *instr = dynamic_array_at(code, i);
+      if (instr->op == ASM_ALIGN && instr->dst.imm > 0)
+        total += (instr->dst.imm - total % instr->dst.imm) % instr->dst.imm;
+      if (instr->op == ASM_LABEL)
+        label[instr->dst.block] = total;
+      offset[i] = total;
+      total += instr_size(instr, near[i]);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      asm_instr *instr = dynamic_array_at(code, i);
+      if ((instr->op != ASM_JMP && instr->op != ASM_JCC) || near[i] ||
+          instr->dst.kind != ASM_BLOCK || instr->dst.block > max_block)
+        continue;
+
+      long next = (long)(offset[i] + instr_size(instr, false));
+      if (!fits_int8((long)label[instr->dst.block] - next)) {
+        near[i] = true;
+        changed = true;
+      }
+    }
+  }
+
+  free(label);
+  free(offset);
+  free(near);
+  return total;
+}
+
+void asm_free(dynamic_array *code) {
+  for (size_t i = 0; i < code->count; i++) {
+    asm_instr *instr = dynamic_array_at(code, i);
+    if (instr->op == ASM_RAW)
+      free(instr->text);
+  }
+  dynamic_array_free(code);
+}
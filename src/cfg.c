@@ -0,0 +1,524 @@
+#include "cfg.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * @brief: record the predecessors of every block.
+ */
+static void build_preds(ir_program *ir, cfg *g) {
+  g->preds = scu_checked_malloc(g->block_count * sizeof(dynamic_array));
+  for (size_t i = 0; i < g->block_count; i++)
+    dynamic_array_init(&g->preds[i], sizeof(size_t));
+
+  for (size_t i = 0; i < g->block_count; i++) {
+    ir_block *succ[2];
+    size_t count = ir_successors(ir_block_at(ir, i), succ);
+    for (size_t s = 0; s < count; s++)
+      dynamic_array_append(&g->preds[succ[s]->index], &i);
+  }
+}
+
+/*
+ * @brief: number the blocks reachable from the entry in reverse postorder,
+ * with an explicit stack so deep nests do not overflow the C one.
+ */
+static void build_rpo(ir_program *ir, cfg *g) {
+  size_t n = g->block_count;
+  g->rpo = scu_checked_malloc(n * sizeof(size_t));
+  g->rpo_count = 0;
+  if (n == 0)
+    return;
+
+  bool *visited = scu_checked_malloc(n * sizeof(bool));
+  size_t *stack = scu_checked_malloc(n * sizeof(size_t));
+  size_t *next = scu_checked_malloc(n * sizeof(size_t));
+  size_t *post = scu_checked_malloc(n * sizeof(size_t));
+  size_t depth = 0, post_count = 0;
+
+  stack[depth++] = 0;
+  visited[0] = true;
+  while (depth > 0) {
+    size_t b = stack[depth - 1];
+    ir_block *succ[2];
+    size_t count = ir_successors(ir_block_at(ir, b), succ);
+
+    if (next[b] < count) {
+      size_t s = succ[next[b]++]->index;
+      if (!visited[s]) {
+        visited[s] = true;
+        stack[depth++] = s;
+      }
+      continue;
+    }
+
+    post[post_count++] = b;
+    depth--;
+  }
+
+  for (size_t i = 0; i < post_count; i++)
+    g->rpo[i] = post[post_count - 1 - i];
+  g->rpo_count = post_count;
+
+  free(visited);
+  free(stack);
+  free(next);
+  free(post);
+}
+
+/*
+ * @brief: walk two blocks up a dominator (or post-dominator) tree until they
+ * meet.
+ */
+static size_t intersect(const size_t *dom, const size_t *order, size_t a,
+                        size_t b) {
+  while (a != b) {
+    while (order[a] > order[b])
+      a = dom[a];
+    while (order[b] > order[a])
+      b = dom[b];
+  }
+  return a;
+}
+
+/*
+ * @brief: compute the immediate dominators with the iterative algorithm of
+ * Cooper, Harvey and Kennedy, visiting the blocks in reverse postorder.
+ */
+static void build_idom(cfg *g) {
+  size_t n = g->block_count;
+  g->idom = scu_checked_malloc(n * sizeof(size_t));
+  for (size_t i = 0; i < n; i++)
+    g->idom[i] = SIZE_MAX;
+  if (g->rpo_count == 0)
+    return;
+
+  size_t *order = scu_checked_malloc(n * sizeof(size_t));
+  for (size_t i = 0; i < g->rpo_count; i++)
+    order[g->rpo[i]] = i;
+
+  size_t entry = g->rpo[0];
+  g->idom[entry] = entry;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (size_t i = 1; i < g->rpo_count; i++) {
+      size_t b = g->rpo[i];
+      size_t idom = SIZE_MAX;
+
+      for (size_t p = 0; p < g->preds[b].count; p++) {
+        size_t pred;
+        dynamic_array_get(&g->preds[b], p, &pred);
+        if (g->idom[pred] == SIZE_MAX)
+          continue;
+        idom =
+            idom == SIZE_MAX ? pred : intersect(g->idom, order, pred, idom);
+      }
+
+      if (g->idom[b] != idom) {
+        g->idom[b] = idom;
+        changed = true;
+      }
+    }
+  }
+
+  free(order);
+}
+
+/*
+ * @brief: get the successors of a node of the reverse graph, which has an
+ * edge from the virtual exit to every block ending the program.
+ *
+ * @return: array of size_t the caller frees, count in *count.
+ */
+static size_t *reverse_succs(ir_program *ir, cfg *g, size_t node,
+                             size_t *count) {
+  size_t n = g->block_count;
+  if (node != n) {
+    *count = g->preds[node].count;
+    size_t *succ = scu_checked_malloc((*count + 1) * sizeof(size_t));
+    for (size_t p = 0; p < *count; p++)
+      dynamic_array_get(&g->preds[node], p, &succ[p]);
+    return succ;
+  }
+
+  size_t *succ = scu_checked_malloc((n + 1) * sizeof(size_t));
+  *count = 0;
+  for (size_t b = 0; b < n; b++) {
+    ir_block *unused[2];
+    if (ir_successors(ir_block_at(ir, b), unused) == 0)
+      succ[(*count)++] = b;
+  }
+  return succ;
+}
+
+/*
+ * @brief: compute the immediate post-dominators, the dominators of the
+ * reverse graph rooted at a virtual exit (numbered block_count) that every
+ * block without a successor leads to.
+ */
+static void build_ipdom(ir_program *ir, cfg *g) {
+  size_t n = g->block_count;
+  size_t exit = n;
+  g->ipdom = scu_checked_malloc((n + 1) * sizeof(size_t));
+  for (size_t i = 0; i <= n; i++)
+    g->ipdom[i] = SIZE_MAX;
+
+  // postorder of the reverse graph from the exit
+  size_t **succ = scu_checked_malloc((n + 1) * sizeof(size_t *));
+  size_t *succ_count = scu_checked_malloc((n + 1) * sizeof(size_t));
+  for (size_t i = 0; i <= n; i++)
+    succ[i] = reverse_succs(ir, g, i, &succ_count[i]);
+
+  bool *visited = scu_checked_malloc((n + 1) * sizeof(bool));
+  size_t *stack = scu_checked_malloc((n + 1) * sizeof(size_t));
+  size_t *next = scu_checked_malloc((n + 1) * sizeof(size_t));
+  size_t *post = scu_checked_malloc((n + 1) * sizeof(size_t));
+  size_t *order = scu_checked_malloc((n + 1) * sizeof(size_t));
+  size_t depth = 0, post_count = 0;
+
+  stack[depth++] = exit;
+  visited[exit] = true;
+  while (depth > 0) {
+    size_t b = stack[depth - 1];
+    if (next[b] < succ_count[b]) {
+      size_t s = succ[b][next[b]++];
+      if (!visited[s]) {
+        visited[s] = true;
+        stack[depth++] = s;
+      }
+      continue;
+    }
+    order[b] = post_count;
+    post[post_count++] = b;
+    depth--;
+  }
+
+  // reverse postorder: the exit comes first, so order decreases towards it
+  for (size_t i = 0; i < post_count; i++)
+    order[post[i]] = post_count - 1 - order[post[i]];
+  g->ipdom[exit] = exit;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (size_t i = post_count - 1; i-- > 0;) {
+      size_t b = post[i];
+      size_t ipdom = SIZE_MAX;
+
+      // the predecessors in the reverse graph are the successors
+      ir_block *cfg_succ[2];
+      size_t count = ir_successors(ir_block_at(ir, b), cfg_succ);
+      for (size_t s = 0; s <= count; s++) {
+        size_t from = s < count ? cfg_succ[s]->index : exit;
+        if ((s == count && count > 0) || g->ipdom[from] == SIZE_MAX)
+          continue;
+        ipdom = ipdom == SIZE_MAX ? from
+                                  : intersect(g->ipdom, order, from, ipdom);
+      }
+
+      if (g->ipdom[b] != ipdom) {
+        g->ipdom[b] = ipdom;
+        changed = true;
+      }
+    }
+  }
+
+  for (size_t i = 0; i <= n; i++)
+    free(succ[i]);
+  free(succ);
+  free(succ_count);
+  free(visited);
+  free(stack);
+  free(next);
+  free(post);
+  free(order);
+}
+
+/*
+ * @brief: get the loop of a header, creating it if there is none yet.
+ */
+static cfg_loop *loop_for_header(ir_program *ir, cfg *g, size_t header) {
+  for (size_t i = 0; i < g->loops.count; i++) {
+    cfg_loop *loop = cfg_loop_at(g, i);
+    if (loop->header->index == header)
+      return loop;
+  }
+
+  cfg_loop loop = {.header = ir_block_at(ir, header),
+                   .depth = 1,
+                   .parent = SIZE_MAX};
+  bitset_init(&loop.blocks, g->block_count);
+  bitset_set(&loop.blocks, header);
+  dynamic_array_init(&loop.latches, sizeof(size_t));
+  dynamic_array_init(&loop.exits, sizeof(size_t));
+  dynamic_array_append(&g->loops, &loop);
+  return cfg_loop_at(g, g->loops.count - 1);
+}
+
+/*
+ * @brief: add the back edge latch -> header to its loop: every block that
+ * reaches the latch without going through the header is in the loop.
+ */
+static void add_back_edge(ir_program *ir, cfg *g, size_t latch, size_t header) {
+  cfg_loop *loop = loop_for_header(ir, g, header);
+  dynamic_array_append(&loop->latches, &latch);
+
+  dynamic_array work;
+  dynamic_array_init(&work, sizeof(size_t));
+  if (!bitset_test(&loop->blocks, latch)) {
+    bitset_set(&loop->blocks, latch);
+    dynamic_array_append(&work, &latch);
+  }
+
+  while (work.count > 0) {
+    size_t b;
+    dynamic_array_pop(&work, &b);
+    for (size_t p = 0; p < g->preds[b].count; p++) {
+      size_t pred;
+      dynamic_array_get(&g->preds[b], p, &pred);
+      if (!cfg_reachable(g, pred) || bitset_test(&loop->blocks, pred))
+        continue;
+      bitset_set(&loop->blocks, pred);
+      dynamic_array_append(&work, &pred);
+    }
+  }
+
+  dynamic_array_free(&work);
+}
+
+/*
+ * @brief: order loops deepest first.
+ */
+static int compare_depth(const void *a, const void *b) {
+  const cfg_loop *la = a;
+  const cfg_loop *lb = b;
+  if (la->depth != lb->depth)
+    return la->depth < lb->depth ? 1 : -1;
+  return la->header->index < lb->header->index ? -1 : 1;
+}
+
+/*
+ * @brief: find the natural loops, their exits and how they nest.
+ */
+static void build_loops(ir_program *ir, cfg *g) {
+  dynamic_array_init(&g->loops, sizeof(cfg_loop));
+
+  for (size_t i = 0; i < g->rpo_count; i++) {
+    size_t b = g->rpo[i];
+    ir_block *succ[2];
+    size_t count = ir_successors(ir_block_at(ir, b), succ);
+    for (size_t s = 0; s < count; s++)
+      if (cfg_dominates(g, succ[s]->index, b))
+        add_back_edge(ir, g, b, succ[s]->index);
+  }
+
+  for (size_t i = 0; i < g->loops.count; i++) {
+    cfg_loop *loop = cfg_loop_at(g, i);
+
+    for (size_t b = 0; b < g->block_count; b++) {
+      if (!bitset_test(&loop->blocks, b))
+        continue;
+      ir_block *succ[2];
+      size_t count = ir_successors(ir_block_at(ir, b), succ);
+      for (size_t s = 0; s < count; s++) {
+        if (!bitset_test(&loop->blocks, succ[s]->index)) {
+          dynamic_array_append(&loop->exits, &b);
+          break;
+        }
+      }
+    }
+
+    for (size_t j = 0; j < g->loops.count; j++)
+      if (j != i &&
+          bitset_test(&cfg_loop_at(g, j)->blocks, loop->header->index))
+        loop->depth++;
+  }
+
+  qsort(g->loops.items, g->loops.count, sizeof(cfg_loop), compare_depth);
+
+  // the parent is the deepest other loop containing the header, which
+  // comes after the loop once they are sorted
+  for (size_t i = 0; i < g->loops.count; i++) {
+    cfg_loop *loop = cfg_loop_at(g, i);
+    for (size_t j = i + 1; j < g->loops.count; j++) {
+      cfg_loop *outer = cfg_loop_at(g, j);
+      if (outer->depth < loop->depth &&
+          bitset_test(&outer->blocks, loop->header->index)) {
+        loop->parent = j;
+        break;
+      }
+    }
+  }
+
+  // deepest first, so the first loop holding a block is its innermost one
+  g->loop_of = scu_checked_malloc((g->block_count + 1) * sizeof(size_t));
+  for (size_t b = 0; b < g->block_count; b++) {
+    g->loop_of[b] = SIZE_MAX;
+    for (size_t i = 0; i < g->loops.count; i++) {
+      if (bitset_test(&cfg_loop_at(g, i)->blocks, b)) {
+        g->loop_of[b] = i;
+        break;
+      }
+    }
+  }
+}
+
+void cfg_build(ir_program *ir, cfg *g) {
+  ir_renumber(ir);
+  g->block_count = ir->blocks.count;
+
+  build_preds(ir, g);
+  build_rpo(ir, g);
+  build_idom(g);
+  build_ipdom(ir, g);
+  build_loops(ir, g);
+}
+
+void cfg_free(cfg *g) {
+  for (size_t i = 0; i < g->block_count; i++)
+    dynamic_array_free(&g->preds[i]);
+  free(g->preds);
+  free(g->idom);
+  free(g->ipdom);
+  free(g->rpo);
+  free(g->loop_of);
+
+  for (size_t i = 0; i < g->loops.count; i++) {
+    cfg_loop *loop = cfg_loop_at(g, i);
+    bitset_free(&loop->blocks);
+    dynamic_array_free(&loop->latches);
+    dynamic_array_free(&loop->exits);
+  }
+  dynamic_array_free(&g->loops);
+  g->block_count = 0;
+}
+
+bool cfg_reachable(cfg *g, size_t block) {
+  return g->idom[block] != SIZE_MAX;
+}
+
+bool cfg_dominates(cfg *g, size_t a, size_t b) {
+  if (!cfg_reachable(g, a) || !cfg_reachable(g, b))
+    return false;
+
+  while (b != a) {
+    size_t up = g->idom[b];
+    if (up == b)
+      return false;
+    b = up;
+  }
+  return true;
+}
+
+cfg_loop *cfg_loop_at(cfg *g, size_t index) {
+  return dynamic_array_at(&g->loops, index);
+}
+
+bool cfg_post_dominates(cfg *g, size_t a, size_t b) {
+  if (g->ipdom[a] == SIZE_MAX || g->ipdom[b] == SIZE_MAX)
+    return false;
+
+  while (b != a) {
+    size_t up = g->ipdom[b];
+    if (up == b)
+      return false;
+    b = up;
+  }
+  return true;
+}
+
+size_t cfg_loop_depth(cfg *g, size_t block) {
+  if (g->loop_of[block] == SIZE_MAX)
+    return 0;
+  return cfg_loop_at(g, g->loop_of[block])->depth;
+}
+
+/*
+ * @brief: print the name of a block in a dot label: its id, like ir_print,
+ * or exit for the virtual exit.
+ */
+static void dot_block_name(ir_program *ir, cfg *g, size_t block) {
+  if (block == g->block_count)
+    printf("exit");
+  else if (block == SIZE_MAX)
+    printf("-");
+  else
+    printf("bb%zu", ir_block_at(ir, block)->id);
+}
+
+/*
+ * @brief: print the node of one block.
+ */
+static void dot_node(ir_program *ir, cfg *g, size_t b, int indent) {
+  ir_block *block = ir_block_at(ir, b);
+
+  printf("%*sbb%zu [label=\"bb%zu", indent, "", block->id, block->id);
+  if (block->label)
+    printf(" .%s", block->label);
+  printf("\\n%zu instrs\\nidom ", block->instrs.count);
+  dot_block_name(ir, g, g->idom[b]);
+  printf(", ipdom ");
+  dot_block_name(ir, g, g->ipdom[b]);
+  printf("\"");
+  if (!cfg_reachable(g, b))
+    printf(", style=dashed, color=gray");
+  printf("];\n");
+}
+
+/*
+ * @brief: print the cluster of a loop, with its own blocks and the clusters
+ * of the loops nested in it.
+ */
+static void dot_loop(ir_program *ir, cfg *g, size_t index, int indent) {
+  cfg_loop *loop = cfg_loop_at(g, index);
+
+  printf("%*ssubgraph cluster_loop%zu {\n", indent, "", index);
+  printf("%*slabel=\"loop bb%zu, depth %zu\";\n", indent + 2, "",
+         loop->header->id, loop->depth);
+  for (size_t b = 0; b < g->block_count; b++)
+    if (g->loop_of[b] == index)
+      dot_node(ir, g, b, indent + 2);
+  for (size_t i = 0; i < g->loops.count; i++)
+    if (cfg_loop_at(g, i)->parent == index)
+      dot_loop(ir, g, i, indent + 2);
+  printf("%*s}\n", indent, "");
+}
+
+void cfg_print_dot(ir_program *ir, cfg *g) {
+  printf("digraph cfg {\n");
+  printf("  node [shape=box, fontname=monospace];\n");
+
+  for (size_t b = 0; b < g->block_count; b++)
+    if (g->loop_of[b] == SIZE_MAX)
+      dot_node(ir, g, b, 2);
+  for (size_t i = 0; i < g->loops.count; i++)
+    if (cfg_loop_at(g, i)->parent == SIZE_MAX)
+      dot_loop(ir, g, i, 2);
+
+  for (size_t b = 0; b < g->block_count; b++) {
+    ir_block *block = ir_block_at(ir, b);
+    ir_instr *term = ir_terminator(block);
+    ir_block *succ[2];
+    size_t count = ir_successors(block, succ);
+
+    for (size_t s = 0; s < count; s++) {
+      printf("  bb%zu -> bb%zu [", block->id, succ[s]->id);
+      if (count == 2)
+        printf("label=\"%s\"", succ[s] == term->target ? "T" : "F");
+      if (cfg_dominates(g, succ[s]->index, b))
+        printf("%sstyle=bold, color=blue", count == 2 ? ", " : "");
+      printf("];\n");
+    }
+  }
+
+  printf("}\n");
+}
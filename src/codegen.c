@@ -1,481 +1,1177 @@
 #include "codegen.h"
-#include "ast.h"
+#include "asm.h"
+#include "cfg.h"
+#include "ds/bitset.h"
 #include "ds/dynamic_array.h"
-#include "ds/ht.h"
-#include "ds/stack.h"
 #include "fasm.h"
+#include "ir.h"
+#include "opt/peephole.h"
+#include "profile.h"
 #include "utils.h"
+#include "x86.h"
 
+#include <inttypes.h>
+#include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 
 /*
- * @brief: generate assembly for arithmetic expressions. (declaration)
+ * @struct codegen: state of the IR -> x86 lowering.
+ */
+typedef struct codegen {
+  ir_program *ir;
+  dynamic_array code;  // <-- asm_instr
+  dynamic_array stubs; // <-- asm_instr, the stubs of counted branches,
+                       //     emitted after the blocks
+  size_t stub_count;
+} codegen;
+
+/*
+ * @brief: get the register an operand lives in.
  *
- * @param expr: pointer to an expr_node.
- * @param variables: hash table of variables.
- * @param errors: counter variable to increment when an error is encountered.
+ * @return: the register, -1 for immediates and spilled vregs.
+ */
+static int operand_reg(codegen *cg, ir_operand op) {
+  if (op.kind != IR_OPERAND_VREG)
+    return -1;
+  return ir_vreg_at(cg->ir, op.vreg)->reg;
+}
+
+/*
+ * @brief: check whether an operand is a vreg that lives in the frame.
  */
-static void expr_asm(expr_node *expr, ht *variables, program_node *program,
-                     unsigned int *errors);
+static bool operand_in_memory(codegen *cg, ir_operand op) {
+  return op.kind == IR_OPERAND_VREG && operand_reg(cg, op) < 0;
+}
 
-int evaluate_const_expr(expr_node *expr, unsigned int *errors) {
-  if (expr == NULL) {
-    return 0;
+/*
+ * @brief: get the frame slot of a variable.
+ */
+static asm_operand variable_slot(variable *var) {
+  return asm_mem(RBP, -1, 0, -(long)var->stack_offset, 8);
+}
+
+/*
+ * @brief: convert an IR operand to the source of a two operand instruction:
+ * register, immediate or qword frame slot.
+ */
+static asm_operand operand_asm(codegen *cg, ir_operand op) {
+  int reg = operand_reg(cg, op);
+
+  if (op.kind == IR_OPERAND_IMM)
+    return asm_imm(op.imm);
+  if (reg >= 0)
+    return asm_reg(reg, 8);
+  return asm_mem(RBP, -1, 0, -(long)ir_vreg_at(cg->ir, op.vreg)->stack_offset,
+                 8);
+}
+
+/*
+ * @brief: load an operand into a register (nothing if it already is there).
+ */
+static void move_to_reg(codegen *cg, ir_operand op, x86_reg reg) {
+  if (operand_reg(cg, op) == (int)reg)
+    return;
+  asm_emit(&cg->code, ASM_MOV, asm_reg(reg, 8), operand_asm(cg, op));
+}
+
+/*
+ * @brief: register the result of instr should be computed into: the one of
+ * its destination, or scratch if the destination is spilled.
+ */
+static x86_reg result_reg(codegen *cg, ir_instr *instr, x86_reg scratch) {
+  int reg = operand_reg(cg, instr->dst);
+  return reg >= 0 ? (x86_reg)reg : scratch;
+}
+
+/*
+ * @brief: write a computed result to the destination of instr.
+ */
+static void store_result(codegen *cg, ir_instr *instr, x86_reg from) {
+  if (operand_reg(cg, instr->dst) == (int)from)
+    return;
+  asm_emit(&cg->code, ASM_MOV, operand_asm(cg, instr->dst), asm_reg(from, 8));
+}
+
+/*
+ * @brief: get the address of an array element. A spilled index is loaded
+ * into scratch first.
+ */
+static asm_operand element_asm(codegen *cg, ir_instr *instr, x86_reg scratch) {
+  long base = -(long)instr->var->stack_offset;
+  ir_operand index = instr->a;
+
+  if (index.kind == IR_OPERAND_IMM)
+    return asm_mem(RBP, -1, 0, base + index.imm * 4, 4);
+
+  int reg = operand_reg(cg, index);
+  if (reg < 0) {
+    move_to_reg(cg, index, scratch);
+    reg = scratch;
   }
+  return asm_mem(RBP, reg, 4, base, 4);
+}
 
-  switch (expr->kind) {
-  case EXPR_TERM:
-    if (expr->term.kind == TERM_INT) {
-      return expr->term.value.integer;
-    }
-    scu_perror(errors, "Array size must be a constant expression\n");
-    return 0;
-
-  case EXPR_ADD:
-    return evaluate_const_expr(expr->binary.left, errors) +
-           evaluate_const_expr(expr->binary.right, errors);
-
-  case EXPR_SUBTRACT:
-    return evaluate_const_expr(expr->binary.left, errors) -
-           evaluate_const_expr(expr->binary.right, errors);
-
-  case EXPR_MULTIPLY:
-    return evaluate_const_expr(expr->binary.left, errors) *
-           evaluate_const_expr(expr->binary.right, errors);
-
-  case EXPR_DIVIDE: {
-    int right = evaluate_const_expr(expr->binary.right, errors);
-    if (right == 0) {
-      scu_perror(errors, "Division by zero in array size\n");
-      return 0;
-    }
-    return evaluate_const_expr(expr->binary.left, errors) / right;
+/*
+ * @brief: get the jcc / setcc condition of a relational operator.
+ */
+static asm_cond rel_cond(rel_kind rel) {
+  switch (rel) {
+  case REL_IS_EQUAL:
+    return ASM_CC_E;
+  case REL_NOT_EQUAL:
+    return ASM_CC_NE;
+  case REL_LESS_THAN:
+    return ASM_CC_L;
+  case REL_LESS_THAN_OR_EQUAL:
+    return ASM_CC_LE;
+  case REL_GREATER_THAN:
+    return ASM_CC_G;
+  case REL_GREATER_THAN_OR_EQUAL:
+    return ASM_CC_GE;
   }
+  return ASM_CC_E;
+}
 
-  case EXPR_MODULO: {
-    int right = evaluate_const_expr(expr->binary.right, errors);
-    if (right == 0) {
-      scu_perror(errors, "Division by zero in array size\n");
-      return 0;
-    }
-    return evaluate_const_expr(expr->binary.left, errors) % right;
+/*
+ * @brief: check whether an operand is an immediate cmp can encode (a sign
+ * extended imm32).
+ */
+static bool is_imm32(ir_operand op) {
+  return op.kind == IR_OPERAND_IMM && op.imm >= INT32_MIN &&
+         op.imm <= INT32_MAX;
+}
+
+/*
+ * @brief: get the x86 opcode of a two operand IR instruction.
+ */
+static asm_opcode arith_opcode(ir_opcode op) {
+  switch (op) {
+  case IR_ADD:
+    return ASM_ADD;
+  case IR_SUB:
+    return ASM_SUB;
+  case IR_AND:
+    return ASM_AND;
+  case IR_SHL:
+    return ASM_SHL;
+  case IR_SAR:
+    return ASM_SAR;
+  case IR_SHR:
+    return ASM_SHR;
+  default:
+    return ASM_IMUL;
   }
+}
+
+/*
+ * @brief: emit x * 3, x * 5 and x * 9 as lea r, [x + x*2 / 4 / 8].
+ */
+static void lea_multiply_asm(codegen *cg, ir_instr *instr) {
+  x86_reg reg = result_reg(cg, instr, RAX);
+  int src = operand_reg(cg, instr->a);
+  if (src < 0) {
+    move_to_reg(cg, instr->a, reg);
+    src = reg;
   }
+  asm_emit(&cg->code, ASM_LEA, asm_reg(reg, 8),
+           asm_mem(src, src, instr->b.imm - 1, 0, 0));
+  store_result(cg, instr, reg);
 }
 
 /*
- * @brief: get array size from declare_array_node
- *
- * @param node: pointer to declare_array_node
- * @param errors: counter variable to increment when an error is encountered.
- *
- * @return: size of the array in elements
+ * @brief: emit add / sub / and / shifts / imul. 0 - x becomes neg.
  */
-static int get_array_size_declare(declare_array_node *node,
-                                  unsigned int *errors) {
-  if (node == NULL || node->size_expr == NULL) {
-    return 0;
+static void arith_asm(codegen *cg, ir_instr *instr) {
+  asm_opcode op = arith_opcode(instr->op);
+  ir_operand a = instr->a;
+  ir_operand b = instr->b;
+  x86_reg reg = result_reg(cg, instr, RAX);
+
+  if (instr->op == IR_MUL && a.kind != IR_OPERAND_IMM &&
+      b.kind == IR_OPERAND_IMM && (b.imm == 3 || b.imm == 5 || b.imm == 9)) {
+    lea_multiply_asm(cg, instr);
+    return;
+  }
+
+  if (instr->op == IR_SUB && a.kind == IR_OPERAND_IMM && a.imm == 0) {
+    move_to_reg(cg, b, reg);
+    asm_emit(&cg->code, ASM_NEG, asm_reg(reg, 8), (asm_operand){0});
+    store_result(cg, instr, reg);
+    return;
+  }
+
+  // the destination shares a register with b: either swap (commutative) or
+  // compute in rax so b is not overwritten before it is read.
+  if (operand_reg(cg, b) == (int)reg && operand_reg(cg, a) != (int)reg) {
+    if (instr->op != IR_SUB) {
+      ir_operand tmp = a;
+      a = b;
+      b = tmp;
+    } else {
+      reg = RAX;
+    }
   }
-  return evaluate_const_expr(node->size_expr, errors);
+
+  move_to_reg(cg, a, reg);
+  asm_emit(&cg->code, op, asm_reg(reg, 8), operand_asm(cg, b));
+  store_result(cg, instr, reg);
 }
 
 /*
- * @brief: get array size from initialize_array_node
- *
- * @param node: pointer to initialize_array_node
- * @param errors: counter variable to increment when an error is encountered.
+ * @brief: emit idiv, the dividend goes in rdx:rax, quotient comes back in rax
+ * and the remainder in rdx. The allocator already moved immediate divisors
+ * to a register and kept rdx free of anything live across the division.
+ */
+static void div_asm(codegen *cg, ir_instr *instr) {
+  move_to_reg(cg, instr->a, RAX);
+  asm_emit(&cg->code, ASM_CQO, (asm_operand){0}, (asm_operand){0});
+  asm_emit(&cg->code, ASM_IDIV, operand_asm(cg, instr->b), (asm_operand){0});
+  store_result(cg, instr, instr->op == IR_DIV ? RAX : RDX);
+}
+
+/*
+ * @brief: emit the one operand imul of a multiply-high, the high half of the
+ * product lands in rdx. Immediates were moved to a register by the
+ * allocator.
+ */
+static void mulhi_asm(codegen *cg, ir_instr *instr) {
+  move_to_reg(cg, instr->a, RAX);
+  asm_emit(&cg->code, ASM_IMUL_WIDE, operand_asm(cg, instr->b),
+           (asm_operand){0});
+  store_result(cg, instr, RDX);
+}
+
+/*
+ * @brief: set the flags for "a rel b" (at most one operand is an immediate).
+ * Registers, frame slots and imm32 values are used in place.
  *
- * @return: size of the array in elements
+ * @return: the operator to test the flags with, rel itself or its mirror
+ * when the operands had to be swapped.
  */
-static int get_array_size_initialize(initialize_array_node *node,
-                                     unsigned int *errors) {
-  if (node == NULL || node->size_expr == NULL) {
-    return 0;
+static rel_kind compare_asm(codegen *cg, ir_operand a, ir_operand b,
+                            rel_kind rel) {
+  // cmp never takes an immediate on the left
+  if (a.kind == IR_OPERAND_IMM) {
+    ir_operand tmp = a;
+    a = b;
+    b = tmp;
+    rel = ir_rel_swap(rel);
   }
-  return evaluate_const_expr(node->size_expr, errors);
+
+  asm_operand lhs = operand_asm(cg, a);
+  asm_operand rhs = operand_asm(cg, b);
+
+  // wide immediates need a register, and cmp takes one memory operand
+  if (b.kind == IR_OPERAND_IMM && !is_imm32(b)) {
+    move_to_reg(cg, b, RAX);
+    rhs = asm_reg(RAX, 8);
+  } else if (operand_in_memory(cg, a) && operand_in_memory(cg, b)) {
+    move_to_reg(cg, a, RAX);
+    lhs = asm_reg(RAX, 8);
+  }
+
+  asm_emit(&cg->code, ASM_CMP, lhs, rhs);
+  return rel;
 }
 
 /*
- * @brief: get the absolute stack offset for an array
+ * @brief: append one line of vector code. There is no asm_opcode for
+ * vector instructions: they only show up in loops the vectorizer built, and
+ * the peephole pass leaves raw lines alone.
  */
-static size_t get_array_base_offset(program_node *program, variable *array_var,
-                                    ht *variables, unsigned int *errors) {
-  size_t offset = variables->count * 8;
+static void vec_emit(codegen *cg, char *format, ...) {
+  char text[128];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  asm_emit_raw(&cg->code, text);
+}
 
-  for (unsigned int i = 0; i < program->instrs.count; i++) {
-    instr_node instr;
-    dynamic_array_get(&program->instrs, i, &instr);
+/*
+ * @brief: get the name of a vector operand (or of a scratch register when
+ * op is not one), xmm or ymm after the lanes of instr.
+ */
+static const char *vec_reg(ir_instr *instr, ir_operand op) {
+  return x86_vec(op.vec, instr->lanes);
+}
 
-    if (instr.kind == INSTR_DECLARE_ARRAY) {
-      if (strcmp(instr.declare_array.var.name, array_var->name) == 0) {
-        int size = get_array_size_declare(&instr.declare_array, errors);
-        return offset + (size * 4);
-      }
-      int size = get_array_size_declare(&instr.declare_array, errors);
-      offset += size * 4;
-    } else if (instr.kind == INSTR_INITIALIZE_ARRAY) {
-      if (strcmp(instr.initialize_array.var.name, array_var->name) == 0) {
-        int size = get_array_size_initialize(&instr.initialize_array, errors);
-        return offset + (size * 4);
-      }
-      int size = get_array_size_initialize(&instr.initialize_array, errors);
-      offset += size * 4;
-    }
+static const char *vec_scratch(ir_instr *instr, unsigned int reg) {
+  return x86_vec(reg, instr->lanes);
+}
+
+/*
+ * @brief: get the address of lanes elements of an array starting at the
+ * index in a. A spilled index is loaded into rax first.
+ */
+static void vec_element(codegen *cg, ir_instr *instr, char *out, size_t len) {
+  int reg = operand_reg(cg, instr->a);
+  if (reg < 0) {
+    move_to_reg(cg, instr->a, RAX);
+    reg = RAX;
   }
-  return offset;
+  snprintf(out, len, "[rbp + %s*4 - %zu]", x86_reg64(reg),
+           instr->var->stack_offset);
 }
 
 /*
- * @brief: generate assembly for terms.
- *
- * @param term: pointer to a term_node.
- * @param variables: hash table of variables.
- * @param errors: counter variable to increment when an error is encountered.
- */
-static void term_asm(term_node *term, ht *variables, program_node *program,
-                     unsigned int *errors) {
-  switch (term->kind) {
-  case TERM_INT:
-    printf("    mov rax, %d\n", term->value.integer);
-    break;
-  case TERM_CHAR: {
-    printf("    mov rax, %d\n", term->value.character);
-    break;
+ * @brief: get the mnemonic of a lane by lane vector instruction, without
+ * the v prefix of its AVX form.
+ */
+static const char *vec_mnemonic(ir_opcode op) {
+  switch (op) {
+  case IR_VADD:
+    return "paddd";
+  case IR_VSUB:
+    return "psubd";
+  case IR_VMUL:
+    return "pmulld";
+  case IR_VAND:
+    return "pand";
+  case IR_VANDN:
+    return "pandn";
+  case IR_VOR:
+    return "por";
+  case IR_VXOR:
+    return "pxor";
+  case IR_VSHL:
+    return "pslld";
+  case IR_VSHR:
+    return "psrld";
+  case IR_VCMPEQ:
+    return "pcmpeqd";
+  case IR_VCMPGT:
+    return "pcmpgtd";
+  case IR_VMAXU:
+    return "pmaxud";
+  case IR_VMINU:
+    return "pminud";
+  default:
+    return "?";
   }
-  case TERM_IDENTIFIER: {
-    int index = get_var_stack_offset(variables, &term->identifier, NULL);
-    if (term->identifier.is_array)
-      printf("    lea rax, [rbp - %d]\n", index * 8 + 8);
-    else
-      printf("    mov rax, qword [rbp - %d]\n", index * 8 + 8);
-    break;
+}
+
+/*
+ * @brief: emit dst = a op b. AVX has a three operand form, SSE2 overwrites
+ * its first operand so a is copied to dst first (through a scratch
+ * register when dst is b and op does not commute).
+ */
+static void vec_binary_asm(codegen *cg, ir_instr *instr) {
+  const char *op = vec_mnemonic(instr->op);
+  const char *d = vec_reg(instr, instr->dst);
+  const char *a = vec_reg(instr, instr->a);
+  bool shift = instr->op == IR_VSHL || instr->op == IR_VSHR;
+
+  char b[32];
+  if (shift)
+    snprintf(b, sizeof(b), "%ld", instr->b.imm);
+  else
+    snprintf(b, sizeof(b), "%s", vec_reg(instr, instr->b));
+
+  if (instr->lanes == 8) {
+    vec_emit(cg, "v%s %s, %s, %s", op, d, a, b);
+    return;
   }
-  case TERM_POINTER:
-    break;
-  case TERM_DEREF: {
-    int index = get_var_stack_offset(variables, &term->identifier, NULL);
-    printf("    mov rbx, qword [rbp - %d]\n", index * 8 + 8);
-    printf("    mov rax, qword [rbx]\n");
-    break;
+
+  bool commutes = instr->op != IR_VSUB && instr->op != IR_VANDN &&
+                  instr->op != IR_VCMPGT && !shift;
+  if (instr->dst.vec == instr->a.vec) {
+    vec_emit(cg, "%s %s, %s", op, d, b);
+  } else if (!shift && instr->dst.vec == instr->b.vec) {
+    if (commutes) {
+      vec_emit(cg, "%s %s, %s", op, d, a);
+    } else {
+      const char *t = vec_scratch(instr, 15);
+      vec_emit(cg, "movdqa %s, %s", t, a);
+      vec_emit(cg, "%s %s, %s", op, t, b);
+      vec_emit(cg, "movdqa %s, %s", d, t);
+    }
+  } else {
+    vec_emit(cg, "movdqa %s, %s", d, a);
+    vec_emit(cg, "%s %s, %s", op, d, b);
   }
-  case TERM_ADDOF: {
-    int index = get_var_stack_offset(variables, &term->identifier, NULL);
-    printf("    lea rax, [rbp - %d]\n", index * 8 + 8);
-    break;
+}
+
+/*
+ * @brief: emit a lane by lane 32 bit multiply. SSE2 has no pmulld: the
+ * even and the odd lanes are multiplied to 64 bits with pmuludq and the low
+ * halves of the products put back together.
+ */
+static void vec_mul_asm(codegen *cg, ir_instr *instr) {
+  if (instr->lanes == 8) {
+    vec_binary_asm(cg, instr);
+    return;
   }
 
-  case TERM_ARRAY_ACCESS: {
-    size_t array_base = get_array_base_offset(
-        program, &term->array_access.array_var, variables, errors);
-    expr_asm(term->array_access.index_expr, variables, program, errors);
-    printf("    cdqe\n");
-    printf("    lea rdx, [rbp - %zu]\n", array_base);
-    printf("    mov eax, dword [rdx + rax*4]\n");
-    break;
+  const char *a = vec_reg(instr, instr->a);
+  const char *b = vec_reg(instr, instr->b);
+  vec_emit(cg, "movdqa xmm15, %s", a);
+  vec_emit(cg, "pmuludq xmm15, %s", b);
+  vec_emit(cg, "movdqa xmm14, %s", a);
+  vec_emit(cg, "psrlq xmm14, 32");
+  vec_emit(cg, "movdqa xmm13, %s", b);
+  vec_emit(cg, "psrlq xmm13, 32");
+  vec_emit(cg, "pmuludq xmm14, xmm13");
+  vec_emit(cg, "pshufd xmm15, xmm15, 8");
+  vec_emit(cg, "pshufd xmm14, xmm14, 8");
+  vec_emit(cg, "punpckldq xmm15, xmm14");
+  vec_emit(cg, "movdqa %s, xmm15", vec_reg(instr, instr->dst));
+}
+
+/*
+ * @brief: emit dst = a in every lane, from a register, a frame slot or an
+ * immediate (through eax).
+ */
+static void vec_splat_asm(codegen *cg, ir_instr *instr) {
+  const char *d = vec_reg(instr, instr->dst);
+  const char *x = x86_vec(instr->dst.vec, 4);
+  const char *mov = instr->lanes == 8 ? "vmovd" : "movd";
+
+  if (instr->a.kind == IR_OPERAND_IMM) {
+    vec_emit(cg, "mov eax, %lu", (unsigned long)instr->a.imm & 0xffffffffUL);
+    vec_emit(cg, "%s %s, eax", mov, x);
+  } else if (operand_reg(cg, instr->a) >= 0) {
+    vec_emit(cg, "%s %s, %s", mov, x,
+             x86_reg32(operand_reg(cg, instr->a)));
+  } else {
+    vec_emit(cg, "%s %s, dword [rbp - %zu]", mov, x,
+             ir_vreg_at(cg->ir, instr->a.vreg)->stack_offset);
   }
 
-  case TERM_ARRAY_LITERAL: {
-    // nothing here cuz its done at initialization itself
-    break;
+  if (instr->lanes == 8)
+    vec_emit(cg, "vpbroadcastd %s, %s", d, x);
+  else
+    vec_emit(cg, "pshufd %s, %s, 0", d, d);
+}
+
+/*
+ * @brief: emit dst = a + the lanes of b zero extended to 64 bits. The low
+ * and high lanes of b are widened and added together first (each sum fits
+ * 33 bits), then added to the 64 bit lanes of a.
+ */
+static void vec_sumq_asm(codegen *cg, ir_instr *instr) {
+  const char *d = vec_reg(instr, instr->dst);
+  const char *a = vec_reg(instr, instr->a);
+  const char *b = vec_reg(instr, instr->b);
+
+  if (instr->lanes == 8) {
+    vec_emit(cg, "vpmovzxdq ymm15, %s", x86_vec(instr->b.vec, 4));
+    vec_emit(cg, "vextracti128 xmm14, %s, 1", b);
+    vec_emit(cg, "vpmovzxdq ymm14, xmm14");
+    vec_emit(cg, "vpaddq ymm15, ymm15, ymm14");
+    vec_emit(cg, "vpaddq %s, %s, ymm15", d, a);
+    return;
   }
+
+  vec_emit(cg, "pxor xmm14, xmm14");
+  vec_emit(cg, "movdqa xmm15, %s", b);
+  vec_emit(cg, "punpckhdq xmm15, xmm14");
+  vec_emit(cg, "movdqa xmm13, %s", b);
+  vec_emit(cg, "punpckldq xmm13, xmm14");
+  vec_emit(cg, "paddq xmm15, xmm13");
+  if (instr->dst.vec != instr->a.vec)
+    vec_emit(cg, "movdqa %s, %s", d, a);
+  vec_emit(cg, "paddq %s, xmm15", d);
+}
+
+/*
+ * @brief: emit one step of an unsigned min / max reduction on SSE2, which
+ * has neither pmaxud nor pminud: xmm15 = xmm15 op xmm14, both biased by
+ * 0x80000000 so the signed pcmpgtd orders them as unsigned numbers.
+ */
+static void vec_reduce_step_asm(codegen *cg, bool max) {
+  if (max) {
+    vec_emit(cg, "movdqa xmm12, xmm15");
+    vec_emit(cg, "pcmpgtd xmm12, xmm14");
+  } else {
+    vec_emit(cg, "movdqa xmm12, xmm14");
+    vec_emit(cg, "pcmpgtd xmm12, xmm15");
   }
+  vec_emit(cg, "pand xmm15, xmm12");
+  vec_emit(cg, "pandn xmm12, xmm14");
+  vec_emit(cg, "por xmm15, xmm12");
 }
 
 /*
- * @brief: generate assembly for arithmetic expressions. (definition)
- *
- * @param expr: pointer to an expr_node.
- * @param variables: hash table of variables.
- * @param errors: counter variable to increment when an error is encountered.
- */
-static void expr_asm(expr_node *expr, ht *variables, program_node *program,
-                     unsigned int *errors) {
-  switch (expr->kind) {
-  case EXPR_TERM:
-    term_asm(&expr->term, variables, program, errors);
-    break;
-  case EXPR_ADD:
-    expr_asm(expr->binary.left, variables, program, errors);
-    printf("    push rax\n");
-    expr_asm(expr->binary.right, variables, program, errors);
-    printf("    pop rdx\n");
-    printf("    add rax, rdx\n");
-    break;
-  case EXPR_SUBTRACT:
-    expr_asm(expr->binary.left, variables, program, errors);
-    printf("    push rax\n");
-    expr_asm(expr->binary.right, variables, program, errors);
-    printf("    mov rdx, rax\n");
-    printf("    pop rax\n");
-    printf("    sub rax, rdx\n");
-    break;
-  case EXPR_MULTIPLY:
-    expr_asm(expr->binary.left, variables, program, errors);
-    printf("    push rax\n");
-    expr_asm(expr->binary.right, variables, program, errors);
-    printf("    pop rdx\n");
-    printf("    imul rax, rdx\n");
-    break;
-  case EXPR_DIVIDE:
-  case EXPR_MODULO:
-    expr_asm(expr->binary.left, variables, program, errors);
-    printf("    push rax\n");
-    expr_asm(expr->binary.right, variables, program, errors);
-    printf("    mov rcx, rax\n");
-    printf("    pop rax\n");
-    printf("    cqo\n");
-    printf("    idiv rcx\n");
-    if (expr->kind == EXPR_MODULO) {
-      printf("    mov rax, rdx\n");
+ * @brief: emit dst = the sum of the 64 bit lanes, or the unsigned max / min
+ * of the 32 bit lanes of a, halving the lanes until one is left.
+ */
+static void vec_reduce_asm(codegen *cg, ir_instr *instr) {
+  const char *a = vec_reg(instr, instr->a);
+  x86_reg reg = result_reg(cg, instr, RAX);
+  bool sum = instr->op == IR_VHSUM;
+  const char *op = sum                          ? "paddq"
+                   : instr->op == IR_VHMAXU ? "pmaxud"
+                                                : "pminud";
+
+  if (instr->lanes == 8) {
+    vec_emit(cg, "vextracti128 xmm15, %s, 1", a);
+    vec_emit(cg, "v%s xmm15, xmm15, %s", op, x86_vec(instr->a.vec, 4));
+    vec_emit(cg, "vpshufd xmm14, xmm15, 0x4e");
+    vec_emit(cg, "v%s xmm15, xmm15, xmm14", op);
+    if (!sum) {
+      vec_emit(cg, "vpshufd xmm14, xmm15, 0xb1");
+      vec_emit(cg, "v%s xmm15, xmm15, xmm14", op);
     }
-    break;
+  } else if (sum) {
+    vec_emit(cg, "pshufd xmm15, %s, 0x4e", a);
+    vec_emit(cg, "paddq xmm15, %s", a);
+  } else {
+    bool max = instr->op == IR_VHMAXU;
+    vec_emit(cg, "mov eax, 0x80000000");
+    vec_emit(cg, "movd xmm13, eax");
+    vec_emit(cg, "pshufd xmm13, xmm13, 0");
+    vec_emit(cg, "movdqa xmm15, %s", a);
+    vec_emit(cg, "pxor xmm15, xmm13");
+    vec_emit(cg, "pshufd xmm14, xmm15, 0x4e");
+    vec_reduce_step_asm(cg, max);
+    vec_emit(cg, "pshufd xmm14, xmm15, 0xb1");
+    vec_reduce_step_asm(cg, max);
+    vec_emit(cg, "pxor xmm15, xmm13");
   }
+
+  const char *v = instr->lanes == 8 ? "v" : "";
+  if (sum)
+    vec_emit(cg, "%smovq %s, xmm15", v, x86_reg64(reg));
+  else
+    vec_emit(cg, "%smovd %s, xmm15", v, x86_reg32(reg));
+  store_result(cg, instr, reg);
 }
 
 /*
- * @brief: generate assembly for relational expressions
- *
- * @param rel: pointer to a rel_node.
- * @param variables: hash table of variables.
- * @param errors: counter variable to increment when an error is encountered.
- */
-static void rel_asm(rel_node *rel, ht *variables, program_node *program,
-                    unsigned int *errors) {
-  term_asm(&rel->comparison.lhs, variables, program, errors);
-  printf("    push rax\n");
-  term_asm(&rel->comparison.rhs, variables, program, errors);
-  printf("    pop rdx\n");
-  printf("    cmp rdx, rax\n");
-
-  switch (rel->kind) {
-  case REL_IS_EQUAL:
-    printf("    sete al\n");
+ * @brief: emit assembly for one vector instruction. Lanes of 4 use SSE2,
+ * lanes of 8 the VEX encoded AVX2 forms on ymm registers.
+ */
+static void vec_asm(codegen *cg, ir_instr *instr) {
+  const char *mov = instr->lanes == 8 ? "vmovdqu" : "movdqu";
+  char mem[64];
+
+  switch (instr->op) {
+  case IR_VLOAD:
+    vec_element(cg, instr, mem, sizeof(mem));
+    vec_emit(cg, "%s %s, %s", mov, vec_reg(instr, instr->dst), mem);
     break;
-  case REL_NOT_EQUAL:
-    printf("    setne al\n");
+
+  case IR_VSTORE:
+    vec_element(cg, instr, mem, sizeof(mem));
+    vec_emit(cg, "%s %s, %s", mov, mem, vec_reg(instr, instr->b));
     break;
-  case REL_LESS_THAN:
-    printf("    setl al\n");
+
+  case IR_VSPLAT:
+    vec_splat_asm(cg, instr);
     break;
-  case REL_LESS_THAN_OR_EQUAL:
-    printf("    setle al\n");
+
+  case IR_VMUL:
+    vec_mul_asm(cg, instr);
     break;
-  case REL_GREATER_THAN:
-    printf("    setg al\n");
+
+  case IR_VSUMQ:
+    vec_sumq_asm(cg, instr);
     break;
-  case REL_GREATER_THAN_OR_EQUAL:
-    printf("    setge al\n");
+
+  case IR_VHSUM:
+  case IR_VHMAXU:
+  case IR_VHMINU:
+    vec_reduce_asm(cg, instr);
+    break;
+
+  default:
+    vec_binary_asm(cg, instr);
     break;
   }
+}
 
-  printf("    movzx rax, al\n");
+/*
+ * @brief: add one to a profile counter. The add leaves every register but
+ * the flags alone, so it fits anywhere between two IR instructions.
+ */
+static void count_asm(dynamic_array *code, size_t counter) {
+  char *add = scu_format_string("add qword [sclc_profile_counts + %zu], 1",
+                                counter * 8);
+  asm_emit_raw(code, add);
+  free(add);
 }
 
 /*
- * @brief: generate assembly for individual expressions.
- *
- * @param instr: pointer ot an instr_node.
- * @param variables: hash table of variables.
- * @param if_count: counter for if instructions.
- * @param errors: counter variable to increment when an error is encountered.
- */
-static void instr_asm(instr_node *instr, ht *variables, unsigned int *if_count,
-                      stack *loops, program_node *program,
-                      unsigned int *errors) {
-  switch (instr->kind) {
-  case INSTR_DECLARE:
-    break;
+ * @brief: emit assembly for one non terminator instruction.
+ */
+static void instr_asm(codegen *cg, ir_instr *instr) {
+  dynamic_array *code = &cg->code;
 
-  case INSTR_INITIALIZE: {
-    int index =
-        get_var_stack_offset(variables, &instr->initialize_variable.var, NULL);
-    expr_asm(&instr->initialize_variable.expr, variables, program, errors);
-    printf("    mov qword [rbp - %d], rax\n", index * 8 + 8);
+  switch (instr->op) {
+  case IR_NOP:
     break;
-  }
 
-  case INSTR_ASSIGN: {
-    int index =
-        get_var_stack_offset(variables, &instr->assign.identifier, NULL);
-    expr_asm(&instr->assign.expr, variables, program, errors);
-    if (instr->assign.identifier.type == TYPE_POINTER) {
-      printf("    mov rbx, qword [rbp - %d]\n", index * 8 + 8);
-      printf("    mov qword [rbx], rax\n");
+  case IR_MOV:
+    // a frame slot takes neither another slot nor a 64 bit immediate
+    if (operand_reg(cg, instr->dst) >= 0 || operand_in_memory(cg, instr->a) ||
+        (instr->a.kind == IR_OPERAND_IMM && !is_imm32(instr->a))) {
+      x86_reg reg = result_reg(cg, instr, RAX);
+      move_to_reg(cg, instr->a, reg);
+      store_result(cg, instr, reg);
     } else {
-      printf("    mov qword [rbp - %d], rax\n", index * 8 + 8);
+      asm_emit(code, ASM_MOV, operand_asm(cg, instr->dst),
+               operand_asm(cg, instr->a));
     }
     break;
-  }
 
-  case INSTR_ASSIGN_TO_ARRAY_SUBSCRIPT:
-    size_t array_base = get_array_base_offset(
-        program, &instr->assign_to_array_subscript.var, variables, errors);
-    expr_asm(&instr->assign_to_array_subscript.expr_to_assign, variables,
-             program, errors);
-    printf("    push rax\n");
-    expr_asm(instr->assign_to_array_subscript.index_expr, variables, program,
-             errors);
-    printf("    mov rcx, rax\n");
-    printf("    lea rdx, [rbp - %zu]\n", array_base);
-    printf("    pop rax\n");
-    printf("    mov dword [rdx + rcx * 4], eax\n");
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_AND:
+  case IR_SHL:
+  case IR_SAR:
+  case IR_SHR:
+    arith_asm(cg, instr);
     break;
 
-  case INSTR_DECLARE_ARRAY: {
+  case IR_MULHI:
+    mulhi_asm(cg, instr);
     break;
-  }
 
-  case INSTR_INITIALIZE_ARRAY: {
-    size_t array_base = get_array_base_offset(
-        program, &instr->initialize_array.var, variables, errors);
-    printf("    lea rdx, [rbp - %zu]\n", array_base);
+  case IR_DIV:
+  case IR_MOD:
+    div_asm(cg, instr);
+    break;
 
-    for (size_t i = 0; i < instr->initialize_array.literal.elements.count;
-         i++) {
-      expr_node elem;
-      dynamic_array_get(&instr->initialize_array.literal.elements, i, &elem);
+  case IR_CMP: {
+    x86_reg reg = result_reg(cg, instr, RAX);
+    if (instr->a.kind == IR_OPERAND_IMM && instr->b.kind == IR_OPERAND_IMM) {
+      move_to_reg(cg,
+                  ir_imm(ir_rel_holds(instr->rel, instr->a.imm, instr->b.imm)),
+                  reg);
+      store_result(cg, instr, reg);
+      break;
+    }
+    rel_kind rel = compare_asm(cg, instr->a, instr->b, instr->rel);
+    asm_emit_cond(code, ASM_SETCC, rel_cond(rel), asm_reg(reg, 1));
+    asm_emit(code, ASM_MOVZX, asm_reg(reg, 4), asm_reg(reg, 1));
+    store_result(cg, instr, reg);
+    break;
+  }
 
-      expr_asm(&elem, variables, program, errors);
-      printf("    mov dword [rdx + %zu], eax\n", i * 4);
+  case IR_LOAD: {
+    x86_reg reg = result_reg(cg, instr, RAX);
+    asm_emit(code, ASM_MOV, asm_reg(reg, 8), variable_slot(instr->var));
+    store_result(cg, instr, reg);
+    break;
+  }
+
+  case IR_STORE: {
+    asm_operand src = operand_asm(cg, instr->a);
+    if (operand_in_memory(cg, instr->a)) {
+      move_to_reg(cg, instr->a, RAX);
+      src = asm_reg(RAX, 8);
     }
+    asm_emit(code, ASM_MOV, variable_slot(instr->var), src);
     break;
   }
 
-  case INSTR_IF: {
-    rel_asm(&instr->if_.rel, variables, program, errors);
-    int label = (*if_count)++;
-    printf("    test rax, rax\n");
-    printf("    jz .endif%d\n", label);
-    switch (instr->if_.kind) {
-    case IF_SINGLE_INSTR:
-      instr_asm(instr->if_.instr, variables, if_count, loops, program, errors);
-      break;
+  case IR_ADDR: {
+    x86_reg reg = result_reg(cg, instr, RAX);
+    asm_emit(code, ASM_LEA, asm_reg(reg, 8),
+             asm_mem(RBP, -1, 0, -(long)instr->var->stack_offset, 0));
+    store_result(cg, instr, reg);
+    break;
+  }
 
-    case IF_MULTI_INSTR:
-      for (size_t i = 0; i < instr->if_.instrs.count; i++) {
-        struct instr_node _instr;
-        dynamic_array_get(&instr->if_.instrs, i, &_instr);
-        instr_asm(&_instr, variables, if_count, loops, program, errors);
-      }
-      break;
+  case IR_LOAD_PTR: {
+    int ptr = operand_reg(cg, instr->a);
+    if (ptr < 0) {
+      move_to_reg(cg, instr->a, RAX);
+      ptr = RAX;
+    }
+    x86_reg reg = result_reg(cg, instr, RAX);
+    asm_emit(code, ASM_MOV, asm_reg(reg, 8), asm_mem(ptr, -1, 0, 0, 8));
+    store_result(cg, instr, reg);
+    break;
+  }
+
+  case IR_STORE_PTR: {
+    int ptr = operand_reg(cg, instr->a);
+    if (ptr < 0) {
+      move_to_reg(cg, instr->a, RAX);
+      ptr = RAX;
+    }
+    asm_operand dst = asm_mem(ptr, -1, 0, 0, 8);
+    if (operand_in_memory(cg, instr->b)) {
+      // both spilled and rax holds the pointer: copy through the stack
+      asm_emit(code, ASM_PUSH, operand_asm(cg, instr->b), (asm_operand){0});
+      asm_emit(code, ASM_POP, dst, (asm_operand){0});
+    } else {
+      asm_emit(code, ASM_MOV, dst, operand_asm(cg, instr->b));
     }
-    printf("    .endif%d:\n", label);
     break;
   }
 
-  case INSTR_GOTO:
-    printf("    jmp .%s\n", instr->goto_.label);
+  case IR_LOAD_ELEM: {
+    asm_operand elem = element_asm(cg, instr, RAX);
+    x86_reg reg = result_reg(cg, instr, RAX);
+    asm_emit(code, ASM_MOV, asm_reg(reg, 4), elem);
+    store_result(cg, instr, reg);
+    break;
+  }
+
+  case IR_STORE_ELEM: {
+    int reg = operand_reg(cg, instr->b);
+    if (instr->b.kind == IR_OPERAND_IMM) {
+      asm_emit(code, ASM_MOV, element_asm(cg, instr, RAX),
+               asm_imm(instr->b.imm));
+    } else if (reg >= 0) {
+      asm_emit(code, ASM_MOV, element_asm(cg, instr, RAX), asm_reg(reg, 4));
+    } else if (!operand_in_memory(cg, instr->a)) {
+      move_to_reg(cg, instr->b, RAX);
+      asm_emit(code, ASM_MOV, element_asm(cg, instr, RAX), asm_reg(RAX, 4));
+    } else {
+      // index and value both spilled: borrow rcx for the value
+      asm_emit(code, ASM_PUSH, asm_reg(RCX, 8), (asm_operand){0});
+      move_to_reg(cg, instr->b, RCX);
+      asm_emit(code, ASM_MOV, element_asm(cg, instr, RAX), asm_reg(RCX, 4));
+      asm_emit(code, ASM_POP, asm_reg(RCX, 8), (asm_operand){0});
+    }
     break;
+  }
 
-  case INSTR_LABEL:
-    printf(".%s:\n", instr->label.label);
+  case IR_VLOAD:
+  case IR_VSTORE:
+  case IR_VSPLAT:
+  case IR_VADD:
+  case IR_VSUB:
+  case IR_VMUL:
+  case IR_VAND:
+  case IR_VANDN:
+  case IR_VOR:
+  case IR_VXOR:
+  case IR_VSHL:
+  case IR_VSHR:
+  case IR_VCMPEQ:
+  case IR_VCMPGT:
+  case IR_VMAXU:
+  case IR_VMINU:
+  case IR_VSUMQ:
+  case IR_VHSUM:
+  case IR_VHMAXU:
+  case IR_VHMINU:
+    vec_asm(cg, instr);
     break;
 
-  case INSTR_FASM_DEFINE:
-    // This is supposed to do nothing as it is already handled
+  case IR_COUNT:
+    count_asm(code, instr->a.imm);
     break;
 
-  case INSTR_FASM:
-    if (instr->fasm.kind == FASM_PAR) {
-      int index = get_var_stack_offset(variables, &instr->fasm.argument, NULL);
-      char *stmt =
-          scu_format_string((char *)instr->fasm.content, index * 8 + 8);
-      printf("    %s\n", stmt);
+  case IR_FASM:
+    if (instr->var) {
+      char *stmt = scu_format_string((char *)instr->content,
+                                     instr->var->stack_offset);
+      asm_emit_raw(code, stmt);
       free(stmt);
     } else {
-      printf("    %s\n", instr->fasm.content);
+      asm_emit_raw(code, instr->content);
     }
     break;
 
-  case INSTR_LOOP:
-    loop_node new_loop = {.kind = instr->loop.kind,
-                          .loop_id = instr->loop.loop_id,
-                          .instrs = {0},
-                          .break_condition = {0}};
-    stack_push(loops, &new_loop);
-
-    switch (instr->loop.kind) {
-    case LOOP_UNCONDITIONAL:
-      printf(".loop_%zu_start:\n", instr->loop.loop_id);
-      for (unsigned int i = 0; i < instr->loop.instrs.count; i++) {
-        struct instr_node _instr;
-        dynamic_array_get(&instr->loop.instrs, i, &_instr);
-        instr_asm(&_instr, variables, if_count, loops, program, errors);
-      }
-      printf(".loop_%zu_end:\n", instr->loop.loop_id);
-      break;
+  case IR_JMP:
+  case IR_BR:
+  case IR_RET:
+    break;
+  }
+}
 
-    case LOOP_WHILE:
-      printf("    jmp .loop_%zu_test\n", instr->loop.loop_id);
+/*
+ * @brief: collect the callee-saved registers the allocator handed out, they
+ * are saved in the prologue and restored before ret.
+ *
+ * @return: number of registers written to saved.
+ */
+static size_t saved_registers(ir_program *ir, x86_reg saved[X86_REG_COUNT]) {
+  bool used[X86_REG_COUNT] = {0};
+  for (size_t v = 0; v < ir->vregs.count; v++) {
+    int reg = ir_vreg_at(ir, v)->reg;
+    if (reg >= 0)
+      used[reg] = true;
+  }
+
+  size_t count = 0;
+  for (int reg = 0; reg < X86_REG_COUNT; reg++)
+    if (used[reg] && x86_is_callee_saved(reg))
+      saved[count++] = reg;
+  return count;
+}
 
-    case LOOP_DO_WHILE:
-      printf(".loop_%zu_start:\n", instr->loop.loop_id);
-      for (unsigned int i = 0; i < instr->loop.instrs.count; i++) {
-        struct instr_node _instr;
-        dynamic_array_get(&instr->loop.instrs, i, &_instr);
-        instr_asm(&_instr, variables, if_count, loops, program, errors);
+/*
+ * @brief: find the loops of the program. The first block of every loop in
+ * the layout is aligned to 16 bytes so the hot loop starts on a fetch
+ * boundary.
+ *
+ * @param heads: receives one flag per block, whether a loop starts there.
+ * @param in_loop: receives one flag per block, whether it is in a loop.
+ * Both are indexed by layout position.
+ */
+static void find_loops(ir_program *ir, bool *heads, bool *in_loop) {
+  cfg g;
+  cfg_build(ir, &g);
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    heads[i] = false;
+    in_loop[i] = g.loop_of[i] != SIZE_MAX;
+  }
+
+  for (size_t l = 0; l < g.loops.count; l++) {
+    cfg_loop *loop = cfg_loop_at(&g, l);
+    for (size_t i = 0; i < ir->blocks.count; i++) {
+      if (bitset_test(&loop->blocks, i)) {
+        heads[i] = true;
+        break;
       }
-      printf(".loop_%zu_test:\n", instr->loop.loop_id);
-      rel_asm(&instr->loop.break_condition, variables, program, errors);
-      printf("    test rax, rax\n");
-      printf("    jz .loop_%zu_end\n", instr->loop.loop_id);
-      printf("    jmp .loop_%zu_start\n", instr->loop.loop_id);
-      printf(".loop_%zu_end:\n", instr->loop.loop_id);
-      break;
     }
+  }
+  cfg_free(&g);
+}
 
-    loop_node loop;
-    stack_pop(loops, &loop);
-    break;
+/*
+ * @brief: count the branches to every block.
+ *
+ * @param preds: receives one count per block, indexed by layout position.
+ */
+static void count_predecessors(ir_program *ir, size_t *preds) {
+  for (size_t i = 0; i < ir->blocks.count; i++)
+    preds[i] = 0;
 
-  case INSTR_LOOP_BREAK: {
-    loop_node *_loop = stack_top(loops);
-    printf("    jmp .loop_%zu_end\n", _loop->loop_id);
-    break;
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *succ[2];
+    size_t count = ir_successors(ir_block_at(ir, i), succ);
+    for (size_t s = 0; s < count; s++)
+      preds[succ[s]->index]++;
   }
+}
 
-  case INSTR_LOOP_CONTINUE:
-    loop_node *_loop = stack_top(loops);
-    switch (_loop->kind) {
-    case LOOP_UNCONDITIONAL:
-      printf("    jmp .loop_%zu_start\n", _loop->loop_id);
-      break;
-    case LOOP_WHILE:
-    case LOOP_DO_WHILE:
-      printf("    jmp .loop_%zu_test\n", _loop->loop_id);
+/*
+ * @brief: check whether block is the body of an if that can run without a
+ * branch: only the branch before it leads there, and it assigns a vreg that
+ * lives in a register (a move, or adding / subtracting an imm32) before
+ * jumping to join. Nothing in it can fault or has to stay conditional.
+ *
+ * @return: the assignment, NULL if block is no such body.
+ */
+static ir_instr *branchless_body(codegen *cg, ir_block *block, ir_block *join,
+                                 size_t preds) {
+  if (preds != 1 || block->label || block->instrs.count != 2)
+    return NULL;
+
+  ir_instr *instr = dynamic_array_at(&block->instrs, 0);
+  ir_instr *term = dynamic_array_at(&block->instrs, 1);
+  if (term->op != IR_JMP || term->target != join ||
+      operand_reg(cg, instr->dst) < 0)
+    return NULL;
+
+  switch (instr->op) {
+  case IR_MOV:
+    return instr;
+  case IR_ADD:
+  case IR_SUB:
+    return is_imm32(instr->b) && instr->a.kind == IR_OPERAND_VREG
+               ? instr
+               : NULL;
+  default:
+    return NULL;
+  }
+}
+
+/*
+ * @brief: check whether an if body is a counter, v = v +/- 1.
+ */
+static bool is_counter(ir_instr *instr) {
+  return instr->op != IR_MOV && instr->a.kind == IR_OPERAND_VREG &&
+         instr->a.vreg == instr->dst.vreg &&
+         (instr->b.imm == 1 || instr->b.imm == -1);
+}
+
+/*
+ * @brief: get the value an if body assigns as a cmov source: computed into
+ * rax with mov / lea, or the register or frame slot it already is in.
+ */
+static asm_operand branchless_value(codegen *cg, ir_instr *instr) {
+  if (instr->op == IR_MOV && instr->a.kind == IR_OPERAND_VREG)
+    return operand_asm(cg, instr->a);
+  if (instr->op == IR_MOV) {
+    move_to_reg(cg, instr->a, RAX);
+    return asm_reg(RAX, 8);
+  }
+
+  int base = operand_reg(cg, instr->a);
+  if (base < 0) {
+    move_to_reg(cg, instr->a, RAX);
+    base = RAX;
+  }
+  long disp = instr->op == IR_ADD ? instr->b.imm : -instr->b.imm;
+  asm_emit(&cg->code, ASM_LEA, asm_reg(RAX, 8), asm_mem(base, -1, 0, disp, 0));
+  return asm_reg(RAX, 8);
+}
+
+/*
+ * @brief: check whether compare_asm needs rax for "a rel b".
+ */
+static bool compare_uses_rax(codegen *cg, ir_operand a, ir_operand b) {
+  return (a.kind == IR_OPERAND_IMM && !is_imm32(a)) ||
+         (b.kind == IR_OPERAND_IMM && !is_imm32(b)) ||
+         (operand_in_memory(cg, a) && operand_in_memory(cg, b));
+}
+
+/*
+ * @brief: if-convert a branch over the body of an if, when the body is the
+ * next block and allowed to run without a branch (see branchless_body).
+ *
+ * @return: whether the branch and the body were emitted.
+ */
+static bool branchless_if(codegen *cg, ir_instr *term, ir_block *next,
+                          size_t preds) {
+  if (term->op != IR_BR || term->counter ||
+      (term->a.kind == IR_OPERAND_IMM && term->b.kind == IR_OPERAND_IMM))
+    return false;
+
+  // the body runs when the condition holds, or when it does not
+  bool taken = term->target == next;
+  if (!taken && term->alt != next)
+    return false;
+  ir_block *join = taken ? term->alt : term->target;
+  if (join == next)
+    return false;
+  ir_instr *body = branchless_body(cg, next, join, preds);
+  if (!body)
+    return false;
+
+  dynamic_array *code = &cg->code;
+  asm_operand dst = asm_reg(operand_reg(cg, body->dst), 8);
+
+  // counters add the condition itself:
+  //     cmp; setcc al; movzx eax, al; add v, rax
+  if (is_counter(body)) {
+    asm_cond cond = rel_cond(compare_asm(cg, term->a, term->b, term->rel));
+    asm_emit_cond(code, ASM_SETCC, taken ? cond : asm_cond_negate(cond),
+                  asm_reg(RAX, 1));
+    asm_emit(code, ASM_MOVZX, asm_reg(RAX, 4), asm_reg(RAX, 1));
+    bool up = (body->op == IR_ADD) == (body->b.imm == 1);
+    asm_emit(code, up ? ASM_ADD : ASM_SUB, dst, asm_reg(RAX, 8));
+  } else {
+    // other bodies compute the value and keep it when they would have run:
+    //     lea rax, [a + imm]; cmp; cmovcc v, rax
+    // the value goes after the cmp when the cmp needs rax itself, mov and
+    // lea leave the flags alone
+    bool first = !compare_uses_rax(cg, term->a, term->b);
+    asm_operand value = first ? branchless_value(cg, body) : (asm_operand){0};
+    asm_cond cond = rel_cond(compare_asm(cg, term->a, term->b, term->rel));
+    if (!first)
+      value = branchless_value(cg, body);
+
+    asm_instr cmov = {.op = ASM_CMOV,
+                      .cond = taken ? cond : asm_cond_negate(cond),
+                      .dst = dst,
+                      .src = value};
+    dynamic_array_append(code, &cmov);
+  }
+  asm_emit(code, ASM_JMP, asm_block(join->id), (asm_operand){0});
+  return true;
+}
+
+/*
+ * @brief: get the label a branch jumps to when its condition holds: its
+ * target, or a new stub that counts the run before going there.
+ */
+static size_t taken_label(codegen *cg, ir_instr *term) {
+  if (!term->counter)
+    return term->target->id;
+
+  size_t label = cg->ir->block_count + cg->stub_count++;
+  asm_emit(&cg->stubs, ASM_LABEL, asm_block(label), (asm_operand){0});
+  count_asm(&cg->stubs, term->counter);
+  asm_emit(&cg->stubs, ASM_JMP, asm_block(term->target->id), (asm_operand){0});
+  return label;
+}
+
+/*
+ * @brief: emit the jump(s) for a block terminator. Every successor gets an
+ * explicit jump, the peephole pass removes the ones to the next block.
+ */
+static void terminator_asm(codegen *cg, ir_instr *term, size_t stack_size,
+                           x86_reg *saved, size_t saved_count) {
+  dynamic_array *code = &cg->code;
+
+  switch (term->op) {
+  case IR_JMP:
+    asm_emit(code, ASM_JMP, asm_block(term->target->id), (asm_operand){0});
+    break;
+
+  case IR_BR: {
+    if (term->a.kind == IR_OPERAND_IMM && term->b.kind == IR_OPERAND_IMM) {
+      ir_block *taken = ir_rel_holds(term->rel, term->a.imm, term->b.imm)
+                            ? term->target
+                            : term->alt;
+      if (taken == term->target && term->counter)
+        count_asm(code, term->counter);
+      asm_emit(code, ASM_JMP, asm_block(taken->id), (asm_operand){0});
       break;
     }
+
+    // cmp directly followed by jcc, so the pair can macro-fuse
+    rel_kind rel = compare_asm(cg, term->a, term->b, term->rel);
+    asm_emit_cond(code, ASM_JCC, rel_cond(rel),
+                  asm_block(taken_label(cg, term)));
+    asm_emit(code, ASM_JMP, asm_block(term->alt->id), (asm_operand){0});
+    break;
+  }
+
+  case IR_RET:
+    for (size_t i = saved_count; i-- > 0;)
+      asm_emit(code, ASM_POP, asm_reg(saved[i], 8), (asm_operand){0});
+    asm_emit(code, ASM_ADD, asm_reg(RSP, 8), asm_imm(stack_size));
+    asm_emit(code, ASM_POP, asm_reg(RBP, 8), (asm_operand){0});
+    asm_emit(code, ASM_RET, (asm_operand){0}, (asm_operand){0});
+    break;
+
+  default:
     break;
   }
 }
 
-static size_t calculate_total_stack_size(ht *variables, program_node *program,
-                                         unsigned int *errors) {
-  size_t total = variables->count * 8;
+/*
+ * @brief: check whether an if should be converted according to the
+ * profile: it ran, and went either way at least once in
+ * CODEGEN_PREDICTABLE runs.
+ *
+ * @param convert: receives the decision.
+ *
+ * @return: false if the profile does not know the block.
+ */
+static bool measured_unpredictable(const profile *prof, ir_block *block,
+                                   ir_instr *term, bool *convert) {
+  uint64_t runs, taken;
+  if (term->op != IR_BR || !profile_runs(prof, block, &runs) ||
+      !profile_edge(prof, block, term->target, &taken) || taken > runs)
+    return false;
+
+  uint64_t rarer = taken < runs - taken ? taken : runs - taken;
+  *convert = runs > 0 && rarer * CODEGEN_PREDICTABLE >= runs;
+  return true;
+}
 
-  for (unsigned int i = 0; i < program->instrs.count; i++) {
-    instr_node instr;
-    dynamic_array_get(&program->instrs, i, &instr);
+void codegen_build(ir_program *ir, dynamic_array *code,
+                   const codegen_options *options, codegen_stats *stats) {
+  codegen cg = {.ir = ir};
+  dynamic_array_init(&cg.code, sizeof(asm_instr));
+  dynamic_array_init(&cg.stubs, sizeof(asm_instr));
+  codegen_branchless branchless = options->branchless;
 
-    if (instr.kind == INSTR_DECLARE_ARRAY) {
-      total += get_array_size_declare(&instr.declare_array, errors) * 4;
-    } else if (instr.kind == INSTR_INITIALIZE_ARRAY) {
-      total += get_array_size_initialize(&instr.initialize_array, errors) * 4;
+  // main function
+  size_t stack_size = ir->frame_size;
+  asm_emit(&cg.code, ASM_PUSH, asm_reg(RBP, 8), (asm_operand){0});
+  asm_emit(&cg.code, ASM_MOV, asm_reg(RBP, 8), asm_reg(RSP, 8));
+  asm_emit(&cg.code, ASM_SUB, asm_reg(RSP, 8), asm_imm(stack_size));
+
+  x86_reg saved[X86_REG_COUNT];
+  size_t saved_count = saved_registers(ir, saved);
+  for (size_t i = 0; i < saved_count; i++)
+    asm_emit(&cg.code, ASM_PUSH, asm_reg(saved[i], 8), (asm_operand){0});
+
+  size_t n = ir->blocks.count;
+  bool *loop_heads = scu_checked_malloc((n + 1) * sizeof(bool));
+  bool *in_loop = scu_checked_malloc((n + 1) * sizeof(bool));
+  size_t *preds = scu_checked_malloc((n + 1) * sizeof(size_t));
+  find_loops(ir, loop_heads, in_loop);
+  count_predecessors(ir, preds);
+  size_t converted = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    ir_block *block = ir_block_at(ir, i);
+
+    if (options->align_loops && loop_heads[i])
+      asm_emit(&cg.code, ASM_ALIGN, asm_imm(16), (asm_operand){0});
+    asm_emit(&cg.code, ASM_LABEL, asm_block(block->id), (asm_operand){0});
+
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (!ir_is_terminator(instr->op)) {
+        instr_asm(&cg, instr);
+        continue;
+      }
+
+      // the body of a converted if is not emitted on its own
+      bool convert = branchless == BRANCHLESS_ALWAYS;
+      if (branchless == BRANCHLESS_LOOPS &&
+          !measured_unpredictable(options->profile, block, instr, &convert))
+        convert = in_loop[i];
+      if (convert && i + 1 < n &&
+          branchless_if(&cg, instr, ir_block_at(ir, i + 1), preds[i + 1])) {
+        converted++;
+        i++;
+      } else {
+        terminator_asm(&cg, instr, stack_size, saved, saved_count);
+      }
     }
   }
 
-  if (total % 16 != 0) {
-    total += 16 - (total % 16);
-  }
-  return total;
+  for (size_t i = 0; i < cg.stubs.count; i++)
+    dynamic_array_append(&cg.code, dynamic_array_at(&cg.stubs, i));
+  dynamic_array_free(&cg.stubs);
+
+  free(loop_heads);
+  free(in_loop);
+  free(preds);
+
+  if (options->peephole)
+    peephole_optimize(&cg.code, stats ? &stats->peephole : NULL);
+  else if (stats)
+    stats->peephole = (peephole_stats){0};
+  if (stats)
+    stats->branchless = converted;
+  *code = cg.code;
+}
+
+/*
+ * @brief: print the code _start runs after main in an instrumented build:
+ * open(profile_file, O_WRONLY | O_CREAT | O_TRUNC, 0644), write the
+ * counters and close it. A file that cannot be opened is skipped.
+ */
+static void profile_dump_asm(const codegen_options *options) {
+  printf("    mov rax, 2\n");
+  printf("    lea rdi, [sclc_profile_path]\n");
+  printf("    mov rsi, 577\n");
+  printf("    mov rdx, 420\n");
+  printf("    syscall\n");
+  printf("    test rax, rax\n");
+  printf("    js .no_profile\n");
+  printf("    mov rdi, rax\n");
+  printf("    mov rax, 1\n");
+  printf("    lea rsi, [sclc_profile]\n");
+  printf("    mov rdx, %zu\n", (3 + options->counters) * sizeof(uint64_t));
+  printf("    syscall\n");
+  printf("    mov rax, 3\n");
+  printf("    syscall\n");
+  printf(".no_profile:\n");
+}
+
+/*
+ * @brief: print the counters of an instrumented build, laid out as the
+ * profile file (see profile.h). The path is written as bytes so it needs
+ * no quoting.
+ */
+static void profile_data_asm(const codegen_options *options) {
+  printf("sclc_profile_path db ");
+  for (const char *c = options->profile_file; *c; c++)
+    printf("%u, ", (unsigned char)*c);
+  printf("0\n");
+  printf("sclc_profile dq 0x%016" PRIx64 ", 0x%016" PRIx64 ", %zu\n",
+         (uint64_t)PROFILE_MAGIC, options->checksum, options->counters / 2);
+  printf("sclc_profile_counts rq %zu\n", options->counters);
 }
 
-void instrs_to_asm(program_node *program, ht *variables, stack *loops,
-                   const char *filename, unsigned int *errors) {
-  unsigned int if_count = 0;
+void ir_to_asm(ir_program *ir, const char *filename,
+               const codegen_options *options, codegen_stats *stats) {
+  dynamic_array code;
+  codegen_build(ir, &code, options, stats);
+  if (stats)
+    stats->code_bytes = asm_code_size(&code);
 
   char *output_asm_file = scu_format_string("%s.s", filename);
   freopen(output_asm_file, "w", stdout);
@@ -487,38 +1183,20 @@ void instrs_to_asm(program_node *program, ht *variables, stack *loops,
   printf("entry _start\n");
   printf("segment readable executable\n");
 
-  for (unsigned int i = 0; i < program->instrs.count; i++) {
-    struct instr_node instr;
-    dynamic_array_get(&program->instrs, i, &instr);
-
-    if (instr.kind == INSTR_FASM_DEFINE) {
-      printf("%s\n", instr.fasm_def.content);
-      dynamic_array_remove(&program->instrs, i);
-    }
+  for (size_t i = 0; i < ir->defines.count; i++) {
+    const char *content;
+    dynamic_array_get(&ir->defines, i, &content);
+    printf("%s\n", content);
   }
 
-  // main function
   printf("\nmain:\n");
-  printf("    push rbp\n");
-  printf("    mov rbp, rsp\n");
-
-  size_t stack_size = calculate_total_stack_size(variables, program, errors);
-  printf("    sub rsp, %zu\n", stack_size);
-
-  for (unsigned int i = 0; i < program->instrs.count; i++) {
-    struct instr_node instr;
-    dynamic_array_get(&program->instrs, i, &instr);
-
-    instr_asm(&instr, variables, &if_count, loops, program, errors);
-  }
-
-  printf("    add rsp, %zu\n", stack_size);
-  printf("    pop rbp\n");
-  printf("    ret\n");
+  asm_print(&code);
 
   // entrypoint
   printf("\n_start:\n");
   printf("    call main\n");
+  if (options->profile_file)
+    profile_dump_asm(options);
   printf("    mov rax, 60\n");
   printf("    xor rdi, rdi\n");
   printf("    syscall\n\n");
@@ -527,10 +1205,13 @@ void instrs_to_asm(program_node *program, ht *variables, stack *loops,
   printf("line rb LINE_MAX\n");
   printf("newline db 10, 0\n");
   printf("char_buf db 0, 0\n");
+  if (options->profile_file)
+    profile_data_asm(options);
 
   fflush(stdout);
   fclose(stdout);
 
   fasm_assemble(output_asm_file, filename);
   free(output_asm_file);
+  asm_free(&code);
 }
@@ -0,0 +1,667 @@
+#include "cost.h"
+#include "asm.h"
+#include "cfg.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "utils.h"
+#include "x86.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Latencies and throughputs of a 64 bit operand on a register, after
+ * Agner Fog's instruction tables and uops.info. The divider numbers are
+ * the fast end of idiv r64, the slow end depends on the operands.
+ */
+static const cost_arch arches[] = {
+    {.name = "skylake",
+     .width = 4,
+     .per_cycle = {[COST_UNIT_ALU] = 4,
+                   [COST_UNIT_MUL] = 1,
+                   [COST_UNIT_DIV] = 1.0 / 24,
+                   [COST_UNIT_LOAD] = 2,
+                   [COST_UNIT_STORE] = 1,
+                   [COST_UNIT_BRANCH] = 2,
+                   [COST_UNIT_VEC] = 3,
+                   [COST_UNIT_SHUFFLE] = 1},
+     .alu_latency = 1,
+     .mul_latency = 3,
+     .div_latency = 42,
+     .div_uops = 57,
+     .load_latency = 5,
+     .vec_latency = 1,
+     .vec_mul_latency = 10,
+     .vec_mul_uops = 2,
+     .cross_latency = 3},
+    {.name = "zen3",
+     .width = 6,
+     .per_cycle = {[COST_UNIT_ALU] = 4,
+                   [COST_UNIT_MUL] = 1,
+                   [COST_UNIT_DIV] = 1.0 / 7,
+                   [COST_UNIT_LOAD] = 3,
+                   [COST_UNIT_STORE] = 2,
+                   [COST_UNIT_BRANCH] = 2,
+                   [COST_UNIT_VEC] = 4,
+                   [COST_UNIT_SHUFFLE] = 2},
+     .alu_latency = 1,
+     .mul_latency = 3,
+     .div_latency = 10,
+     .div_uops = 2,
+     .load_latency = 4,
+     .vec_latency = 1,
+     .vec_mul_latency = 3,
+     .vec_mul_uops = 1,
+     .cross_latency = 3},
+};
+
+#define ARCH_COUNT (sizeof(arches) / sizeof(arches[0]))
+
+static const char *unit_names[COST_UNIT_COUNT] = {
+    [COST_UNIT_ALU] = "alu",          [COST_UNIT_MUL] = "multiplier",
+    [COST_UNIT_DIV] = "divider",      [COST_UNIT_LOAD] = "loads",
+    [COST_UNIT_STORE] = "stores",     [COST_UNIT_BRANCH] = "branches",
+    [COST_UNIT_VEC] = "vector",       [COST_UNIT_SHUFFLE] = "shuffles",
+};
+
+/*
+ * Locations an instruction reads and writes: the general purpose
+ * registers, then the vector registers, the flags and the frame slots.
+ */
+#define LOC_VEC X86_REG_COUNT
+#define LOC_FLAGS (LOC_VEC + X86_VEC_COUNT)
+#define LOC_SLOTS (LOC_FLAGS + 1)
+
+#define MAX_READS 8
+#define MAX_WRITES 4
+
+/*
+ * Times the loop body runs in the dependency chain simulation, the growth
+ * of the second half is what is measured.
+ */
+#define CHAIN_ROUNDS 16
+
+/*
+ * @struct cost_op: one instruction, as the model sees it.
+ */
+typedef struct cost_op {
+  unsigned int latency;
+  unsigned int uops;
+  unsigned int loads;
+  unsigned int stores;
+  double busy[COST_UNIT_COUNT]; // <-- cycles it keeps every unit busy
+  size_t reads[MAX_READS];
+  size_t read_count;
+  size_t writes[MAX_WRITES];
+  size_t write_count;
+} cost_op;
+
+/*
+ * @struct decoder: state of turning asm_instr into cost_op.
+ */
+typedef struct decoder {
+  const cost_arch *arch;
+  dynamic_array slots; // <-- long, frame displacement of every slot seen
+} decoder;
+
+/*
+ * @enum decoded: what decode made of an instruction.
+ */
+typedef enum decoded {
+  DECODED_OP = 0, // an instruction of the model
+  DECODED_NONE,   // a label or directive, costs nothing
+  DECODED_UNKNOWN // inline fasm the model does not know
+} decoded;
+
+const cost_arch *cost_find_arch(const char *name) {
+  for (size_t i = 0; i < ARCH_COUNT; i++)
+    if (strcmp(arches[i].name, name) == 0)
+      return &arches[i];
+  return NULL;
+}
+
+const char *cost_arch_names(void) { return "skylake, zen3"; }
+
+static void add_read(cost_op *op, size_t loc) {
+  if (op->read_count < MAX_READS)
+    op->reads[op->read_count++] = loc;
+}
+
+static void add_write(cost_op *op, size_t loc) {
+  if (op->write_count < MAX_WRITES)
+    op->writes[op->write_count++] = loc;
+}
+
+/*
+ * @brief: make an instruction take a unit for one issue slot, with a
+ * latency.
+ */
+static void use(decoder *d, cost_op *op, cost_unit unit,
+                unsigned int latency) {
+  op->busy[unit] += 1.0 / d->arch->per_cycle[unit];
+  op->latency = latency;
+}
+
+/*
+ * @brief: get the location of the frame slot at a displacement from rbp.
+ */
+static size_t slot_of(decoder *d, long disp) {
+  for (size_t i = 0; i < d->slots.count; i++) {
+    long seen;
+    dynamic_array_get(&d->slots, i, &seen);
+    if (seen == disp)
+      return LOC_SLOTS + i;
+  }
+  dynamic_array_append(&d->slots, &disp);
+  return LOC_SLOTS + d->slots.count - 1;
+}
+
+/*
+ * @brief: read the registers of an address and, for a frame slot, the slot
+ * itself. Element and pointer accesses are taken to never alias.
+ */
+static void read_address(decoder *d, cost_op *op, asm_operand mem,
+                         bool slot) {
+  add_read(op, mem.reg);
+  if (mem.index >= 0)
+    add_read(op, mem.index);
+  if (slot && mem.reg == RBP && mem.index < 0)
+    add_read(op, slot_of(d, mem.imm));
+}
+
+static void read_operand(decoder *d, cost_op *op, asm_operand operand) {
+  if (operand.kind == ASM_REG) {
+    add_read(op, operand.reg);
+  } else if (operand.kind == ASM_MEM) {
+    read_address(d, op, operand, true);
+    op->loads++;
+  }
+}
+
+static void write_operand(decoder *d, cost_op *op, asm_operand operand) {
+  if (operand.kind == ASM_REG) {
+    add_write(op, operand.reg);
+  } else if (operand.kind == ASM_MEM) {
+    read_address(d, op, operand, false);
+    if (operand.reg == RBP && operand.index < 0)
+      add_write(op, slot_of(d, operand.imm));
+    op->stores++;
+  }
+}
+
+/*
+ * @brief: find the register an operand of an inline line names.
+ *
+ * @return: its location, SIZE_MAX if it is not a register.
+ */
+static size_t parse_reg(const char *name, size_t length) {
+  if (length >= 4 && (strncmp(name, "xmm", 3) == 0 ||
+                      strncmp(name, "ymm", 3) == 0)) {
+    size_t reg = 0;
+    for (size_t i = 3; i < length; i++) {
+      if (!isdigit((unsigned char)name[i]))
+        return SIZE_MAX;
+      reg = reg * 10 + name[i] - '0';
+    }
+    return reg < X86_VEC_COUNT ? LOC_VEC + reg : SIZE_MAX;
+  }
+
+  for (int reg = 0; reg < X86_REG_COUNT; reg++) {
+    const char *names[3] = {x86_reg64(reg), x86_reg32(reg), x86_reg8(reg)};
+    for (size_t n = 0; n < 3; n++)
+      if (strlen(names[n]) == length && strncmp(names[n], name, length) == 0)
+        return reg;
+  }
+  return SIZE_MAX;
+}
+
+/*
+ * @struct raw_operand: one operand of an inline line.
+ */
+typedef struct raw_operand {
+  bool memory;
+  size_t reg;                 // <-- location, SIZE_MAX for none
+  size_t address[2];          // <-- registers of a memory operand
+  size_t address_count;
+} raw_operand;
+
+/*
+ * @brief: parse one comma separated operand of an inline line.
+ */
+static raw_operand parse_operand(const char *text, size_t length) {
+  raw_operand operand = {.reg = SIZE_MAX};
+  const char *bracket = memchr(text, '[', length);
+  operand.memory = bracket != NULL;
+
+  for (size_t i = 0; i < length;) {
+    if (!isalpha((unsigned char)text[i])) {
+      i++;
+      continue;
+    }
+    size_t start = i;
+    while (i < length && isalnum((unsigned char)text[i]))
+      i++;
+    size_t reg = parse_reg(text + start, i - start);
+    if (reg == SIZE_MAX)
+      continue;
+    if (!operand.memory)
+      operand.reg = reg;
+    else if (operand.address_count < 2)
+      operand.address[operand.address_count++] = reg;
+  }
+  return operand;
+}
+
+static bool starts_with(const char *s, const char *prefix) {
+  return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/*
+ * @brief: decode an inline line: the vector instructions codegen writes as
+ * text, and moves. Anything else is a fasm statement of the program.
+ */
+static decoded decode_raw(decoder *d, const char *text, cost_op *op) {
+  while (isspace((unsigned char)*text))
+    text++;
+  char mnemonic[24] = {0};
+  size_t length = 0;
+  while (isalnum((unsigned char)text[length]) &&
+         length < sizeof(mnemonic) - 1) {
+    mnemonic[length] = text[length];
+    length++;
+  }
+
+  raw_operand operands[4];
+  size_t count = 0;
+  const char *rest = text + length;
+  while (*rest && count < 4) {
+    size_t part = strcspn(rest, ",");
+    operands[count++] = parse_operand(rest, part);
+    rest += part;
+    if (*rest == ',')
+      rest++;
+  }
+
+  bool vector = false;
+  for (size_t i = 0; i < count; i++)
+    vector |= operands[i].reg != SIZE_MAX && operands[i].reg >= LOC_VEC;
+  if (count == 0 || (!vector && strcmp(mnemonic, "mov") != 0))
+    return DECODED_UNKNOWN;
+
+  // a move, shuffle or three operand form does not read its destination
+  bool overwrites = starts_with(mnemonic, "mov") ||
+                    starts_with(mnemonic, "vmov") ||
+                    strstr(mnemonic, "shuf") || strstr(mnemonic, "broadcast") ||
+                    strstr(mnemonic, "extract") ||
+                    (mnemonic[0] == 'v' && count >= 3);
+  bool zero = strstr(mnemonic, "xor") && count == 2 &&
+              operands[0].reg == operands[1].reg;
+
+  for (size_t i = 0; i < count; i++) {
+    for (size_t a = 0; a < operands[i].address_count; a++)
+      add_read(op, operands[i].address[a]);
+    if (operands[i].memory) {
+      if (i == 0)
+        op->stores++;
+      else
+        op->loads++;
+    } else if (operands[i].reg != SIZE_MAX && !zero &&
+               (i > 0 || !overwrites)) {
+      add_read(op, operands[i].reg);
+    }
+  }
+  if (!operands[0].memory && operands[0].reg != SIZE_MAX)
+    add_write(op, operands[0].reg);
+
+  op->uops = 1;
+  bool move = starts_with(mnemonic, "mov") || starts_with(mnemonic, "vmov");
+  if (zero || (move && (op->loads || op->stores)))
+    return DECODED_OP; // renamed away, or only a load / store
+
+  if (!vector) {
+    use(d, op, COST_UNIT_ALU, d->arch->alu_latency);
+  } else if (strstr(mnemonic, "pmulld")) {
+    use(d, op, COST_UNIT_VEC, d->arch->vec_mul_latency);
+    op->uops = d->arch->vec_mul_uops;
+  } else if (strstr(mnemonic, "mul")) {
+    use(d, op, COST_UNIT_VEC, d->arch->mul_latency);
+  } else if (strstr(mnemonic, "extract") || strstr(mnemonic, "broadcast") ||
+             strstr(mnemonic, "movzx")) {
+    use(d, op, COST_UNIT_SHUFFLE, d->arch->cross_latency);
+  } else if (strstr(mnemonic, "shuf") || strstr(mnemonic, "unpck") ||
+             strcmp(mnemonic, "movd") == 0 || strcmp(mnemonic, "vmovd") == 0) {
+    use(d, op, COST_UNIT_SHUFFLE, d->arch->vec_latency);
+  } else {
+    use(d, op, COST_UNIT_VEC, d->arch->vec_latency);
+  }
+  return DECODED_OP;
+}
+
+/*
+ * @brief: decode one instruction.
+ *
+ * @param prev: the instruction before it, a cmp / test fuses with a jcc.
+ */
+static decoded decode(decoder *d, asm_instr *instr, asm_instr *prev,
+                      cost_op *op) {
+  const cost_arch *arch = d->arch;
+  *op = (cost_op){.uops = 1};
+
+  // xor r, r is a zero idiom, handled when renaming
+  if (instr->op == ASM_XOR && instr->dst.kind == ASM_REG &&
+      asm_operand_equal(instr->dst, instr->src)) {
+    write_operand(d, op, instr->dst);
+    add_write(op, LOC_FLAGS);
+    return DECODED_OP;
+  }
+
+  switch (instr->op) {
+  case ASM_NOP:
+  case ASM_LABEL:
+  case ASM_ALIGN:
+    return DECODED_NONE;
+
+  case ASM_RAW:
+    *op = (cost_op){0};
+    if (decode_raw(d, instr->text, op) == DECODED_UNKNOWN)
+      return DECODED_UNKNOWN;
+    break;
+
+  case ASM_MOV:
+  case ASM_MOVZX:
+    read_operand(d, op, instr->src);
+    write_operand(d, op, instr->dst);
+    if (instr->dst.kind == ASM_REG && instr->src.kind != ASM_MEM)
+      use(d, op, COST_UNIT_ALU, arch->alu_latency);
+    break;
+
+  case ASM_LEA:
+    read_address(d, op, instr->src, false);
+    write_operand(d, op, instr->dst);
+    use(d, op, COST_UNIT_ALU, arch->alu_latency);
+    break;
+
+  case ASM_XOR:
+  case ASM_ADD:
+  case ASM_SUB:
+  case ASM_AND:
+  case ASM_SHL:
+  case ASM_SAR:
+  case ASM_SHR:
+  case ASM_NEG:
+  case ASM_IMUL:
+    read_operand(d, op, instr->dst);
+    read_operand(d, op, instr->src);
+    write_operand(d, op, instr->dst);
+    add_write(op, LOC_FLAGS);
+    op->uops += instr->dst.kind == ASM_MEM;
+    if (instr->op == ASM_IMUL)
+      use(d, op, COST_UNIT_MUL, arch->mul_latency);
+    else
+      use(d, op, COST_UNIT_ALU, arch->alu_latency);
+    break;
+
+  case ASM_IMUL_WIDE:
+    add_read(op, RAX);
+    read_operand(d, op, instr->dst);
+    add_write(op, RAX);
+    add_write(op, RDX);
+    add_write(op, LOC_FLAGS);
+    op->uops = 2;
+    use(d, op, COST_UNIT_MUL, arch->mul_latency);
+    break;
+
+  case ASM_CQO:
+    add_read(op, RAX);
+    add_write(op, RDX);
+    use(d, op, COST_UNIT_ALU, arch->alu_latency);
+    break;
+
+  case ASM_IDIV:
+    add_read(op, RAX);
+    add_read(op, RDX);
+    read_operand(d, op, instr->dst);
+    add_write(op, RAX);
+    add_write(op, RDX);
+    add_write(op, LOC_FLAGS);
+    op->uops = arch->div_uops;
+    use(d, op, COST_UNIT_DIV, arch->div_latency);
+    break;
+
+  case ASM_CMP:
+  case ASM_TEST:
+    read_operand(d, op, instr->dst);
+    read_operand(d, op, instr->src);
+    add_write(op, LOC_FLAGS);
+    use(d, op, COST_UNIT_ALU, arch->alu_latency);
+    break;
+
+  case ASM_SETCC:
+    add_read(op, LOC_FLAGS);
+    write_operand(d, op, instr->dst);
+    use(d, op, COST_UNIT_ALU, arch->alu_latency);
+    break;
+
+  case ASM_CMOV:
+    add_read(op, LOC_FLAGS);
+    read_operand(d, op, instr->dst);
+    read_operand(d, op, instr->src);
+    write_operand(d, op, instr->dst);
+    use(d, op, COST_UNIT_ALU, arch->alu_latency);
+    break;
+
+  case ASM_JCC:
+    add_read(op, LOC_FLAGS);
+    if (prev && (prev->op == ASM_CMP || prev->op == ASM_TEST))
+      op->uops = 0;
+    use(d, op, COST_UNIT_BRANCH, 0);
+    break;
+
+  case ASM_JMP:
+  case ASM_RET:
+    use(d, op, COST_UNIT_BRANCH, 0);
+    break;
+
+  case ASM_PUSH:
+    read_operand(d, op, instr->dst);
+    add_read(op, RSP);
+    add_write(op, RSP);
+    op->stores++;
+    break;
+
+  case ASM_POP:
+    add_read(op, RSP);
+    add_write(op, RSP);
+    write_operand(d, op, instr->dst);
+    op->loads++;
+    break;
+  }
+
+  if (op->loads) {
+    op->latency += arch->load_latency;
+    op->busy[COST_UNIT_LOAD] += op->loads / arch->per_cycle[COST_UNIT_LOAD];
+  }
+  op->busy[COST_UNIT_STORE] += op->stores / arch->per_cycle[COST_UNIT_STORE];
+  return DECODED_OP;
+}
+
+/*
+ * @brief: run the body over and over with unlimited units, and measure how
+ * much later the latest result gets every iteration.
+ */
+static double dependency_chain(cost_op *ops, size_t count, size_t locations) {
+  double *ready = scu_checked_malloc(locations * sizeof(double));
+  double half = 0, latest = 0;
+
+  for (size_t round = 0; round < CHAIN_ROUNDS; round++) {
+    for (size_t i = 0; i < count; i++) {
+      double start = 0;
+      for (size_t r = 0; r < ops[i].read_count; r++)
+        if (ready[ops[i].reads[r]] > start)
+          start = ready[ops[i].reads[r]];
+      for (size_t w = 0; w < ops[i].write_count; w++)
+        ready[ops[i].writes[w]] = start + ops[i].latency;
+    }
+
+    for (size_t l = 0; l < locations; l++)
+      if (ready[l] > latest)
+        latest = ready[l];
+    if (round == CHAIN_ROUNDS / 2 - 1)
+      half = latest;
+  }
+
+  free(ready);
+  return (latest - half) / (CHAIN_ROUNDS / 2);
+}
+
+/*
+ * @brief: estimate one iteration of a loop body.
+ *
+ * @param body: asm_instr pointers, in layout order.
+ */
+static void estimate(const cost_arch *arch, dynamic_array *body,
+                     cost_loop *loop) {
+  decoder d = {.arch = arch};
+  dynamic_array_init(&d.slots, sizeof(long));
+  cost_op *ops = scu_checked_malloc((body->count + 1) * sizeof(cost_op));
+  size_t count = 0;
+  asm_instr *prev = NULL;
+
+  for (size_t i = 0; i < body->count; i++) {
+    asm_instr *instr;
+    dynamic_array_get(body, i, &instr);
+
+    cost_op op;
+    decoded kind = decode(&d, instr, prev, &op);
+    if (kind == DECODED_NONE)
+      continue;
+    prev = instr;
+    if (kind == DECODED_UNKNOWN) {
+      loop->unknown++;
+      continue;
+    }
+
+    ops[count++] = op;
+    loop->instrs++;
+    loop->uops += op.uops;
+    for (int u = 0; u < COST_UNIT_COUNT; u++)
+      loop->pressure[u] += op.busy[u];
+  }
+
+  loop->issue = (double)loop->uops / arch->width;
+  loop->chain = dependency_chain(ops, count, LOC_SLOTS + d.slots.count);
+
+  loop->cycles = loop->issue;
+  loop->bound = "issue width";
+  for (int u = 0; u < COST_UNIT_COUNT; u++) {
+    if (loop->pressure[u] > loop->cycles) {
+      loop->cycles = loop->pressure[u];
+      loop->bound = unit_names[u];
+    }
+  }
+  if (loop->chain > loop->cycles) {
+    loop->cycles = loop->chain;
+    loop->bound = "dependency chain";
+  }
+
+  free(ops);
+  dynamic_array_free(&d.slots);
+}
+
+/*
+ * @brief: order loops by source line, outer loops first.
+ */
+static int compare_loops(const void *a, const void *b) {
+  const cost_loop *la = a;
+  const cost_loop *lb = b;
+  if (la->line != lb->line)
+    return (la->line > lb->line) - (la->line < lb->line);
+  return (la->depth > lb->depth) - (la->depth < lb->depth);
+}
+
+void cost_analyze(ir_program *ir, dynamic_array *code, const cost_arch *arch,
+                  cost_report *report) {
+  report->arch = arch;
+  dynamic_array_init(&report->loops, sizeof(cost_loop));
+
+  cfg g;
+  cfg_build(ir, &g);
+  if (g.loops.count == 0) {
+    cfg_free(&g);
+    return;
+  }
+
+  // layout position of the block every label starts
+  size_t ids = 0;
+  for (size_t i = 0; i < ir->blocks.count; i++)
+    if (ir_block_at(ir, i)->id >= ids)
+      ids = ir_block_at(ir, i)->id + 1;
+  size_t *position = scu_checked_malloc((ids + 1) * sizeof(size_t));
+  for (size_t id = 0; id < ids; id++)
+    position[id] = SIZE_MAX;
+  for (size_t i = 0; i < ir->blocks.count; i++)
+    position[ir_block_at(ir, i)->id] = i;
+
+  dynamic_array *bodies =
+      scu_checked_malloc(g.loops.count * sizeof(dynamic_array));
+  for (size_t l = 0; l < g.loops.count; l++)
+    dynamic_array_init(&bodies[l], sizeof(asm_instr *));
+
+  size_t loop = SIZE_MAX;
+  for (size_t i = 0; i < code->count; i++) {
+    asm_instr *instr = dynamic_array_at(code, i);
+    if (instr->op == ASM_LABEL) {
+      size_t at =
+          instr->dst.block < ids ? position[instr->dst.block] : SIZE_MAX;
+      loop = at != SIZE_MAX ? g.loop_of[at] : SIZE_MAX;
+    }
+    if (loop != SIZE_MAX)
+      dynamic_array_append(&bodies[loop], &instr);
+  }
+
+  for (size_t l = 0; l < g.loops.count; l++) {
+    cfg_loop *cl = cfg_loop_at(&g, l);
+    size_t latch;
+    dynamic_array_get(&cl->latches, 0, &latch);
+    ir_instr *test = ir_terminator(ir_block_at(ir, latch));
+
+    cost_loop entry = {.line = test ? test->line : 0, .depth = cl->depth};
+    estimate(arch, &bodies[l], &entry);
+    dynamic_array_append(&report->loops, &entry);
+    dynamic_array_free(&bodies[l]);
+  }
+  qsort(report->loops.items, report->loops.count, sizeof(cost_loop),
+        compare_loops);
+
+  free(bodies);
+  free(position);
+  cfg_free(&g);
+}
+
+void cost_print(cost_report *report) {
+  printf("Cost model: %s, %u uops per cycle, %zu loop%s\n",
+         report->arch->name, report->arch->width, report->loops.count,
+         report->loops.count == 1 ? "" : "s");
+
+  for (size_t i = 0; i < report->loops.count; i++) {
+    cost_loop *loop = dynamic_array_at(&report->loops, i);
+    printf("  loop at line %zu (depth %zu): %.2f cycles per iteration, "
+           "bound by %s\n",
+           loop->line, loop->depth, loop->cycles, loop->bound);
+    printf("    %zu instructions, %zu uops: issue %.2f, chain %.2f",
+           loop->instrs, loop->uops, loop->issue, loop->chain);
+    for (int u = 0; u < COST_UNIT_COUNT; u++)
+      if (loop->pressure[u] > 0)
+        printf(", %s %.2f", unit_names[u], loop->pressure[u]);
+    printf("\n");
+    if (loop->unknown)
+      printf("    fasm lines not counted: %zu\n", loop->unknown);
+  }
+}
+
+void cost_report_free(cost_report *report) {
+  dynamic_array_free(&report->loops);
+}
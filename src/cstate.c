@@ -1,18 +1,44 @@
 #include "cstate.h"
 #include "ast.h"
+#include "cost.h"
 #include "ds/dynamic_array.h"
 #include "ds/ht.h"
-#include "ds/stack.h"
+#include "ir.h"
 #include "lexer.h"
+#include "opt/pipeline.h"
+#include "opt/unroll.h"
 #include "parser.h"
 #include "token.h"
 #include "utils.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 
+/*
+ * @brief: parse the count following an option.
+ */
+static size_t parse_count(cstate *s, int argc, char *argv[], int i) {
+  if (i + 1 >= argc) {
+    scu_perror(&s->error_count, "Missing number after %s\n", argv[i]);
+    exit(1);
+  }
+
+  char *end;
+  errno = 0;
+  unsigned long value = strtoul(argv[i + 1], &end, 10);
+  if (errno != 0 || end == argv[i + 1] || *end != '\0' ||
+      argv[i + 1][0] == '-') {
+    scu_perror(&s->error_count, "Invalid number after %s: %s\n", argv[i],
+               argv[i + 1]);
+    exit(1);
+  }
+
+  return value;
+}
+
 cstate *cstate_create_from_args(int argc, char *argv[]) {
   cstate *s = scu_checked_malloc(sizeof(cstate));
 
@@ -29,11 +55,48 @@ cstate *cstate_create_from_args(int argc, char *argv[]) {
            "stages.\n");
     printf("--output       OR -o \t Specify output binary filename.\n");
     printf("--include_dir  OR -i \t Specify include directory path.\n");
+    printf("--emit-ir            \t Print the intermediate representation.\n");
+    printf("--emit-cfg=dot       \t Print the control-flow graph for "
+           "graphviz.\n");
+    printf("--stats              \t Print optimization statistics.\n");
+    printf("--unroll <n>         \t Unroll counted loops n times (default "
+           "%d, 1 disables).\n",
+           UNROLL_DEFAULT_FACTOR);
+    printf("--unroll-budget <n>  \t Instructions unrolling may add per loop "
+           "(default %d).\n",
+           UNROLL_DEFAULT_BUDGET);
+    printf("--avx2               \t Vectorize loops with AVX2 instead of "
+           "SSE2.\n");
+    printf("-O0, -O1, -O2        \t Optimization level (default -O%d), -O0 "
+           "emits the code as generated.\n",
+           PIPELINE_DEFAULT_LEVEL);
+    printf("--passes=<a,b,...>   \t Run these passes instead of the "
+           "level's.\n");
+    printf("--print-after=<pass> \t Print the IR after a pass (the code "
+           "after align, peephole).\n");
+    printf("-Rpass[=<a,b,...>]   \t Print remarks on what the passes "
+           "optimized.\n");
+    printf("-Rpass-missed[=...]  \t Print remarks on what the passes could "
+           "not optimize.\n");
+    printf("--remarks-json=<file>\t Write every remark to a JSON file.\n");
+    printf("--branchless         \t Lower every short if to cmov / setcc, "
+           "not just those in loops.\n");
+    printf("--no-branchless      \t Lower every if to a branch.\n");
+    printf("--analyze-cost[=<cpu>]\t Estimate the cycles per iteration of "
+           "every loop (%s).\n",
+           cost_arch_names());
+    printf("--profile-generate[=<file>] Count block and branch runs, write "
+           "them on exit\n\t\t\t (default <output>.profile).\n");
+    printf("--profile-use=<file> \t Optimize for the counts of a profile.\n");
     exit(1);
   }
 
   int i = 1;
   char *positional_filename = NULL;
+  bool branchless_given = false;
+  s->options = (coptions){.unroll_factor = UNROLL_DEFAULT_FACTOR,
+                          .unroll_budget = UNROLL_DEFAULT_BUDGET,
+                          .opt_level = PIPELINE_DEFAULT_LEVEL};
   s->output_filename = NULL;
   s->include_dir = NULL;
   s->code_buffer = NULL;
@@ -47,6 +110,161 @@ cstate *cstate_create_from_args(int argc, char *argv[]) {
       continue;
     }
 
+    if (strcmp(arg, "--emit-ir") == 0) {
+      s->options.emit_ir = true;
+      i++;
+      continue;
+    }
+
+    if (strncmp(arg, "--emit-cfg=", 11) == 0) {
+      if (strcmp(arg + 11, "dot") != 0) {
+        scu_perror(&s->error_count, "Unsupported CFG format: %s\n", arg + 11);
+        exit(1);
+      }
+      s->options.emit_cfg = true;
+      i++;
+      continue;
+    }
+
+    if (strcmp(arg, "--stats") == 0) {
+      s->options.stats = true;
+      i++;
+      continue;
+    }
+
+    if (strcmp(arg, "--avx2") == 0) {
+      s->options.avx2 = true;
+      i++;
+      continue;
+    }
+
+    if (strcmp(arg, "--branchless") == 0 ||
+        strcmp(arg, "--no-branchless") == 0) {
+      s->options.branchless =
+          arg[2] == 'b' ? BRANCHLESS_ALWAYS : BRANCHLESS_NEVER;
+      branchless_given = true;
+      i++;
+      continue;
+    }
+
+    if (strncmp(arg, "-O", 2) == 0) {
+      if (arg[2] < '0' || arg[2] > '0' + PIPELINE_MAX_LEVEL || arg[3]) {
+        scu_perror(&s->error_count, "Unknown optimization level: %s\n", arg);
+        exit(1);
+      }
+      s->options.opt_level = arg[2] - '0';
+      i++;
+      continue;
+    }
+
+    if (strncmp(arg, "--passes=", 9) == 0) {
+      char *bad = pipeline_check_list(arg + 9);
+      if (bad) {
+        scu_perror(&s->error_count, "Unknown pass: '%s'\n", bad);
+        free(bad);
+        exit(1);
+      }
+      s->options.passes = arg + 9;
+      i++;
+      continue;
+    }
+
+    if (strncmp(arg, "--print-after=", 14) == 0) {
+      if (pipeline_find_pass(arg + 14, strlen(arg + 14)) < 0) {
+        scu_perror(&s->error_count, "Unknown pass: '%s'\n", arg + 14);
+        exit(1);
+      }
+      s->options.print_after = arg + 14;
+      i++;
+      continue;
+    }
+
+    if (strncmp(arg, "-Rpass", 6) == 0) {
+      bool missed = strncmp(arg + 6, "-missed", 7) == 0;
+      const char *list = arg + (missed ? 13 : 6);
+      if (*list != '\0' && *list != '=') {
+        scu_perror(&s->error_count, "Unknown option: %s\n", arg);
+        exit(1);
+      }
+      if (*list == '=') {
+        list++;
+        char *bad = pipeline_check_list(list);
+        if (bad) {
+          scu_perror(&s->error_count, "Unknown pass: '%s'\n", bad);
+          free(bad);
+          exit(1);
+        }
+      }
+      if (missed)
+        s->options.rpass_missed = list;
+      else
+        s->options.rpass = list;
+      i++;
+      continue;
+    }
+
+    if (strncmp(arg, "--remarks-json=", 15) == 0) {
+      if (arg[15] == '\0') {
+        scu_perror(&s->error_count, "Missing filename after %s\n", arg);
+        exit(1);
+      }
+      s->options.remarks_json = arg + 15;
+      i++;
+      continue;
+    }
+
+    if (strncmp(arg, "--analyze-cost", 14) == 0 &&
+        (arg[14] == '\0' || arg[14] == '=')) {
+      const char *name = arg[14] ? arg + 15 : COST_DEFAULT_ARCH;
+      if (!cost_find_arch(name)) {
+        scu_perror(&s->error_count,
+                   "Unknown microarchitecture: %s (known: %s)\n", name,
+                   cost_arch_names());
+        exit(1);
+      }
+      s->options.analyze_cost = name;
+      i++;
+      continue;
+    }
+
+    if (strncmp(arg, "--profile-generate", 18) == 0 &&
+        (arg[18] == '\0' || arg[18] == '=')) {
+      if (arg[18] == '=' && arg[19] == '\0') {
+        scu_perror(&s->error_count, "Missing filename after %s\n", arg);
+        exit(1);
+      }
+      s->options.profile_generate = true;
+      s->options.profile_file = arg[18] ? arg + 19 : NULL;
+      i++;
+      continue;
+    }
+
+    if (strncmp(arg, "--profile-use=", 14) == 0) {
+      if (arg[14] == '\0') {
+        scu_perror(&s->error_count, "Missing filename after %s\n", arg);
+        exit(1);
+      }
+      s->options.profile_use = arg + 14;
+      i++;
+      continue;
+    }
+
+    if (strcmp(arg, "--unroll") == 0) {
+      s->options.unroll_factor = parse_count(s, argc, argv, i);
+      if (s->options.unroll_factor == 0) {
+        scu_perror(&s->error_count, "Unroll factor must be at least 1\n");
+        exit(1);
+      }
+      i += 2;
+      continue;
+    }
+
+    if (strcmp(arg, "--unroll-budget") == 0) {
+      s->options.unroll_budget = parse_count(s, argc, argv, i);
+      i += 2;
+      continue;
+    }
+
     if (strcmp(arg, "--output") == 0 || strcmp(arg, "-o") == 0) {
       if (i + 1 >= argc) {
         scu_perror(&s->error_count, "Missing filename after %s\n", arg);
@@ -59,7 +277,7 @@ cstate *cstate_create_from_args(int argc, char *argv[]) {
         exit(1);
       }
 
-      s->output_filename = argv[i + 1];
+      s->output_filename = strdup(argv[i + 1]);
       s->options.output = true;
       i += 2;
       continue;
@@ -116,6 +334,16 @@ cstate *cstate_create_from_args(int argc, char *argv[]) {
   if (s->include_dir == NULL)
     s->include_dir = strdup(".");
 
+  if (!branchless_given)
+    s->options.branchless =
+        s->options.opt_level > 0 ? BRANCHLESS_LOOPS : BRANCHLESS_NEVER;
+
+  if (s->options.profile_generate && s->options.profile_use) {
+    scu_perror(&s->error_count,
+               "--profile-generate and --profile-use exclude each other\n");
+    exit(1);
+  }
+
   if (positional_filename == NULL) {
     scu_perror(&s->error_count, "Missing input filename\n");
     exit(1);
@@ -147,8 +375,7 @@ cstate *cstate_create_from_args(int argc, char *argv[]) {
   s->program = scu_checked_malloc(sizeof(program_node));
   s->program->loop_counter = 0;
 
-  s->loops = scu_checked_malloc(sizeof(stack));
-  stack_init(s->loops, sizeof(loop_node));
+  s->ir = NULL;
 
   s->variables = ht_new(sizeof(variable));
 
@@ -171,8 +398,7 @@ void cstate_free(cstate *s) {
   dynamic_array_free(&s->program->instrs);
   free(s->program);
 
-  stack_free(s->loops);
-  free(s->loops);
+  ir_free(s->ir);
 
   ht_del_ht(s->variables);
 
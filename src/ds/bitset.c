@@ -0,0 +1,85 @@
+#include "ds/bitset.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BITS_PER_WORD (8 * sizeof(unsigned long))
+
+void bitset_init(bitset *b, size_t nbits) {
+  b->nbits = nbits;
+  b->nwords = (nbits + BITS_PER_WORD - 1) / BITS_PER_WORD;
+  b->words = scu_checked_malloc(b->nwords * sizeof(unsigned long));
+}
+
+void bitset_free(bitset *b) {
+  free(b->words);
+  b->words = NULL;
+  b->nbits = 0;
+  b->nwords = 0;
+}
+
+void bitset_set(bitset *b, size_t i) {
+  b->words[i / BITS_PER_WORD] |= 1UL << (i % BITS_PER_WORD);
+}
+
+void bitset_clear(bitset *b, size_t i) {
+  b->words[i / BITS_PER_WORD] &= ~(1UL << (i % BITS_PER_WORD));
+}
+
+bool bitset_test(const bitset *b, size_t i) {
+  return (b->words[i / BITS_PER_WORD] >> (i % BITS_PER_WORD)) & 1UL;
+}
+
+void bitset_clear_all(bitset *b) {
+  memset(b->words, 0, b->nwords * sizeof(unsigned long));
+}
+
+void bitset_set_all(bitset *b) {
+  memset(b->words, 0xff, b->nwords * sizeof(unsigned long));
+
+  // keep the bits past nbits clear so count / equal stay exact
+  size_t tail = b->nbits % BITS_PER_WORD;
+  if (tail)
+    b->words[b->nwords - 1] &= (1UL << tail) - 1;
+}
+
+void bitset_copy(bitset *dst, const bitset *src) {
+  memcpy(dst->words, src->words, dst->nwords * sizeof(unsigned long));
+}
+
+bool bitset_union(bitset *dst, const bitset *src) {
+  bool changed = false;
+  for (size_t i = 0; i < dst->nwords; i++) {
+    unsigned long word = dst->words[i] | src->words[i];
+    changed |= word != dst->words[i];
+    dst->words[i] = word;
+  }
+  return changed;
+}
+
+bool bitset_intersect(bitset *dst, const bitset *src) {
+  bool changed = false;
+  for (size_t i = 0; i < dst->nwords; i++) {
+    unsigned long word = dst->words[i] & src->words[i];
+    changed |= word != dst->words[i];
+    dst->words[i] = word;
+  }
+  return changed;
+}
+
+void bitset_subtract(bitset *dst, const bitset *src) {
+  for (size_t i = 0; i < dst->nwords; i++)
+    dst->words[i] &= ~src->words[i];
+}
+
+bool bitset_equal(const bitset *a, const bitset *b) {
+  return memcmp(a->words, b->words, a->nwords * sizeof(unsigned long)) == 0;
+}
+
+size_t bitset_count(const bitset *b) {
+  size_t count = 0;
+  for (size_t i = 0; i < b->nwords; i++)
+    count += __builtin_popcountl(b->words[i]);
+  return count;
+}
@@ -22,6 +22,15 @@ int dynamic_array_get(dynamic_array *da, size_t index, void *item) {
   return 0;
 }
 
+void *dynamic_array_at(dynamic_array *da, size_t index) {
+  if (!da || index >= da->count || !da->items) {
+    scu_perror(NULL, "Invalid Dynamic array passed to function.\n");
+    return NULL;
+  }
+
+  return (char *)da->items + (index * da->item_size);
+}
+
 int dynamic_array_set(dynamic_array *da, size_t index, void *item) {
   if (!da || !item || !da->items || da->item_size == 0 || index >= da->count ||
       da->capacity == 0) {
@@ -69,16 +78,16 @@ int dynamic_array_insert(dynamic_array *da, size_t index, void *item) {
   }
 
   if (da->count == da->capacity) {
-    unsigned int new_capacity = da->capacity * 2;
+    unsigned int new_capacity = da->capacity ? da->capacity * 2 : 4;
     void *new_items =
         scu_checked_realloc(da->items, da->item_size * new_capacity);
     da->items = new_items;
     da->capacity = new_capacity;
   }
 
-  memmove((char *)da->items + (index * da->item_size),
-          (char *)da->items + (index * da->item_size) + da->item_size,
-          (da->count * da->item_size) - ((da->count - index) * da->item_size));
+  memmove((char *)da->items + (index * da->item_size) + da->item_size,
+          (char *)da->items + (index * da->item_size),
+          (da->count - index) * da->item_size);
   memcpy((char *)da->items + (index * da->item_size), item, da->item_size);
   da->count++;
   return 0;
@@ -69,7 +69,10 @@ static int ht_get_hash(const char *s, const int num_buckets,
 #define HT_PRIME_2 0x1b873593
   const int hash_a = ht_hash(s, HT_PRIME_1, num_buckets);
   const int hash_b = ht_hash(s, HT_PRIME_2, num_buckets);
-  return (hash_a + (attempt * (hash_b + 1))) % num_buckets;
+  // the step must never be a multiple of num_buckets (a prime), otherwise
+  // the probe sequence keeps revisiting the same bucket.
+  const long step = hash_b % (num_buckets - 1) + 1;
+  return (int)((hash_a + attempt * step) % num_buckets);
 #undef HT_PRIME_1
 #undef HT_PRIME_2
 }
@@ -126,9 +129,29 @@ static ht *ht_new_sized(const size_t base_capacity, const size_t value_size) {
 
 ht *ht_new(const size_t value_size) { return ht_new_sized(53, value_size); }
 
+/*
+ * @brief: place an existing item into a table without copying it.
+ *
+ * @param table: pointer to an initialized ht struct.
+ * @param item: pointer to the item to be placed.
+ */
+static void ht_place_item(ht *table, ht_item *item) {
+  int index = ht_get_hash(item->key, table->capacity, 0);
+
+  int i = 1;
+  while (table->items[index] != NULL) {
+    index = ht_get_hash(item->key, table->capacity, i);
+    i++;
+  }
+
+  table->items[index] = item;
+  table->count++;
+}
+
 /*
  * @brief: resize an existing hash table to avoid high collission rates and keep
- * storing more key-value pairs.
+ * storing more key-value pairs. Items are moved rather than copied, so value
+ * pointers returned by ht_search stay valid across resizes.
  *
  * @param table: pointer to an initialized ht struct.
  * @param base_capacity
@@ -142,22 +165,17 @@ static void ht_resize(ht *table, const size_t base_capacity) {
   for (size_t i = 0; i < table->capacity; i++) {
     ht_item *item = table->items[i];
     if (item != NULL && item != &HT_DELETED_ITEM) {
-      ht_insert(new_ht, item->key, item->value);
+      ht_place_item(new_ht, item);
     }
   }
 
   table->base_capacity = new_ht->base_capacity;
   table->count = new_ht->count;
-
-  const int tmp_size = table->capacity;
   table->capacity = new_ht->capacity;
-  new_ht->capacity = tmp_size;
 
-  ht_item **tmp_items = table->items;
+  free(table->items);
   table->items = new_ht->items;
-  new_ht->items = tmp_items;
-
-  ht_del_ht(new_ht);
+  free(new_ht);
 }
 
 /*
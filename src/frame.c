@@ -0,0 +1,91 @@
+#include "frame.h"
+#include "ast.h"
+#include "ds/dynamic_array.h"
+
+#include <stddef.h>
+
+/*
+ * @brief: round value up to the next multiple of align.
+ */
+static size_t align_up(size_t value, size_t align) {
+  if (align == 0)
+    return value;
+  return (value + align - 1) / align * align;
+}
+
+/*
+ * @brief: give a declared symbol its slot, unless it already has one.
+ *
+ * @param decl: pointer to the declaring variable (resolved by semantic).
+ * @param frame_size: running size of the frame in bytes.
+ */
+static void place_symbol(variable *decl, size_t *frame_size) {
+  variable *sym = decl->symbol;
+  if (!sym || sym->stack_offset != 0)
+    return;
+
+  *frame_size = align_up(*frame_size + sym->size, sym->align);
+  sym->stack_offset = *frame_size;
+}
+
+/*
+ * @brief: place the declarations of a block of instructions. (declaration)
+ *
+ * @param instrs: pointer to the dynamic_array of instructions.
+ * @param frame_size: running size of the frame in bytes.
+ */
+static void layout_instrs(dynamic_array *instrs, size_t *frame_size);
+
+/*
+ * @brief: place the declarations made by a single instruction, recursing into
+ * if and loop bodies.
+ *
+ * @param instr: pointer to an instr_node.
+ * @param frame_size: running size of the frame in bytes.
+ */
+static void layout_instr(instr_node *instr, size_t *frame_size) {
+  switch (instr->kind) {
+  case INSTR_DECLARE:
+    place_symbol(&instr->declare_variable, frame_size);
+    break;
+  case INSTR_INITIALIZE:
+    place_symbol(&instr->initialize_variable.var, frame_size);
+    break;
+  case INSTR_DECLARE_ARRAY:
+    place_symbol(&instr->declare_array.var, frame_size);
+    break;
+  case INSTR_INITIALIZE_ARRAY:
+    place_symbol(&instr->initialize_array.var, frame_size);
+    break;
+  case INSTR_IF:
+    if (instr->if_.kind == IF_SINGLE_INSTR) {
+      layout_instr(instr->if_.instr, frame_size);
+    } else {
+      layout_instrs(&instr->if_.instrs, frame_size);
+    }
+    break;
+  case INSTR_LOOP:
+    layout_instrs(&instr->loop.instrs, frame_size);
+    break;
+  default:
+    break;
+  }
+}
+
+/*
+ * @brief: place the declarations of a block of instructions. (definition)
+ *
+ * @param instrs: pointer to the dynamic_array of instructions.
+ * @param frame_size: running size of the frame in bytes.
+ */
+static void layout_instrs(dynamic_array *instrs, size_t *frame_size) {
+  for (size_t i = 0; i < instrs->count; i++) {
+    layout_instr(dynamic_array_at(instrs, i), frame_size);
+  }
+}
+
+void frame_layout(program_node *program) {
+  size_t frame_size = 0;
+  layout_instrs(&program->instrs, &frame_size);
+  program->frame_size = align_up(frame_size, 16);
+}
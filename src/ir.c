@@ -0,0 +1,574 @@
+#include "ir.h"
+#include "ds/dynamic_array.h"
+#include "ds/ht.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+ir_program *ir_new(size_t frame_size) {
+  ir_program *ir = scu_checked_malloc(sizeof(ir_program));
+  dynamic_array_init(&ir->blocks, sizeof(ir_block *));
+  dynamic_array_init(&ir->vregs, sizeof(ir_vreg));
+  dynamic_array_init(&ir->defines, sizeof(const char *));
+  ir->block_count = 0;
+  ir->frame_size = frame_size;
+  return ir;
+}
+
+void ir_free(ir_program *ir) {
+  if (ir == NULL)
+    return;
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    dynamic_array_free(&block->instrs);
+    free(block);
+  }
+
+  dynamic_array_free(&ir->blocks);
+  dynamic_array_free(&ir->vregs);
+  dynamic_array_free(&ir->defines);
+  free(ir);
+}
+
+ir_program *ir_clone(ir_program *ir) {
+  ir_program *copy = ir_new(ir->frame_size);
+  copy->block_count = ir->block_count;
+
+  // old block id -> new block, so jump targets can be remapped
+  ir_block **by_id =
+      scu_checked_malloc((ir->block_count + 1) * sizeof(ir_block *));
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    ir_block *clone = scu_checked_malloc(sizeof(ir_block));
+    *clone = *block;
+    dynamic_array_init(&clone->instrs, sizeof(ir_instr));
+    for (size_t j = 0; j < block->instrs.count; j++)
+      dynamic_array_append(&clone->instrs,
+                           dynamic_array_at(&block->instrs, j));
+    by_id[block->id] = clone;
+    ir_place_block(copy, clone);
+  }
+
+  for (size_t i = 0; i < copy->blocks.count; i++) {
+    ir_block *block = ir_block_at(copy, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->target)
+        instr->target = by_id[instr->target->id];
+      if (instr->alt)
+        instr->alt = by_id[instr->alt->id];
+    }
+  }
+
+  for (size_t i = 0; i < ir->vregs.count; i++)
+    dynamic_array_append(&copy->vregs, dynamic_array_at(&ir->vregs, i));
+  for (size_t i = 0; i < ir->defines.count; i++)
+    dynamic_array_append(&copy->defines, dynamic_array_at(&ir->defines, i));
+
+  free(by_id);
+  return copy;
+}
+
+ir_block *ir_block_new(ir_program *ir, const char *label) {
+  ir_block *block = scu_checked_malloc(sizeof(ir_block));
+  block->id = ir->block_count++;
+  block->origin = block->id;
+  block->index = 0;
+  block->label = label;
+  dynamic_array_init(&block->instrs, sizeof(ir_instr));
+  return block;
+}
+
+void ir_place_block(ir_program *ir, ir_block *block) {
+  dynamic_array_append(&ir->blocks, &block);
+}
+
+void ir_insert_block(ir_program *ir, size_t index, ir_block *block) {
+  dynamic_array_insert(&ir->blocks, index, &block);
+}
+
+void ir_remove_block(ir_program *ir, size_t index) {
+  ir_block *block = ir_block_at(ir, index);
+  dynamic_array_remove(&ir->blocks, index);
+  dynamic_array_free(&block->instrs);
+  free(block);
+}
+
+ir_block *ir_block_at(ir_program *ir, size_t index) {
+  if (index >= ir->blocks.count)
+    return NULL;
+
+  ir_block **slot = dynamic_array_at(&ir->blocks, index);
+  return *slot;
+}
+
+ir_operand ir_new_vreg(ir_program *ir, type t) {
+  ir_operand op = {.kind = IR_OPERAND_VREG, .vreg = ir->vregs.count};
+  ir_vreg info = {.type = t, .var = NULL, .reg = -1, .stack_offset = 0};
+  dynamic_array_append(&ir->vregs, &info);
+  return op;
+}
+
+ir_vreg *ir_vreg_at(ir_program *ir, size_t vreg) {
+  return dynamic_array_at(&ir->vregs, vreg);
+}
+
+ir_operand ir_imm(long value) {
+  return (ir_operand){.kind = IR_OPERAND_IMM, .imm = value};
+}
+
+ir_operand ir_vec(size_t reg) {
+  return (ir_operand){.kind = IR_OPERAND_VEC, .vec = reg};
+}
+
+bool ir_is_terminator(ir_opcode op) {
+  return op == IR_JMP || op == IR_BR || op == IR_RET;
+}
+
+ir_instr *ir_terminator(ir_block *block) {
+  if (block->instrs.count == 0)
+    return NULL;
+
+  ir_instr *last = dynamic_array_at(&block->instrs, block->instrs.count - 1);
+  return ir_is_terminator(last->op) ? last : NULL;
+}
+
+size_t ir_successors(ir_block *block, ir_block *succ[2]) {
+  ir_instr *term = ir_terminator(block);
+  if (!term)
+    return 0;
+
+  switch (term->op) {
+  case IR_JMP:
+    succ[0] = term->target;
+    return 1;
+  case IR_BR:
+    succ[0] = term->target;
+    succ[1] = term->alt;
+    return term->target == term->alt ? 1 : 2;
+  default:
+    return 0;
+  }
+}
+
+bool ir_has_fasm(ir_block *block) {
+  for (size_t j = 0; j < block->instrs.count; j++) {
+    ir_instr *instr = dynamic_array_at(&block->instrs, j);
+    if (instr->op == IR_FASM)
+      return true;
+  }
+  return false;
+}
+
+void ir_renumber(ir_program *ir) {
+  for (size_t i = 0; i < ir->blocks.count; i++)
+    ir_block_at(ir, i)->index = i;
+}
+
+size_t ir_instr_count(ir_program *ir) {
+  size_t count = 0;
+  for (size_t i = 0; i < ir->blocks.count; i++)
+    count += ir_block_at(ir, i)->instrs.count;
+  return count;
+}
+
+size_t *ir_def_counts(ir_program *ir) {
+  size_t *defs = scu_checked_malloc((ir->vregs.count + 1) * sizeof(size_t));
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->dst.kind == IR_OPERAND_VREG)
+        defs[instr->dst.vreg]++;
+    }
+  }
+
+  return defs;
+}
+
+size_t *ir_use_counts(ir_program *ir) {
+  size_t *uses = scu_checked_malloc((ir->vregs.count + 1) * sizeof(size_t));
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->a.kind == IR_OPERAND_VREG)
+        uses[instr->a.vreg]++;
+      if (instr->b.kind == IR_OPERAND_VREG)
+        uses[instr->b.vreg]++;
+    }
+  }
+
+  return uses;
+}
+
+ht *ir_address_taken(ir_program *ir) {
+  ht *taken = ht_new(sizeof(bool));
+  bool yes = true;
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->op == IR_ADDR)
+        ht_insert(taken, instr->var->name, &yes);
+    }
+  }
+
+  return taken;
+}
+
+bool ir_rel_holds(rel_kind rel, long a, long b) {
+  switch (rel) {
+  case REL_IS_EQUAL:
+    return a == b;
+  case REL_NOT_EQUAL:
+    return a != b;
+  case REL_LESS_THAN:
+    return a < b;
+  case REL_LESS_THAN_OR_EQUAL:
+    return a <= b;
+  case REL_GREATER_THAN:
+    return a > b;
+  case REL_GREATER_THAN_OR_EQUAL:
+    return a >= b;
+  }
+  return false;
+}
+
+rel_kind ir_rel_swap(rel_kind rel) {
+  switch (rel) {
+  case REL_LESS_THAN:
+    return REL_GREATER_THAN;
+  case REL_LESS_THAN_OR_EQUAL:
+    return REL_GREATER_THAN_OR_EQUAL;
+  case REL_GREATER_THAN:
+    return REL_LESS_THAN;
+  case REL_GREATER_THAN_OR_EQUAL:
+    return REL_LESS_THAN_OR_EQUAL;
+  default:
+    return rel;
+  }
+}
+
+rel_kind ir_rel_negate(rel_kind rel) {
+  switch (rel) {
+  case REL_IS_EQUAL:
+    return REL_NOT_EQUAL;
+  case REL_NOT_EQUAL:
+    return REL_IS_EQUAL;
+  case REL_LESS_THAN:
+    return REL_GREATER_THAN_OR_EQUAL;
+  case REL_LESS_THAN_OR_EQUAL:
+    return REL_GREATER_THAN;
+  case REL_GREATER_THAN:
+    return REL_LESS_THAN_OR_EQUAL;
+  case REL_GREATER_THAN_OR_EQUAL:
+    return REL_LESS_THAN;
+  }
+  return rel;
+}
+
+bool ir_is_vreg(ir_operand op, size_t vreg) {
+  return op.kind == IR_OPERAND_VREG && op.vreg == vreg;
+}
+
+/*
+ * @brief: get the printable name of a type.
+ */
+static const char *ir_type_str(type t) {
+  switch (t) {
+  case TYPE_INT:
+    return "int";
+  case TYPE_CHAR:
+    return "char";
+  case TYPE_POINTER:
+    return "ptr";
+  case TYPE_VOID:
+    return "void";
+  }
+  return "?";
+}
+
+/*
+ * @brief: get the mnemonic of an opcode.
+ */
+static const char *ir_opcode_str(ir_opcode op) {
+  switch (op) {
+  case IR_NOP:
+    return "nop";
+  case IR_MOV:
+    return "mov";
+  case IR_ADD:
+    return "add";
+  case IR_SUB:
+    return "sub";
+  case IR_MUL:
+    return "mul";
+  case IR_MULHI:
+    return "mulhi";
+  case IR_DIV:
+    return "div";
+  case IR_MOD:
+    return "mod";
+  case IR_AND:
+    return "and";
+  case IR_SHL:
+    return "shl";
+  case IR_SAR:
+    return "sar";
+  case IR_SHR:
+    return "shr";
+  case IR_CMP:
+    return "cmp";
+  case IR_LOAD:
+    return "load";
+  case IR_STORE:
+    return "store";
+  case IR_ADDR:
+    return "addr";
+  case IR_LOAD_PTR:
+    return "load.ptr";
+  case IR_STORE_PTR:
+    return "store.ptr";
+  case IR_LOAD_ELEM:
+    return "load.elem";
+  case IR_STORE_ELEM:
+    return "store.elem";
+  case IR_VLOAD:
+    return "vload";
+  case IR_VSTORE:
+    return "vstore";
+  case IR_VSPLAT:
+    return "vsplat";
+  case IR_VADD:
+    return "vadd";
+  case IR_VSUB:
+    return "vsub";
+  case IR_VMUL:
+    return "vmul";
+  case IR_VAND:
+    return "vand";
+  case IR_VANDN:
+    return "vandn";
+  case IR_VOR:
+    return "vor";
+  case IR_VXOR:
+    return "vxor";
+  case IR_VSHL:
+    return "vshl";
+  case IR_VSHR:
+    return "vshr";
+  case IR_VCMPEQ:
+    return "vcmpeq";
+  case IR_VCMPGT:
+    return "vcmpgt";
+  case IR_VMAXU:
+    return "vmaxu";
+  case IR_VMINU:
+    return "vminu";
+  case IR_VSUMQ:
+    return "vsumq";
+  case IR_VHSUM:
+    return "vhsum";
+  case IR_VHMAXU:
+    return "vhmaxu";
+  case IR_VHMINU:
+    return "vhminu";
+  case IR_COUNT:
+    return "count";
+  case IR_FASM:
+    return "fasm";
+  case IR_JMP:
+    return "jmp";
+  case IR_BR:
+    return "br";
+  case IR_RET:
+    return "ret";
+  }
+  return "?";
+}
+
+/*
+ * @brief: get the suffix of a relational operator.
+ */
+static const char *ir_rel_str(rel_kind rel) {
+  switch (rel) {
+  case REL_IS_EQUAL:
+    return "eq";
+  case REL_NOT_EQUAL:
+    return "ne";
+  case REL_LESS_THAN:
+    return "lt";
+  case REL_LESS_THAN_OR_EQUAL:
+    return "le";
+  case REL_GREATER_THAN:
+    return "gt";
+  case REL_GREATER_THAN_OR_EQUAL:
+    return "ge";
+  }
+  return "?";
+}
+
+/*
+ * @brief: print one operand.
+ */
+static void ir_print_operand(ir_operand op) {
+  switch (op.kind) {
+  case IR_OPERAND_NONE:
+    printf("_");
+    break;
+  case IR_OPERAND_VREG:
+    printf("%%%zu", op.vreg);
+    break;
+  case IR_OPERAND_IMM:
+    printf("%ld", op.imm);
+    break;
+  case IR_OPERAND_VEC:
+    printf("v%zu", op.vec);
+    break;
+  }
+}
+
+/*
+ * @brief: print one instruction, indented, on its own line.
+ */
+static void ir_print_instr(ir_instr *instr) {
+  printf("    ");
+
+  if (instr->dst.kind == IR_OPERAND_VREG) {
+    ir_print_operand(instr->dst);
+    printf(":%s = ", ir_type_str(instr->type));
+  } else if (instr->dst.kind == IR_OPERAND_VEC) {
+    ir_print_operand(instr->dst);
+    printf(" = ");
+  }
+
+  printf("%s", ir_opcode_str(instr->op));
+  if (instr->op == IR_CMP || instr->op == IR_BR)
+    printf(".%s", ir_rel_str(instr->rel));
+  if (instr->lanes)
+    printf(".x%u", instr->lanes);
+
+  switch (instr->op) {
+  case IR_NOP:
+  case IR_RET:
+    break;
+
+  case IR_MOV:
+  case IR_LOAD_PTR:
+  case IR_COUNT:
+  case IR_VSPLAT:
+  case IR_VHSUM:
+  case IR_VHMAXU:
+  case IR_VHMINU:
+    printf(" ");
+    ir_print_operand(instr->a);
+    break;
+
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_MULHI:
+  case IR_DIV:
+  case IR_MOD:
+  case IR_AND:
+  case IR_SHL:
+  case IR_SAR:
+  case IR_SHR:
+  case IR_CMP:
+  case IR_STORE_PTR:
+  case IR_VADD:
+  case IR_VSUB:
+  case IR_VMUL:
+  case IR_VAND:
+  case IR_VANDN:
+  case IR_VOR:
+  case IR_VXOR:
+  case IR_VSHL:
+  case IR_VSHR:
+  case IR_VCMPEQ:
+  case IR_VCMPGT:
+  case IR_VMAXU:
+  case IR_VMINU:
+  case IR_VSUMQ:
+    printf(" ");
+    ir_print_operand(instr->a);
+    printf(", ");
+    ir_print_operand(instr->b);
+    break;
+
+  case IR_LOAD:
+  case IR_ADDR:
+    printf(" %s", instr->var->name);
+    break;
+
+  case IR_STORE:
+    printf(" %s, ", instr->var->name);
+    ir_print_operand(instr->a);
+    break;
+
+  case IR_LOAD_ELEM:
+  case IR_VLOAD:
+    printf(" %s[", instr->var->name);
+    ir_print_operand(instr->a);
+    printf("]");
+    break;
+
+  case IR_STORE_ELEM:
+  case IR_VSTORE:
+    printf(" %s[", instr->var->name);
+    ir_print_operand(instr->a);
+    printf("], ");
+    ir_print_operand(instr->b);
+    break;
+
+  case IR_FASM:
+    printf(" \"%s\"", instr->content);
+    if (instr->var)
+      printf(", %s", instr->var->name);
+    break;
+
+  case IR_JMP:
+    printf(" bb%zu", instr->target->id);
+    break;
+
+  case IR_BR:
+    printf(" ");
+    ir_print_operand(instr->a);
+    printf(", ");
+    ir_print_operand(instr->b);
+    printf(", bb%zu, bb%zu", instr->target->id, instr->alt->id);
+    break;
+  }
+
+  printf("\n");
+}
+
+void ir_print(ir_program *ir) {
+  printf("IR: %zu blocks, %zu vregs, frame %zu bytes\n", ir->blocks.count,
+         ir->vregs.count, ir->frame_size);
+
+  for (size_t v = 0; v < ir->vregs.count; v++) {
+    ir_vreg *info = ir_vreg_at(ir, v);
+    if (info->var)
+      printf("    %%%zu <- %s\n", v, info->var->name);
+  }
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+
+    printf("bb%zu:", block->id);
+    if (block->label)
+      printf("  ; .%s", block->label);
+    printf("\n");
+
+    for (size_t j = 0; j < block->instrs.count; j++)
+      ir_print_instr(dynamic_array_at(&block->instrs, j));
+  }
+}
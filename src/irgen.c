@@ -0,0 +1,425 @@
+#include "irgen.h"
+#include "ast.h"
+#include "ds/dynamic_array.h"
+#include "ds/ht.h"
+#include "ds/stack.h"
+#include "ir.h"
+
+#include <stddef.h>
+
+/*
+ * @struct irgen_loop: jump targets of the innermost enclosing loop.
+ */
+typedef struct irgen_loop {
+  ir_block *continue_to;
+  ir_block *break_to;
+} irgen_loop;
+
+/*
+ * @struct irgen: state of the AST -> IR lowering.
+ */
+typedef struct irgen {
+  ir_program *ir;
+  ir_block *current; // <-- block new instructions are appended to
+  stack loops;       // <-- irgen_loop
+  ht *labels;        // <-- label name -> ir_block *
+} irgen;
+
+/*
+ * @brief: lower an expression to an operand. (declaration)
+ */
+static ir_operand expr_ir(irgen *g, expr_node *expr);
+
+/*
+ * @brief: lower a dynamic_array of instructions. (declaration)
+ */
+static void instrs_ir(irgen *g, dynamic_array *instrs);
+
+/*
+ * @brief: make block the current one and append it to the layout.
+ */
+static void start_block(irgen *g, ir_block *block) {
+  ir_place_block(g->ir, block);
+  g->current = block;
+}
+
+/*
+ * @brief: append an instruction to the current block. Anything after a
+ * terminator goes to a fresh block that nothing jumps to (yet).
+ */
+static void emit(irgen *g, ir_instr instr) {
+  if (ir_terminator(g->current))
+    start_block(g, ir_block_new(g->ir, NULL));
+
+  dynamic_array_append(&g->current->instrs, &instr);
+}
+
+/*
+ * @brief: append an instruction producing a value into a fresh vreg.
+ *
+ * @return: the destination vreg.
+ */
+static ir_operand emit_value(irgen *g, ir_instr instr) {
+  instr.dst = ir_new_vreg(g->ir, instr.type);
+  emit(g, instr);
+  return instr.dst;
+}
+
+/*
+ * @brief: end the current block with a jump to target.
+ */
+static void emit_jmp(irgen *g, ir_block *target, size_t line) {
+  emit(g, (ir_instr){.op = IR_JMP, .type = TYPE_VOID, .line = line,
+                     .target = target});
+}
+
+/*
+ * @brief: fall through (jump) into block and continue emitting there.
+ */
+static void enter_block(irgen *g, ir_block *block, size_t line) {
+  if (!ir_terminator(g->current))
+    emit_jmp(g, block, line);
+  start_block(g, block);
+}
+
+/*
+ * @brief: get the block that starts at a user label, creating it on the first
+ * reference so forward gotos work.
+ */
+static ir_block *label_block(irgen *g, const char *label) {
+  ir_block **found = ht_search(g->labels, label);
+  if (found)
+    return *found;
+
+  ir_block *block = ir_block_new(g->ir, label);
+  ht_insert(g->labels, label, &block);
+  return block;
+}
+
+/*
+ * @brief: lower a term to an operand. Literals become immediates.
+ */
+static ir_operand term_ir(irgen *g, term_node *term) {
+  switch (term->kind) {
+  case TERM_INT:
+    return ir_imm(term->value.integer);
+
+  case TERM_CHAR:
+    return ir_imm(term->value.character);
+
+  case TERM_IDENTIFIER: {
+    variable *sym = term->identifier.symbol;
+    if (sym->is_array)
+      return emit_value(g, (ir_instr){.op = IR_ADDR, .type = TYPE_POINTER,
+                                      .line = term->line, .var = sym});
+    return emit_value(g, (ir_instr){.op = IR_LOAD, .type = sym->type,
+                                    .line = term->line, .var = sym});
+  }
+
+  case TERM_DEREF: {
+    variable *sym = term->identifier.symbol;
+    ir_operand ptr = emit_value(g, (ir_instr){.op = IR_LOAD,
+                                              .type = TYPE_POINTER,
+                                              .line = term->line,
+                                              .var = sym});
+    return emit_value(g, (ir_instr){.op = IR_LOAD_PTR, .type = term->type,
+                                    .line = term->line, .a = ptr});
+  }
+
+  case TERM_ADDOF:
+    return emit_value(g, (ir_instr){.op = IR_ADDR, .type = TYPE_POINTER,
+                                    .line = term->line,
+                                    .var = term->identifier.symbol});
+
+  case TERM_ARRAY_ACCESS: {
+    ir_operand index = expr_ir(g, term->array_access.index_expr);
+    return emit_value(g, (ir_instr){.op = IR_LOAD_ELEM, .type = term->type,
+                                    .line = term->line,
+                                    .var = term->array_access.array_var.symbol,
+                                    .a = index});
+  }
+
+  case TERM_POINTER:
+  case TERM_ARRAY_LITERAL:
+    break;
+  }
+
+  return ir_imm(0);
+}
+
+/*
+ * @brief: Sethi-Ullman number of an expression: how many registers it needs
+ * to be evaluated without spilling. Literals fold into the instruction that
+ * uses them and need none.
+ */
+static unsigned int expr_need(expr_node *expr) {
+  if (expr->kind == EXPR_TERM)
+    return expr->term.kind == TERM_INT || expr->term.kind == TERM_CHAR ? 0 : 1;
+
+  unsigned int left = expr_need(expr->binary.left);
+  unsigned int right = expr_need(expr->binary.right);
+  if (left == right)
+    return left + 1;
+  return left > right ? left : right;
+}
+
+/*
+ * @brief: lower an expression to an operand. (definition)
+ *
+ * The operand needing more registers is evaluated first, so the value of the
+ * other one is held for as short as possible. Expressions have no side
+ * effects, so the order is free.
+ */
+static ir_operand expr_ir(irgen *g, expr_node *expr) {
+  ir_opcode op = IR_NOP;
+
+  switch (expr->kind) {
+  case EXPR_TERM:
+    return term_ir(g, &expr->term);
+  case EXPR_ADD:
+    op = IR_ADD;
+    break;
+  case EXPR_SUBTRACT:
+    op = IR_SUB;
+    break;
+  case EXPR_MULTIPLY:
+    op = IR_MUL;
+    break;
+  case EXPR_DIVIDE:
+    op = IR_DIV;
+    break;
+  case EXPR_MODULO:
+    op = IR_MOD;
+    break;
+  }
+
+  ir_operand left, right;
+  if (expr_need(expr->binary.right) > expr_need(expr->binary.left)) {
+    right = expr_ir(g, expr->binary.right);
+    left = expr_ir(g, expr->binary.left);
+  } else {
+    left = expr_ir(g, expr->binary.left);
+    right = expr_ir(g, expr->binary.right);
+  }
+
+  return emit_value(g, (ir_instr){.op = op, .type = expr->type,
+                                  .line = expr->line, .a = left,
+                                  .b = right});
+}
+
+/*
+ * @brief: lower a relational expression to a 0 / 1 vreg.
+ */
+static ir_operand rel_ir(irgen *g, rel_node *rel) {
+  ir_operand lhs = term_ir(g, &rel->comparison.lhs);
+  ir_operand rhs = term_ir(g, &rel->comparison.rhs);
+  return emit_value(g, (ir_instr){.op = IR_CMP, .type = TYPE_INT,
+                                  .line = rel->line, .rel = rel->kind,
+                                  .a = lhs, .b = rhs});
+}
+
+/*
+ * @brief: lower "if rel goto then else goto other" as a branch on the 0 / 1
+ * value of rel. The fuse pass moves the comparison into the branch.
+ */
+static void branch_ir(irgen *g, rel_node *rel, ir_block *then,
+                      ir_block *other) {
+  ir_operand cond = rel_ir(g, rel);
+  emit(g, (ir_instr){.op = IR_BR, .type = TYPE_VOID, .line = rel->line,
+                     .a = cond, .b = ir_imm(0), .rel = REL_NOT_EQUAL,
+                     .target = then, .alt = other});
+}
+
+/*
+ * @brief: lower a loop.
+ *
+ * unconditional: head: body; end
+ * while:         head: br cond, body, end; body: ...; jmp head; end
+ * do-while:      body: ...; test: br cond, body, end; end
+ *
+ * The rotate pass turns while loops into the do-while shape.
+ */
+static void loop_ir(irgen *g, instr_node *instr) {
+  loop_node *loop = &instr->loop;
+  ir_block *end = ir_block_new(g->ir, NULL);
+  irgen_loop targets = {.break_to = end};
+
+  switch (loop->kind) {
+  case LOOP_UNCONDITIONAL: {
+    ir_block *head = ir_block_new(g->ir, NULL);
+    targets.continue_to = head;
+    enter_block(g, head, instr->line);
+
+    stack_push(&g->loops, &targets);
+    instrs_ir(g, &loop->instrs);
+    stack_pop(&g->loops, &targets);
+    break;
+  }
+
+  case LOOP_WHILE: {
+    ir_block *head = ir_block_new(g->ir, NULL);
+    ir_block *body = ir_block_new(g->ir, NULL);
+    targets.continue_to = head;
+    enter_block(g, head, instr->line);
+    branch_ir(g, &loop->break_condition, body, end);
+    start_block(g, body);
+
+    stack_push(&g->loops, &targets);
+    instrs_ir(g, &loop->instrs);
+    stack_pop(&g->loops, &targets);
+
+    emit_jmp(g, head, instr->line);
+    break;
+  }
+
+  case LOOP_DO_WHILE: {
+    ir_block *body = ir_block_new(g->ir, NULL);
+    ir_block *test = ir_block_new(g->ir, NULL);
+    targets.continue_to = test;
+    enter_block(g, body, instr->line);
+
+    stack_push(&g->loops, &targets);
+    instrs_ir(g, &loop->instrs);
+    stack_pop(&g->loops, &targets);
+
+    enter_block(g, test, instr->line);
+    branch_ir(g, &loop->break_condition, body, end);
+    break;
+  }
+  }
+
+  enter_block(g, end, instr->line);
+}
+
+/*
+ * @brief: lower a single instruction.
+ */
+static void instr_ir(irgen *g, instr_node *instr) {
+  switch (instr->kind) {
+  case INSTR_DECLARE:
+  case INSTR_DECLARE_ARRAY:
+    break;
+
+  case INSTR_INITIALIZE: {
+    ir_operand value = expr_ir(g, &instr->initialize_variable.expr);
+    variable *sym = instr->initialize_variable.var.symbol;
+    emit(g, (ir_instr){.op = IR_STORE, .type = sym->type, .line = instr->line,
+                       .var = sym, .a = value});
+    break;
+  }
+
+  case INSTR_ASSIGN: {
+    ir_operand value = expr_ir(g, &instr->assign.expr);
+    variable *sym = instr->assign.identifier.symbol;
+
+    if (instr->assign.identifier.type == TYPE_POINTER) {
+      // *p = expr
+      ir_operand ptr = emit_value(g, (ir_instr){.op = IR_LOAD,
+                                                .type = TYPE_POINTER,
+                                                .line = instr->line,
+                                                .var = sym});
+      emit(g, (ir_instr){.op = IR_STORE_PTR, .type = instr->assign.expr.type,
+                         .line = instr->line, .a = ptr, .b = value});
+    } else {
+      emit(g, (ir_instr){.op = IR_STORE, .type = sym->type,
+                         .line = instr->line, .var = sym, .a = value});
+    }
+    break;
+  }
+
+  case INSTR_ASSIGN_TO_ARRAY_SUBSCRIPT: {
+    assign_to_array_subscript_node *node = &instr->assign_to_array_subscript;
+    ir_operand value = expr_ir(g, &node->expr_to_assign);
+    ir_operand index = expr_ir(g, node->index_expr);
+    emit(g, (ir_instr){.op = IR_STORE_ELEM, .type = node->expr_to_assign.type,
+                       .line = instr->line, .var = node->var.symbol,
+                       .a = index, .b = value});
+    break;
+  }
+
+  case INSTR_INITIALIZE_ARRAY: {
+    initialize_array_node *node = &instr->initialize_array;
+    for (size_t i = 0; i < node->literal.elements.count; i++) {
+      expr_node *elem = dynamic_array_at(&node->literal.elements, i);
+      ir_operand value = expr_ir(g, elem);
+      emit(g, (ir_instr){.op = IR_STORE_ELEM, .type = elem->type,
+                         .line = instr->line, .var = node->var.symbol,
+                         .a = ir_imm(i), .b = value});
+    }
+    break;
+  }
+
+  case INSTR_IF: {
+    ir_block *then = ir_block_new(g->ir, NULL);
+    ir_block *end = ir_block_new(g->ir, NULL);
+    branch_ir(g, &instr->if_.rel, then, end);
+    start_block(g, then);
+
+    if (instr->if_.kind == IF_SINGLE_INSTR)
+      instr_ir(g, instr->if_.instr);
+    else
+      instrs_ir(g, &instr->if_.instrs);
+
+    enter_block(g, end, instr->line);
+    break;
+  }
+
+  case INSTR_GOTO:
+    emit_jmp(g, label_block(g, instr->goto_.label), instr->line);
+    break;
+
+  case INSTR_LABEL:
+    enter_block(g, label_block(g, instr->label.label), instr->line);
+    break;
+
+  case INSTR_FASM_DEFINE:
+    dynamic_array_append(&g->ir->defines, &instr->fasm_def.content);
+    break;
+
+  case INSTR_FASM:
+    emit(g, (ir_instr){.op = IR_FASM, .type = TYPE_VOID, .line = instr->line,
+                       .content = instr->fasm.content,
+                       .var = instr->fasm.kind == FASM_PAR
+                                  ? instr->fasm.argument.symbol
+                                  : NULL});
+    break;
+
+  case INSTR_LOOP:
+    loop_ir(g, instr);
+    break;
+
+  case INSTR_LOOP_BREAK: {
+    irgen_loop *loop = stack_top(&g->loops);
+    emit_jmp(g, loop->break_to, instr->line);
+    break;
+  }
+
+  case INSTR_LOOP_CONTINUE: {
+    irgen_loop *loop = stack_top(&g->loops);
+    emit_jmp(g, loop->continue_to, instr->line);
+    break;
+  }
+  }
+}
+
+/*
+ * @brief: lower a dynamic_array of instructions. (definition)
+ */
+static void instrs_ir(irgen *g, dynamic_array *instrs) {
+  for (size_t i = 0; i < instrs->count; i++)
+    instr_ir(g, dynamic_array_at(instrs, i));
+}
+
+ir_program *ir_from_ast(program_node *program) {
+  irgen g = {.ir = ir_new(program->frame_size)};
+  stack_init(&g.loops, sizeof(irgen_loop));
+  g.labels = ht_new(sizeof(ir_block *));
+
+  start_block(&g, ir_block_new(g.ir, NULL));
+  instrs_ir(&g, &program->instrs);
+  emit(&g, (ir_instr){.op = IR_RET, .type = TYPE_VOID});
+
+  stack_free(&g.loops);
+  ht_del_ht(g.labels);
+  return g.ir;
+}
@@ -0,0 +1,237 @@
+#include "opt/counted.h"
+#include "cfg.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "utils.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+size_t counted_position(counted_loop *cl, ir_block *block) {
+  for (size_t i = 0; i < cl->count; i++)
+    if (cl->blocks[i] == block)
+      return i;
+  return SIZE_MAX;
+}
+
+bool counted_innermost(cfg *g, size_t index) {
+  for (size_t i = 0; i < g->loops.count; i++)
+    if (cfg_loop_at(g, i)->parent == index)
+      return false;
+  return true;
+}
+
+/*
+ * @brief: find the update iv = iv + step of a loop, which must be the only
+ * definition of iv in it and run on every iteration.
+ */
+static bool find_step(cfg *g, counted_loop *cl) {
+  ir_instr *update = NULL;
+  size_t block = 0;
+
+  for (size_t i = 0; i < cl->count; i++) {
+    dynamic_array *instrs = &cl->blocks[i]->instrs;
+    for (size_t j = 0; j < instrs->count; j++) {
+      ir_instr *instr = dynamic_array_at(instrs, j);
+      if (!ir_is_vreg(instr->dst, cl->iv))
+        continue;
+      if (update)
+        return false;
+      update = instr;
+      block = i;
+    }
+  }
+
+  if (!update ||
+      !cfg_dominates(g, cl->blocks[block]->index, cl->blocks[cl->latch]->index))
+    return false;
+
+  if (update->op == IR_ADD && ir_is_vreg(update->a, cl->iv) &&
+      update->b.kind == IR_OPERAND_IMM)
+    cl->step = update->b.imm;
+  else if (update->op == IR_ADD && ir_is_vreg(update->b, cl->iv) &&
+           update->a.kind == IR_OPERAND_IMM)
+    cl->step = update->a.imm;
+  else if (update->op == IR_SUB && ir_is_vreg(update->a, cl->iv) &&
+           update->b.kind == IR_OPERAND_IMM && update->b.imm != LONG_MIN)
+    cl->step = -update->b.imm;
+  else
+    return false;
+
+  switch (cl->rel) {
+  case REL_LESS_THAN:
+  case REL_LESS_THAN_OR_EQUAL:
+    return cl->step > 0;
+  case REL_GREATER_THAN:
+  case REL_GREATER_THAN_OR_EQUAL:
+    return cl->step < 0;
+  default:
+    return false;
+  }
+}
+
+/*
+ * @brief: check whether an operand is defined inside the loop.
+ */
+static bool defined_in(counted_loop *cl, ir_operand op) {
+  if (op.kind != IR_OPERAND_VREG)
+    return false;
+
+  for (size_t i = 0; i < cl->count; i++) {
+    dynamic_array *instrs = &cl->blocks[i]->instrs;
+    for (size_t j = 0; j < instrs->count; j++) {
+      ir_instr *instr = dynamic_array_at(instrs, j);
+      if (ir_is_vreg(instr->dst, op.vreg))
+        return true;
+    }
+  }
+  return false;
+}
+
+bool counted_analyze(ir_program *ir, cfg *g, size_t index, counted_loop *cl) {
+  cfg_loop *loop = cfg_loop_at(g, index);
+  *cl = (counted_loop){0};
+  dynamic_array_init(&cl->entries, sizeof(size_t));
+
+  if (!counted_innermost(g, index) || loop->latches.count != 1)
+    goto fail;
+
+  cl->blocks = scu_checked_malloc(g->block_count * sizeof(ir_block *));
+  for (size_t i = 0; i < g->block_count; i++) {
+    if (!bitset_test(&loop->blocks, i))
+      continue;
+
+    ir_block *block = ir_block_at(ir, i);
+    if (block == loop->header)
+      cl->header = cl->count;
+    cl->blocks[cl->count++] = block;
+  }
+
+  size_t latch;
+  dynamic_array_get(&loop->latches, 0, &latch);
+  cl->latch = counted_position(cl, ir_block_at(ir, latch));
+
+  ir_instr *test = ir_terminator(cl->blocks[cl->latch]);
+  if (test->op != IR_BR || test->target != loop->header ||
+      counted_position(cl, test->alt) != SIZE_MAX)
+    goto fail;
+  cl->exit = test->alt;
+  cl->line = test->line;
+
+  if (defined_in(cl, test->a)) {
+    cl->iv = test->a.vreg;
+    cl->bound = test->b;
+    cl->rel = test->rel;
+  } else if (defined_in(cl, test->b)) {
+    cl->iv = test->b.vreg;
+    cl->bound = test->a;
+    cl->rel = ir_rel_swap(test->rel);
+  } else {
+    goto fail;
+  }
+  if (defined_in(cl, cl->bound) || !find_step(g, cl))
+    goto fail;
+
+  dynamic_array *preds = &g->preds[loop->header->index];
+  for (size_t p = 0; p < preds->count; p++) {
+    size_t pred;
+    dynamic_array_get(preds, p, &pred);
+    if (cfg_reachable(g, pred) && !bitset_test(&loop->blocks, pred))
+      dynamic_array_append(&cl->entries, &pred);
+  }
+  return true;
+
+fail:
+  counted_free(cl);
+  return false;
+}
+
+void counted_free(counted_loop *cl) {
+  free(cl->blocks);
+  cl->blocks = NULL;
+  dynamic_array_free(&cl->entries);
+}
+
+ir_block *counted_test_block(ir_program *ir, counted_loop *cl, ir_operand a,
+                             rel_kind rel, ir_operand b, ir_block *target,
+                             ir_block *alt) {
+  ir_block *block = ir_block_new(ir, NULL);
+  ir_instr br = {.op = IR_BR,
+                 .type = TYPE_VOID,
+                 .line = cl->line,
+                 .a = a,
+                 .b = b,
+                 .rel = rel,
+                 .target = target,
+                 .alt = alt};
+  dynamic_array_append(&block->instrs, &br);
+  return block;
+}
+
+bool counted_enter(ir_program *ir, counted_loop *cl, long distance,
+                   ir_block **guard, ir_block **pre, ir_operand *limit) {
+  if (cl->bound.kind == IR_OPERAND_IMM) {
+    long value;
+    if (__builtin_sub_overflow(cl->bound.imm, distance, &value))
+      return false;
+    *limit = ir_imm(value);
+  } else {
+    *limit = ir_new_vreg(ir, ir_vreg_at(ir, cl->iv)->type);
+  }
+
+  ir_block *header = cl->blocks[cl->header];
+
+  *guard = NULL;
+  if (cl->bound.kind == IR_OPERAND_VREG) {
+    // bound - distance must not wrap around
+    rel_kind rel = cl->step > 0 ? REL_GREATER_THAN_OR_EQUAL
+                                : REL_LESS_THAN_OR_EQUAL;
+    long edge = cl->step > 0 ? LONG_MIN + distance : LONG_MAX + distance;
+    *guard = counted_test_block(ir, cl, cl->bound, rel, ir_imm(edge), NULL,
+                                header);
+  }
+
+  *pre = counted_test_block(ir, cl,
+                            (ir_operand){.kind = IR_OPERAND_VREG,
+                                         .vreg = cl->iv},
+                            cl->rel, *limit, NULL, header);
+  if (limit->kind == IR_OPERAND_VREG) {
+    ir_instr sub = {.op = IR_SUB,
+                    .type = ir_vreg_at(ir, cl->iv)->type,
+                    .line = cl->line,
+                    .dst = *limit,
+                    .a = cl->bound,
+                    .b = ir_imm(distance)};
+    dynamic_array_insert(&(*pre)->instrs, 0, &sub);
+  }
+  if (*guard)
+    ir_terminator(*guard)->target = *pre;
+  return true;
+}
+
+void counted_redirect_entries(ir_program *ir, counted_loop *cl, ir_block *to) {
+  ir_block *header = cl->blocks[cl->header];
+  for (size_t p = 0; p < cl->entries.count; p++) {
+    size_t index;
+    dynamic_array_get(&cl->entries, p, &index);
+    ir_instr *term = ir_terminator(ir_block_at(ir, index));
+    if (term->target == header)
+      term->target = to;
+    if (term->op == IR_BR && term->alt == header)
+      term->alt = to;
+  }
+}
+
+void counted_insert_before(ir_program *ir, counted_loop *cl, ir_block **blocks,
+                           size_t count) {
+  ir_block *header = cl->blocks[cl->header];
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    if (ir_block_at(ir, i) != header)
+      continue;
+    for (size_t b = 0; b < count; b++)
+      ir_insert_block(ir, i + b, blocks[b]);
+    return;
+  }
+}
@@ -0,0 +1,263 @@
+#include "opt/dce.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ds/ht.h"
+#include "ir.h"
+#include "opt/liveness.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * @brief: turn branches whose outcome is known into jumps.
+ *
+ * @return: number of rewritten branches.
+ */
+static size_t fold_branches(ir_program *ir) {
+  size_t folded = 0;
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_instr *term = ir_terminator(ir_block_at(ir, i));
+    if (!term || term->op != IR_BR)
+      continue;
+
+    bool constant =
+        term->a.kind == IR_OPERAND_IMM && term->b.kind == IR_OPERAND_IMM;
+    if (!constant && term->target != term->alt)
+      continue;
+
+    if (constant && !ir_rel_holds(term->rel, term->a.imm, term->b.imm))
+      term->target = term->alt;
+    term->op = IR_JMP;
+    term->a = term->b = (ir_operand){0};
+    term->alt = NULL;
+    folded++;
+  }
+
+  return folded;
+}
+
+/*
+ * @brief: remove the blocks that neither the entry nor a block with a fasm
+ * statement reaches.
+ *
+ * @return: number of removed blocks.
+ */
+static size_t remove_unreachable(ir_program *ir) {
+  size_t n = ir->blocks.count;
+  ir_renumber(ir);
+
+  bool *live = scu_checked_malloc((n + 1) * sizeof(bool));
+  dynamic_array work;
+  dynamic_array_init(&work, sizeof(size_t));
+
+  for (size_t i = 0; i < n; i++) {
+    if (i == 0 || ir_has_fasm(ir_block_at(ir, i))) {
+      live[i] = true;
+      dynamic_array_append(&work, &i);
+    }
+  }
+
+  while (work.count > 0) {
+    size_t b;
+    dynamic_array_pop(&work, &b);
+
+    ir_block *succ[2];
+    size_t count = ir_successors(ir_block_at(ir, b), succ);
+    for (size_t s = 0; s < count; s++) {
+      size_t index = succ[s]->index;
+      if (!live[index]) {
+        live[index] = true;
+        dynamic_array_append(&work, &index);
+      }
+    }
+  }
+
+  size_t removed = 0;
+  for (size_t i = n; i-- > 0;) {
+    if (!live[i]) {
+      ir_remove_block(ir, i);
+      removed++;
+    }
+  }
+
+  dynamic_array_free(&work);
+  free(live);
+  return removed;
+}
+
+/*
+ * @brief: check whether removing an instruction can only change the vreg it
+ * writes. A division that would fault goes away with it, as it would in C.
+ */
+static bool is_pure(ir_opcode op) {
+  switch (op) {
+  case IR_MOV:
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_MULHI:
+  case IR_DIV:
+  case IR_MOD:
+  case IR_AND:
+  case IR_SHL:
+  case IR_SAR:
+  case IR_SHR:
+  case IR_CMP:
+  case IR_LOAD:
+  case IR_ADDR:
+  case IR_LOAD_PTR:
+  case IR_LOAD_ELEM:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * @brief: remove the pure instructions whose result is dead, walking every
+ * block backwards from its live-out set.
+ *
+ * @return: number of removed instructions.
+ */
+static size_t remove_dead_values(ir_program *ir) {
+  liveness lv;
+  liveness_compute(ir, &lv);
+
+  bitset live;
+  bitset_init(&live, ir->vregs.count);
+
+  size_t removed = 0;
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    bitset_copy(&live, &lv.live_out[i]);
+
+    for (size_t j = block->instrs.count; j-- > 0;) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+
+      if (instr->dst.kind == IR_OPERAND_VREG) {
+        if (is_pure(instr->op) && !bitset_test(&live, instr->dst.vreg)) {
+          dynamic_array_remove(&block->instrs, j);
+          removed++;
+          continue;
+        }
+        bitset_clear(&live, instr->dst.vreg);
+      }
+
+      if (instr->a.kind == IR_OPERAND_VREG)
+        bitset_set(&live, instr->a.vreg);
+      if (instr->b.kind == IR_OPERAND_VREG)
+        bitset_set(&live, instr->b.vreg);
+    }
+  }
+
+  bitset_free(&live);
+  liveness_free(&lv);
+  return removed;
+}
+
+/*
+ * @brief: check whether an instruction may read any variable in memory,
+ * whatever it names.
+ */
+static bool reads_any_var(ir_instr *instr) {
+  return instr->op == IR_FASM || instr->op == IR_LOAD_PTR ||
+         instr->op == IR_STORE_PTR;
+}
+
+/*
+ * @brief: collect the names of the variables and arrays that are read
+ * somewhere. fasm parameters and variables whose address is taken count as
+ * read.
+ *
+ * @return: table of names, or NULL when every variable must be assumed read
+ * (a fasm statement without parameter may address any of them).
+ */
+static ht *read_vars(ir_program *ir) {
+  ht *read = ht_new(sizeof(bool));
+  bool yes = true;
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->op == IR_FASM && !instr->var) {
+        ht_del_ht(read);
+        return NULL;
+      }
+      if (instr->var && (instr->op == IR_LOAD || instr->op == IR_LOAD_ELEM ||
+                         instr->op == IR_VLOAD || instr->op == IR_ADDR ||
+                         instr->op == IR_FASM))
+        ht_insert(read, instr->var->name, &yes);
+    }
+  }
+
+  return read;
+}
+
+/*
+ * @brief: check whether the store at j is overwritten later in its block
+ * before anything could read the variable.
+ */
+static bool overwritten_later(ir_block *block, size_t j) {
+  ir_instr *store = dynamic_array_at(&block->instrs, j);
+
+  for (size_t k = j + 1; k < block->instrs.count; k++) {
+    ir_instr *instr = dynamic_array_at(&block->instrs, k);
+    if (reads_any_var(instr) || ir_is_terminator(instr->op))
+      return false;
+    if (instr->var && strcmp(instr->var->name, store->var->name) == 0)
+      return instr->op == IR_STORE; // <-- or a load / &var
+  }
+  return false;
+}
+
+/*
+ * @brief: remove stores to variables and arrays that are never read, and
+ * stores to a variable overwritten before the next possible read.
+ *
+ * @return: number of removed stores.
+ */
+static size_t remove_dead_stores(ir_program *ir) {
+  ht *read = read_vars(ir);
+
+  size_t removed = 0;
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = block->instrs.count; j-- > 0;) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->op != IR_STORE && instr->op != IR_STORE_ELEM)
+        continue;
+
+      bool never_read = read && !ht_search(read, instr->var->name);
+      if (never_read ||
+          (instr->op == IR_STORE && overwritten_later(block, j))) {
+        dynamic_array_remove(&block->instrs, j);
+        removed++;
+      }
+    }
+  }
+
+  if (read)
+    ht_del_ht(read);
+  return removed;
+}
+
+void eliminate_dead_code(ir_program *ir, dce_stats *stats) {
+  *stats = (dce_stats){0};
+
+  bool changed = true;
+  while (changed) {
+    size_t branches = fold_branches(ir);
+    size_t blocks = remove_unreachable(ir);
+    size_t stores = remove_dead_stores(ir);
+    size_t instrs = remove_dead_values(ir);
+
+    stats->branches += branches;
+    stats->blocks += blocks;
+    stats->stores += stores;
+    stats->instrs += instrs;
+    changed = branches || blocks || stores || instrs;
+  }
+}
@@ -0,0 +1,305 @@
+#include "opt/fold.h"
+#include "ast.h"
+#include "ds/dynamic_array.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/*
+ * @brief: check if an expression is an int or char literal.
+ */
+static bool is_const(expr_node *expr) {
+  return expr->kind == EXPR_TERM &&
+         (expr->term.kind == TERM_INT || expr->term.kind == TERM_CHAR);
+}
+
+/*
+ * @brief: get the value of an int or char literal expression.
+ */
+static long const_value(expr_node *expr) {
+  if (expr->term.kind == TERM_CHAR)
+    return expr->term.value.character;
+  return expr->term.value.integer;
+}
+
+/*
+ * @brief: check if a value can be stored in a literal of type t without
+ * changing what codegen would load into rax.
+ */
+static bool fits(long value, type t) {
+  if (t == TYPE_CHAR)
+    return value >= CHAR_MIN && value <= CHAR_MAX;
+  return value >= INT_MIN && value <= INT_MAX;
+}
+
+/*
+ * @brief: check if an expression contains a division or modulo, which might
+ * trap at runtime and therefore must not be folded away.
+ */
+static bool may_trap(expr_node *expr) {
+  switch (expr->kind) {
+  case EXPR_TERM:
+    if (expr->term.kind == TERM_ARRAY_ACCESS)
+      return may_trap(expr->term.array_access.index_expr);
+    return false;
+  case EXPR_DIVIDE:
+  case EXPR_MODULO:
+    return true;
+  case EXPR_ADD:
+  case EXPR_SUBTRACT:
+  case EXPR_MULTIPLY:
+    return may_trap(expr->binary.left) || may_trap(expr->binary.right);
+  }
+  return true;
+}
+
+/*
+ * @brief: structural equality of two expressions. Only used for x - x, so
+ * variables compare by their resolved symbol.
+ */
+static bool expr_equal(expr_node *a, expr_node *b) {
+  if (a->kind != b->kind)
+    return false;
+
+  if (a->kind != EXPR_TERM) {
+    return expr_equal(a->binary.left, b->binary.left) &&
+           expr_equal(a->binary.right, b->binary.right);
+  }
+
+  if (a->term.kind != b->term.kind)
+    return false;
+
+  switch (a->term.kind) {
+  case TERM_INT:
+  case TERM_CHAR:
+    return const_value(a) == const_value(b);
+  case TERM_IDENTIFIER:
+  case TERM_DEREF:
+  case TERM_ADDOF:
+    return a->term.identifier.symbol == b->term.identifier.symbol;
+  case TERM_ARRAY_ACCESS:
+    return a->term.array_access.array_var.symbol ==
+               b->term.array_access.array_var.symbol &&
+           expr_equal(a->term.array_access.index_expr,
+                      b->term.array_access.index_expr);
+  default:
+    return false;
+  }
+}
+
+/*
+ * @brief: free the malloc'd children of an expression that is being replaced.
+ */
+static void free_children(expr_node *expr) {
+  switch (expr->kind) {
+  case EXPR_TERM:
+    if (expr->term.kind == TERM_ARRAY_ACCESS) {
+      free_children(expr->term.array_access.index_expr);
+      free(expr->term.array_access.index_expr);
+    }
+    break;
+  case EXPR_ADD:
+  case EXPR_SUBTRACT:
+  case EXPR_MULTIPLY:
+  case EXPR_DIVIDE:
+  case EXPR_MODULO:
+    free_children(expr->binary.left);
+    free_children(expr->binary.right);
+    free(expr->binary.left);
+    free(expr->binary.right);
+    break;
+  }
+}
+
+/*
+ * @brief: turn an expression into a literal of its own type.
+ */
+static void make_const(expr_node *expr, long value) {
+  free_children(expr);
+
+  type t = expr->type;
+  expr->kind = EXPR_TERM;
+  expr->term.line = expr->line;
+  expr->term.type = t;
+  if (t == TYPE_CHAR) {
+    expr->term.kind = TERM_CHAR;
+    expr->term.value.character = (char)value;
+  } else {
+    expr->term.kind = TERM_INT;
+    expr->term.value.integer = (int)value;
+  }
+}
+
+/*
+ * @brief: replace a binary expression by one of its operands, dropping the
+ * other one.
+ */
+static void replace_with(expr_node *expr, expr_node *keep) {
+  expr_node *drop =
+      keep == expr->binary.left ? expr->binary.right : expr->binary.left;
+  free_children(drop);
+  free(drop);
+
+  *expr = *keep;
+  free(keep);
+}
+
+/*
+ * @brief: evaluate a binary operation on two constants.
+ *
+ * @return: false if the operation cannot be folded (division by zero).
+ */
+static bool eval_binary(expr_kind kind, long lhs, long rhs, long *result) {
+  switch (kind) {
+  case EXPR_ADD:
+    *result = lhs + rhs;
+    return true;
+  case EXPR_SUBTRACT:
+    *result = lhs - rhs;
+    return true;
+  case EXPR_MULTIPLY:
+    *result = lhs * rhs;
+    return true;
+  case EXPR_DIVIDE:
+    if (rhs == 0)
+      return false;
+    *result = lhs / rhs;
+    return true;
+  case EXPR_MODULO:
+    if (rhs == 0)
+      return false;
+    *result = lhs % rhs;
+    return true;
+  case EXPR_TERM:
+    break;
+  }
+  return false;
+}
+
+/*
+ * @brief: fold and simplify an expression, bottom up.
+ *
+ * @param expr: pointer to an expr_node, modified in place.
+ */
+static void fold_expr(expr_node *expr) {
+  if (expr->kind == EXPR_TERM) {
+    if (expr->term.kind == TERM_ARRAY_ACCESS)
+      fold_expr(expr->term.array_access.index_expr);
+    return;
+  }
+
+  fold_expr(expr->binary.left);
+  fold_expr(expr->binary.right);
+
+  long value;
+  if (is_const(expr->binary.left) && is_const(expr->binary.right)) {
+    if (eval_binary(expr->kind, const_value(expr->binary.left),
+                    const_value(expr->binary.right), &value) &&
+        fits(value, expr->type)) {
+      make_const(expr, value);
+    }
+    return;
+  }
+
+  bool commutative = expr->kind == EXPR_ADD || expr->kind == EXPR_MULTIPLY;
+
+  // Canonicalize: constants go on the right of commutative operations.
+  if (commutative && is_const(expr->binary.left)) {
+    expr_node *tmp = expr->binary.left;
+    expr->binary.left = expr->binary.right;
+    expr->binary.right = tmp;
+  }
+
+  // Reassociate: (x op c1) op c2 => x op (c1 op c2)
+  expr_node *left = expr->binary.left;
+  if (commutative && is_const(expr->binary.right) && left->kind == expr->kind &&
+      is_const(left->binary.right) &&
+      eval_binary(expr->kind, const_value(left->binary.right),
+                  const_value(expr->binary.right), &value) &&
+      fits(value, left->binary.right->type)) {
+    make_const(left->binary.right, value);
+    replace_with(expr, left);
+    fold_expr(expr);
+    return;
+  }
+
+  if (is_const(expr->binary.right)) {
+    long c = const_value(expr->binary.right);
+
+    if ((c == 0 && (expr->kind == EXPR_ADD || expr->kind == EXPR_SUBTRACT)) ||
+        (c == 1 && (expr->kind == EXPR_MULTIPLY || expr->kind == EXPR_DIVIDE))) {
+      replace_with(expr, expr->binary.left);
+      return;
+    }
+
+    if (c == 0 && expr->kind == EXPR_MULTIPLY && !may_trap(expr->binary.left)) {
+      make_const(expr, 0);
+      return;
+    }
+  }
+
+  if (expr->kind == EXPR_SUBTRACT &&
+      expr_equal(expr->binary.left, expr->binary.right) &&
+      !may_trap(expr->binary.left)) {
+    make_const(expr, 0);
+  }
+}
+
+/*
+ * @brief: fold every expression of a block of instructions. (declaration)
+ *
+ * @param instrs: pointer to the dynamic_array of instructions.
+ */
+static void fold_instrs(dynamic_array *instrs);
+
+/*
+ * @brief: fold every expression used by an instruction.
+ *
+ * @param instr: pointer to an instr_node.
+ */
+static void fold_instr(instr_node *instr) {
+  switch (instr->kind) {
+  case INSTR_INITIALIZE:
+    fold_expr(&instr->initialize_variable.expr);
+    break;
+  case INSTR_INITIALIZE_ARRAY:
+    for (size_t i = 0; i < instr->initialize_array.literal.elements.count;
+         i++) {
+      fold_expr(dynamic_array_at(&instr->initialize_array.literal.elements, i));
+    }
+    break;
+  case INSTR_ASSIGN:
+    fold_expr(&instr->assign.expr);
+    break;
+  case INSTR_ASSIGN_TO_ARRAY_SUBSCRIPT:
+    fold_expr(instr->assign_to_array_subscript.index_expr);
+    fold_expr(&instr->assign_to_array_subscript.expr_to_assign);
+    break;
+  case INSTR_IF:
+    if (instr->if_.kind == IF_SINGLE_INSTR) {
+      fold_instr(instr->if_.instr);
+    } else {
+      fold_instrs(&instr->if_.instrs);
+    }
+    break;
+  case INSTR_LOOP:
+    fold_instrs(&instr->loop.instrs);
+    break;
+  default:
+    break;
+  }
+}
+
+/*
+ * @brief: fold every expression of a block of instructions. (definition)
+ *
+ * @param instrs: pointer to the dynamic_array of instructions.
+ */
+static void fold_instrs(dynamic_array *instrs) {
+  for (size_t i = 0; i < instrs->count; i++) {
+    fold_instr(dynamic_array_at(instrs, i));
+  }
+}
+
+void fold_program(program_node *program) { fold_instrs(&program->instrs); }
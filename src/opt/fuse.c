@@ -0,0 +1,69 @@
+#include "opt/fuse.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * @brief: find the cmp a branch on a 0 / 1 vreg tests.
+ *
+ * @return: its position in the block, SIZE_MAX if it is not there or one of
+ * its operands is written between the cmp and the branch.
+ */
+static size_t find_compare(ir_block *block, size_t vreg) {
+  size_t end = block->instrs.count - 1;
+
+  for (size_t j = end; j-- > 0;) {
+    ir_instr *instr = dynamic_array_at(&block->instrs, j);
+    if (!ir_is_vreg(instr->dst, vreg))
+      continue;
+    if (instr->op != IR_CMP)
+      return SIZE_MAX;
+
+    for (size_t k = j + 1; k < end; k++) {
+      ir_instr *later = dynamic_array_at(&block->instrs, k);
+      if (later->dst.kind == IR_OPERAND_VREG &&
+          (ir_is_vreg(instr->a, later->dst.vreg) ||
+           ir_is_vreg(instr->b, later->dst.vreg)))
+        return SIZE_MAX;
+    }
+    return j;
+  }
+
+  return SIZE_MAX;
+}
+
+size_t fuse_branches(ir_program *ir) {
+  size_t *defs = ir_def_counts(ir);
+  size_t *uses = ir_use_counts(ir);
+  size_t fused = 0;
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    ir_instr *term = ir_terminator(block);
+    if (!term || term->op != IR_BR || term->a.kind != IR_OPERAND_VREG ||
+        term->b.kind != IR_OPERAND_IMM || term->b.imm != 0 ||
+        (term->rel != REL_NOT_EQUAL && term->rel != REL_IS_EQUAL))
+      continue;
+
+    size_t c = term->a.vreg;
+    if (defs[c] != 1 || uses[c] != 1)
+      continue;
+
+    size_t at = find_compare(block, c);
+    if (at == SIZE_MAX)
+      continue;
+
+    ir_instr *cmp = dynamic_array_at(&block->instrs, at);
+    term->rel = term->rel == REL_NOT_EQUAL ? cmp->rel : ir_rel_negate(cmp->rel);
+    term->a = cmp->a;
+    term->b = cmp->b;
+    dynamic_array_remove(&block->instrs, at);
+    fused++;
+  }
+
+  free(defs);
+  free(uses);
+  return fused;
+}
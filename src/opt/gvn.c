@@ -0,0 +1,519 @@
+#include "opt/gvn.h"
+#include "cfg.h"
+#include "ds/dynamic_array.h"
+#include "ds/ht.h"
+#include "ir.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// an operand key: "%" vreg "." version, or "$" immediate
+#define GVN_OPERAND_KEY_SIZE 48
+
+// a load is as cheap as a register move when it hits the cache, keeping its
+// value in a register any longer only competes with everything else for one
+#define GVN_LOAD_REACH 24
+
+/*
+ * @struct gvn_value: what a key of the value table maps to. Memory keys
+ * ("@name", "#mem", "#ptr", "#store") only use version.
+ */
+typedef struct gvn_value {
+  bool valid;
+  ir_operand value; // <-- vreg or immediate holding the value
+  size_t version;   // <-- version of value.vreg when it was recorded
+  size_t block;     // <-- id of the block the value became available in
+  size_t position;  // <-- number of instructions walked before it
+} gvn_value;
+
+/*
+ * @struct gvn_undo: a change to revert when the walk leaves a block.
+ */
+typedef struct gvn_undo {
+  char *key;      // <-- table key, NULL for a vreg version
+  gvn_value old;  // <-- previous table value
+  size_t vreg;    // <-- vreg whose version changed
+  size_t version; // <-- previous version of vreg
+} gvn_undo;
+
+/*
+ * @struct gvn_state: the value table while walking the dominator tree.
+ */
+typedef struct gvn_state {
+  ht *table;     // <-- gvn_value, keyed by expression
+  ht *taken;     // <-- names of the variables whose address is taken
+  size_t *defs;  // <-- number of definitions of every vreg
+  size_t *vers;  // <-- current version of every vreg defined more than once
+  size_t *subst; // <-- vreg replacing a dropped one, or the vreg itself
+  dynamic_array multi; // <-- size_t, vregs defined more than once
+  dynamic_array undo;  // <-- gvn_undo
+  size_t next_version;
+  size_t position; // <-- instructions walked so far
+  gvn_stats *stats;
+} gvn_state;
+
+/*
+ * @struct gvn_walk: a step of the dominator tree walk.
+ */
+typedef struct gvn_walk {
+  size_t block; // <-- layout position
+  size_t mark;  // <-- undo count when the block was entered
+  bool leave;
+} gvn_walk;
+
+/*
+ * @brief: set a key of the value table, remembering the old value.
+ */
+static void set_value(gvn_state *s, const char *key, gvn_value value) {
+  gvn_undo undo = {.key = strdup(key)};
+  gvn_value *old = ht_search(s->table, key);
+  if (old)
+    undo.old = *old;
+  dynamic_array_append(&s->undo, &undo);
+  ht_insert(s->table, key, &value);
+}
+
+/*
+ * @brief: get the current version of a memory key, 0 if it was never set.
+ */
+static size_t memory_version(gvn_state *s, const char *key) {
+  gvn_value *value = ht_search(s->table, key);
+  return value && value->valid ? value->version : 0;
+}
+
+/*
+ * @brief: give a memory key a new version, which invalidates every value
+ * recorded under the old one.
+ */
+static void clobber(gvn_state *s, const char *key) {
+  set_value(s, key, (gvn_value){.valid = true, .version = ++s->next_version});
+}
+
+/*
+ * @brief: clobber everything stored in a variable or array.
+ */
+static void clobber_var(gvn_state *s, variable *var) {
+  char *key = scu_format_string("@%s", var->name);
+  clobber(s, key);
+  free(key);
+}
+
+/*
+ * @brief: record a new definition of a vreg. Only vregs defined more than
+ * once need a version, the others never change after their definition.
+ */
+static void define(gvn_state *s, ir_operand dst) {
+  if (dst.kind != IR_OPERAND_VREG || s->defs[dst.vreg] < 2)
+    return;
+
+  gvn_undo undo = {.vreg = dst.vreg, .version = s->vers[dst.vreg]};
+  dynamic_array_append(&s->undo, &undo);
+  s->vers[dst.vreg] = ++s->next_version;
+}
+
+/*
+ * @brief: revert every change made after the undo log had mark entries.
+ */
+static void undo_to(gvn_state *s, size_t mark) {
+  while (s->undo.count > mark) {
+    gvn_undo undo;
+    dynamic_array_pop(&s->undo, &undo);
+    if (undo.key) {
+      ht_insert(s->table, undo.key, &undo.old);
+      free(undo.key);
+    } else {
+      s->vers[undo.vreg] = undo.version;
+    }
+  }
+}
+
+/*
+ * @brief: write the key of an operand: a vreg with its version, or an
+ * immediate.
+ */
+static void operand_key(gvn_state *s, ir_operand op, char *buf, size_t size) {
+  switch (op.kind) {
+  case IR_OPERAND_VREG:
+    snprintf(buf, size, "%%%zu.%zu", op.vreg, s->vers[op.vreg]);
+    break;
+  case IR_OPERAND_IMM:
+    snprintf(buf, size, "$%ld", op.imm);
+    break;
+  default:
+    snprintf(buf, size, "_");
+    break;
+  }
+}
+
+/*
+ * @brief: format the part of a key that changes whenever a variable or
+ * array may be written. Names have no length limit, so keys that contain
+ * one are allocated, free them after use.
+ */
+static char *memory_key(gvn_state *s, variable *var) {
+  char *key = scu_format_string("@%s", var->name);
+  size_t version = memory_version(s, key);
+  free(key);
+
+  size_t ptr = ht_search(s->taken, var->name) ? memory_version(s, "#ptr") : 0;
+  return scu_format_string("%s.%zu.%zu.%zu", var->name, version,
+                           memory_version(s, "#mem"), ptr);
+}
+
+/*
+ * @brief: format the key of a load of a variable.
+ */
+static char *load_key(gvn_state *s, type t, variable *var) {
+  char *mem = memory_key(s, var);
+  char *key = scu_format_string("load %d %s", t, mem);
+  free(mem);
+  return key;
+}
+
+/*
+ * @brief: format the key of a load of an array element.
+ */
+static char *elem_key(gvn_state *s, type t, variable *var, ir_operand index) {
+  char idx[GVN_OPERAND_KEY_SIZE];
+  operand_key(s, index, idx, sizeof(idx));
+  char *mem = memory_key(s, var);
+  char *key = scu_format_string("elem %d %s[%s]", t, mem, idx);
+  free(mem);
+  return key;
+}
+
+/*
+ * @brief: format the key of a load through a pointer, which any store may
+ * change.
+ */
+static char *ptr_key(gvn_state *s, type t, ir_operand ptr) {
+  char a[GVN_OPERAND_KEY_SIZE];
+  operand_key(s, ptr, a, sizeof(a));
+  return scu_format_string("deref %d %s.%zu.%zu", t, a,
+                           memory_version(s, "#store"),
+                           memory_version(s, "#mem"));
+}
+
+/*
+ * @brief: check whether a op b == b op a.
+ */
+static bool is_commutative(ir_opcode op) {
+  return op == IR_ADD || op == IR_MUL || op == IR_MULHI || op == IR_AND;
+}
+
+/*
+ * @brief: format the key of the value an instruction computes.
+ *
+ * @return: the key, free it after use, or NULL if the instruction is not
+ * numbered.
+ */
+static char *instr_key(gvn_state *s, ir_instr *instr) {
+  ir_operand a = instr->a, b = instr->b;
+  char ka[GVN_OPERAND_KEY_SIZE], kb[GVN_OPERAND_KEY_SIZE];
+
+  switch (instr->op) {
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_MULHI:
+  case IR_DIV:
+  case IR_MOD:
+  case IR_AND:
+  case IR_SHL:
+  case IR_SAR:
+  case IR_SHR:
+  case IR_CMP:
+    // order the operands of x op y and y op x the same way
+    if (is_commutative(instr->op) &&
+        (a.kind == IR_OPERAND_IMM ||
+         (b.kind == IR_OPERAND_VREG && b.vreg < a.vreg))) {
+      ir_operand tmp = a;
+      a = b;
+      b = tmp;
+    }
+    operand_key(s, a, ka, sizeof(ka));
+    operand_key(s, b, kb, sizeof(kb));
+    return scu_format_string("%d %d %d %s %s", instr->op, instr->type,
+                             instr->rel, ka, kb);
+
+  case IR_ADDR:
+    return scu_format_string("addr %s", instr->var->name);
+
+  case IR_LOAD:
+    return load_key(s, instr->type, instr->var);
+
+  case IR_LOAD_ELEM:
+    return elem_key(s, instr->type, instr->var, a);
+
+  case IR_LOAD_PTR:
+    return ptr_key(s, instr->type, a);
+
+  default:
+    return NULL;
+  }
+}
+
+/*
+ * @brief: check whether an instruction reads memory.
+ */
+static bool is_load(ir_opcode op) {
+  return op == IR_LOAD || op == IR_LOAD_ELEM || op == IR_LOAD_PTR;
+}
+
+/*
+ * @brief: get the table value of a key if the vreg holding it was not
+ * redefined since. A loaded value is only reused close to where it was
+ * loaded or stored.
+ */
+static gvn_value *available(gvn_state *s, const char *key, ir_opcode op) {
+  gvn_value *value = ht_search(s->table, key);
+  if (!value || !value->valid)
+    return NULL;
+  if (is_load(op) && s->position - value->position > GVN_LOAD_REACH)
+    return NULL;
+  if (value->value.kind == IR_OPERAND_VREG &&
+      s->vers[value->value.vreg] != value->version)
+    return NULL;
+  return value;
+}
+
+/*
+ * @brief: make an operand available under a key.
+ */
+static void record(gvn_state *s, const char *key, ir_operand op,
+                   ir_block *block) {
+  if (op.kind == IR_OPERAND_NONE)
+    return;
+
+  gvn_value value = {.valid = true,
+                     .value = op,
+                     .block = block->id,
+                     .position = s->position};
+  if (op.kind == IR_OPERAND_VREG)
+    value.version = s->vers[op.vreg];
+  set_value(s, key, value);
+}
+
+/*
+ * @brief: replace an operand by the vreg that replaced it.
+ */
+static void substitute(gvn_state *s, ir_operand *op) {
+  if (op->kind == IR_OPERAND_VREG)
+    op->vreg = s->subst[op->vreg];
+}
+
+/*
+ * @brief: reuse an available value for the instruction at j.
+ *
+ * @return: true if the instruction was removed.
+ */
+static bool reuse(gvn_state *s, ir_block *block, size_t j, gvn_value *hit) {
+  ir_instr *instr = dynamic_array_at(&block->instrs, j);
+  ir_operand dst = instr->dst;
+  ir_operand value = hit->value;
+
+  if (hit->block == block->id)
+    s->stats->local++;
+  else
+    s->stats->global++;
+
+  if (ir_is_vreg(value, dst.vreg)) {
+    dynamic_array_remove(&block->instrs, j);
+    return true;
+  }
+
+  if (value.kind == IR_OPERAND_VREG && s->defs[dst.vreg] == 1 &&
+      s->defs[value.vreg] == 1) {
+    s->subst[dst.vreg] = value.vreg;
+    dynamic_array_remove(&block->instrs, j);
+    return true;
+  }
+
+  *instr = (ir_instr){.op = IR_MOV,
+                      .type = instr->type,
+                      .line = instr->line,
+                      .dst = dst,
+                      .a = value};
+  define(s, dst);
+  return false;
+}
+
+/*
+ * @brief: number the instructions of a block. When the block does not
+ * continue its immediate dominator, the values that may differ on another
+ * path into it are forgotten first.
+ */
+static void number_block(gvn_state *s, ir_block *block, bool inherit) {
+  if (!inherit) {
+    for (size_t i = 0; i < s->multi.count; i++) {
+      size_t vreg;
+      dynamic_array_get(&s->multi, i, &vreg);
+      define(s, (ir_operand){.kind = IR_OPERAND_VREG, .vreg = vreg});
+    }
+    clobber(s, "#mem");
+  }
+
+  for (size_t j = 0; j < block->instrs.count; j++) {
+    ir_instr *instr = dynamic_array_at(&block->instrs, j);
+    substitute(s, &instr->a);
+    substitute(s, &instr->b);
+    s->position++;
+
+    char *key = instr_key(s, instr);
+    if (key) {
+      gvn_value *hit = available(s, key, instr->op);
+      if (hit) {
+        if (reuse(s, block, j, hit))
+          j--;
+      } else {
+        define(s, instr->dst);
+        record(s, key, instr->dst, block);
+      }
+      free(key);
+      continue;
+    }
+
+    switch (instr->op) {
+    case IR_STORE:
+      clobber_var(s, instr->var);
+      clobber(s, "#store");
+      key = load_key(s, instr->type, instr->var);
+      record(s, key, instr->a, block);
+      free(key);
+      break;
+
+    case IR_STORE_ELEM:
+      clobber_var(s, instr->var);
+      clobber(s, "#store");
+      // elements are dwords, a load gives back the low 32 bits zero
+      // extended, which only an immediate stays known as
+      if (instr->b.kind == IR_OPERAND_IMM) {
+        key = elem_key(s, instr->type, instr->var, instr->a);
+        record(s, key, ir_imm((uint32_t)instr->b.imm), block);
+        free(key);
+      }
+      break;
+
+    case IR_VSTORE:
+      clobber_var(s, instr->var);
+      clobber(s, "#store");
+      break;
+
+    case IR_STORE_PTR:
+      clobber(s, "#ptr");
+      clobber(s, "#store");
+      key = ptr_key(s, instr->type, instr->a);
+      record(s, key, instr->b, block);
+      free(key);
+      break;
+
+    case IR_FASM:
+      clobber(s, "#mem");
+      break;
+
+    default:
+      define(s, instr->dst);
+      break;
+    }
+  }
+}
+
+/*
+ * @brief: count the predecessors of a block that can be reached.
+ */
+static size_t reachable_preds(cfg *g, size_t block) {
+  size_t count = 0;
+  for (size_t p = 0; p < g->preds[block].count; p++) {
+    size_t pred;
+    dynamic_array_get(&g->preds[block], p, &pred);
+    if (cfg_reachable(g, pred))
+      count++;
+  }
+  return count;
+}
+
+void number_values(ir_program *ir, gvn_stats *stats) {
+  *stats = (gvn_stats){0};
+
+  cfg g;
+  cfg_build(ir, &g);
+
+  // dominator tree, children in reverse postorder
+  dynamic_array *children =
+      scu_checked_malloc((g.block_count + 1) * sizeof(dynamic_array));
+  for (size_t i = 0; i < g.block_count; i++)
+    dynamic_array_init(&children[i], sizeof(size_t));
+  for (size_t r = 1; r < g.rpo_count; r++)
+    dynamic_array_append(&children[g.idom[g.rpo[r]]], &g.rpo[r]);
+
+  size_t n = ir->vregs.count + 1;
+  gvn_state s = {
+      .table = ht_new(sizeof(gvn_value)),
+      .taken = ir_address_taken(ir),
+      .defs = ir_def_counts(ir),
+      .vers = scu_checked_malloc(n * sizeof(size_t)),
+      .subst = scu_checked_malloc(n * sizeof(size_t)),
+      .stats = stats,
+  };
+  dynamic_array_init(&s.multi, sizeof(size_t));
+  dynamic_array_init(&s.undo, sizeof(gvn_undo));
+  for (size_t v = 0; v < n; v++) {
+    s.subst[v] = v;
+    if (s.defs[v] > 1)
+      dynamic_array_append(&s.multi, &v);
+  }
+
+  dynamic_array walk;
+  dynamic_array_init(&walk, sizeof(gvn_walk));
+  if (g.block_count > 0)
+    dynamic_array_append(&walk, &(gvn_walk){.block = 0});
+
+  while (walk.count > 0) {
+    gvn_walk step;
+    dynamic_array_pop(&walk, &step);
+    if (step.leave) {
+      undo_to(&s, step.mark);
+      continue;
+    }
+
+    step.mark = s.undo.count;
+    step.leave = true;
+    dynamic_array_append(&walk, &step);
+
+    bool inherit = step.block != 0 && reachable_preds(&g, step.block) == 1;
+    number_block(&s, ir_block_at(ir, step.block), inherit);
+
+    dynamic_array *kids = &children[step.block];
+    for (size_t c = kids->count; c-- > 0;) {
+      gvn_walk child = {0};
+      dynamic_array_get(kids, c, &child.block);
+      dynamic_array_append(&walk, &child);
+    }
+  }
+
+  // uses the walk did not reach
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      substitute(&s, &instr->a);
+      substitute(&s, &instr->b);
+    }
+  }
+
+  dynamic_array_free(&walk);
+  dynamic_array_free(&s.undo);
+  dynamic_array_free(&s.multi);
+  free(s.subst);
+  free(s.vers);
+  free(s.defs);
+  ht_del_ht(s.taken);
+  ht_del_ht(s.table);
+  for (size_t i = 0; i < g.block_count; i++)
+    dynamic_array_free(&children[i]);
+  free(children);
+  cfg_free(&g);
+}
@@ -0,0 +1,535 @@
+#include "opt/indvars.h"
+#include "cfg.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/licm.h"
+#include "opt/remarks.h"
+#include "utils.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * @enum iv_kind: what the definitions of a vreg inside the loop are.
+ */
+typedef enum iv_kind {
+  IV_UNDEFINED = 0, // <-- none
+  IV_BASIC,         // <-- only i = i + c, with the same c
+  IV_OTHER,
+} iv_kind;
+
+/*
+ * @struct derived_iv: a product of a basic induction variable kept up to
+ * date with additions.
+ */
+typedef struct derived_iv {
+  size_t base; // <-- the basic induction variable i
+  bool square; // <-- i * i, else i * factor
+  ir_operand factor;
+  ir_operand value;       // <-- vreg that holds the product
+  ir_operand step;        // <-- added to value after every update of i
+  ir_operand square_step; // <-- added to step after every update, squares
+} derived_iv;
+
+/*
+ * @struct iv_loop: the loop being reduced.
+ */
+typedef struct iv_loop {
+  ir_program *ir;
+  cfg *g;
+  cfg_loop *loop;
+  ir_block *pre;
+  size_t vregs; // <-- vregs that existed before the loop was reduced
+  size_t *defs; // <-- definitions of every vreg inside the loop
+  iv_kind *kinds;
+  long *steps;       // <-- c of every basic induction variable
+  dynamic_array ivs; // <-- derived_iv
+} iv_loop;
+
+/*
+ * @brief: wrapping multiplication and addition, like the ones the
+ * generated code does.
+ */
+static long wrap_mul(long a, long b) {
+  return (long)((uint64_t)a * (uint64_t)b);
+}
+
+static long wrap_add(long a, long b) {
+  return (long)((uint64_t)a + (uint64_t)b);
+}
+
+/*
+ * @brief: check whether an instruction is i = i + c, i = c + i or
+ * i = i - c.
+ *
+ * @param step: receives c (negated for a subtraction).
+ */
+static bool is_update(ir_instr *instr, long *step) {
+  if (instr->dst.kind != IR_OPERAND_VREG)
+    return false;
+  size_t i = instr->dst.vreg;
+
+  if (instr->op == IR_ADD && ir_is_vreg(instr->a, i) &&
+      instr->b.kind == IR_OPERAND_IMM)
+    *step = instr->b.imm;
+  else if (instr->op == IR_ADD && ir_is_vreg(instr->b, i) &&
+           instr->a.kind == IR_OPERAND_IMM)
+    *step = instr->a.imm;
+  else if (instr->op == IR_SUB && ir_is_vreg(instr->a, i) &&
+           instr->b.kind == IR_OPERAND_IMM && instr->b.imm != LONG_MIN)
+    *step = -instr->b.imm;
+  else
+    return false;
+  return *step != 0;
+}
+
+/*
+ * @brief: record the definitions inside the loop and which vregs are basic
+ * induction variables.
+ */
+static void find_basic(iv_loop *l) {
+  ir_program *ir = l->ir;
+  l->defs = scu_checked_malloc((l->vregs + 1) * sizeof(size_t));
+  l->kinds = scu_checked_malloc((l->vregs + 1) * sizeof(iv_kind));
+  l->steps = scu_checked_malloc((l->vregs + 1) * sizeof(long));
+
+  for (size_t b = 0; b < ir->blocks.count; b++) {
+    if (!bitset_test(&l->loop->blocks, b))
+      continue;
+
+    ir_block *block = ir_block_at(ir, b);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->dst.kind != IR_OPERAND_VREG)
+        continue;
+
+      size_t v = instr->dst.vreg;
+      long step;
+      l->defs[v]++;
+      if (!is_update(instr, &step)) {
+        l->kinds[v] = IV_OTHER;
+      } else if (l->kinds[v] == IV_UNDEFINED) {
+        l->kinds[v] = IV_BASIC;
+        l->steps[v] = step;
+      } else if (l->steps[v] != step) {
+        l->kinds[v] = IV_OTHER;
+      }
+    }
+  }
+}
+
+/*
+ * @brief: check whether an operand keeps its value for the whole loop.
+ */
+static bool invariant(iv_loop *l, ir_operand op) {
+  return op.kind == IR_OPERAND_IMM ||
+         (op.kind == IR_OPERAND_VREG && op.vreg < l->vregs &&
+          l->defs[op.vreg] == 0);
+}
+
+/*
+ * @brief: check whether an operand is a basic induction variable.
+ */
+static bool is_basic(iv_loop *l, ir_operand op) {
+  return op.kind == IR_OPERAND_VREG && op.vreg < l->vregs &&
+         l->kinds[op.vreg] == IV_BASIC;
+}
+
+/*
+ * @brief: get the value i has when the loop is entered: the constant of
+ * its only definition outside the loop if that is a move of one, which
+ * runs before the preheader every time, else i itself.
+ */
+static ir_operand entry_value(iv_loop *l, size_t i) {
+  ir_program *ir = l->ir;
+  ir_operand self = {.kind = IR_OPERAND_VREG, .vreg = i};
+  ir_instr *def = NULL;
+  size_t def_block = 0;
+
+  for (size_t b = 0; b < ir->blocks.count; b++) {
+    if (bitset_test(&l->loop->blocks, b))
+      continue;
+
+    ir_block *block = ir_block_at(ir, b);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (!ir_is_vreg(instr->dst, i))
+        continue;
+      if (def)
+        return self;
+      def = instr;
+      def_block = b;
+    }
+  }
+
+  if (!def || def->op != IR_MOV || def->a.kind != IR_OPERAND_IMM ||
+      !cfg_dominates(l->g, def_block, l->pre->index))
+    return self;
+
+  // going around a loop the preheader is in must run the move again
+  for (size_t m = l->g->loop_of[l->pre->index]; m != SIZE_MAX;
+       m = cfg_loop_at(l->g, m)->parent)
+    if (!bitset_test(&cfg_loop_at(l->g, m)->blocks, def_block))
+      return self;
+
+  return def->a;
+}
+
+/*
+ * @brief: append dst = a op b to the preheader, in front of its jump.
+ */
+static void emit_pre(iv_loop *l, ir_instr *orig, ir_opcode op,
+                     ir_operand dst, ir_operand a, ir_operand b) {
+  ir_instr instr = {.op = op,
+                    .type = orig->type,
+                    .line = orig->line,
+                    .dst = dst,
+                    .a = a,
+                    .b = b};
+  dynamic_array_insert(&l->pre->instrs, l->pre->instrs.count - 1, &instr);
+}
+
+/*
+ * @brief: get a constant as an operand arithmetic can take: an imm32, or
+ * a vreg the preheader moves a wider one into.
+ */
+static ir_operand pre_constant(iv_loop *l, ir_instr *orig, long value) {
+  if (value >= INT32_MIN && value <= INT32_MAX)
+    return ir_imm(value);
+
+  ir_operand v = ir_new_vreg(l->ir, orig->type);
+  emit_pre(l, orig, IR_MOV, v, ir_imm(value), (ir_operand){0});
+  return v;
+}
+
+/*
+ * @brief: set up a new derived induction variable for instr in the
+ * preheader.
+ */
+static derived_iv make_derived(iv_loop *l, ir_instr *instr, size_t i,
+                               bool square, ir_operand factor) {
+  ir_program *ir = l->ir;
+  ir_operand e = entry_value(l, i);
+  long c = l->steps[i];
+  bool known = e.kind == IR_OPERAND_IMM;
+
+  derived_iv iv = {.base = i,
+                   .square = square,
+                   .factor = factor,
+                   .value = ir_new_vreg(ir, instr->type)};
+  ir_operand none = {0};
+
+  if (square) {
+    // value = e * e, step = 2 * c * e + c * c
+    iv.step = ir_new_vreg(ir, instr->type);
+    if (known) {
+      emit_pre(l, instr, IR_MOV, iv.value, ir_imm(wrap_mul(e.imm, e.imm)),
+               none);
+      emit_pre(l, instr, IR_MOV, iv.step,
+               ir_imm(wrap_add(wrap_mul(wrap_mul(2, c), e.imm),
+                               wrap_mul(c, c))),
+               none);
+    } else {
+      emit_pre(l, instr, IR_MUL, iv.value, e, e);
+      ir_operand t = ir_new_vreg(ir, instr->type);
+      emit_pre(l, instr, IR_MUL, t, e,
+               pre_constant(l, instr, wrap_mul(2, c)));
+      emit_pre(l, instr, IR_ADD, iv.step, t,
+               pre_constant(l, instr, wrap_mul(c, c)));
+    }
+    iv.square_step = pre_constant(l, instr, wrap_mul(wrap_mul(2, c), c));
+    return iv;
+  }
+
+  // value = e * factor, step = factor * c
+  if (known && factor.kind == IR_OPERAND_IMM)
+    emit_pre(l, instr, IR_MOV, iv.value, ir_imm(wrap_mul(e.imm, factor.imm)),
+             none);
+  else if (known && e.imm == 0)
+    emit_pre(l, instr, IR_MOV, iv.value, ir_imm(0), none);
+  else if (known && e.imm == 1)
+    emit_pre(l, instr, IR_MOV, iv.value, factor, none);
+  else if (known)
+    emit_pre(l, instr, IR_MUL, iv.value, factor, pre_constant(l, instr, e.imm));
+  else
+    emit_pre(l, instr, IR_MUL, iv.value, e, factor);
+
+  if (factor.kind == IR_OPERAND_IMM) {
+    iv.step = pre_constant(l, instr, wrap_mul(factor.imm, c));
+  } else if (c == 1) {
+    iv.step = factor;
+  } else {
+    iv.step = ir_new_vreg(ir, instr->type);
+    emit_pre(l, instr, IR_MUL, iv.step, factor, pre_constant(l, instr, c));
+  }
+  return iv;
+}
+
+/*
+ * @brief: get the name of a vreg for a remark: the variable it holds, or
+ * its number.
+ */
+static const char *vreg_name(ir_program *ir, size_t vreg, char *buf,
+                             size_t len) {
+  variable *var = ir_vreg_at(ir, vreg)->var;
+  if (var)
+    return var->name;
+  snprintf(buf, len, "%%%zu", vreg);
+  return buf;
+}
+
+/*
+ * @brief: replace a multiplication of a basic induction variable by a move
+ * from a derived one, made the first time the product shows up.
+ *
+ * @return: whether instr was reduced.
+ */
+static bool reduce(iv_loop *l, ir_instr *instr, dynamic_array *remarks) {
+  if (instr->op != IR_MUL)
+    return false;
+
+  ir_operand i = instr->a;
+  ir_operand factor = instr->b;
+  if (!is_basic(l, i) || !invariant(l, factor)) {
+    i = instr->b;
+    factor = instr->a;
+  }
+
+  bool square = is_basic(l, i) && ir_is_vreg(factor, i.vreg);
+  if (!square && (!is_basic(l, i) || !invariant(l, factor)))
+    return false;
+
+  derived_iv *iv = NULL;
+  for (size_t k = 0; k < l->ivs.count && !iv; k++) {
+    derived_iv *other = dynamic_array_at(&l->ivs, k);
+    if (other->base == i.vreg && other->square == square &&
+        (square || (other->factor.kind == factor.kind &&
+                    (factor.kind == IR_OPERAND_IMM
+                         ? other->factor.imm == factor.imm
+                         : other->factor.vreg == factor.vreg))))
+      iv = other;
+  }
+  if (!iv) {
+    derived_iv made = make_derived(l, instr, i.vreg, square, factor);
+    dynamic_array_append(&l->ivs, &made);
+    iv = dynamic_array_at(&l->ivs, l->ivs.count - 1);
+  }
+
+  char buf[32];
+  remark_add(remarks, REMARK_PASSED, "indvars", instr->line,
+             "%s of induction variable %s replaced by additions",
+             square ? "square" : "multiplication",
+             vreg_name(l->ir, i.vreg, buf, sizeof(buf)));
+
+  instr->op = IR_MOV;
+  instr->a = iv->value;
+  instr->b = (ir_operand){0};
+  return true;
+}
+
+/*
+ * @brief: add the updates of the derived induction variables after every
+ * update of their basic one.
+ */
+static void insert_updates(iv_loop *l) {
+  ir_program *ir = l->ir;
+
+  for (size_t b = 0; b < ir->blocks.count; b++) {
+    if (!bitset_test(&l->loop->blocks, b))
+      continue;
+
+    ir_block *block = ir_block_at(ir, b);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *update = dynamic_array_at(&block->instrs, j);
+      if (update->dst.kind != IR_OPERAND_VREG || !is_basic(l, update->dst))
+        continue;
+
+      size_t i = update->dst.vreg;
+      type t = update->type;
+      size_t line = update->line;
+      for (size_t k = 0; k < l->ivs.count; k++) {
+        derived_iv *iv = dynamic_array_at(&l->ivs, k);
+        if (iv->base != i)
+          continue;
+
+        ir_instr add = {.op = IR_ADD,
+                        .type = t,
+                        .line = line,
+                        .dst = iv->value,
+                        .a = iv->value,
+                        .b = iv->step};
+        dynamic_array_insert(&block->instrs, ++j, &add);
+        if (iv->square) {
+          add.dst = add.a = iv->step;
+          add.b = iv->square_step;
+          dynamic_array_insert(&block->instrs, ++j, &add);
+        }
+      }
+    }
+  }
+}
+
+/*
+ * @brief: remove every definition of a vreg from the blocks inside (or
+ * outside) the loop.
+ */
+static void remove_defs(iv_loop *l, size_t v, bool inside) {
+  ir_program *ir = l->ir;
+
+  for (size_t b = 0; b < ir->blocks.count; b++) {
+    if (bitset_test(&l->loop->blocks, b) != inside)
+      continue;
+
+    ir_block *block = ir_block_at(ir, b);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (ir_is_vreg(instr->dst, v))
+        dynamic_array_remove(&block->instrs, j--);
+    }
+  }
+}
+
+/*
+ * @brief: eliminate the basic induction variable of a derived one i * x
+ * with constant x, when i is only read by its updates and the back edge
+ * test `br i rel n` (see indvars.h).
+ *
+ * @return: whether i was eliminated.
+ */
+static bool eliminate(iv_loop *l, derived_iv *iv, const size_t *uses,
+                      dynamic_array *remarks) {
+  size_t i = iv->base;
+  long x = iv->factor.imm;
+  if (iv->square || iv->factor.kind != IR_OPERAND_IMM || x == 0 ||
+      l->loop->latches.count != 1 || uses[i] != l->defs[i] + 1)
+    return false;
+
+  size_t latch;
+  dynamic_array_get(&l->loop->latches, 0, &latch);
+  ir_instr *test = ir_terminator(ir_block_at(l->ir, latch));
+  if (!test || test->op != IR_BR)
+    return false;
+
+  // normalize to "the loop goes on while i rel n"
+  long n;
+  rel_kind rel;
+  if (ir_is_vreg(test->a, i) && test->b.kind == IR_OPERAND_IMM) {
+    n = test->b.imm;
+    rel = test->rel;
+  } else if (ir_is_vreg(test->b, i) && test->a.kind == IR_OPERAND_IMM) {
+    n = test->a.imm;
+    rel = ir_rel_swap(test->rel);
+  } else {
+    return false;
+  }
+  bool stays = bitset_test(&l->loop->blocks, test->target->index);
+  if (stays == bitset_test(&l->loop->blocks, test->alt->index))
+    return false;
+  if (!stays)
+    rel = ir_rel_negate(rel);
+
+  long c = l->steps[i];
+  bool up = rel == REL_LESS_THAN || rel == REL_LESS_THAN_OR_EQUAL;
+  bool down = rel == REL_GREATER_THAN || rel == REL_GREATER_THAN_OR_EQUAL;
+  if (!(up && c > 0) && !(down && c < 0))
+    return false;
+
+  ir_operand e = entry_value(l, i);
+  if (e.kind != IR_OPERAND_IMM)
+    return false;
+
+  // the test sees i between its start and one step past n
+  long lo = e.imm < n ? e.imm : n;
+  long hi = e.imm < n ? n : e.imm;
+  long scaled;
+  if ((up && __builtin_add_overflow(hi, c, &hi)) ||
+      (down && __builtin_add_overflow(lo, c, &lo)) ||
+      __builtin_mul_overflow(lo, x, &scaled) ||
+      __builtin_mul_overflow(hi, x, &scaled) ||
+      __builtin_mul_overflow(n, x, &scaled))
+    return false;
+
+  if (ir_is_vreg(test->a, i)) {
+    test->a = iv->value;
+    test->b = ir_imm(scaled);
+  } else {
+    test->a = ir_imm(scaled);
+    test->b = iv->value;
+  }
+  if (x < 0)
+    test->rel = ir_rel_swap(test->rel);
+
+  char buf[32];
+  const char *name = vreg_name(l->ir, i, buf, sizeof(buf));
+  remark_add(remarks, REMARK_PASSED, "indvars", test->line,
+             "induction variable %s eliminated, the exit test uses %s * %ld",
+             name, name, x);
+
+  remove_defs(l, i, true);
+  remove_defs(l, i, false);
+  return true;
+}
+
+/*
+ * @brief: reduce the induction variables of one loop.
+ */
+static void reduce_loop(iv_loop *l, indvars_stats *stats,
+                        dynamic_array *remarks) {
+  ir_program *ir = l->ir;
+  find_basic(l);
+
+  for (size_t b = 0; b < ir->blocks.count; b++) {
+    if (!bitset_test(&l->loop->blocks, b))
+      continue;
+
+    ir_block *block = ir_block_at(ir, b);
+    for (size_t j = 0; j < block->instrs.count; j++)
+      stats->reduced +=
+          reduce(l, dynamic_array_at(&block->instrs, j), remarks);
+  }
+  if (l->ivs.count == 0)
+    return;
+
+  insert_updates(l);
+
+  size_t *uses = ir_use_counts(ir);
+  for (size_t k = 0; k < l->ivs.count; k++) {
+    derived_iv *iv = dynamic_array_at(&l->ivs, k);
+    if (l->kinds[iv->base] == IV_BASIC && eliminate(l, iv, uses, remarks)) {
+      l->kinds[iv->base] = IV_OTHER;
+      stats->eliminated++;
+    }
+  }
+  free(uses);
+}
+
+void reduce_induction_variables(ir_program *ir, indvars_stats *stats,
+                                dynamic_array *remarks) {
+  *stats = (indvars_stats){0};
+
+  cfg g;
+  cfg_build(ir, &g);
+
+  // inner loops first, blocks are only added to, so g stays valid
+  for (size_t i = 0; i < g.loops.count; i++) {
+    iv_loop l = {.ir = ir,
+                 .g = &g,
+                 .loop = cfg_loop_at(&g, i),
+                 .vregs = ir->vregs.count};
+    l.pre = licm_preheader(ir->blocks.items, &g, l.loop);
+    if (!l.pre)
+      continue;
+
+    dynamic_array_init(&l.ivs, sizeof(derived_iv));
+    reduce_loop(&l, stats, remarks);
+    dynamic_array_free(&l.ivs);
+    free(l.defs);
+    free(l.kinds);
+    free(l.steps);
+  }
+
+  cfg_free(&g);
+}
@@ -0,0 +1,516 @@
+#include "opt/layout.h"
+#include "cfg.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/remarks.h"
+#include "profile.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Probability of a branch going the way a heuristic deems unlikely.
+ */
+#define UNLIKELY (1.0 / 32)
+
+/*
+ * A loop is assumed to run at most this many times per entry, however
+ * unlikely leaving it looks.
+ */
+#define MAX_TRIPS 4096.0
+
+/*
+ * An if body of at most this many instructions (its jump included) stays
+ * between the branch and the join.
+ */
+#define SHORT_BODY 4
+
+/*
+ * @struct estimate: state of a static frequency estimate. Arrays are
+ * indexed by layout position.
+ */
+typedef struct estimate {
+  cfg *g;
+  const profile *prof;
+  ir_block **layout;
+  block_weights *w;
+  size_t *loop_of_header; // <-- index in cfg.loops of the loop a block
+                          //     heads, SIZE_MAX if none
+  double *trips;          // <-- loop headers: runs per entry into the loop
+  double *freq;
+} estimate;
+
+/*
+ * @struct edge: a control flow edge and how often it is taken.
+ */
+typedef struct edge {
+  size_t from;
+  size_t to;
+  double weight;
+} edge;
+
+/*
+ * @brief: check whether a block ends in ret.
+ */
+static bool returns(ir_block *block) {
+  ir_instr *term = ir_terminator(block);
+  return term && term->op == IR_RET;
+}
+
+/*
+ * @brief: get the probability of a branch going to its target, measured or
+ * guessed, see layout_estimate for the heuristics.
+ */
+static double branch_probability(estimate *e, ir_block *block,
+                                 ir_instr *term) {
+  if (term->a.kind == IR_OPERAND_IMM && term->b.kind == IR_OPERAND_IMM)
+    return ir_rel_holds(term->rel, term->a.imm, term->b.imm) ? 1 : 0;
+
+  ir_block *t = term->target;
+  ir_block *f = term->alt;
+
+  uint64_t runs, count;
+  if (profile_runs(e->prof, block, &runs) && runs > 0) {
+    if (profile_edge(e->prof, block, t, &count))
+      return (double)count / runs;
+    if (profile_edge(e->prof, block, f, &count))
+      return 1 - (double)count / runs;
+  }
+
+  size_t loop = e->g->loop_of[block->index];
+  if (loop != SIZE_MAX) {
+    bitset *blocks = &cfg_loop_at(e->g, loop)->blocks;
+    bool t_in = bitset_test(blocks, t->index);
+    if (t_in != bitset_test(blocks, f->index))
+      return t_in ? 1 - UNLIKELY : UNLIKELY;
+  }
+
+  // a loop header with fasm in it is entered on purpose
+  bool t_fasm = ir_has_fasm(t) && e->loop_of_header[t->index] == SIZE_MAX;
+  bool f_fasm = ir_has_fasm(f) && e->loop_of_header[f->index] == SIZE_MAX;
+  if (t_fasm != f_fasm)
+    return t_fasm ? UNLIKELY : 1 - UNLIKELY;
+
+  if (returns(t) != returns(f))
+    return returns(t) ? UNLIKELY : 1 - UNLIKELY;
+
+  if (term->rel == REL_IS_EQUAL)
+    return 3.0 / 8;
+  if (term->rel == REL_NOT_EQUAL)
+    return 5.0 / 8;
+  return 0.5;
+}
+
+/*
+ * @brief: get how often a block runs, 0 if the weights do not know it.
+ */
+static double block_freq(const block_weights *w, ir_block *block) {
+  return block->id < w->count ? w->freq[block->id] : 0;
+}
+
+/*
+ * @brief: get the probability of leaving from by the edge to to.
+ */
+static double edge_probability(const block_weights *w, ir_block *from,
+                               ir_block *to) {
+  ir_instr *term = ir_terminator(from);
+  if (!term || term->op != IR_BR || term->target == term->alt)
+    return 1;
+
+  double taken = from->id < w->count ? w->taken[from->id] : 0.5;
+  return to == term->target ? taken : 1 - taken;
+}
+
+/*
+ * @brief: check whether the edge from pred to b goes back to the header of
+ * a loop pred is in.
+ */
+static bool is_back_edge(estimate *e, size_t pred, size_t b) {
+  size_t loop = e->loop_of_header[b];
+  return loop != SIZE_MAX &&
+         bitset_test(&cfg_loop_at(e->g, loop)->blocks, pred);
+}
+
+/*
+ * @brief: compute the frequencies of the blocks of a loop relative to its
+ * header, or of the whole program relative to the entry when loop is NULL.
+ * Blocks are visited in reverse postorder and back edges left out, so
+ * every predecessor is done before the block. A nested loop header runs
+ * its trips per entry.
+ */
+static void propagate(estimate *e, cfg_loop *loop) {
+  cfg *g = e->g;
+  size_t head = loop ? loop->header->index : 0;
+  memset(e->freq, 0, g->block_count * sizeof(double));
+
+  for (size_t r = 0; r < g->rpo_count; r++) {
+    size_t b = g->rpo[r];
+    if (loop && !bitset_test(&loop->blocks, b))
+      continue;
+
+    if (b == head) {
+      e->freq[b] = 1;
+      if (loop)
+        continue;
+    }
+
+    for (size_t p = 0; p < g->preds[b].count; p++) {
+      size_t pred;
+      dynamic_array_get(&g->preds[b], p, &pred);
+      if (!cfg_reachable(g, pred) || is_back_edge(e, pred, b) ||
+          (loop && !bitset_test(&loop->blocks, pred)))
+        continue;
+      e->freq[b] += e->freq[pred] *
+                    edge_probability(e->w, e->layout[pred], e->layout[b]);
+    }
+
+    if (e->loop_of_header[b] != SIZE_MAX)
+      e->freq[b] *= e->trips[b];
+  }
+}
+
+void layout_estimate(ir_program *ir, cfg *g, const profile *prof,
+                     block_weights *w) {
+  size_t n = g->block_count;
+  w->count = ir->block_count;
+  w->freq = scu_checked_malloc((w->count + 1) * sizeof(double));
+  w->taken = scu_checked_malloc((w->count + 1) * sizeof(double));
+
+  estimate e = {
+      .g = g,
+      .prof = prof,
+      .w = w,
+      .layout = scu_checked_malloc((n + 1) * sizeof(ir_block *)),
+      .loop_of_header = scu_checked_malloc((n + 1) * sizeof(size_t)),
+      .trips = scu_checked_malloc((n + 1) * sizeof(double)),
+      .freq = scu_checked_malloc((n + 1) * sizeof(double)),
+  };
+  for (size_t b = 0; b < n; b++) {
+    e.layout[b] = ir_block_at(ir, b);
+    e.loop_of_header[b] = SIZE_MAX;
+  }
+  for (size_t l = 0; l < g->loops.count; l++)
+    e.loop_of_header[cfg_loop_at(g, l)->header->index] = l;
+
+  for (size_t b = 0; b < n; b++) {
+    ir_instr *term = ir_terminator(e.layout[b]);
+    w->taken[e.layout[b]->id] =
+        term && term->op == IR_BR ? branch_probability(&e, e.layout[b], term)
+                                  : 1;
+  }
+
+  // inner loops come first, so their trips are known in their parents
+  for (size_t l = 0; l < g->loops.count; l++) {
+    cfg_loop *loop = cfg_loop_at(g, l);
+    size_t header = loop->header->index;
+    propagate(&e, loop);
+
+    double back = 0;
+    for (size_t i = 0; i < loop->latches.count; i++) {
+      size_t latch;
+      dynamic_array_get(&loop->latches, i, &latch);
+      back += e.freq[latch] *
+              edge_probability(w, e.layout[latch], loop->header);
+    }
+    e.trips[header] =
+        back >= 1 - 1 / MAX_TRIPS ? MAX_TRIPS : 1 / (1 - back);
+  }
+
+  propagate(&e, NULL);
+  for (size_t b = 0; b < n; b++)
+    w->freq[e.layout[b]->id] = e.freq[b];
+
+  free(e.layout);
+  free(e.loop_of_header);
+  free(e.trips);
+  free(e.freq);
+}
+
+void block_weights_free(block_weights *w) {
+  free(w->freq);
+  free(w->taken);
+  w->freq = NULL;
+  w->taken = NULL;
+  w->count = 0;
+}
+
+/*
+ * @brief: find the cold blocks: the unreachable ones, and those running
+ * rarely compared to the header of their innermost loop (the entry outside
+ * of loops, the parent loop for a header). Headers come before their
+ * loops in reverse postorder, so everything in a cold loop is cold too.
+ */
+static bool *find_cold(cfg *g, ir_block **layout, const block_weights *w) {
+  size_t n = g->block_count;
+  bool *cold = scu_checked_malloc((n + 1) * sizeof(bool));
+  for (size_t b = 1; b < n; b++)
+    cold[b] = !cfg_reachable(g, b);
+
+  for (size_t r = 0; r < g->rpo_count; r++) {
+    size_t b = g->rpo[r];
+    if (b == 0)
+      continue;
+
+    size_t loop = g->loop_of[b];
+    if (loop != SIZE_MAX && cfg_loop_at(g, loop)->header->index == b)
+      loop = cfg_loop_at(g, loop)->parent;
+    size_t ref = loop == SIZE_MAX ? 0 : cfg_loop_at(g, loop)->header->index;
+
+    double freq = block_freq(w, layout[b]);
+    cold[b] = cold[ref] || freq == 0 ||
+              freq * LAYOUT_COLD_RATIO < block_freq(w, layout[ref]);
+  }
+  return cold;
+}
+
+/*
+ * @brief: get the share of the control transfers between blocks, weighted
+ * by how often they happen, that go to the next block without a jump.
+ */
+static double fallthrough_share(ir_block **order, size_t n,
+                                const block_weights *w) {
+  double total = 0;
+  double fall = 0;
+  for (size_t i = 0; i < n; i++) {
+    ir_block *succ[2];
+    size_t count = ir_successors(order[i], succ);
+    for (size_t s = 0; s < count; s++) {
+      double weight =
+          block_freq(w, order[i]) * edge_probability(w, order[i], succ[s]);
+      total += weight;
+      if (i + 1 < n && succ[s] == order[i + 1])
+        fall += weight;
+    }
+  }
+  return total > 0 ? fall / total : 1;
+}
+
+/*
+ * @struct chains: blocks merged into chains, by layout position.
+ */
+typedef struct chains {
+  size_t *next; // <-- following block in the chain, SIZE_MAX for a tail
+  size_t *head; // <-- first block of the chain of every block
+  size_t *tail; // <-- chain heads: last block of the chain
+  bool *cold;
+} chains;
+
+/*
+ * @brief: append the chain starting at to behind the one ending at from,
+ * if from ends a chain, to starts another one and both are as cold.
+ */
+static bool join_chains(chains *c, size_t from, size_t to) {
+  if (from == to || to == 0 || c->cold[from] != c->cold[to] ||
+      c->tail[c->head[from]] != from || c->head[to] != to ||
+      c->head[from] == to)
+    return false;
+
+  size_t head = c->head[from];
+  c->next[from] = to;
+  for (size_t b = to; b != SIZE_MAX; b = c->next[b])
+    c->head[b] = head;
+  c->tail[head] = c->tail[to];
+  return true;
+}
+
+/*
+ * @brief: keep short if bodies between their branch and the join:
+ * `br cond, body, join` where only the branch leads to body and body
+ * jumps to join.
+ */
+static void link_if_bodies(chains *c, cfg *g, ir_block **layout) {
+  for (size_t b = 0; b < g->block_count; b++) {
+    ir_instr *term = ir_terminator(layout[b]);
+    if (!term || term->op != IR_BR || term->target == term->alt)
+      continue;
+
+    for (int side = 0; side < 2; side++) {
+      ir_block *body = side == 0 ? term->target : term->alt;
+      ir_block *join = side == 0 ? term->alt : term->target;
+      ir_instr *jump = ir_terminator(body);
+      if (g->preds[body->index].count != 1 ||
+          body->instrs.count > SHORT_BODY || !jump || jump->op != IR_JMP ||
+          jump->target != join)
+        continue;
+      if (join_chains(c, b, body->index))
+        join_chains(c, body->index, join->index);
+      break;
+    }
+  }
+}
+
+static int by_weight(const void *a, const void *b) {
+  const edge *x = a;
+  const edge *y = b;
+  if (x->weight != y->weight)
+    return x->weight > y->weight ? -1 : 1;
+  if (x->from != y->from)
+    return x->from < y->from ? -1 : 1;
+  return (x->to > y->to) - (x->to < y->to);
+}
+
+/*
+ * @brief: collect the edges between reachable blocks with their weights.
+ * A block never falls through to a cold successor, so when it does not
+ * fall through to the other one either, it jumps twice: the edge to the
+ * other one weighs every run of the block.
+ */
+static void collect_edges(cfg *g, ir_block **layout, const block_weights *w,
+                          const bool *cold, dynamic_array *edges) {
+  for (size_t b = 0; b < g->block_count; b++) {
+    if (!cfg_reachable(g, b))
+      continue;
+
+    ir_block *succ[2];
+    size_t count = ir_successors(layout[b], succ);
+    for (size_t s = 0; s < count; s++) {
+      double p = edge_probability(w, layout[b], succ[s]);
+      if (count == 2 && !cold[succ[s]->index] && cold[succ[1 - s]->index])
+        p = 1;
+      edge e = {.from = b,
+                .to = succ[s]->index,
+                .weight = block_freq(w, layout[b]) * p};
+      dynamic_array_append(edges, &e);
+    }
+  }
+}
+
+/*
+ * @struct placement: chains put in order, by layout position.
+ */
+typedef struct placement {
+  size_t *order; // <-- layout positions in their new order
+  size_t count;
+  bool *placed; // <-- chain heads already in order
+  double *best; // <-- chain heads: heaviest edge into the chain from a
+                //     placed block, -1 if none
+} placement;
+
+/*
+ * @brief: put a chain in order and offer the chains its blocks lead to.
+ */
+static void place(placement *p, chains *c, ir_block **layout,
+                  const block_weights *w, size_t head) {
+  p->placed[head] = true;
+  for (size_t b = head; b != SIZE_MAX; b = c->next[b]) {
+    p->order[p->count++] = b;
+
+    ir_block *succ[2];
+    size_t count = ir_successors(layout[b], succ);
+    for (size_t s = 0; s < count; s++) {
+      size_t to = c->head[succ[s]->index];
+      double weight = block_freq(w, layout[b]) *
+                      edge_probability(w, layout[b], succ[s]);
+      if (!p->placed[to] && weight > p->best[to])
+        p->best[to] = weight;
+    }
+  }
+}
+
+/*
+ * @brief: get the first line number a block has.
+ */
+static size_t block_line(ir_block *block) {
+  for (size_t i = 0; i < block->instrs.count; i++) {
+    ir_instr *instr = dynamic_array_at(&block->instrs, i);
+    if (instr->line)
+      return instr->line;
+  }
+  return 0;
+}
+
+void layout_blocks(ir_program *ir, const profile *prof, layout_stats *stats,
+                   dynamic_array *remarks) {
+  *stats = (layout_stats){0};
+
+  cfg g;
+  cfg_build(ir, &g);
+  size_t n = g.block_count;
+
+  block_weights weights;
+  layout_estimate(ir, &g, prof, &weights);
+  const block_weights *w = &weights;
+
+  ir_block **layout = scu_checked_malloc((n + 1) * sizeof(ir_block *));
+  for (size_t b = 0; b < n; b++)
+    layout[b] = ir_block_at(ir, b);
+  stats->fall_before = fallthrough_share(layout, n, w);
+
+  chains c = {.next = scu_checked_malloc((n + 1) * sizeof(size_t)),
+              .head = scu_checked_malloc((n + 1) * sizeof(size_t)),
+              .tail = scu_checked_malloc((n + 1) * sizeof(size_t)),
+              .cold = find_cold(&g, layout, w)};
+  for (size_t b = 0; b < n; b++) {
+    c.next[b] = SIZE_MAX;
+    c.head[b] = b;
+    c.tail[b] = b;
+  }
+
+  link_if_bodies(&c, &g, layout);
+
+  dynamic_array edges;
+  dynamic_array_init(&edges, sizeof(edge));
+  collect_edges(&g, layout, w, c.cold, &edges);
+  if (edges.count)
+    qsort(edges.items, edges.count, sizeof(edge), by_weight);
+  for (size_t i = 0; i < edges.count; i++) {
+    edge *e = dynamic_array_at(&edges, i);
+    join_chains(&c, e->from, e->to);
+  }
+  dynamic_array_free(&edges);
+
+  placement p = {.order = scu_checked_malloc((n + 1) * sizeof(size_t)),
+                 .placed = scu_checked_malloc((n + 1) * sizeof(bool)),
+                 .best = scu_checked_malloc((n + 1) * sizeof(double))};
+  for (size_t b = 0; b < n; b++)
+    p.best[b] = -1;
+
+  // the entry first, then the hot chain with the heaviest edge into it,
+  // or the first one in source order when nothing leads to the rest
+  place(&p, &c, layout, w, 0);
+  while (true) {
+    size_t next = SIZE_MAX;
+    for (size_t b = 1; b < n; b++) {
+      if (c.head[b] != b || p.placed[b] || c.cold[b])
+        continue;
+      if (next == SIZE_MAX || p.best[b] > p.best[next])
+        next = b;
+    }
+    if (next == SIZE_MAX)
+      break;
+    place(&p, &c, layout, w, next);
+  }
+
+  for (size_t b = 1; b < n; b++) {
+    if (c.head[b] != b || p.placed[b])
+      continue;
+
+    size_t first = p.count;
+    place(&p, &c, layout, w, b);
+    stats->cold += p.count - first;
+    remark_add(remarks, REMARK_PASSED, "layout", block_line(layout[b]),
+               "%zu cold blocks moved to the end of main", p.count - first);
+  }
+
+  for (size_t i = 0; i < n; i++)
+    dynamic_array_set(&ir->blocks, i, &layout[p.order[i]]);
+  ir_renumber(ir);
+
+  for (size_t i = 0; i < n; i++)
+    layout[i] = ir_block_at(ir, i);
+  stats->fall_after = fallthrough_share(layout, n, w);
+
+  free(p.order);
+  free(p.placed);
+  free(p.best);
+  free(c.next);
+  free(c.head);
+  free(c.tail);
+  free(c.cold);
+  free(layout);
+  block_weights_free(&weights);
+  cfg_free(&g);
+}
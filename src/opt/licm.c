@@ -0,0 +1,334 @@
+#include "opt/licm.h"
+#include "cfg.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ds/ht.h"
+#include "ir.h"
+#include "utils.h"
+
+#include <stdlib.h>
+
+/*
+ * @struct loop_effects: the memory a loop may write.
+ */
+typedef struct loop_effects {
+  bool fasm;      // <-- a fasm statement may touch any variable
+  bool store_ptr; // <-- stores through a pointer reach address-taken ones
+  bool store_any;
+  ht *stored; // <-- names of the variables and arrays stored to, as bool
+} loop_effects;
+
+/*
+ * @brief: get the outside predecessors of a loop header.
+ */
+static void outside_preds(cfg *g, cfg_loop *loop, dynamic_array *out) {
+  dynamic_array *preds = &g->preds[loop->header->index];
+  for (size_t p = 0; p < preds->count; p++) {
+    size_t pred;
+    dynamic_array_get(preds, p, &pred);
+    if (cfg_reachable(g, pred) && !bitset_test(&loop->blocks, pred))
+      dynamic_array_append(out, &pred);
+  }
+}
+
+ir_block *licm_preheader(ir_block **layout, cfg *g, cfg_loop *loop) {
+  dynamic_array preds;
+  dynamic_array_init(&preds, sizeof(size_t));
+  outside_preds(g, loop, &preds);
+
+  ir_block *pre = NULL;
+  if (preds.count == 1) {
+    size_t index;
+    dynamic_array_get(&preds, 0, &index);
+    ir_block *succ[2];
+    if (ir_successors(layout[index], succ) == 1)
+      pre = layout[index];
+  }
+
+  dynamic_array_free(&preds);
+  return pre;
+}
+
+/*
+ * @brief: give a loop a preheader: a new block right before the header in
+ * the layout that jumps to it, which every outside edge is redirected to.
+ * layout holds the blocks in the order g was built from, since inserting
+ * shifts the layout positions.
+ */
+static void insert_preheader(ir_program *ir, cfg *g, ir_block **layout,
+                             cfg_loop *loop) {
+  ir_block *header = loop->header;
+  ir_block *pre = ir_block_new(ir, NULL);
+  ir_instr jmp = {.op = IR_JMP, .type = TYPE_VOID, .target = header};
+
+  dynamic_array preds;
+  dynamic_array_init(&preds, sizeof(size_t));
+  outside_preds(g, loop, &preds);
+  for (size_t p = 0; p < preds.count; p++) {
+    size_t index;
+    dynamic_array_get(&preds, p, &index);
+    ir_instr *term = ir_terminator(layout[index]);
+    if (p == 0)
+      jmp.line = term->line; // <-- the statement that enters the loop
+    if (term->target == header)
+      term->target = pre;
+    if (term->op == IR_BR && term->alt == header)
+      term->alt = pre;
+  }
+  dynamic_array_free(&preds);
+  dynamic_array_append(&pre->instrs, &jmp);
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    if (ir_block_at(ir, i) == header) {
+      ir_insert_block(ir, i, pre);
+      break;
+    }
+  }
+}
+
+/*
+ * @brief: record what the blocks of a loop store to.
+ */
+static void collect_effects(ir_program *ir, cfg_loop *loop,
+                            loop_effects *fx) {
+  bool yes = true;
+  *fx = (loop_effects){.stored = ht_new(sizeof(bool))};
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    if (!bitset_test(&loop->blocks, i))
+      continue;
+
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      switch (instr->op) {
+      case IR_FASM:
+        fx->fasm = true;
+        break;
+      case IR_STORE_PTR:
+        fx->store_ptr = true;
+        fx->store_any = true;
+        break;
+      case IR_STORE:
+      case IR_STORE_ELEM:
+      case IR_VSTORE:
+        ht_insert(fx->stored, instr->var->name, &yes);
+        fx->store_any = true;
+        break;
+      default:
+        break;
+      }
+    }
+  }
+}
+
+/*
+ * @brief: check whether a block runs on every iteration of a loop, i.e. it
+ * dominates every latch and every block the loop can be left from.
+ */
+static bool runs_every_iteration(ir_program *ir, cfg *g, cfg_loop *loop,
+                                 size_t block) {
+  dynamic_array *lists[2] = {&loop->latches, &loop->exits};
+  for (size_t l = 0; l < 2; l++) {
+    for (size_t i = 0; i < lists[l]->count; i++) {
+      size_t other;
+      dynamic_array_get(lists[l], i, &other);
+      if (!cfg_dominates(g, block, other))
+        return false;
+    }
+  }
+
+  // a ret leaves the loop as well
+  for (size_t i = 0; i < g->block_count; i++) {
+    ir_block *succ[2];
+    if (bitset_test(&loop->blocks, i) &&
+        ir_successors(ir_block_at(ir, i), succ) == 0 &&
+        !cfg_dominates(g, block, i))
+      return false;
+  }
+  return true;
+}
+
+/*
+ * @brief: check whether an operand keeps its value for the whole loop.
+ */
+static bool invariant_operand(ir_operand op, const size_t *loop_defs) {
+  return op.kind != IR_OPERAND_VREG || loop_defs[op.vreg] == 0;
+}
+
+/*
+ * @brief: check whether a load of var may be moved out of the loop.
+ */
+static bool invariant_load(variable *var, loop_effects *fx, ht *taken) {
+  if (fx->fasm || ht_search(fx->stored, var->name))
+    return false;
+  return !(fx->store_ptr && ht_search(taken, var->name));
+}
+
+/*
+ * @brief: check whether an instruction can be moved to the preheader.
+ */
+static bool can_hoist(ir_instr *instr, const size_t *defs,
+                      const size_t *loop_defs, loop_effects *fx, ht *taken,
+                      bool every_iteration) {
+  if (instr->dst.kind != IR_OPERAND_VREG || defs[instr->dst.vreg] != 1 ||
+      !invariant_operand(instr->a, loop_defs) ||
+      !invariant_operand(instr->b, loop_defs))
+    return false;
+
+  switch (instr->op) {
+  case IR_MOV:
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_MULHI:
+  case IR_AND:
+  case IR_SHL:
+  case IR_SAR:
+  case IR_SHR:
+  case IR_CMP:
+  case IR_ADDR:
+    return true;
+
+  case IR_DIV:
+  case IR_MOD:
+    // idiv faults on a zero divisor and on LONG_MIN / -1
+    if (instr->b.kind == IR_OPERAND_IMM && instr->b.imm != 0 &&
+        instr->b.imm != -1)
+      return true;
+    return every_iteration;
+
+  case IR_LOAD:
+    return invariant_load(instr->var, fx, taken);
+
+  case IR_LOAD_ELEM:
+    return every_iteration && invariant_load(instr->var, fx, taken);
+
+  case IR_LOAD_PTR:
+    return every_iteration && !fx->fasm && !fx->store_any;
+
+  default:
+    return false;
+  }
+}
+
+/*
+ * @brief: move the invariant instructions of one loop to its preheader.
+ * The loop blocks are visited in reverse postorder, so a definition is
+ * hoisted before the instructions that use it.
+ *
+ * @return: number of hoisted instructions.
+ */
+static size_t hoist_loop(ir_program *ir, ir_block *pre, cfg *g,
+                         cfg_loop *loop, const size_t *defs, ht *taken) {
+  size_t *loop_defs =
+      scu_checked_malloc((ir->vregs.count + 1) * sizeof(size_t));
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    if (!bitset_test(&loop->blocks, i))
+      continue;
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->dst.kind == IR_OPERAND_VREG)
+        loop_defs[instr->dst.vreg]++;
+    }
+  }
+
+  loop_effects fx;
+  collect_effects(ir, loop, &fx);
+
+  size_t hoisted = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (size_t r = 0; r < g->rpo_count; r++) {
+      size_t b = g->rpo[r];
+      if (!bitset_test(&loop->blocks, b))
+        continue;
+
+      ir_block *block = ir_block_at(ir, b);
+      bool every = runs_every_iteration(ir, g, loop, b);
+
+      for (size_t j = 0; j < block->instrs.count; j++) {
+        ir_instr *instr = dynamic_array_at(&block->instrs, j);
+        if (!can_hoist(instr, defs, loop_defs, &fx, taken, every))
+          continue;
+
+        ir_instr moved = *instr;
+        dynamic_array_remove(&block->instrs, j--);
+        dynamic_array_insert(&pre->instrs, pre->instrs.count - 1, &moved);
+        loop_defs[moved.dst.vreg]--;
+        hoisted++;
+        changed = true;
+      }
+    }
+  }
+
+  ht_del_ht(fx.stored);
+  free(loop_defs);
+  return hoisted;
+}
+
+/*
+ * @brief: order per-loop counts by source line.
+ */
+static int compare_line(const void *a, const void *b) {
+  const licm_loop_stats *la = a;
+  const licm_loop_stats *lb = b;
+  return (la->line > lb->line) - (la->line < lb->line);
+}
+
+void hoist_loop_invariants(ir_program *ir, licm_stats *stats) {
+  *stats = (licm_stats){0};
+  dynamic_array_init(&stats->loops, sizeof(licm_loop_stats));
+
+  cfg g;
+  cfg_build(ir, &g);
+
+  // every loop gets its preheader first, then the graph is rebuilt once
+  ir_block **layout = scu_checked_malloc(g.block_count * sizeof(ir_block *));
+  for (size_t i = 0; i < g.block_count; i++)
+    layout[i] = ir_block_at(ir, i);
+
+  for (size_t i = 0; i < g.loops.count; i++) {
+    cfg_loop *loop = cfg_loop_at(&g, i);
+    if (!licm_preheader(layout, &g, loop)) {
+      insert_preheader(ir, &g, layout, loop);
+      stats->preheaders++;
+    }
+  }
+  free(layout);
+
+  if (stats->preheaders) {
+    cfg_free(&g);
+    cfg_build(ir, &g);
+  }
+
+  size_t *defs = ir_def_counts(ir);
+  ht *taken = ir_address_taken(ir);
+
+  for (size_t i = 0; i < g.loops.count; i++) {
+    cfg_loop *loop = cfg_loop_at(&g, i);
+    ir_block *pre = licm_preheader(ir->blocks.items, &g, loop);
+
+    licm_loop_stats entry = {.depth = loop->depth};
+    if (pre) {
+      entry.line = ir_terminator(pre)->line;
+      entry.hoisted = hoist_loop(ir, pre, &g, loop, defs, taken);
+    }
+    stats->hoisted += entry.hoisted;
+    dynamic_array_append(&stats->loops, &entry);
+  }
+
+  qsort(stats->loops.items, stats->loops.count, sizeof(licm_loop_stats),
+        compare_line);
+
+  ht_del_ht(taken);
+  free(defs);
+  cfg_free(&g);
+}
+
+void licm_stats_free(licm_stats *stats) {
+  dynamic_array_free(&stats->loops);
+}
@@ -0,0 +1,89 @@
+#include "opt/liveness.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "utils.h"
+
+#include <stdlib.h>
+
+/*
+ * @brief: record the upward exposed uses and the defs of a block.
+ */
+static void block_use_def(ir_block *block, bitset *use, bitset *def) {
+  for (size_t i = 0; i < block->instrs.count; i++) {
+    ir_instr *instr = dynamic_array_at(&block->instrs, i);
+
+    if (instr->a.kind == IR_OPERAND_VREG && !bitset_test(def, instr->a.vreg))
+      bitset_set(use, instr->a.vreg);
+    if (instr->b.kind == IR_OPERAND_VREG && !bitset_test(def, instr->b.vreg))
+      bitset_set(use, instr->b.vreg);
+    if (instr->dst.kind == IR_OPERAND_VREG)
+      bitset_set(def, instr->dst.vreg);
+  }
+}
+
+void liveness_compute(ir_program *ir, liveness *lv) {
+  size_t n = ir->blocks.count;
+  size_t nvregs = ir->vregs.count;
+
+  ir_renumber(ir);
+
+  lv->block_count = n;
+  lv->live_in = scu_checked_malloc(n * sizeof(bitset));
+  lv->live_out = scu_checked_malloc(n * sizeof(bitset));
+
+  bitset *use = scu_checked_malloc(n * sizeof(bitset));
+  bitset *def = scu_checked_malloc(n * sizeof(bitset));
+
+  for (size_t i = 0; i < n; i++) {
+    bitset_init(&lv->live_in[i], nvregs);
+    bitset_init(&lv->live_out[i], nvregs);
+    bitset_init(&use[i], nvregs);
+    bitset_init(&def[i], nvregs);
+    block_use_def(ir_block_at(ir, i), &use[i], &def[i]);
+  }
+
+  // in = use | (out - def), iterated backwards until nothing changes
+  bitset tmp;
+  bitset_init(&tmp, nvregs);
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (size_t i = n; i-- > 0;) {
+      ir_block *succ[2];
+      size_t nsucc = ir_successors(ir_block_at(ir, i), succ);
+
+      for (size_t s = 0; s < nsucc; s++)
+        bitset_union(&lv->live_out[i], &lv->live_in[succ[s]->index]);
+
+      bitset_copy(&tmp, &lv->live_out[i]);
+      bitset_subtract(&tmp, &def[i]);
+      bitset_union(&tmp, &use[i]);
+
+      if (!bitset_equal(&tmp, &lv->live_in[i])) {
+        bitset_copy(&lv->live_in[i], &tmp);
+        changed = true;
+      }
+    }
+  }
+
+  bitset_free(&tmp);
+  for (size_t i = 0; i < n; i++) {
+    bitset_free(&use[i]);
+    bitset_free(&def[i]);
+  }
+  free(use);
+  free(def);
+}
+
+void liveness_free(liveness *lv) {
+  for (size_t i = 0; i < lv->block_count; i++) {
+    bitset_free(&lv->live_in[i]);
+    bitset_free(&lv->live_out[i]);
+  }
+  free(lv->live_in);
+  free(lv->live_out);
+  lv->block_count = 0;
+}
@@ -0,0 +1,492 @@
+#include "opt/peephole.h"
+#include "asm.h"
+#include "ds/dynamic_array.h"
+#include "utils.h"
+#include "x86.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * How many instructions past a store (or load) a later load of the same
+ * slot is looked for.
+ */
+#define WINDOW 8
+
+/*
+ * @struct peephole: state of one sweep over the instruction list.
+ */
+typedef struct peephole {
+  dynamic_array *code;
+  size_t *labels; // <-- block id -> position of its label, SIZE_MAX if none
+  size_t label_count;
+} peephole;
+
+static const char *pattern_names[PEEPHOLE_PATTERN_COUNT] = {
+    [PEEPHOLE_PUSH_POP] = "push_pop",
+    [PEEPHOLE_SELF_MOVE] = "self_move",
+    [PEEPHOLE_STORE_LOAD] = "store_load",
+    [PEEPHOLE_ZERO_IDIOM] = "zero_idiom",
+    [PEEPHOLE_SHORT_IMM] = "short_imm",
+    [PEEPHOLE_TEST_ZERO] = "test_zero",
+    [PEEPHOLE_JUMP_THREAD] = "jump_thread",
+    [PEEPHOLE_BRANCH_OVER] = "branch_over",
+    [PEEPHOLE_JUMP_NEXT] = "jump_next",
+    [PEEPHOLE_UNREACHABLE] = "unreachable",
+};
+
+const char *peephole_pattern_name(peephole_pattern pattern) {
+  return pattern_names[pattern];
+}
+
+/*
+ * @brief: get the instruction at position i, NULL past the end.
+ */
+static asm_instr *at(peephole *p, size_t i) {
+  if (i >= p->code->count)
+    return NULL;
+  return dynamic_array_at(p->code, i);
+}
+
+/*
+ * @brief: get the position of the first instruction after i that was not
+ * deleted (code->count if there is none).
+ */
+static size_t next(peephole *p, size_t i) {
+  for (i++; i < p->code->count; i++)
+    if (at(p, i)->op != ASM_NOP)
+      break;
+  return i;
+}
+
+/*
+ * @brief: delete an instruction, it is dropped at the end of the sweep.
+ */
+static void delete(asm_instr *instr) {
+  if (instr->op == ASM_RAW)
+    free(instr->text);
+  instr->op = ASM_NOP;
+}
+
+/*
+ * @brief: check whether an instruction is a label or an alignment directive
+ * (things control flows through without executing anything).
+ */
+static bool is_marker(asm_instr *instr) {
+  return instr->op == ASM_LABEL || instr->op == ASM_ALIGN;
+}
+
+/*
+ * @brief: check whether an instruction ends a straight-line window.
+ */
+static bool ends_window(asm_instr *instr) {
+  return instr->op == ASM_LABEL || instr->op == ASM_RAW || asm_is_jump(instr);
+}
+
+/*
+ * @brief: check whether an instruction may overwrite reg.
+ */
+static bool writes_reg(asm_instr *instr, x86_reg reg) {
+  switch (instr->op) {
+  case ASM_RAW:
+    return true;
+  case ASM_CQO:
+    return reg == RDX;
+  case ASM_IDIV:
+  case ASM_IMUL_WIDE:
+    return reg == RAX || reg == RDX;
+  case ASM_PUSH:
+    return reg == RSP;
+  case ASM_POP:
+    return reg == RSP || (instr->dst.kind == ASM_REG && instr->dst.reg == reg);
+  case ASM_NOP:
+  case ASM_LABEL:
+  case ASM_ALIGN:
+  case ASM_CMP:
+  case ASM_TEST:
+  case ASM_JMP:
+  case ASM_JCC:
+  case ASM_RET:
+    return false;
+  default:
+    return instr->dst.kind == ASM_REG && instr->dst.reg == reg;
+  }
+}
+
+/*
+ * @brief: check whether an instruction may write memory other than the slot
+ * m. Only two non-indexed rbp slots are known not to overlap.
+ */
+static bool writes_other_memory(asm_instr *instr, asm_operand m) {
+  switch (instr->op) {
+  case ASM_RAW:
+    return true;
+  case ASM_CMP:
+  case ASM_TEST:
+  case ASM_IDIV:
+  case ASM_IMUL_WIDE:
+  case ASM_PUSH:
+    return false;
+  default:
+    break;
+  }
+
+  asm_operand d = instr->dst;
+  if (d.kind != ASM_MEM)
+    return false;
+  if (d.reg == RBP && d.index < 0 && m.reg == RBP && m.index < 0)
+    return d.imm < m.imm + (long)m.size && m.imm < d.imm + (long)d.size;
+  return true;
+}
+
+/*
+ * @brief: check whether the flags may be read after position i before being
+ * set again.
+ */
+static bool flags_live_after(peephole *p, size_t i) {
+  for (size_t j = next(p, i); j < p->code->count; j = next(p, j)) {
+    asm_instr *instr = at(p, j);
+    switch (instr->op) {
+    case ASM_JCC:
+    case ASM_SETCC:
+    case ASM_CMOV:
+      return true;
+    case ASM_CMP:
+    case ASM_TEST:
+    case ASM_ADD:
+    case ASM_SUB:
+    case ASM_AND:
+    case ASM_SHL:
+    case ASM_SAR:
+    case ASM_SHR:
+    case ASM_NEG:
+    case ASM_XOR:
+    case ASM_IMUL:
+    case ASM_IMUL_WIDE:
+    case ASM_IDIV:
+    case ASM_LABEL:
+    case ASM_JMP:
+    case ASM_RET:
+    case ASM_RAW:
+      return false;
+    default:
+      break;
+    }
+  }
+  return false;
+}
+
+/*
+ * @brief: check whether the label of block comes before any instruction
+ * after position i (so jumping there from i is falling through).
+ */
+static bool label_follows(peephole *p, size_t i, size_t block) {
+  for (size_t j = next(p, i); j < p->code->count; j = next(p, j)) {
+    asm_instr *instr = at(p, j);
+    if (!is_marker(instr))
+      return false;
+    if (instr->op == ASM_LABEL && instr->dst.block == block)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * @brief: push x; pop y -> mov y, x (or nothing when x is y).
+ */
+static bool push_pop(peephole *p, size_t i) {
+  asm_instr *push = at(p, i);
+  asm_instr *pop = at(p, next(p, i));
+  if (push->op != ASM_PUSH || !pop || pop->op != ASM_POP)
+    return false;
+
+  if (asm_operand_equal(push->dst, pop->dst)) {
+    delete(push);
+    delete(pop);
+    return true;
+  }
+
+  if (push->dst.kind == ASM_MEM && pop->dst.kind == ASM_MEM)
+    return false;
+
+  *push = (asm_instr){.op = ASM_MOV, .dst = pop->dst, .src = push->dst};
+  delete(pop);
+  return true;
+}
+
+/*
+ * @brief: mov r, r -> nothing (64 bit only, a 32 bit move clears the upper
+ * half).
+ */
+static bool self_move(peephole *p, size_t i) {
+  asm_instr *instr = at(p, i);
+  if (instr->op != ASM_MOV || instr->dst.kind != ASM_REG ||
+      instr->dst.size != 8 || !asm_operand_equal(instr->dst, instr->src))
+    return false;
+
+  delete(instr);
+  return true;
+}
+
+/*
+ * @brief: after a store to (or load from) a slot, a later load of the same
+ * slot reads the register (or immediate) that is known to be in it.
+ */
+static bool store_load(peephole *p, size_t i) {
+  asm_instr *instr = at(p, i);
+  if (instr->op != ASM_MOV)
+    return false;
+
+  asm_operand slot;
+  asm_operand value;
+  if (instr->dst.kind == ASM_MEM &&
+      (instr->src.kind == ASM_REG || instr->src.kind == ASM_IMM)) {
+    slot = instr->dst;
+    value = instr->src;
+  } else if (instr->dst.kind == ASM_REG && instr->src.kind == ASM_MEM &&
+             instr->dst.size == instr->src.size) {
+    slot = instr->src;
+    value = instr->dst;
+    if (slot.reg == value.reg || slot.index == (int)value.reg)
+      return false;
+  } else {
+    return false;
+  }
+
+  size_t j = i;
+  for (size_t seen = 0; seen < WINDOW; seen++) {
+    j = next(p, j);
+    asm_instr *later = at(p, j);
+    if (!later || ends_window(later))
+      return false;
+
+    if (later->op == ASM_MOV && later->dst.kind == ASM_REG &&
+        asm_operand_equal(later->src, slot)) {
+      // a dword load zero extends, mov r32, r32 keeps doing that
+      if (value.kind == ASM_REG && value.reg == later->dst.reg &&
+          slot.size == 8) {
+        delete(later);
+      } else {
+        later->src = value;
+        if (value.kind == ASM_REG)
+          later->src.size = later->dst.size;
+      }
+      return true;
+    }
+
+    if (writes_other_memory(later, slot) ||
+        (value.kind == ASM_REG && writes_reg(later, value.reg)) ||
+        writes_reg(later, slot.reg) ||
+        (slot.index >= 0 && writes_reg(later, slot.index)))
+      return false;
+  }
+  return false;
+}
+
+/*
+ * @brief: mov r, 0 -> xor r32, r32, when the flags are dead.
+ */
+static bool zero_idiom(peephole *p, size_t i) {
+  asm_instr *instr = at(p, i);
+  if (instr->op != ASM_MOV || instr->dst.kind != ASM_REG ||
+      instr->src.kind != ASM_IMM || instr->src.imm != 0 ||
+      flags_live_after(p, i))
+    return false;
+
+  asm_operand reg = asm_reg(instr->dst.reg, 4);
+  *instr = (asm_instr){.op = ASM_XOR, .dst = reg, .src = reg};
+  return true;
+}
+
+/*
+ * @brief: mov r64, imm -> mov r32, imm when the value fits in 32 unsigned
+ * bits (the upper half is cleared anyway, and the imm64 form is longer).
+ */
+static bool short_imm(peephole *p, size_t i) {
+  asm_instr *instr = at(p, i);
+  if (instr->op != ASM_MOV || instr->dst.kind != ASM_REG ||
+      instr->dst.size != 8 || instr->src.kind != ASM_IMM ||
+      instr->src.imm <= 0 || instr->src.imm > (long)UINT32_MAX)
+    return false;
+
+  instr->dst.size = 4;
+  return true;
+}
+
+/*
+ * @brief: cmp r, 0 -> test r, r.
+ */
+static bool test_zero(peephole *p, size_t i) {
+  asm_instr *instr = at(p, i);
+  if (instr->op != ASM_CMP || instr->dst.kind != ASM_REG ||
+      instr->src.kind != ASM_IMM || instr->src.imm != 0)
+    return false;
+
+  instr->op = ASM_TEST;
+  instr->src = instr->dst;
+  return true;
+}
+
+/*
+ * @brief: a jump to a label that is directly followed by "jmp M" goes to M.
+ */
+static bool jump_thread(peephole *p, size_t i) {
+  asm_instr *instr = at(p, i);
+  if (instr->op != ASM_JMP && instr->op != ASM_JCC)
+    return false;
+
+  size_t label = instr->dst.block;
+  if (label >= p->label_count || p->labels[label] == SIZE_MAX)
+    return false;
+
+  size_t j = p->labels[label];
+  while (j < p->code->count && (at(p, j)->op == ASM_NOP || is_marker(at(p, j))))
+    j++;
+
+  asm_instr *target = at(p, j);
+  if (!target || target->op != ASM_JMP || target->dst.block == label ||
+      j == i)
+    return false;
+
+  instr->dst = target->dst;
+  return true;
+}
+
+/*
+ * @brief: jcc L; jmp M; L: -> jncc M.
+ */
+static bool branch_over(peephole *p, size_t i) {
+  asm_instr *jcc = at(p, i);
+  size_t j = next(p, i);
+  asm_instr *jmp = at(p, j);
+  if (jcc->op != ASM_JCC || !jmp || jmp->op != ASM_JMP ||
+      !label_follows(p, j, jcc->dst.block))
+    return false;
+
+  jcc->cond = asm_cond_negate(jcc->cond);
+  jcc->dst = jmp->dst;
+  delete(jmp);
+  return true;
+}
+
+/*
+ * @brief: a jump to the label right after it does nothing.
+ */
+static bool jump_next(peephole *p, size_t i) {
+  asm_instr *instr = at(p, i);
+  if ((instr->op != ASM_JMP && instr->op != ASM_JCC) ||
+      !label_follows(p, i, instr->dst.block))
+    return false;
+
+  delete(instr);
+  return true;
+}
+
+/*
+ * @brief: nothing between an unconditional jump (or ret) and the next label
+ * can run.
+ */
+static bool unreachable(peephole *p, size_t i) {
+  asm_instr *instr = at(p, i);
+  if (instr->op != ASM_JMP && instr->op != ASM_RET)
+    return false;
+
+  bool hit = false;
+  for (size_t j = next(p, i); j < p->code->count && !is_marker(at(p, j));
+       j = next(p, j)) {
+    delete(at(p, j));
+    hit = true;
+  }
+  return hit;
+}
+
+typedef bool (*peephole_rule)(peephole *p, size_t i);
+
+static const peephole_rule rules[PEEPHOLE_PATTERN_COUNT] = {
+    [PEEPHOLE_PUSH_POP] = push_pop,       [PEEPHOLE_SELF_MOVE] = self_move,
+    [PEEPHOLE_STORE_LOAD] = store_load,   [PEEPHOLE_ZERO_IDIOM] = zero_idiom,
+    [PEEPHOLE_SHORT_IMM] = short_imm,     [PEEPHOLE_TEST_ZERO] = test_zero,
+    [PEEPHOLE_JUMP_THREAD] = jump_thread, [PEEPHOLE_BRANCH_OVER] = branch_over,
+    [PEEPHOLE_JUMP_NEXT] = jump_next,     [PEEPHOLE_UNREACHABLE] = unreachable,
+};
+
+/*
+ * @brief: record where every label is.
+ */
+static void index_labels(peephole *p) {
+  p->label_count = 0;
+  for (size_t i = 0; i < p->code->count; i++) {
+    asm_instr *instr = at(p, i);
+    if (instr->op == ASM_LABEL && instr->dst.block >= p->label_count)
+      p->label_count = instr->dst.block + 1;
+  }
+
+  free(p->labels);
+  p->labels = scu_checked_malloc((p->label_count + 1) * sizeof(size_t));
+  for (size_t l = 0; l < p->label_count; l++)
+    p->labels[l] = SIZE_MAX;
+
+  for (size_t i = 0; i < p->code->count; i++) {
+    asm_instr *instr = at(p, i);
+    if (instr->op == ASM_LABEL)
+      p->labels[instr->dst.block] = i;
+  }
+}
+
+/*
+ * @brief: drop the deleted instructions.
+ */
+static void compact(dynamic_array *code) {
+  size_t kept = 0;
+  for (size_t i = 0; i < code->count; i++) {
+    asm_instr *instr = dynamic_array_at(code, i);
+    if (instr->op == ASM_NOP)
+      continue;
+    if (kept != i)
+      dynamic_array_set(code, kept, instr);
+    kept++;
+  }
+  code->count = kept;
+}
+
+/*
+ * @brief: count the real instructions of a list.
+ */
+static size_t instr_count(dynamic_array *code) {
+  size_t count = 0;
+  for (size_t i = 0; i < code->count; i++) {
+    asm_instr *instr = dynamic_array_at(code, i);
+    if (instr->op != ASM_NOP && !is_marker(instr))
+      count++;
+  }
+  return count;
+}
+
+void peephole_optimize(dynamic_array *code, peephole_stats *stats) {
+  peephole p = {.code = code};
+  peephole_stats local = {.before = instr_count(code)};
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    index_labels(&p);
+
+    for (size_t i = 0; i < code->count; i++) {
+      for (int r = 0; r < PEEPHOLE_PATTERN_COUNT; r++) {
+        if (at(&p, i)->op == ASM_NOP)
+          break;
+        if (rules[r](&p, i)) {
+          local.hits[r]++;
+          changed = true;
+        }
+      }
+    }
+
+    compact(code);
+  }
+
+  free(p.labels);
+  local.after = instr_count(code);
+  if (stats)
+    *stats = local;
+}
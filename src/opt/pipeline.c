@@ -0,0 +1,257 @@
+#include "opt/pipeline.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/dce.h"
+#include "opt/fuse.h"
+#include "opt/gvn.h"
+#include "opt/indvars.h"
+#include "opt/layout.h"
+#include "opt/licm.h"
+#include "opt/promote.h"
+#include "opt/remarks.h"
+#include "opt/rotate.h"
+#include "opt/sccp.h"
+#include "opt/strength.h"
+#include "opt/unroll.h"
+#include "opt/vectorize.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *pass_names[PASS_COUNT] = {
+    [PASS_FUSE] = "fuse",           [PASS_ROTATE] = "rotate",
+    [PASS_PROMOTE] = "promote",     [PASS_SCCP] = "sccp",
+    [PASS_DCE] = "dce",             [PASS_STRENGTH] = "strength",
+    [PASS_LICM] = "licm",           [PASS_INDVARS] = "indvars",
+    [PASS_VECTORIZE] = "vectorize", [PASS_UNROLL] = "unroll",
+    [PASS_GVN] = "gvn",             [PASS_LAYOUT] = "layout",
+    [PASS_ALIGN] = "align",         [PASS_PEEPHOLE] = "peephole",
+};
+
+/*
+ * Lowest optimization level every pass runs at.
+ */
+static const unsigned int pass_levels[PASS_COUNT] = {
+    [PASS_FUSE] = 1,      [PASS_ROTATE] = 1,   [PASS_PROMOTE] = 1,
+    [PASS_SCCP] = 2,      [PASS_DCE] = 1,      [PASS_STRENGTH] = 1,
+    [PASS_LICM] = 2,      [PASS_INDVARS] = 2,  [PASS_VECTORIZE] = 2,
+    [PASS_UNROLL] = 2,    [PASS_GVN] = 2,      [PASS_LAYOUT] = 2,
+    [PASS_ALIGN] = 1,     [PASS_PEEPHOLE] = 1,
+};
+
+const char *pipeline_pass_name(pipeline_pass pass) { return pass_names[pass]; }
+
+bool pipeline_in_codegen(pipeline_pass pass) {
+  return pass == PASS_ALIGN || pass == PASS_PEEPHOLE;
+}
+
+int pipeline_find_pass(const char *name, size_t length) {
+  for (int pass = 0; pass < PASS_COUNT; pass++)
+    if (strlen(pass_names[pass]) == length &&
+        strncmp(pass_names[pass], name, length) == 0)
+      return pass;
+  return -1;
+}
+
+char *pipeline_check_list(const char *list) {
+  const char *name = list;
+  while (true) {
+    size_t length = strcspn(name, ",");
+    if (pipeline_find_pass(name, length) < 0) {
+      char *bad = scu_checked_malloc(length + 1);
+      memcpy(bad, name, length);
+      return bad;
+    }
+    if (name[length] == '\0')
+      return NULL;
+    name += length + 1;
+  }
+}
+
+void pipeline_init(pipeline *p, unsigned int level, const char *list) {
+  *p = (pipeline){.print_after = -1};
+
+  if (!list) {
+    p->passes = scu_checked_malloc(PASS_COUNT * sizeof(pipeline_pass));
+    for (int pass = 0; pass < PASS_COUNT; pass++)
+      if (pass_levels[pass] <= level)
+        p->passes[p->count++] = pass;
+    return;
+  }
+
+  size_t names = 1;
+  for (const char *c = list; *c; c++)
+    names += *c == ',';
+  p->passes = scu_checked_malloc(names * sizeof(pipeline_pass));
+
+  const char *name = list;
+  while (true) {
+    size_t length = strcspn(name, ",");
+    p->passes[p->count++] = pipeline_find_pass(name, length);
+    if (name[length] == '\0')
+      break;
+    name += length + 1;
+  }
+}
+
+size_t pipeline_position(pipeline *p, pipeline_pass pass) {
+  for (size_t i = 0; i < p->count; i++)
+    if (p->passes[i] == pass)
+      return i;
+  return p->count;
+}
+
+/*
+ * @brief: turn the per-loop reports of licm and vectorize into remarks.
+ */
+static void loop_remarks(pipeline_pass pass, pipeline_stats *stats) {
+  if (pass == PASS_LICM) {
+    for (size_t i = 0; i < stats->licm.loops.count; i++) {
+      licm_loop_stats *loop = dynamic_array_at(&stats->licm.loops, i);
+      if (loop->hoisted)
+        remark_add(&stats->remarks, REMARK_PASSED, "licm", loop->line,
+                   "%zu instructions hoisted out of loop", loop->hoisted);
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < stats->vectorize.loops.count; i++) {
+    vectorize_loop_stats *loop = dynamic_array_at(&stats->vectorize.loops, i);
+    if (loop->reason)
+      remark_add(&stats->remarks, REMARK_MISSED, "vectorize", loop->line,
+                 "loop not vectorized: it %s", loop->reason);
+    else
+      remark_add(&stats->remarks, REMARK_PASSED, "vectorize", loop->line,
+                 "loop vectorized, %u lanes", stats->vectorize.lanes);
+  }
+}
+
+/*
+ * @brief: run one pass. A pass running again replaces the counts of its
+ * earlier run, its remarks are added to the earlier ones.
+ */
+static void run_pass(pipeline *p, ir_program *ir, pipeline_pass pass,
+                     pipeline_stats *stats) {
+  switch (pass) {
+  case PASS_FUSE:
+    stats->fused = fuse_branches(ir);
+    break;
+  case PASS_ROTATE:
+    stats->rotated = rotate_loops(ir);
+    break;
+  case PASS_PROMOTE:
+    stats->promoted = promote_variables(ir, &stats->remarks);
+    break;
+  case PASS_SCCP:
+    propagate_constants(ir, &stats->sccp, &stats->remarks);
+    break;
+  case PASS_DCE:
+    eliminate_dead_code(ir, &stats->dce);
+    break;
+  case PASS_STRENGTH:
+    stats->reduced = strength_reduce(ir, &stats->remarks);
+    break;
+  case PASS_LICM:
+    licm_stats_free(&stats->licm);
+    hoist_loop_invariants(ir, &stats->licm);
+    loop_remarks(pass, stats);
+    break;
+  case PASS_INDVARS:
+    reduce_induction_variables(ir, &stats->indvars, &stats->remarks);
+    break;
+  case PASS_VECTORIZE:
+    vectorize_stats_free(&stats->vectorize);
+    vectorize_loops(ir, p->avx2, &stats->vectorize);
+    loop_remarks(pass, stats);
+    break;
+  case PASS_UNROLL:
+    unroll_loops(ir, p->unroll_factor, p->unroll_budget, p->profile,
+                 &stats->unroll, &stats->remarks);
+    break;
+  case PASS_GVN:
+    number_values(ir, &stats->gvn);
+    break;
+  case PASS_LAYOUT:
+    layout_blocks(ir, p->profile, &stats->layout, &stats->remarks);
+    break;
+  case PASS_ALIGN:
+  case PASS_PEEPHOLE:
+  case PASS_COUNT:
+    break;
+  }
+  stats->ran[pass] = true;
+}
+
+/*
+ * @brief: get the wall clock time in milliseconds.
+ */
+static double now_ms(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void pipeline_run(pipeline *p, ir_program *ir, size_t from, size_t to,
+                  pipeline_stats *stats) {
+  pipeline_stats scratch;
+  bool silent = stats == NULL;
+  if (silent) {
+    pipeline_stats_init(&scratch);
+    stats = &scratch;
+  }
+
+  for (size_t i = from; i < to; i++) {
+    pipeline_pass pass = p->passes[i];
+    if (pipeline_in_codegen(pass)) {
+      stats->ran[pass] = true;
+      continue;
+    }
+
+    pipeline_timing timing = {.pass = pass,
+                              .instrs_before = ir_instr_count(ir),
+                              .blocks_before = ir->blocks.count};
+
+    double start = now_ms();
+    run_pass(p, ir, pass, stats);
+    timing.ms = now_ms() - start;
+
+    if (silent)
+      continue;
+
+    timing.instrs_after = ir_instr_count(ir);
+    timing.blocks_after = ir->blocks.count;
+    dynamic_array_append(&stats->timings, &timing);
+
+    if ((int)pass == p->print_after) {
+      printf("IR after %s:\n", pass_names[pass]);
+      ir_print(ir);
+    }
+  }
+
+  if (silent)
+    pipeline_stats_free(&scratch);
+}
+
+void pipeline_stats_init(pipeline_stats *stats) {
+  *stats = (pipeline_stats){0};
+  dynamic_array_init(&stats->licm.loops, sizeof(licm_loop_stats));
+  dynamic_array_init(&stats->vectorize.loops, sizeof(vectorize_loop_stats));
+  dynamic_array_init(&stats->timings, sizeof(pipeline_timing));
+  dynamic_array_init(&stats->remarks, sizeof(remark));
+}
+
+void pipeline_stats_free(pipeline_stats *stats) {
+  licm_stats_free(&stats->licm);
+  vectorize_stats_free(&stats->vectorize);
+  dynamic_array_free(&stats->timings);
+  remarks_free(&stats->remarks);
+}
+
+void pipeline_free(pipeline *p) {
+  free(p->passes);
+  p->passes = NULL;
+  p->count = 0;
+}
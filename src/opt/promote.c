@@ -0,0 +1,251 @@
+#include "opt/promote.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ds/ht.h"
+#include "ir.h"
+#include "opt/liveness.h"
+#include "opt/remarks.h"
+#include "utils.h"
+
+#include <stdlib.h>
+
+/*
+ * @struct promote_slot: what is known about one variable.
+ */
+typedef struct promote_slot {
+  bool pinned;
+  ir_opcode pin;   // <-- instruction that pinned it, IR_ADDR or IR_FASM
+  size_t pin_line; // <-- source line of that instruction
+  size_t vreg;
+} promote_slot;
+
+/*
+ * @brief: find the variables that must stay in memory and give every other
+ * scalar a vreg.
+ *
+ * @return: number of promoted variables.
+ */
+static size_t assign_vregs(ir_program *ir, ht *slots,
+                           dynamic_array *remarks) {
+  dynamic_array candidates;
+  dynamic_array_init(&candidates, sizeof(variable *));
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (!instr->var || instr->var->is_array)
+        continue;
+
+      promote_slot *slot = ht_search(slots, instr->var->name);
+      if (!slot) {
+        promote_slot fresh = {.pinned = false, .vreg = 0};
+        ht_insert(slots, instr->var->name, &fresh);
+        dynamic_array_append(&candidates, &instr->var);
+        slot = ht_search(slots, instr->var->name);
+      }
+
+      if ((instr->op == IR_ADDR || instr->op == IR_FASM) && !slot->pinned) {
+        slot->pinned = true;
+        slot->pin = instr->op;
+        slot->pin_line = instr->line;
+      }
+    }
+  }
+
+  size_t promoted = 0;
+  for (size_t i = 0; i < candidates.count; i++) {
+    variable *var;
+    dynamic_array_get(&candidates, i, &var);
+
+    promote_slot *slot = ht_search(slots, var->name);
+    if (slot->pinned) {
+      remark_add(remarks, REMARK_MISSED, "promote", var->line,
+                 "variable %s kept in memory: %s at line %zu", var->name,
+                 slot->pin == IR_ADDR ? "address taken" : "used by fasm",
+                 slot->pin_line);
+      continue;
+    }
+
+    slot->vreg = ir_new_vreg(ir, var->type).vreg;
+    ir_vreg_at(ir, slot->vreg)->var = var;
+    promoted++;
+    remark_add(remarks, REMARK_PASSED, "promote", var->line,
+               "variable %s promoted to a register", var->name);
+  }
+
+  dynamic_array_free(&candidates);
+  return promoted;
+}
+
+/*
+ * @brief: turn loads / stores of promoted variables into moves.
+ */
+static void rewrite_accesses(ir_program *ir, ht *slots) {
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->op != IR_LOAD && instr->op != IR_STORE)
+        continue;
+
+      promote_slot *slot = ht_search(slots, instr->var->name);
+      if (!slot || slot->pinned)
+        continue;
+
+      ir_operand reg = {.kind = IR_OPERAND_VREG, .vreg = slot->vreg};
+      if (instr->op == IR_LOAD) {
+        instr->a = reg;
+      } else {
+        instr->dst = reg;
+      }
+      instr->op = IR_MOV;
+      instr->var = NULL;
+    }
+  }
+}
+
+/*
+ * @brief: replace reads of the copy t = v in the rest of the block by v, if
+ * every read of t is in this block and v does not change before the last one.
+ *
+ * @return: true if the copy became dead.
+ */
+static bool forward_copy(ir_block *block, size_t at, size_t *uses) {
+  ir_instr *copy = dynamic_array_at(&block->instrs, at);
+  size_t t = copy->dst.vreg;
+  size_t v = copy->a.vreg;
+
+  size_t seen = 0;
+  size_t last = at;
+  for (size_t j = at + 1; j < block->instrs.count && seen < uses[t]; j++) {
+    ir_instr *instr = dynamic_array_at(&block->instrs, j);
+    if (ir_is_vreg(instr->a, t) || ir_is_vreg(instr->b, t)) {
+      seen += ir_is_vreg(instr->a, t) + ir_is_vreg(instr->b, t);
+      last = j;
+    }
+    if (seen < uses[t] && ir_is_vreg(instr->dst, v))
+      return false;
+  }
+  if (seen != uses[t])
+    return false;
+
+  for (size_t j = at + 1; j <= last; j++) {
+    ir_instr *instr = dynamic_array_at(&block->instrs, j);
+    if (ir_is_vreg(instr->a, t))
+      instr->a.vreg = v;
+    if (ir_is_vreg(instr->b, t))
+      instr->b.vreg = v;
+  }
+
+  uses[v] += uses[t];
+  uses[t] = 0;
+  return true;
+}
+
+/*
+ * @brief: for the copy v = t, make the instruction that computed t write v
+ * directly, when t has no other reader and v is untouched in between.
+ *
+ * @return: true if the copy became dead.
+ */
+static bool backward_copy(ir_block *block, size_t at, size_t *uses) {
+  ir_instr *copy = dynamic_array_at(&block->instrs, at);
+  size_t v = copy->dst.vreg;
+  size_t t = copy->a.vreg;
+  if (uses[t] != 1)
+    return false;
+
+  for (size_t j = at; j-- > 0;) {
+    ir_instr *instr = dynamic_array_at(&block->instrs, j);
+
+    if (ir_is_vreg(instr->dst, t)) {
+      instr->dst.vreg = v;
+      uses[t] = 0;
+      return true;
+    }
+
+    if (ir_is_vreg(instr->a, v) || ir_is_vreg(instr->b, v) ||
+        ir_is_vreg(instr->dst, v))
+      return false;
+  }
+
+  return false;
+}
+
+/*
+ * @brief: fold the register moves introduced by the rewrite into their
+ * neighbours and drop the moves that became dead.
+ */
+static void coalesce_copies(ir_program *ir) {
+  size_t *uses = ir_use_counts(ir);
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->op != IR_MOV || instr->a.kind != IR_OPERAND_VREG)
+        continue;
+
+      bool from_var = ir_vreg_at(ir, instr->a.vreg)->var != NULL;
+      bool to_var = ir_vreg_at(ir, instr->dst.vreg)->var != NULL;
+      bool dead = false;
+
+      if (from_var && !to_var)
+        dead = forward_copy(block, j, uses);
+      else if (to_var && !from_var)
+        dead = backward_copy(block, j, uses);
+
+      if (dead)
+        instr->op = IR_NOP;
+    }
+
+    for (size_t j = block->instrs.count; j-- > 0;) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->op == IR_NOP)
+        dynamic_array_remove(&block->instrs, j);
+    }
+  }
+
+  free(uses);
+}
+
+/*
+ * @brief: zero the promoted variables that are live on entry, i.e. may be read
+ * before any assignment.
+ */
+static void zero_live_in(ir_program *ir) {
+  liveness lv;
+  liveness_compute(ir, &lv);
+
+  ir_block *entry = ir_block_at(ir, 0);
+  for (size_t v = 0; v < ir->vregs.count; v++) {
+    ir_vreg *info = ir_vreg_at(ir, v);
+    if (!info->var || !bitset_test(&lv.live_in[0], v))
+      continue;
+
+    ir_instr zero = {.op = IR_MOV,
+                     .type = info->type,
+                     .line = info->var->line,
+                     .dst = {.kind = IR_OPERAND_VREG, .vreg = v},
+                     .a = ir_imm(0)};
+    dynamic_array_insert(&entry->instrs, 0, &zero);
+  }
+
+  liveness_free(&lv);
+}
+
+size_t promote_variables(ir_program *ir, dynamic_array *remarks) {
+  ht *slots = ht_new(sizeof(promote_slot));
+
+  size_t promoted = assign_vregs(ir, slots, remarks);
+  if (promoted) {
+    rewrite_accesses(ir, slots);
+    coalesce_copies(ir);
+    zero_live_in(ir);
+  }
+
+  ht_del_ht(slots);
+  return promoted;
+}
@@ -0,0 +1,133 @@
+#include "opt/remarks.h"
+#include "ds/dynamic_array.h"
+#include "utils.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void remark_add(dynamic_array *remarks, remark_kind kind, const char *pass,
+                size_t line, const char *format, ...) {
+  if (!remarks)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  va_list args_copy;
+  va_copy(args_copy, args);
+  int length = vsnprintf(NULL, 0, format, args_copy);
+  va_end(args_copy);
+
+  remark r = {.kind = kind, .pass = pass, .line = line};
+  r.message = scu_checked_malloc(length + 1);
+  vsnprintf(r.message, length + 1, format, args);
+  va_end(args);
+
+  dynamic_array_append(remarks, &r);
+}
+
+/*
+ * @brief: get the remarks in source line order, remarks on the same line in
+ * the order the passes made them.
+ *
+ * @return: malloc'd array of pointers into remarks.
+ */
+static remark **sorted(dynamic_array *remarks) {
+  remark **order = scu_checked_malloc(remarks->count * sizeof(remark *));
+  for (size_t i = 0; i < remarks->count; i++) {
+    remark *r = dynamic_array_at(remarks, i);
+    size_t j = i;
+    for (; j > 0 && order[j - 1]->line > r->line; j--)
+      order[j] = order[j - 1];
+    order[j] = r;
+  }
+  return order;
+}
+
+/*
+ * @brief: check whether a comma separated list names a pass, "" names all.
+ */
+static bool listed(const char *list, const char *pass) {
+  if (!list)
+    return false;
+  if (*list == '\0')
+    return true;
+
+  size_t length = strlen(pass);
+  while (true) {
+    size_t name = strcspn(list, ",");
+    if (name == length && strncmp(list, pass, length) == 0)
+      return true;
+    if (list[name] == '\0')
+      return false;
+    list += name + 1;
+  }
+}
+
+void remarks_print(dynamic_array *remarks, const char *filename,
+                   const char *passed, const char *missed) {
+  remark **order = sorted(remarks);
+
+  for (size_t i = 0; i < remarks->count; i++) {
+    remark *r = order[i];
+    bool is_passed = r->kind == REMARK_PASSED;
+    if (!listed(is_passed ? passed : missed, r->pass))
+      continue;
+
+    printf("%s:%zu: %sremark:\033[0m %s [-Rpass%s=%s]\n", filename, r->line,
+           is_passed ? "\033[1;32m" : "\033[1;33m", r->message,
+           is_passed ? "" : "-missed", r->pass);
+  }
+
+  free(order);
+}
+
+/*
+ * @brief: write a string as a JSON string literal.
+ */
+static void write_json_string(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+bool remarks_write_json(dynamic_array *remarks, const char *filename,
+                        const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return false;
+
+  remark **order = sorted(remarks);
+
+  fprintf(f, "{\n  \"file\": ");
+  write_json_string(f, filename);
+  fprintf(f, ",\n  \"remarks\": [");
+  for (size_t i = 0; i < remarks->count; i++) {
+    remark *r = order[i];
+    fprintf(f, "%s\n    {\"kind\": \"%s\", \"pass\": ", i ? "," : "",
+            r->kind == REMARK_PASSED ? "passed" : "missed");
+    write_json_string(f, r->pass);
+    fprintf(f, ", \"line\": %zu, \"message\": ", r->line);
+    write_json_string(f, r->message);
+    fputc('}', f);
+  }
+  fprintf(f, "%s]\n}\n", remarks->count ? "\n  " : "");
+
+  free(order);
+  return fclose(f) == 0;
+}
+
+void remarks_free(dynamic_array *remarks) {
+  for (size_t i = 0; i < remarks->count; i++)
+    free(((remark *)dynamic_array_at(remarks, i))->message);
+  dynamic_array_free(remarks);
+}
@@ -0,0 +1,140 @@
+#include "opt/rotate.h"
+#include "cfg.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * @brief: check whether the header of a loop can be copied to its bottom:
+ * it branches to one block in the loop (not itself) and one outside, has no
+ * fasm statement, and every vreg it writes is written nowhere else and only
+ * read inside it.
+ */
+static bool can_rotate(ir_program *ir, cfg_loop *loop) {
+  ir_block *head = loop->header;
+  ir_instr *term = ir_terminator(head);
+  if (!term || term->op != IR_BR || term->target == term->alt)
+    return false;
+
+  bool target_in = bitset_test(&loop->blocks, term->target->index);
+  bool alt_in = bitset_test(&loop->blocks, term->alt->index);
+  ir_block *inside = target_in ? term->target : term->alt;
+  if (target_in == alt_in || inside == head)
+    return false;
+
+  if (ir_has_fasm(head))
+    return false;
+
+  size_t *defs = ir_def_counts(ir);
+  bool *local = scu_checked_malloc((ir->vregs.count + 1) * sizeof(bool));
+  bool ok = true;
+
+  for (size_t j = 0; ok && j < head->instrs.count; j++) {
+    ir_instr *instr = dynamic_array_at(&head->instrs, j);
+    if (instr->dst.kind == IR_OPERAND_VREG) {
+      local[instr->dst.vreg] = true;
+      ok = defs[instr->dst.vreg] == 1;
+    }
+  }
+
+  for (size_t i = 0; ok && i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    if (block == head)
+      continue;
+    for (size_t j = 0; ok && j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if ((instr->a.kind == IR_OPERAND_VREG && local[instr->a.vreg]) ||
+          (instr->b.kind == IR_OPERAND_VREG && local[instr->b.vreg]))
+        ok = false;
+    }
+  }
+
+  free(defs);
+  free(local);
+  return ok;
+}
+
+/*
+ * @brief: rename an operand read by the copy of the header.
+ */
+static ir_operand renamed(ir_operand op, size_t *names) {
+  if (op.kind == IR_OPERAND_VREG && names[op.vreg] != SIZE_MAX)
+    op.vreg = names[op.vreg];
+  return op;
+}
+
+/*
+ * @brief: copy the header of a loop to a test block after its last block
+ * and send the back edges there.
+ */
+static void rotate(ir_program *ir, cfg_loop *loop) {
+  ir_block *head = loop->header;
+  ir_block *test = ir_block_new(ir, NULL);
+  test->origin = head->origin;
+
+  size_t count = ir->vregs.count;
+  size_t *names = scu_checked_malloc((count + 1) * sizeof(size_t));
+  for (size_t v = 0; v < count; v++)
+    names[v] = SIZE_MAX;
+
+  for (size_t j = 0; j < head->instrs.count; j++) {
+    ir_instr copy = *(ir_instr *)dynamic_array_at(&head->instrs, j);
+    copy.a = renamed(copy.a, names);
+    copy.b = renamed(copy.b, names);
+    if (copy.dst.kind == IR_OPERAND_VREG) {
+      ir_operand fresh = ir_new_vreg(ir, ir_vreg_at(ir, copy.dst.vreg)->type);
+      names[copy.dst.vreg] = fresh.vreg;
+      copy.dst = fresh;
+    }
+    dynamic_array_append(&test->instrs, &copy);
+  }
+  free(names);
+
+  for (size_t k = 0; k < loop->latches.count; k++) {
+    size_t latch = *(size_t *)dynamic_array_at(&loop->latches, k);
+    ir_instr *term = ir_terminator(ir_block_at(ir, latch));
+    if (term->target == head)
+      term->target = test;
+    if (term->op == IR_BR && term->alt == head)
+      term->alt = test;
+  }
+
+  size_t last = 0;
+  for (size_t i = 0; i < ir->blocks.count; i++)
+    if (bitset_test(&loop->blocks, i))
+      last = i;
+  ir_insert_block(ir, last + 1, test);
+}
+
+size_t rotate_loops(ir_program *ir) {
+  cfg g;
+  cfg_build(ir, &g);
+  dynamic_array heads;
+  dynamic_array_init(&heads, sizeof(ir_block *));
+  for (size_t l = 0; l < g.loops.count; l++)
+    dynamic_array_append(&heads, &cfg_loop_at(&g, l)->header);
+  cfg_free(&g);
+
+  // the cfg is rebuilt for every loop, rotating one adds a block
+  size_t rotated = 0;
+  for (size_t h = 0; h < heads.count; h++) {
+    ir_block *head = *(ir_block **)dynamic_array_at(&heads, h);
+    cfg_build(ir, &g);
+    for (size_t l = 0; l < g.loops.count; l++) {
+      cfg_loop *loop = cfg_loop_at(&g, l);
+      if (loop->header == head && can_rotate(ir, loop)) {
+        rotate(ir, loop);
+        rotated++;
+        break;
+      }
+    }
+    cfg_free(&g);
+  }
+
+  dynamic_array_free(&heads);
+  return rotated;
+}
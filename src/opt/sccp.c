@@ -0,0 +1,516 @@
+#include "opt/sccp.h"
+#include "cfg.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/remarks.h"
+#include "opt/ssa.h"
+#include "utils.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * @enum sccp_level: position of a value in the lattice, it only goes down.
+ */
+typedef enum sccp_level {
+  SCCP_UNKNOWN = 0, // <-- no definition found executable yet
+  SCCP_CONST,
+  SCCP_VARYING,
+} sccp_level;
+
+/*
+ * @struct sccp_value: what is known about a vreg.
+ */
+typedef struct sccp_value {
+  sccp_level level;
+  long value; // <-- SCCP_CONST only
+} sccp_value;
+
+/*
+ * @struct sccp_site: an instruction or a phi using a vreg.
+ */
+typedef struct sccp_site {
+  size_t block;
+  size_t index; // <-- instruction, or phi when phi is set
+  bool phi;
+} sccp_site;
+
+/*
+ * @struct sccp_edge: a control flow edge to visit.
+ */
+typedef struct sccp_edge {
+  size_t from;
+  size_t to;
+} sccp_edge;
+
+/*
+ * @struct sccp_branch: a branch that only goes one way.
+ */
+typedef struct sccp_branch {
+  ir_block *block;
+  bool taken;
+} sccp_branch;
+
+/*
+ * @struct sccp_state: state of the propagation.
+ */
+typedef struct sccp_state {
+  ir_program *ir;
+  ssa_form *ssa;
+  sccp_value *values;   // <-- by vreg
+  size_t *use_start;    // <-- users of vreg v: uses[use_start[v] ..]
+  sccp_site *uses;      //     .. use_start[v + 1])
+  bool *executable;     // <-- by block
+  size_t *edge_start;   // <-- edges[edge_start[b] + k]: the edge from the
+  bool *edges;          //     k-th predecessor of block b is executable
+  dynamic_array flow;   // <-- sccp_edge
+  dynamic_array lowered; // <-- size_t, vregs whose value went down
+} sccp_state;
+
+/*
+ * @brief: check whether a fasm statement of the program may define a label.
+ */
+static bool defines_label(ir_program *ir) {
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (instr->op == IR_FASM && strchr(instr->content, ':'))
+        return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * @brief: meet of two lattice values.
+ */
+static sccp_value meet(sccp_value a, sccp_value b) {
+  if (a.level == SCCP_UNKNOWN)
+    return b;
+  if (b.level == SCCP_UNKNOWN)
+    return a;
+  if (a.level == SCCP_CONST && b.level == SCCP_CONST && a.value == b.value)
+    return a;
+  return (sccp_value){.level = SCCP_VARYING};
+}
+
+/*
+ * @brief: lower the value of a vreg, its users are visited again if it
+ * changed.
+ */
+static void lower(sccp_state *s, size_t vreg, sccp_value value) {
+  sccp_value old = s->values[vreg];
+  sccp_value now = meet(old, value);
+  if (now.level == old.level && now.value == old.value)
+    return;
+  s->values[vreg] = now;
+  dynamic_array_append(&s->lowered, &vreg);
+}
+
+/*
+ * @brief: get the value of an operand.
+ */
+static sccp_value operand_value(sccp_state *s, ir_operand op) {
+  if (op.kind == IR_OPERAND_IMM)
+    return (sccp_value){.level = SCCP_CONST, .value = op.imm};
+  if (op.kind == IR_OPERAND_VREG)
+    return s->values[op.vreg];
+  return (sccp_value){.level = SCCP_VARYING};
+}
+
+/*
+ * @brief: check whether an instruction only computes its vreg, so it can
+ * become a move of a constant result.
+ */
+static bool computes(ir_opcode op) {
+  switch (op) {
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_MULHI:
+  case IR_DIV:
+  case IR_MOD:
+  case IR_AND:
+  case IR_SHL:
+  case IR_SAR:
+  case IR_SHR:
+  case IR_CMP:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * @brief: evaluate an instruction on constants the way the generated code
+ * computes it (64 bit, wrapping).
+ *
+ * @return: false if it cannot be evaluated at compile time.
+ */
+static bool evaluate(ir_opcode op, rel_kind rel, long a, long b,
+                     long *result) {
+  unsigned long ua = (unsigned long)a;
+  unsigned long ub = (unsigned long)b;
+
+  switch (op) {
+  case IR_ADD:
+    *result = (long)(ua + ub);
+    return true;
+  case IR_SUB:
+    *result = (long)(ua - ub);
+    return true;
+  case IR_MUL:
+    *result = (long)(ua * ub);
+    return true;
+  case IR_MULHI:
+    *result = (long)(((__int128)a * b) >> 64);
+    return true;
+  case IR_DIV:
+  case IR_MOD:
+    if (b == 0 || (a == LONG_MIN && b == -1))
+      return false;
+    *result = op == IR_DIV ? a / b : a % b;
+    return true;
+  case IR_AND:
+    *result = a & b;
+    return true;
+  case IR_SHL:
+    *result = (long)(ua << (b & 63));
+    return true;
+  case IR_SAR:
+    *result = a >> (b & 63);
+    return true;
+  case IR_SHR:
+    *result = (long)(ua >> (b & 63));
+    return true;
+  case IR_CMP:
+    *result = ir_rel_holds(rel, a, b);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * @brief: mark the edges from one block to another executable.
+ */
+static void add_edge(sccp_state *s, size_t from, ir_block *to) {
+  dynamic_array_append(&s->flow, &(sccp_edge){.from = from, .to = to->index});
+}
+
+/*
+ * @brief: visit a phi, meeting the arguments of the executable edges.
+ */
+static void visit_phi(sccp_state *s, size_t b, size_t p) {
+  ssa_phi *phi = dynamic_array_at(&s->ssa->phis[b], p);
+
+  // the entry is also entered from outside the graph
+  if (b == 0) {
+    lower(s, phi->dst, (sccp_value){.level = SCCP_VARYING});
+    return;
+  }
+
+  sccp_value value = {.level = SCCP_UNKNOWN};
+  for (size_t k = 0; k < s->ssa->g.preds[b].count; k++)
+    if (s->edges[s->edge_start[b] + k])
+      value = meet(value, operand_value(s, phi->args[k]));
+  lower(s, phi->dst, value);
+}
+
+/*
+ * @brief: visit an instruction, lowering its result or adding the edges a
+ * terminator can take.
+ */
+static void visit_instr(sccp_state *s, size_t b, size_t j) {
+  ir_block *block = ir_block_at(s->ir, b);
+  ir_instr *instr = dynamic_array_at(&block->instrs, j);
+  sccp_value a = operand_value(s, instr->a);
+  sccp_value bv = operand_value(s, instr->b);
+
+  switch (instr->op) {
+  case IR_JMP:
+    add_edge(s, b, instr->target);
+    return;
+  case IR_BR:
+    if (a.level == SCCP_CONST && bv.level == SCCP_CONST) {
+      bool taken = ir_rel_holds(instr->rel, a.value, bv.value);
+      add_edge(s, b, taken ? instr->target : instr->alt);
+    } else if (a.level == SCCP_VARYING || bv.level == SCCP_VARYING) {
+      add_edge(s, b, instr->target);
+      add_edge(s, b, instr->alt);
+    }
+    return;
+  default:
+    break;
+  }
+
+  if (instr->dst.kind != IR_OPERAND_VREG)
+    return;
+
+  if (instr->op == IR_MOV) {
+    lower(s, instr->dst.vreg, a);
+    return;
+  }
+
+  if (!computes(instr->op) || a.level == SCCP_VARYING ||
+      bv.level == SCCP_VARYING) {
+    lower(s, instr->dst.vreg, (sccp_value){.level = SCCP_VARYING});
+  } else if (a.level == SCCP_CONST && bv.level == SCCP_CONST) {
+    sccp_value value = {.level = SCCP_VARYING};
+    long result;
+    if (evaluate(instr->op, instr->rel, a.value, bv.value, &result))
+      value = (sccp_value){.level = SCCP_CONST, .value = result};
+    lower(s, instr->dst.vreg, value);
+  }
+}
+
+/*
+ * @brief: a block became executable through one more edge: visit its phis,
+ * and everything else the first time.
+ */
+static void visit_edge(sccp_state *s, sccp_edge edge) {
+  dynamic_array *preds = &s->ssa->g.preds[edge.to];
+  bool added = false;
+  for (size_t k = 0; k < preds->count; k++) {
+    size_t pred;
+    dynamic_array_get(preds, k, &pred);
+    if (pred == edge.from && !s->edges[s->edge_start[edge.to] + k]) {
+      s->edges[s->edge_start[edge.to] + k] = true;
+      added = true;
+    }
+  }
+  if (!added)
+    return;
+
+  for (size_t p = 0; p < s->ssa->phis[edge.to].count; p++)
+    visit_phi(s, edge.to, p);
+  if (s->executable[edge.to])
+    return;
+
+  s->executable[edge.to] = true;
+  ir_block *block = ir_block_at(s->ir, edge.to);
+  for (size_t j = 0; j < block->instrs.count; j++)
+    visit_instr(s, edge.to, j);
+}
+
+/*
+ * @brief: collect the instructions and phis using every vreg.
+ */
+static void find_uses(sccp_state *s) {
+  size_t n = s->ir->vregs.count;
+  size_t blocks = s->ssa->g.block_count;
+  s->use_start = scu_checked_malloc((n + 2) * sizeof(size_t));
+
+  // two passes: count, then fill
+  for (int pass = 0; pass < 2; pass++) {
+    size_t *fill = NULL;
+    if (pass == 1) {
+      for (size_t v = 0; v < n; v++)
+        s->use_start[v + 1] += s->use_start[v];
+      s->uses = scu_checked_malloc((s->use_start[n] + 1) * sizeof(sccp_site));
+      fill = scu_checked_malloc((n + 1) * sizeof(size_t));
+      memcpy(fill, s->use_start, n * sizeof(size_t));
+    }
+
+    for (size_t b = 0; b < blocks; b++) {
+      dynamic_array *phis = &s->ssa->phis[b];
+      for (size_t p = 0; p < phis->count; p++) {
+        ssa_phi *phi = dynamic_array_at(phis, p);
+        for (size_t k = 0; k < s->ssa->g.preds[b].count; k++) {
+          if (phi->args[k].kind != IR_OPERAND_VREG)
+            continue;
+          size_t v = phi->args[k].vreg;
+          if (pass == 0)
+            s->use_start[v + 1]++;
+          else
+            s->uses[fill[v]++] = (sccp_site){.block = b, .index = p, .phi = true};
+        }
+      }
+
+      dynamic_array *instrs = &ir_block_at(s->ir, b)->instrs;
+      for (size_t j = 0; j < instrs->count; j++) {
+        ir_instr *instr = dynamic_array_at(instrs, j);
+        ir_operand ops[2] = {instr->a, instr->b};
+        for (size_t o = 0; o < 2; o++) {
+          if (ops[o].kind != IR_OPERAND_VREG)
+            continue;
+          size_t v = ops[o].vreg;
+          if (pass == 0)
+            s->use_start[v + 1]++;
+          else
+            s->uses[fill[v]++] = (sccp_site){.block = b, .index = j};
+        }
+      }
+    }
+    free(fill);
+  }
+}
+
+/*
+ * @brief: only vregs with a single definition in a reachable block can be
+ * constant. A use no definition reaches, or of a vreg still defined more
+ * than once (in blocks the entry does not reach), is varying.
+ */
+static void init_values(sccp_state *s) {
+  size_t n = s->ir->vregs.count;
+  size_t *defs = ir_def_counts(s->ir);
+  cfg *g = &s->ssa->g;
+
+  for (size_t b = 0; b < g->block_count; b++)
+    for (size_t p = 0; p < s->ssa->phis[b].count; p++)
+      defs[((ssa_phi *)dynamic_array_at(&s->ssa->phis[b], p))->dst]++;
+
+  for (size_t b = 0; b < g->block_count; b++) {
+    if (cfg_reachable(g, b))
+      continue;
+    dynamic_array *instrs = &ir_block_at(s->ir, b)->instrs;
+    for (size_t j = 0; j < instrs->count; j++) {
+      ir_instr *instr = dynamic_array_at(instrs, j);
+      if (instr->dst.kind == IR_OPERAND_VREG)
+        defs[instr->dst.vreg] = SIZE_MAX;
+    }
+  }
+
+  s->values = scu_checked_malloc((n + 1) * sizeof(sccp_value));
+  for (size_t v = 0; v < n; v++)
+    if (defs[v] != 1)
+      s->values[v].level = SCCP_VARYING;
+  free(defs);
+}
+
+/*
+ * @brief: check whether a constant can replace a vreg operand.
+ */
+static bool substitutable(sccp_value value) {
+  return value.level == SCCP_CONST && value.value >= INT32_MIN &&
+         value.value <= INT32_MAX;
+}
+
+/*
+ * @brief: rewrite the executable blocks with the constants found, and
+ * collect the branches that only go one way (sccp_branch).
+ */
+static void rewrite(sccp_state *s, dynamic_array *decided,
+                    sccp_stats *stats) {
+  for (size_t b = 0; b < s->ssa->g.block_count; b++) {
+    if (!s->executable[b])
+      continue;
+
+    ir_block *block = ir_block_at(s->ir, b);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+
+      if (instr->dst.kind == IR_OPERAND_VREG && computes(instr->op) &&
+          substitutable(s->values[instr->dst.vreg])) {
+        instr->op = IR_MOV;
+        instr->a = ir_imm(s->values[instr->dst.vreg].value);
+        instr->b = (ir_operand){0};
+        stats->folded++;
+        continue;
+      }
+
+      ir_operand *ops[2] = {&instr->a, &instr->b};
+      for (size_t o = 0; o < 2; o++) {
+        if (ops[o]->kind == IR_OPERAND_VREG &&
+            substitutable(s->values[ops[o]->vreg])) {
+          *ops[o] = ir_imm(s->values[ops[o]->vreg].value);
+          stats->constants++;
+        }
+      }
+
+      if (instr->op == IR_BR && instr->a.kind == IR_OPERAND_IMM &&
+          instr->b.kind == IR_OPERAND_IMM) {
+        sccp_branch branch = {
+            .block = block,
+            .taken = ir_rel_holds(instr->rel, instr->a.imm, instr->b.imm)};
+        dynamic_array_append(decided, &branch);
+      }
+    }
+  }
+}
+
+void propagate_constants(ir_program *ir, sccp_stats *stats,
+                         dynamic_array *remarks) {
+  *stats = (sccp_stats){0};
+  if (ir->blocks.count == 0 || defines_label(ir))
+    return;
+
+  ssa_form ssa;
+  ssa_build(ir, &ssa);
+
+  sccp_state s = {.ir = ir, .ssa = &ssa};
+  size_t blocks = ssa.g.block_count;
+  s.executable = scu_checked_malloc((blocks + 1) * sizeof(bool));
+  s.edge_start = scu_checked_malloc((blocks + 1) * sizeof(size_t));
+  for (size_t b = 0; b < blocks; b++)
+    s.edge_start[b + 1] = s.edge_start[b] + ssa.g.preds[b].count;
+  s.edges = scu_checked_malloc((s.edge_start[blocks] + 1) * sizeof(bool));
+  dynamic_array_init(&s.flow, sizeof(sccp_edge));
+  dynamic_array_init(&s.lowered, sizeof(size_t));
+  find_uses(&s);
+  init_values(&s);
+
+  // the entry runs first, then both worklists drain
+  s.executable[0] = true;
+  for (size_t p = 0; p < ssa.phis[0].count; p++)
+    visit_phi(&s, 0, p);
+  ir_block *entry = ir_block_at(ir, 0);
+  for (size_t j = 0; j < entry->instrs.count; j++)
+    visit_instr(&s, 0, j);
+
+  while (s.flow.count > 0 || s.lowered.count > 0) {
+    if (s.flow.count > 0) {
+      sccp_edge edge;
+      dynamic_array_pop(&s.flow, &edge);
+      visit_edge(&s, edge);
+      continue;
+    }
+
+    size_t v;
+    dynamic_array_pop(&s.lowered, &v);
+    for (size_t u = s.use_start[v]; u < s.use_start[v + 1]; u++) {
+      sccp_site site = s.uses[u];
+      if (!s.executable[site.block])
+        continue;
+      if (site.phi)
+        visit_phi(&s, site.block, site.index);
+      else
+        visit_instr(&s, site.block, site.index);
+    }
+  }
+
+  dynamic_array decided;
+  dynamic_array_init(&decided, sizeof(sccp_branch));
+  rewrite(&s, &decided, stats);
+
+  stats->phis = ssa.phi_count;
+  ssa_destroy(ir, &ssa);
+  stats->copies = ssa.copies;
+
+  // leaving SSA may have split edges, but not moved the terminators
+  for (size_t i = 0; i < decided.count; i++) {
+    sccp_branch *branch = dynamic_array_at(&decided, i);
+    ir_instr *term = ir_terminator(branch->block);
+    remark_add(remarks, REMARK_PASSED, "sccp", term->line,
+               "condition is always %s, branch folded",
+               branch->taken ? "true" : "false");
+    *term = (ir_instr){.op = IR_JMP,
+                       .type = TYPE_VOID,
+                       .line = term->line,
+                       .target = branch->taken ? term->target : term->alt};
+    stats->branches++;
+  }
+
+  dynamic_array_free(&decided);
+  dynamic_array_free(&s.lowered);
+  dynamic_array_free(&s.flow);
+  free(s.values);
+  free(s.uses);
+  free(s.use_start);
+  free(s.edges);
+  free(s.edge_start);
+  free(s.executable);
+}
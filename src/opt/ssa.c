@@ -0,0 +1,474 @@
+#include "opt/ssa.h"
+#include "cfg.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/liveness.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * @struct ssa_undo: the version of a vreg before the walk entered the block
+ * that defined a new one.
+ */
+typedef struct ssa_undo {
+  size_t vreg;
+  size_t previous;
+} ssa_undo;
+
+/*
+ * @struct ssa_walk: a step of the dominator tree walk, entering a block or
+ * leaving it and restoring the versions from before.
+ */
+typedef struct ssa_walk {
+  size_t block;
+  size_t mark; // <-- undo log length when the block was entered
+  bool leave;
+} ssa_walk;
+
+/*
+ * @struct ssa_copy: a move a phi needs on one edge.
+ */
+typedef struct ssa_copy {
+  size_t dst;
+  ir_operand src;
+} ssa_copy;
+
+/*
+ * @struct ssa_renamer: state of the renaming walk.
+ */
+typedef struct ssa_renamer {
+  ir_program *ir;
+  ssa_form *ssa;
+  bool *multi;     // <-- defined more than once, by original vreg
+  size_t *current; // <-- version reaching the walk, by original vreg
+  dynamic_array undo; // <-- ssa_undo
+  size_t versions;    // <-- versions made so far
+} ssa_renamer;
+
+/*
+ * @brief: compute the dominance frontier of every block (Cooper, Harvey and
+ * Kennedy): a join is in the frontier of each block on the dominator tree
+ * path from a predecessor up to its immediate dominator.
+ *
+ * @return: malloc'd array of dynamic_array of size_t, one per block.
+ */
+static dynamic_array *dominance_frontiers(cfg *g) {
+  dynamic_array *df =
+      scu_checked_malloc((g->block_count + 1) * sizeof(dynamic_array));
+  for (size_t b = 0; b < g->block_count; b++)
+    dynamic_array_init(&df[b], sizeof(size_t));
+
+  for (size_t b = 0; b < g->block_count; b++) {
+    if (!cfg_reachable(g, b) || g->preds[b].count < 2)
+      continue;
+
+    for (size_t p = 0; p < g->preds[b].count; p++) {
+      size_t runner;
+      dynamic_array_get(&g->preds[b], p, &runner);
+      if (!cfg_reachable(g, runner))
+        continue;
+
+      while (runner != g->idom[b]) {
+        dynamic_array *front = &df[runner];
+        size_t last = SIZE_MAX;
+        if (front->count > 0)
+          dynamic_array_get(front, front->count - 1, &last);
+        if (last != b)
+          dynamic_array_append(front, &b);
+        if (runner == g->idom[runner])
+          break;
+        runner = g->idom[runner];
+      }
+    }
+  }
+  return df;
+}
+
+/*
+ * @brief: add a phi for vreg at the top of a block, every argument is the
+ * vreg itself until the walk renames it.
+ */
+static void add_phi(ssa_form *ssa, size_t block, size_t vreg) {
+  size_t count = ssa->g.preds[block].count;
+  ssa_phi phi = {.dst = vreg,
+                 .vreg = vreg,
+                 .args = scu_checked_malloc((count + 1) * sizeof(ir_operand))};
+  for (size_t k = 0; k < count; k++)
+    phi.args[k] = (ir_operand){.kind = IR_OPERAND_VREG, .vreg = vreg};
+  dynamic_array_append(&ssa->phis[block], &phi);
+  ssa->phi_count++;
+}
+
+/*
+ * @brief: place the phis of every vreg defined more than once on the
+ * iterated dominance frontier of its definitions, in the blocks where it is
+ * live on entry.
+ */
+static void place_phis(ir_program *ir, ssa_form *ssa, bool *multi) {
+  cfg *g = &ssa->g;
+  size_t n = ssa->vreg_count;
+  size_t blocks = g->block_count;
+
+  // blocks defining each vreg, grouped by vreg
+  size_t *start = scu_checked_malloc((n + 2) * sizeof(size_t));
+  for (size_t b = 0; b < blocks; b++) {
+    dynamic_array *instrs = &ir_block_at(ir, b)->instrs;
+    for (size_t j = 0; j < instrs->count; j++) {
+      ir_instr *instr = dynamic_array_at(instrs, j);
+      if (instr->dst.kind == IR_OPERAND_VREG && multi[instr->dst.vreg])
+        start[instr->dst.vreg + 1]++;
+    }
+  }
+  for (size_t v = 0; v < n; v++)
+    start[v + 1] += start[v];
+
+  size_t *fill = scu_checked_malloc((n + 1) * sizeof(size_t));
+  size_t *def_blocks = scu_checked_malloc((start[n] + 1) * sizeof(size_t));
+  for (size_t v = 0; v < n; v++)
+    fill[v] = start[v];
+  for (size_t b = 0; b < blocks; b++) {
+    dynamic_array *instrs = &ir_block_at(ir, b)->instrs;
+    for (size_t j = 0; j < instrs->count; j++) {
+      ir_instr *instr = dynamic_array_at(instrs, j);
+      if (instr->dst.kind == IR_OPERAND_VREG && multi[instr->dst.vreg])
+        def_blocks[fill[instr->dst.vreg]++] = b;
+    }
+  }
+
+  liveness lv;
+  liveness_compute(ir, &lv);
+  dynamic_array *df = dominance_frontiers(g);
+
+  // markers hold vreg + 1 for the vreg being placed
+  size_t *has_phi = scu_checked_malloc((blocks + 1) * sizeof(size_t));
+  size_t *queued = scu_checked_malloc((blocks + 1) * sizeof(size_t));
+  dynamic_array work;
+  dynamic_array_init(&work, sizeof(size_t));
+
+  for (size_t v = 0; v < n; v++) {
+    if (!multi[v])
+      continue;
+
+    for (size_t d = start[v]; d < start[v + 1]; d++) {
+      size_t b = def_blocks[d];
+      if (queued[b] != v + 1 && cfg_reachable(g, b)) {
+        queued[b] = v + 1;
+        dynamic_array_append(&work, &b);
+      }
+    }
+
+    while (work.count > 0) {
+      size_t x;
+      dynamic_array_pop(&work, &x);
+      for (size_t f = 0; f < df[x].count; f++) {
+        size_t y;
+        dynamic_array_get(&df[x], f, &y);
+        if (has_phi[y] == v + 1 || !bitset_test(&lv.live_in[y], v))
+          continue;
+        has_phi[y] = v + 1;
+        add_phi(ssa, y, v);
+        if (queued[y] != v + 1) {
+          queued[y] = v + 1;
+          dynamic_array_append(&work, &y);
+        }
+      }
+    }
+  }
+
+  dynamic_array_free(&work);
+  free(queued);
+  free(has_phi);
+  for (size_t b = 0; b < blocks; b++)
+    dynamic_array_free(&df[b]);
+  free(df);
+  liveness_free(&lv);
+  free(def_blocks);
+  free(fill);
+  free(start);
+}
+
+/*
+ * @brief: give a vreg a new version, reaching the rest of the walk until it
+ * leaves the current block.
+ */
+static size_t new_version(ssa_renamer *r, size_t vreg) {
+  ir_vreg info = *ir_vreg_at(r->ir, vreg);
+  size_t version = ir_new_vreg(r->ir, info.type).vreg;
+  ir_vreg_at(r->ir, version)->var = info.var;
+  r->ssa->origin[version] = vreg;
+  r->versions++;
+
+  ssa_undo undo = {.vreg = vreg, .previous = r->current[vreg]};
+  dynamic_array_append(&r->undo, &undo);
+  r->current[vreg] = version;
+  return version;
+}
+
+/*
+ * @brief: rename a use to the version reaching it.
+ */
+static void rename_use(ssa_renamer *r, ir_operand *op) {
+  if (op->kind == IR_OPERAND_VREG && op->vreg < r->ssa->vreg_count &&
+      r->multi[op->vreg])
+    op->vreg = r->current[op->vreg];
+}
+
+/*
+ * @brief: rename the phis and instructions of a block, then fill in the
+ * arguments its successors' phis take from it.
+ */
+static void rename_block(ssa_renamer *r, size_t b) {
+  ssa_form *ssa = r->ssa;
+  ir_block *block = ir_block_at(r->ir, b);
+
+  for (size_t p = 0; p < ssa->phis[b].count; p++) {
+    ssa_phi *phi = dynamic_array_at(&ssa->phis[b], p);
+    phi->dst = new_version(r, phi->vreg);
+  }
+
+  for (size_t j = 0; j < block->instrs.count; j++) {
+    ir_instr *instr = dynamic_array_at(&block->instrs, j);
+    rename_use(r, &instr->a);
+    rename_use(r, &instr->b);
+    if (instr->dst.kind == IR_OPERAND_VREG && r->multi[instr->dst.vreg])
+      instr->dst.vreg = new_version(r, instr->dst.vreg);
+  }
+
+  ir_block *succ[2];
+  size_t count = ir_successors(block, succ);
+  for (size_t s = 0; s < count; s++) {
+    size_t index = succ[s]->index;
+    dynamic_array *preds = &ssa->g.preds[index];
+    for (size_t k = 0; k < preds->count; k++) {
+      size_t pred;
+      dynamic_array_get(preds, k, &pred);
+      if (pred != b)
+        continue;
+      for (size_t p = 0; p < ssa->phis[index].count; p++) {
+        ssa_phi *phi = dynamic_array_at(&ssa->phis[index], p);
+        phi->args[k].vreg = r->current[phi->vreg];
+      }
+    }
+  }
+}
+
+void ssa_build(ir_program *ir, ssa_form *ssa) {
+  *ssa = (ssa_form){.vreg_count = ir->vregs.count};
+  cfg_build(ir, &ssa->g);
+  size_t blocks = ssa->g.block_count;
+  size_t n = ssa->vreg_count;
+
+  ssa->phis = scu_checked_malloc((blocks + 1) * sizeof(dynamic_array));
+  for (size_t b = 0; b < blocks; b++)
+    dynamic_array_init(&ssa->phis[b], sizeof(ssa_phi));
+
+  size_t *defs = ir_def_counts(ir);
+  bool *multi = scu_checked_malloc((n + 1) * sizeof(bool));
+  size_t versions = 0;
+  for (size_t v = 0; v < n; v++) {
+    multi[v] = defs[v] > 1;
+    if (multi[v])
+      versions += defs[v];
+  }
+  free(defs);
+
+  place_phis(ir, ssa, multi);
+
+  // every definition and phi gets a version of its own
+  ssa->origin =
+      scu_checked_malloc((n + versions + ssa->phi_count + 1) * sizeof(size_t));
+  for (size_t v = 0; v < n; v++)
+    ssa->origin[v] = v;
+
+  ssa_renamer r = {.ir = ir,
+                   .ssa = ssa,
+                   .multi = multi,
+                   .current = scu_checked_malloc((n + 1) * sizeof(size_t))};
+  dynamic_array_init(&r.undo, sizeof(ssa_undo));
+  for (size_t v = 0; v < n; v++)
+    r.current[v] = v;
+
+  // dominator tree, children in reverse postorder
+  cfg *g = &ssa->g;
+  dynamic_array *children =
+      scu_checked_malloc((blocks + 1) * sizeof(dynamic_array));
+  for (size_t b = 0; b < blocks; b++)
+    dynamic_array_init(&children[b], sizeof(size_t));
+  for (size_t i = 1; i < g->rpo_count; i++)
+    dynamic_array_append(&children[g->idom[g->rpo[i]]], &g->rpo[i]);
+
+  dynamic_array walk;
+  dynamic_array_init(&walk, sizeof(ssa_walk));
+  if (blocks > 0)
+    dynamic_array_append(&walk, &(ssa_walk){.block = 0});
+
+  while (walk.count > 0) {
+    ssa_walk step;
+    dynamic_array_pop(&walk, &step);
+    if (step.leave) {
+      while (r.undo.count > step.mark) {
+        ssa_undo undo;
+        dynamic_array_pop(&r.undo, &undo);
+        r.current[undo.vreg] = undo.previous;
+      }
+      continue;
+    }
+
+    step.mark = r.undo.count;
+    step.leave = true;
+    dynamic_array_append(&walk, &step);
+    rename_block(&r, step.block);
+
+    dynamic_array *kids = &children[step.block];
+    for (size_t c = kids->count; c-- > 0;) {
+      ssa_walk child = {0};
+      dynamic_array_get(kids, c, &child.block);
+      dynamic_array_append(&walk, &child);
+    }
+  }
+
+  dynamic_array_free(&walk);
+  for (size_t b = 0; b < blocks; b++)
+    dynamic_array_free(&children[b]);
+  free(children);
+  dynamic_array_free(&r.undo);
+  free(r.current);
+  free(multi);
+}
+
+/*
+ * @brief: get the vreg a version stands for.
+ */
+static size_t origin_of(ssa_form *ssa, size_t vreg) {
+  return vreg < ssa->vreg_count ? vreg : ssa->origin[vreg];
+}
+
+/*
+ * @brief: get an operand with its version coalesced back into its vreg.
+ */
+static ir_operand coalesced(ssa_form *ssa, ir_operand op) {
+  if (op.kind == IR_OPERAND_VREG)
+    op.vreg = origin_of(ssa, op.vreg);
+  return op;
+}
+
+/*
+ * @brief: emit the moves of one edge, which all happen at once: a source
+ * that another move of the edge overwrites is saved in a vreg first.
+ */
+static void emit_copies(ir_program *ir, ir_block *block, size_t at,
+                        ssa_copy *copies, size_t count) {
+  bool overlap = false;
+  for (size_t i = 0; i < count && !overlap; i++)
+    for (size_t j = 0; j < count; j++)
+      if (i != j && ir_is_vreg(copies[j].src, copies[i].dst))
+        overlap = true;
+
+  for (size_t i = 0; i < count && overlap; i++) {
+    type t = ir_vreg_at(ir, copies[i].dst)->type;
+    ir_instr save = {.op = IR_MOV,
+                     .type = t,
+                     .dst = ir_new_vreg(ir, t),
+                     .a = copies[i].src};
+    dynamic_array_insert(&block->instrs, at++, &save);
+    copies[i].src = save.dst;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    ir_instr mov = {.op = IR_MOV,
+                    .type = ir_vreg_at(ir, copies[i].dst)->type,
+                    .dst = {.kind = IR_OPERAND_VREG, .vreg = copies[i].dst},
+                    .a = copies[i].src};
+    dynamic_array_insert(&block->instrs, at++, &mov);
+  }
+}
+
+/*
+ * @brief: put the moves a block's phis need on the edge from its k-th
+ * predecessor: at the end of the predecessor when the block is its only
+ * successor, else on a new block splitting the edge.
+ */
+static void copy_on_edge(ir_program *ir, ssa_form *ssa, ir_block **layout,
+                         size_t b, size_t k) {
+  dynamic_array *phis = &ssa->phis[b];
+  ssa_copy *copies = scu_checked_malloc((phis->count + 1) * sizeof(ssa_copy));
+  size_t count = 0;
+
+  for (size_t p = 0; p < phis->count; p++) {
+    ssa_phi *phi = dynamic_array_at(phis, p);
+    ir_operand arg = phi->args[k];
+    if (arg.kind == IR_OPERAND_VREG && origin_of(ssa, arg.vreg) == phi->vreg)
+      continue;
+    copies[count++] = (ssa_copy){.dst = phi->vreg, .src = coalesced(ssa, arg)};
+  }
+
+  size_t pred;
+  dynamic_array_get(&ssa->g.preds[b], k, &pred);
+  if (count == 0 || !cfg_reachable(&ssa->g, pred)) {
+    free(copies);
+    return;
+  }
+
+  ir_block *from = layout[pred];
+  ir_block *to = layout[b];
+  ir_block *succ[2];
+  if (ir_successors(from, succ) == 1) {
+    emit_copies(ir, from, from->instrs.count - 1, copies, count);
+  } else {
+    ir_block *edge = ir_block_new(ir, NULL);
+    ir_instr *term = ir_terminator(from);
+    ir_instr jmp = {.op = IR_JMP,
+                    .type = TYPE_VOID,
+                    .line = term->line,
+                    .target = to};
+    dynamic_array_append(&edge->instrs, &jmp);
+    emit_copies(ir, edge, 0, copies, count);
+    if (term->target == to)
+      term->target = edge;
+    else
+      term->alt = edge;
+    ir_place_block(ir, edge);
+  }
+  ssa->copies += count;
+  free(copies);
+}
+
+void ssa_destroy(ir_program *ir, ssa_form *ssa) {
+  cfg *g = &ssa->g;
+  size_t blocks = g->block_count;
+
+  // the layout as the graph knows it, edge blocks go after it
+  ir_block **layout = scu_checked_malloc((blocks + 1) * sizeof(ir_block *));
+  for (size_t b = 0; b < blocks; b++)
+    layout[b] = ir_block_at(ir, b);
+
+  for (size_t b = 0; b < blocks; b++) {
+    for (size_t j = 0; j < layout[b]->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&layout[b]->instrs, j);
+      instr->dst = coalesced(ssa, instr->dst);
+      instr->a = coalesced(ssa, instr->a);
+      instr->b = coalesced(ssa, instr->b);
+    }
+  }
+
+  // copies reference original vregs only, the versions can go
+  ir->vregs.count = ssa->vreg_count;
+  for (size_t b = 0; b < blocks; b++)
+    for (size_t k = 0; k < g->preds[b].count; k++)
+      copy_on_edge(ir, ssa, layout, b, k);
+
+  for (size_t b = 0; b < blocks; b++) {
+    for (size_t p = 0; p < ssa->phis[b].count; p++) {
+      ssa_phi *phi = dynamic_array_at(&ssa->phis[b], p);
+      free(phi->args);
+    }
+    dynamic_array_free(&ssa->phis[b]);
+  }
+  free(ssa->phis);
+  free(ssa->origin);
+  free(layout);
+  cfg_free(g);
+}
@@ -0,0 +1,256 @@
+#include "opt/strength.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/remarks.h"
+
+#include <limits.h>
+#include <stdint.h>
+
+/*
+ * @brief: get k when value is 2^k with k >= 1.
+ *
+ * @return: k, or 0 if value is not such a power of two.
+ */
+static unsigned int log2_exact(long value) {
+  if (value < 2 || (value & (value - 1)))
+    return 0;
+
+  unsigned int k = 0;
+  while (value > 1) {
+    value >>= 1;
+    k++;
+  }
+  return k;
+}
+
+/*
+ * @brief: append "tmp = a op b" to out, with a fresh vreg for tmp.
+ */
+static ir_operand emit_temp(ir_program *ir, dynamic_array *out,
+                            ir_instr *orig, ir_opcode op, ir_operand a,
+                            ir_operand b) {
+  ir_instr instr = {.op = op,
+                    .type = orig->type,
+                    .line = orig->line,
+                    .dst = ir_new_vreg(ir, orig->type),
+                    .a = a,
+                    .b = b};
+  dynamic_array_append(out, &instr);
+  return instr.dst;
+}
+
+/*
+ * @brief: append "orig->dst = a op b" to out.
+ */
+static void emit_result(dynamic_array *out, ir_instr *orig, ir_opcode op,
+                        ir_operand a, ir_operand b) {
+  ir_instr instr = {.op = op,
+                    .type = orig->type,
+                    .line = orig->line,
+                    .dst = orig->dst,
+                    .a = a,
+                    .b = b};
+  dynamic_array_append(out, &instr);
+}
+
+/*
+ * @brief: compute the bias that makes a shift round toward zero: 2^k - 1
+ * when x is negative, 0 otherwise.
+ */
+static ir_operand rounding_bias(ir_program *ir, dynamic_array *out,
+                                ir_instr *orig, ir_operand x, unsigned int k) {
+  ir_operand sign = x;
+  if (k > 1)
+    sign = emit_temp(ir, out, orig, IR_SAR, x, ir_imm(63));
+  return emit_temp(ir, out, orig, IR_SHR, sign, ir_imm(64 - k));
+}
+
+bool strength_signed_magic(long d, long *multiplier, unsigned int *shift) {
+  if (d == LONG_MIN || (d >= -2 && d <= 2) ||
+      log2_exact(d < 0 ? -d : d) != 0)
+    return false;
+
+  // Hacker's Delight, figure 10-1, widened to 64 bits
+  const uint64_t two63 = (uint64_t)1 << 63;
+  uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+  uint64_t t = two63 + ((uint64_t)d >> 63);
+  uint64_t anc = t - 1 - t % ad; // <-- absolute value of nc
+  unsigned int p = 63;
+  uint64_t q1 = two63 / anc;
+  uint64_t r1 = two63 - q1 * anc;
+  uint64_t q2 = two63 / ad;
+  uint64_t r2 = two63 - q2 * ad;
+  uint64_t delta;
+
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+
+  uint64_t m = q2 + 1;
+  *multiplier = (long)(d < 0 ? -m : m);
+  *shift = p - 64;
+  return true;
+}
+
+/*
+ * @brief: append the quotient of x / d for a non power of two constant d:
+ * the high half of x * M, corrected by x when M and d have different signs,
+ * shifted, plus one when negative so it rounds toward zero.
+ *
+ * @return: the vreg holding the quotient, or the result when for_result.
+ */
+static ir_operand magic_quotient(ir_program *ir, dynamic_array *out,
+                                 ir_instr *orig, ir_operand x, long d,
+                                 bool for_result) {
+  long m;
+  unsigned int s;
+  strength_signed_magic(d, &m, &s);
+
+  ir_operand q = emit_temp(ir, out, orig, IR_MULHI, x, ir_imm(m));
+  if (d > 0 && m < 0)
+    q = emit_temp(ir, out, orig, IR_ADD, q, x);
+  else if (d < 0 && m > 0)
+    q = emit_temp(ir, out, orig, IR_SUB, q, x);
+  if (s > 0)
+    q = emit_temp(ir, out, orig, IR_SAR, q, ir_imm(s));
+
+  ir_operand sign = emit_temp(ir, out, orig, IR_SHR, q, ir_imm(63));
+  if (for_result) {
+    emit_result(out, orig, IR_ADD, q, sign);
+    return orig->dst;
+  }
+  return emit_temp(ir, out, orig, IR_ADD, q, sign);
+}
+
+/*
+ * @brief: divide (or take the remainder) by a constant that is not a power
+ * of two. The remainder is x - (x / d) * d.
+ */
+static bool reduce_magic(ir_program *ir, dynamic_array *out, ir_instr *instr,
+                         ir_operand x, long d) {
+  long m;
+  unsigned int s;
+  if (!strength_signed_magic(d, &m, &s))
+    return false;
+
+  if (instr->op == IR_DIV) {
+    magic_quotient(ir, out, instr, x, d, true);
+    return true;
+  }
+
+  // imul only takes a sign extended imm32
+  if (d < INT32_MIN || d > INT32_MAX)
+    return false;
+  ir_operand q = magic_quotient(ir, out, instr, x, d, false);
+  ir_operand p = emit_temp(ir, out, instr, IR_MUL, q, ir_imm(d));
+  emit_result(out, instr, IR_SUB, x, p);
+  return true;
+}
+
+/*
+ * @brief: lower one instruction to out, reduced if it can be.
+ *
+ * @return: whether the instruction was rewritten.
+ */
+static bool reduce(ir_program *ir, dynamic_array *out, ir_instr *instr) {
+  ir_operand x = instr->a;
+  ir_operand c = instr->b;
+
+  if (instr->op == IR_MUL && x.kind == IR_OPERAND_IMM) {
+    x = instr->b;
+    c = instr->a;
+  }
+
+  if ((instr->op != IR_MUL && instr->op != IR_DIV && instr->op != IR_MOD) ||
+      x.kind != IR_OPERAND_VREG || c.kind != IR_OPERAND_IMM ||
+      c.imm == LONG_MIN)
+    return false;
+
+  bool negative = c.imm < 0;
+  unsigned int k = log2_exact(negative ? -c.imm : c.imm);
+  if (k == 0)
+    return instr->op != IR_MUL && reduce_magic(ir, out, instr, x, c.imm);
+
+  switch (instr->op) {
+  case IR_MUL:
+    if (!negative) {
+      emit_result(out, instr, IR_SHL, x, ir_imm(k));
+    } else {
+      ir_operand t = emit_temp(ir, out, instr, IR_SHL, x, ir_imm(k));
+      emit_result(out, instr, IR_SUB, ir_imm(0), t);
+    }
+    return true;
+
+  case IR_DIV: {
+    ir_operand bias = rounding_bias(ir, out, instr, x, k);
+    ir_operand t = emit_temp(ir, out, instr, IR_ADD, x, bias);
+    if (!negative) {
+      emit_result(out, instr, IR_SAR, t, ir_imm(k));
+    } else {
+      ir_operand q = emit_temp(ir, out, instr, IR_SAR, t, ir_imm(k));
+      emit_result(out, instr, IR_SUB, ir_imm(0), q);
+    }
+    return true;
+  }
+
+  case IR_MOD: {
+    // and only takes a sign extended imm32 mask
+    if (k > 31)
+      return false;
+    ir_operand bias = rounding_bias(ir, out, instr, x, k);
+    ir_operand t = emit_temp(ir, out, instr, IR_ADD, x, bias);
+    ir_operand m =
+        emit_temp(ir, out, instr, IR_AND, t, ir_imm((1L << k) - 1));
+    emit_result(out, instr, IR_SUB, m, bias);
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
+size_t strength_reduce(ir_program *ir, dynamic_array *remarks) {
+  size_t count = 0;
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    dynamic_array out;
+    dynamic_array_init(&out, sizeof(ir_instr));
+
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (!reduce(ir, &out, instr)) {
+        dynamic_array_append(&out, instr);
+        continue;
+      }
+
+      count++;
+      long c = instr->b.kind == IR_OPERAND_IMM ? instr->b.imm : instr->a.imm;
+      remark_add(remarks, REMARK_PASSED, "strength", instr->line,
+                 "%s by %ld strength-reduced",
+                 instr->op == IR_MUL   ? "multiplication"
+                 : instr->op == IR_DIV ? "division"
+                                       : "modulo",
+                 c);
+    }
+
+    dynamic_array_free(&block->instrs);
+    block->instrs = out;
+  }
+
+  return count;
+}
@@ -0,0 +1,444 @@
+#include "opt/unroll.h"
+#include "cfg.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/counted.h"
+#include "opt/remarks.h"
+#include "profile.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * @brief: check whether an instruction can be copied. The text of a fasm
+ * statement with a colon may define a label, which must stay unique.
+ */
+static bool can_copy(ir_instr *instr) {
+  return instr->op != IR_FASM || !strchr(instr->content, ':');
+}
+
+/*
+ * @brief: find the vregs of a loop that have a single definition and are
+ * only used after it in the same block. Every copy of the loop can give
+ * them a new name.
+ */
+static bool *find_locals(ir_program *ir, counted_loop *cl) {
+  size_t n = ir->vregs.count + 1;
+  size_t *defs = ir_def_counts(ir);
+  bool *local = scu_checked_malloc(n * sizeof(bool));
+  ir_block **def_block = scu_checked_malloc(n * sizeof(ir_block *));
+  size_t *def_pos = scu_checked_malloc(n * sizeof(size_t));
+
+  for (size_t i = 0; i < cl->count; i++) {
+    dynamic_array *instrs = &cl->blocks[i]->instrs;
+    for (size_t j = 0; j < instrs->count; j++) {
+      ir_instr *instr = dynamic_array_at(instrs, j);
+      if (instr->dst.kind == IR_OPERAND_VREG && defs[instr->dst.vreg] == 1) {
+        local[instr->dst.vreg] = true;
+        def_block[instr->dst.vreg] = cl->blocks[i];
+        def_pos[instr->dst.vreg] = j;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      ir_operand ops[2] = {instr->a, instr->b};
+      for (size_t o = 0; o < 2; o++) {
+        if (ops[o].kind != IR_OPERAND_VREG || !local[ops[o].vreg])
+          continue;
+        size_t v = ops[o].vreg;
+        if (def_block[v] != block || def_pos[v] >= j)
+          local[v] = false;
+      }
+    }
+  }
+
+  free(def_pos);
+  free(def_block);
+  free(defs);
+  return local;
+}
+
+/*
+ * @brief: find the constant iv starts from, following the only path into
+ * the loop backwards to its last definition.
+ */
+static bool known_start(ir_program *ir, cfg *g, counted_loop *cl,
+                        long *start) {
+  if (cl->entries.count != 1)
+    return false;
+
+  size_t index;
+  dynamic_array_get(&cl->entries, 0, &index);
+
+  for (size_t hops = 0; hops < 16; hops++) {
+    ir_block *block = ir_block_at(ir, index);
+    for (size_t j = block->instrs.count; j-- > 0;) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (!ir_is_vreg(instr->dst, cl->iv))
+        continue;
+      if (instr->op != IR_MOV || instr->a.kind != IR_OPERAND_IMM)
+        return false;
+      *start = instr->a.imm;
+      return true;
+    }
+
+    if (index == 0 || g->preds[index].count != 1)
+      return false;
+    dynamic_array_get(&g->preds[index], 0, &index);
+  }
+  return false;
+}
+
+/*
+ * @brief: count the iterations of a loop starting from a constant and
+ * ending at a constant bound. The first one always runs: the header is only
+ * entered after the test, or it is a do-while loop.
+ *
+ * @return: false if there are more than max of them.
+ */
+static bool trip_count(counted_loop *cl, long start, size_t max,
+                       size_t *trips) {
+  long value = start;
+  for (size_t n = 1; n <= max; n++) {
+    if (__builtin_add_overflow(value, cl->step, &value))
+      return false;
+    if (!ir_rel_holds(cl->rel, value, cl->bound.imm)) {
+      *trips = n;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * @brief: give an operand the new name of a local vreg.
+ */
+static void rename_local(ir_operand *op, size_t *names) {
+  if (op->kind == IR_OPERAND_VREG && names[op->vreg] != SIZE_MAX)
+    op->vreg = names[op->vreg];
+}
+
+/*
+ * @brief: copy the blocks of a loop, edges between them go to the copies
+ * and local vregs get new names. Vregs made after find_locals (known being
+ * the count it saw) are not local.
+ */
+static ir_block **copy_loop(ir_program *ir, counted_loop *cl, bool *local,
+                            size_t known) {
+  ir_block **copy = scu_checked_malloc(cl->count * sizeof(ir_block *));
+
+  size_t n = ir->vregs.count;
+  size_t *names = scu_checked_malloc((n + 1) * sizeof(size_t));
+  for (size_t v = 0; v < n; v++)
+    names[v] = v < known && local[v]
+                   ? ir_new_vreg(ir, ir_vreg_at(ir, v)->type).vreg
+                   : SIZE_MAX;
+
+  for (size_t i = 0; i < cl->count; i++) {
+    copy[i] = ir_block_new(ir, NULL);
+    copy[i]->origin = cl->blocks[i]->origin;
+    dynamic_array *instrs = &cl->blocks[i]->instrs;
+    for (size_t j = 0; j < instrs->count; j++) {
+      ir_instr instr = *(ir_instr *)dynamic_array_at(instrs, j);
+      rename_local(&instr.dst, names);
+      rename_local(&instr.a, names);
+      rename_local(&instr.b, names);
+      dynamic_array_append(&copy[i]->instrs, &instr);
+    }
+  }
+  free(names);
+
+  for (size_t i = 0; i < cl->count; i++) {
+    ir_instr *term = ir_terminator(copy[i]);
+    size_t target = term ? counted_position(cl, term->target) : SIZE_MAX;
+    size_t alt = term ? counted_position(cl, term->alt) : SIZE_MAX;
+    if (target != SIZE_MAX)
+      term->target = copy[target];
+    if (alt != SIZE_MAX)
+      term->alt = copy[alt];
+  }
+
+  return copy;
+}
+
+/*
+ * @brief: turn a terminator into jmp target.
+ */
+static void set_jmp(ir_instr *term, ir_block *target) {
+  *term = (ir_instr){.op = IR_JMP,
+                     .type = TYPE_VOID,
+                     .line = term->line,
+                     .target = target};
+}
+
+/*
+ * @brief: replace a loop by trips copies of its body.
+ */
+static void unroll_fully(ir_program *ir, counted_loop *cl, bool *local,
+                         size_t known, size_t trips) {
+  ir_block **all = scu_checked_malloc(trips * cl->count * sizeof(ir_block *));
+  ir_instr *prev = NULL;
+
+  for (size_t t = 0; t < trips; t++) {
+    ir_block **copy = copy_loop(ir, cl, local, known);
+    if (prev)
+      set_jmp(prev, copy[cl->header]);
+    else
+      counted_redirect_entries(ir, cl, copy[cl->header]);
+    prev = ir_terminator(copy[cl->latch]);
+    memcpy(all + t * cl->count, copy, cl->count * sizeof(ir_block *));
+    free(copy);
+  }
+  set_jmp(prev, cl->exit);
+
+  /*
+   * Unreachable blocks may still jump into the loop, send them to the first
+   * copy so no terminator is left pointing at a removed block.
+   */
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    if (counted_position(cl, block) != SIZE_MAX)
+      continue;
+    ir_instr *term = ir_terminator(block);
+    size_t target = term ? counted_position(cl, term->target) : SIZE_MAX;
+    size_t alt = term ? counted_position(cl, term->alt) : SIZE_MAX;
+    if (target != SIZE_MAX)
+      term->target = all[target];
+    if (alt != SIZE_MAX)
+      term->alt = all[alt];
+  }
+
+  counted_insert_before(ir, cl, all, trips * cl->count);
+  for (size_t i = ir->blocks.count; i-- > 0;)
+    if (counted_position(cl, ir_block_at(ir, i)) != SIZE_MAX)
+      ir_remove_block(ir, i);
+
+  free(all);
+}
+
+/*
+ * @brief: put a copy of the loop with factor bodies in front of it, which
+ * runs while at least factor iterations are left.
+ *
+ * guard:    br bound in range, pre, loop   (bound in a vreg only)
+ * pre:      limit = bound - (factor - 1) * step
+ *           br iv rel limit, body1, loop
+ * body1..n: the loop blocks, the test of the last one is
+ *           br iv rel limit, body1, check
+ * check:    br iv rel bound, loop, exit
+ * loop:     the original loop, for the iterations left over
+ *
+ * @return: false if the limit would overflow.
+ */
+static bool unroll_partially(ir_program *ir, counted_loop *cl, bool *local,
+                             size_t known, size_t factor) {
+  long distance;
+  if (__builtin_mul_overflow((long)(factor - 1), cl->step, &distance))
+    return false;
+
+  ir_block *guard, *pre;
+  ir_operand limit;
+  if (!counted_enter(ir, cl, distance, &guard, &pre, &limit))
+    return false;
+
+  size_t count = factor * cl->count + 3;
+  ir_block **added = scu_checked_malloc(count * sizeof(ir_block *));
+  size_t n = 0;
+  ir_block *header = cl->blocks[cl->header];
+
+  if (guard)
+    added[n++] = guard;
+  added[n++] = pre;
+
+  ir_block *first = NULL;
+  ir_instr *prev = NULL;
+  for (size_t f = 0; f < factor; f++) {
+    ir_block **copy = copy_loop(ir, cl, local, known);
+    if (prev)
+      set_jmp(prev, copy[cl->header]);
+    else
+      first = copy[cl->header];
+    prev = ir_terminator(copy[cl->latch]);
+    for (size_t i = 0; i < cl->count; i++)
+      added[n++] = copy[i];
+    free(copy);
+  }
+  ir_terminator(pre)->target = first;
+
+  ir_operand iv = {.kind = IR_OPERAND_VREG, .vreg = cl->iv};
+  ir_block *check =
+      counted_test_block(ir, cl, iv, cl->rel, cl->bound, header, cl->exit);
+  prev->a = iv;
+  prev->b = limit;
+  prev->rel = cl->rel;
+  prev->target = first;
+  prev->alt = check;
+  added[n++] = check;
+
+  counted_redirect_entries(ir, cl, guard ? guard : pre);
+  counted_insert_before(ir, cl, added, n);
+  free(added);
+  return true;
+}
+
+/*
+ * @brief: get the source line of the back edge test of a loop.
+ */
+static size_t loop_line(ir_program *ir, cfg *g, size_t index) {
+  size_t latch;
+  dynamic_array_get(&cfg_loop_at(g, index)->latches, 0, &latch);
+  ir_instr *test = ir_terminator(ir_block_at(ir, latch));
+  return test ? test->line : 0;
+}
+
+/*
+ * @brief: get how many times a loop ran per entry according to the profile:
+ * the runs of its header over those that did not come by the back edge.
+ *
+ * @return: false if the profile does not know the loop.
+ */
+static bool measured_trips(const profile *prof, counted_loop *cl,
+                           double *trips) {
+  ir_block *header = cl->blocks[cl->header];
+  uint64_t runs, back;
+  if (!profile_runs(prof, header, &runs) ||
+      !profile_edge(prof, cl->blocks[cl->latch], header, &back) ||
+      (back >= runs && runs > 0))
+    return false;
+
+  *trips = runs ? (double)runs / (runs - back) : 0;
+  return true;
+}
+
+/*
+ * @brief: unroll one loop if it is counted and fits the budget.
+ */
+static void unroll_loop(ir_program *ir, cfg *g, size_t index, size_t factor,
+                        size_t budget, const profile *prof,
+                        unroll_stats *stats, dynamic_array *remarks) {
+  counted_loop cl;
+  if (!counted_analyze(ir, g, index, &cl)) {
+    remark_add(remarks, REMARK_MISSED, "unroll", loop_line(ir, g, index),
+               "loop not unrolled: it is not a counted loop");
+    return;
+  }
+
+  // instructions of the loop, fasm weighted
+  size_t size = 0;
+  for (size_t i = 0; i < cl.count; i++) {
+    dynamic_array *instrs = &cl.blocks[i]->instrs;
+    for (size_t j = 0; j < instrs->count; j++) {
+      ir_instr *instr = dynamic_array_at(instrs, j);
+      if (instr->op == IR_COUNT) {
+        // copies would count into the counters of the original, and the
+        // branches between them count nothing
+        remark_add(remarks, REMARK_MISSED, "unroll", cl.line,
+                   "loop not unrolled: it is instrumented for profiling");
+        counted_free(&cl);
+        return;
+      }
+      if (!can_copy(instr)) {
+        remark_add(remarks, REMARK_MISSED, "unroll", cl.line,
+                   "loop not unrolled: its fasm at line %zu may define a "
+                   "label",
+                   instr->line);
+        counted_free(&cl);
+        return;
+      }
+      size += instr->op == IR_FASM ? UNROLL_FASM_WEIGHT : 1;
+    }
+  }
+
+  double measured = 0;
+  bool profiled = measured_trips(prof, &cl, &measured);
+  if (profiled && measured == 0) {
+    remark_add(remarks, REMARK_MISSED, "unroll", cl.line,
+               "loop not unrolled: the profile shows it never runs");
+    counted_free(&cl);
+    return;
+  }
+
+  size_t known = ir->vregs.count;
+  bool *local = find_locals(ir, &cl);
+
+  long start;
+  size_t trips;
+  size_t max = size ? budget / size : 0;
+  if (cl.bound.kind == IR_OPERAND_IMM && known_start(ir, g, &cl, &start) &&
+      trip_count(&cl, start, max, &trips)) {
+    unroll_fully(ir, &cl, local, known, trips);
+    stats->full++;
+    stats->added += (trips - 1) * size;
+    remark_add(remarks, REMARK_PASSED, "unroll", cl.line,
+               "loop fully unrolled, %zu iterations", trips);
+  } else if (factor >= 2 && profiled && measured < 2) {
+    remark_add(remarks, REMARK_MISSED, "unroll", cl.line,
+               "loop not unrolled: it runs %.1f times per entry in the "
+               "profile",
+               measured);
+  } else if (factor >= 2) {
+    // copies for more trips than the loop usually makes are never run
+    if (profiled && measured < factor)
+      factor = (size_t)measured;
+    size_t wanted = factor;
+    while (factor >= 2 && factor * size > budget)
+      factor--;
+    if (factor < 2) {
+      remark_add(remarks, REMARK_MISSED, "unroll", cl.line,
+                 "loop not unrolled: %zu copies of its %zu instructions do "
+                 "not fit the budget of %zu",
+                 wanted, size, budget);
+    } else if (unroll_partially(ir, &cl, local, known, factor)) {
+      stats->partial++;
+      stats->added += factor * size;
+      remark_add(remarks, REMARK_PASSED, "unroll", cl.line,
+                 "loop unrolled %zu times", factor);
+    } else {
+      remark_add(remarks, REMARK_MISSED, "unroll", cl.line,
+                 "loop not unrolled: its unrolled bound would overflow");
+    }
+  }
+
+  free(local);
+  counted_free(&cl);
+}
+
+void unroll_loops(ir_program *ir, size_t factor, size_t budget,
+                  const profile *prof, unroll_stats *stats,
+                  dynamic_array *remarks) {
+  *stats = (unroll_stats){0};
+
+  // every transformation changes the graph, so loops are found again by
+  // their header
+  dynamic_array headers;
+  dynamic_array_init(&headers, sizeof(ir_block *));
+
+  cfg g;
+  cfg_build(ir, &g);
+  for (size_t i = 0; i < g.loops.count; i++)
+    if (counted_innermost(&g, i))
+      dynamic_array_append(&headers, &cfg_loop_at(&g, i)->header);
+  cfg_free(&g);
+
+  for (size_t h = 0; h < headers.count; h++) {
+    ir_block *header;
+    dynamic_array_get(&headers, h, &header);
+
+    cfg_build(ir, &g);
+    for (size_t i = 0; i < g.loops.count; i++) {
+      if (cfg_loop_at(&g, i)->header == header) {
+        unroll_loop(ir, &g, i, factor, budget, prof, stats, remarks);
+        break;
+      }
+    }
+    cfg_free(&g);
+  }
+
+  dynamic_array_free(&headers);
+}
@@ -0,0 +1,1387 @@
+#include "opt/vectorize.h"
+#include "cfg.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/counted.h"
+#include "utils.h"
+#include "x86.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Flipping the sign bit of two lanes makes the signed pcmpgtd order them as
+ * unsigned numbers, which is what zero extended elements are.
+ */
+#define BIAS 0x80000000L
+#define LANE_MAX 0xffffffffL
+
+// elements a sum may add per iteration
+#define SUM_TERMS 8
+
+/*
+ * @enum vec_kind: what a reduction computes.
+ */
+typedef enum vec_kind { VEC_SUM, VEC_MAX, VEC_MIN } vec_kind;
+
+/*
+ * @struct vec_entry: an instruction of the loop, in the order the vector
+ * loop runs them.
+ */
+typedef struct vec_entry {
+  ir_instr *instr;
+  size_t pred; // <-- vectorizer.preds index it runs under, SIZE_MAX if none
+} vec_entry;
+
+/*
+ * @struct vec_pred: the condition of an if in the loop.
+ */
+typedef struct vec_pred {
+  ir_instr *br;
+  bool negated; // <-- the body of the if runs when br does not branch
+} vec_pred;
+
+/*
+ * @struct vec_reduction: a value carried from one iteration to the next
+ * that the vector loop computes in every lane, to be combined at the end.
+ */
+typedef struct vec_reduction {
+  vec_kind kind;
+  size_t vreg;      // <-- accumulator vreg, SIZE_MAX if it is in memory
+  variable *var;    // <-- accumulator variable in memory
+  size_t read;      // <-- vreg the variable is loaded into
+  ir_instr *update; // <-- sum: the last add, min / max: what replaces it
+  ir_operand terms[SUM_TERMS]; // <-- sum: what is added
+  size_t term_count;
+  ir_instr *chain[SUM_TERMS]; // <-- sum: the adds before the last one
+  size_t chain_count;
+  ir_operand elem; // <-- min / max: what replaces the accumulator
+  ir_operand cond; // <-- min / max: what is compared to the accumulator
+  rel_kind rel;     // <-- min / max: cond rel accumulator replaces it
+  unsigned int reg; // <-- vector of partial results
+} vec_reduction;
+
+/*
+ * @struct vec_value: the vector register holding a scalar vreg in each
+ * lane.
+ */
+typedef struct vec_value {
+  bool set;
+  bool exact; // <-- the vreg is the lane zero extended, not only its low half
+  unsigned int reg;
+} vec_value;
+
+/*
+ * @struct vec_cached: a constant or array already in a vector register.
+ */
+typedef struct vec_cached {
+  variable *var;
+  long imm;
+  unsigned int reg;
+} vec_cached;
+
+/*
+ * @struct vectorizer: state of the vectorization of one loop.
+ */
+typedef struct vectorizer {
+  ir_program *ir;
+  counted_loop *cl;
+  bool avx2;
+  unsigned int lanes;
+  const char *reason; // <-- why the loop is rejected, NULL so far
+
+  dynamic_array body;       // <-- vec_entry
+  dynamic_array preds;      // <-- vec_pred
+  dynamic_array reductions; // <-- vec_reduction
+  size_t *defs;             // <-- definitions in the loop, per vreg
+  size_t *uses;             // <-- uses in the loop, per vreg
+  size_t *all_defs;         // <-- definitions in the program, per vreg
+  bool *outside;            // <-- used outside the loop, per vreg
+  size_t *last;             // <-- last body position reading the vreg
+  vec_value *values;
+
+  unsigned int refs[X86_VEC_SCRATCH]; // <-- vregs held in the register
+  bool pinned[X86_VEC_SCRATCH];       // <-- lives through the whole loop
+  bool touched[X86_VEC_SCRATCH];      // <-- written by the body so far
+  int biased[X86_VEC_SCRATCH];        // <-- register holding reg ^ BIAS
+  dynamic_array imms;                 // <-- vec_cached, splat constants
+  dynamic_array loads;                // <-- vec_cached, arrays loaded
+  dynamic_array ranged;               // <-- size_t, vregs compared as lanes
+  int mask;                           // <-- condition of the current if
+  bool mask_negated;
+  size_t mask_pred;
+
+  dynamic_array init; // <-- ir_instr, run once in front of the vector loop
+  dynamic_array code; // <-- ir_instr, the body of the vector loop
+} vectorizer;
+
+/*
+ * @brief: record why the loop cannot be vectorized (the first reason wins).
+ *
+ * @return: false, for the callers to return.
+ */
+static bool reject(vectorizer *v, const char *reason) {
+  if (!v->reason)
+    v->reason = reason;
+  return false;
+}
+
+/*
+ * @brief: append a vector instruction.
+ *
+ * @return: pointer to it, valid until the next one is appended.
+ */
+static ir_instr *emit(vectorizer *v, dynamic_array *to, ir_opcode op,
+                      ir_operand dst, ir_operand a, ir_operand b) {
+  ir_instr instr = {.op = op,
+                    .type = TYPE_INT,
+                    .line = v->cl->line,
+                    .dst = dst,
+                    .a = a,
+                    .b = b,
+                    .lanes = v->lanes};
+  dynamic_array_append(to, &instr);
+  return dynamic_array_at(to, to->count - 1);
+}
+
+/*
+ * @brief: hand out a free vector register for the body.
+ */
+static bool alloc(vectorizer *v, unsigned int *reg) {
+  for (unsigned int r = 0; r < X86_VEC_SCRATCH; r++) {
+    if (v->refs[r] || v->pinned[r])
+      continue;
+    v->refs[r] = 1;
+    v->touched[r] = true;
+    v->biased[r] = -1;
+    *reg = r;
+    return true;
+  }
+  return reject(v, "needs too many vector registers");
+}
+
+/*
+ * @brief: hand out a register set in front of the loop and kept through
+ * it, which the body must not have written before. They are taken from the
+ * top down, away from the ones the body takes.
+ */
+static bool pin(vectorizer *v, unsigned int *reg) {
+  for (unsigned int r = X86_VEC_SCRATCH; r-- > 0;) {
+    if (v->refs[r] || v->pinned[r] || v->touched[r])
+      continue;
+    v->pinned[r] = true;
+    v->biased[r] = -1;
+    *reg = r;
+    return true;
+  }
+  return reject(v, "needs too many vector registers");
+}
+
+/*
+ * @brief: drop one holder of a register, it is free again when there is
+ * none left. Pinned registers are never freed.
+ */
+static void release(vectorizer *v, unsigned int reg) {
+  if (v->pinned[reg] || --v->refs[reg] > 0)
+    return;
+
+  if (v->biased[reg] >= 0)
+    release(v, v->biased[reg]);
+  v->biased[reg] = -1;
+
+  for (size_t i = v->loads.count; i-- > 0;) {
+    vec_cached *c = dynamic_array_at(&v->loads, i);
+    if (c->reg == reg)
+      dynamic_array_remove(&v->loads, i);
+  }
+}
+
+/*
+ * @brief: get a register holding a constant in every lane, made once in
+ * front of the loop.
+ */
+static bool splat_imm(vectorizer *v, long imm, unsigned int *reg) {
+  for (size_t i = 0; i < v->imms.count; i++) {
+    vec_cached *c = dynamic_array_at(&v->imms, i);
+    if (c->imm == imm) {
+      *reg = c->reg;
+      return true;
+    }
+  }
+
+  if (!pin(v, reg))
+    return false;
+  emit(v, &v->init, IR_VSPLAT, ir_vec(*reg), ir_imm(imm), (ir_operand){0});
+  vec_cached c = {.imm = imm, .reg = *reg};
+  dynamic_array_append(&v->imms, &c);
+  return true;
+}
+
+/*
+ * @brief: get the vector of an operand: constants and vregs defined outside
+ * the loop are put in every lane in front of it.
+ */
+static bool vector_of(vectorizer *v, ir_operand op, vec_value *out) {
+  if (op.kind == IR_OPERAND_IMM) {
+    *out = (vec_value){.set = true, .exact = op.imm >= 0 && op.imm <= LANE_MAX};
+    return splat_imm(v, op.imm, &out->reg);
+  }
+  if (op.kind != IR_OPERAND_VREG)
+    return reject(v, "uses a value the vector loop does not have");
+  if (op.vreg == v->cl->iv)
+    return reject(v, "uses the loop counter as a value");
+
+  vec_value *value = &v->values[op.vreg];
+  if (value->set) {
+    *out = *value;
+    return true;
+  }
+  if (v->defs[op.vreg] > 0)
+    return reject(v, "uses a value the vector loop does not have");
+
+  unsigned int reg;
+  if (!pin(v, &reg))
+    return false;
+  emit(v, &v->init, IR_VSPLAT, ir_vec(reg), op, (ir_operand){0});
+  *value = (vec_value){.set = true, .reg = reg};
+  *out = *value;
+  return true;
+}
+
+/*
+ * @brief: get a register holding a vector with the sign bit of its lanes
+ * flipped. Pinned vectors are flipped once in front of the loop.
+ */
+static bool biased_of(vectorizer *v, unsigned int reg, unsigned int *out) {
+  if (v->biased[reg] >= 0) {
+    *out = v->biased[reg];
+    return true;
+  }
+
+  unsigned int bias;
+  if (!splat_imm(v, BIAS, &bias))
+    return false;
+  if (!(v->pinned[reg] ? pin(v, out) : alloc(v, out)))
+    return false;
+  emit(v, v->pinned[reg] ? &v->init : &v->code, IR_VXOR, ir_vec(*out),
+       ir_vec(reg), ir_vec(bias));
+  v->biased[reg] = *out;
+  return true;
+}
+
+/*
+ * @brief: get the vector of an operand of a compare, whose lanes must hold
+ * the whole scalar. A vreg from outside the loop is checked to fit 32 bits
+ * in front of the vector loop.
+ */
+static bool compared_of(vectorizer *v, ir_operand op, vec_value *out) {
+  if (!vector_of(v, op, out))
+    return false;
+  if (out->exact)
+    return true;
+  if (op.kind == IR_OPERAND_IMM)
+    return reject(v, "compares with a constant out of the element range");
+  if (v->defs[op.vreg] > 0)
+    return reject(v, "compares a value wider than an element");
+
+  for (size_t i = 0; i < v->ranged.count; i++)
+    if (*(size_t *)dynamic_array_at(&v->ranged, i) == op.vreg)
+      return true;
+  dynamic_array_append(&v->ranged, &op.vreg);
+  return true;
+}
+
+/*
+ * @brief: put the body of the loop in one list, the blocks of an if
+ * (without else) become a condition on the instructions inside it.
+ */
+static bool linearize(vectorizer *v) {
+  counted_loop *cl = v->cl;
+  if (cl->header != 0 || cl->latch != cl->count - 1)
+    return reject(v, "has blocks out of order");
+
+  size_t pred = SIZE_MAX;
+  ir_block *join = NULL;
+
+  for (size_t i = 0; i < cl->count; i++) {
+    ir_block *block = cl->blocks[i];
+    if (block == join)
+      pred = SIZE_MAX;
+
+    for (size_t j = 0; j + 1 < block->instrs.count; j++) {
+      vec_entry entry = {.instr = dynamic_array_at(&block->instrs, j),
+                         .pred = pred};
+      dynamic_array_append(&v->body, &entry);
+    }
+    if (i == cl->latch)
+      break;
+
+    ir_instr *term = ir_terminator(block);
+    ir_block *next = cl->blocks[i + 1];
+    if (term->op == IR_JMP && term->target == next)
+      continue;
+    if (term->op != IR_BR || pred != SIZE_MAX)
+      return reject(v, "has control flow other than an if");
+
+    vec_pred p = {.br = term};
+    if (term->target == next) {
+      join = term->alt;
+    } else if (term->alt == next) {
+      join = term->target;
+      p.negated = true;
+    } else {
+      return reject(v, "has control flow other than an if");
+    }
+    size_t at = counted_position(cl, join);
+    if (at == SIZE_MAX || at <= i + 1)
+      return reject(v, "has control flow other than an if");
+
+    // the branch itself runs unconditionally, the mask is made there
+    vec_entry entry = {.instr = term, .pred = v->preds.count};
+    dynamic_array_append(&v->body, &entry);
+    pred = v->preds.count;
+    dynamic_array_append(&v->preds, &p);
+  }
+  return true;
+}
+
+/*
+ * @brief: count definitions and uses of every vreg in the loop, note the
+ * ones used after it, and find the last body position reading each.
+ */
+static void count(vectorizer *v) {
+  ir_program *ir = v->ir;
+  size_t n = ir->vregs.count + 1;
+  v->defs = scu_checked_malloc(n * sizeof(size_t));
+  v->uses = scu_checked_malloc(n * sizeof(size_t));
+  v->last = scu_checked_malloc(n * sizeof(size_t));
+  v->outside = scu_checked_malloc(n * sizeof(bool));
+  v->values = scu_checked_malloc(n * sizeof(vec_value));
+  v->all_defs = ir_def_counts(ir);
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    bool in_loop = counted_position(v->cl, block) != SIZE_MAX;
+
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      ir_operand ops[2] = {instr->a, instr->b};
+      for (size_t o = 0; o < 2; o++) {
+        if (ops[o].kind != IR_OPERAND_VREG)
+          continue;
+        if (in_loop)
+          v->uses[ops[o].vreg]++;
+        else
+          v->outside[ops[o].vreg] = true;
+      }
+      if (in_loop && instr->dst.kind == IR_OPERAND_VREG)
+        v->defs[instr->dst.vreg]++;
+    }
+  }
+
+  for (size_t p = 0; p < v->body.count; p++) {
+    vec_entry *entry = dynamic_array_at(&v->body, p);
+    if (entry->instr->a.kind == IR_OPERAND_VREG)
+      v->last[entry->instr->a.vreg] = p;
+    if (entry->instr->b.kind == IR_OPERAND_VREG)
+      v->last[entry->instr->b.vreg] = p;
+  }
+}
+
+/*
+ * @brief: check the body for instructions that rule the loop out whatever
+ * the rest of it does.
+ */
+static bool check_effects(vectorizer *v) {
+  for (size_t p = 0; p < v->body.count; p++) {
+    vec_entry *entry = dynamic_array_at(&v->body, p);
+    switch (entry->instr->op) {
+    case IR_FASM:
+      return reject(v, "has a fasm statement");
+    case IR_COUNT:
+      return reject(v, "is instrumented for profiling");
+    case IR_ADDR:
+    case IR_LOAD_PTR:
+    case IR_STORE_PTR:
+      return reject(v, "accesses memory through a pointer");
+    case IR_MULHI:
+    case IR_DIV:
+    case IR_MOD:
+    case IR_CMP:
+      return reject(v, "has an operation without a vector form");
+    default:
+      break;
+    }
+  }
+  return true;
+}
+
+/*
+ * @brief: find the body position of the instruction defining a vreg.
+ */
+static vec_entry *defining(vectorizer *v, size_t vreg) {
+  for (size_t p = 0; p < v->body.count; p++) {
+    vec_entry *entry = dynamic_array_at(&v->body, p);
+    if (ir_is_vreg(entry->instr->dst, vreg))
+      return entry;
+  }
+  return NULL;
+}
+
+/*
+ * @brief: recognize a min / max update: under the condition `x rel acc`
+ * (or `acc rel x`), acc is replaced, acc being read only by the condition.
+ */
+static bool min_max(vectorizer *v, vec_entry *update, size_t acc,
+                    vec_reduction *r) {
+  if (update->pred == SIZE_MAX || v->uses[acc] != 1)
+    return false;
+
+  vec_pred *pred = dynamic_array_at(&v->preds, update->pred);
+  ir_instr *br = pred->br;
+  rel_kind rel;
+  if (ir_is_vreg(br->b, acc) && !ir_is_vreg(br->a, acc)) {
+    r->cond = br->a;
+    rel = br->rel;
+  } else if (ir_is_vreg(br->a, acc) && !ir_is_vreg(br->b, acc)) {
+    r->cond = br->b;
+    rel = ir_rel_swap(br->rel);
+  } else {
+    return false;
+  }
+  r->rel = pred->negated ? ir_rel_negate(rel) : rel;
+
+  switch (r->rel) {
+  case REL_GREATER_THAN:
+  case REL_GREATER_THAN_OR_EQUAL:
+    r->kind = VEC_MAX;
+    return true;
+  case REL_LESS_THAN:
+  case REL_LESS_THAN_OR_EQUAL:
+    r->kind = VEC_MIN;
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * @brief: split an operand of a sum into the terms it adds, following the
+ * adds only the sum reads.
+ *
+ * @return: how many times the operand reads acc.
+ */
+static size_t sum_terms(vectorizer *v, ir_operand op, size_t acc,
+                        vec_reduction *r) {
+  if (ir_is_vreg(op, acc))
+    return 1;
+
+  vec_entry *add = op.kind == IR_OPERAND_VREG && v->uses[op.vreg] == 1 &&
+                           v->defs[op.vreg] == 1
+                       ? defining(v, op.vreg)
+                       : NULL;
+  if (add && add->instr->op == IR_ADD && add->pred == SIZE_MAX &&
+      r->chain_count < SUM_TERMS) {
+    r->chain[r->chain_count++] = add->instr;
+    return sum_terms(v, add->instr->a, acc, r) +
+           sum_terms(v, add->instr->b, acc, r);
+  }
+
+  // too many terms, leave the sum to the scalar loop
+  if (r->term_count == SUM_TERMS)
+    return 2;
+  r->terms[r->term_count++] = op;
+  return 0;
+}
+
+/*
+ * @brief: recognize a sum: acc = acc + x + y ..., acc being read only by
+ * the adds.
+ */
+static bool sum(vectorizer *v, vec_entry *update, size_t acc,
+                vec_reduction *r) {
+  ir_instr *add = update->instr;
+  if (update->pred != SIZE_MAX || add->op != IR_ADD || v->uses[acc] != 1)
+    return false;
+
+  r->kind = VEC_SUM;
+  return sum_terms(v, add->a, acc, r) + sum_terms(v, add->b, acc, r) == 1;
+}
+
+/*
+ * @brief: recognize a reduction over a variable in memory, loaded once and
+ * stored once in the loop.
+ */
+static bool memory_reduction(vectorizer *v, size_t at, vec_reduction *r) {
+  vec_entry *store = dynamic_array_at(&v->body, at);
+  variable *var = store->instr->var;
+  vec_entry *load = NULL;
+
+  for (size_t p = 0; p < v->body.count; p++) {
+    vec_entry *entry = dynamic_array_at(&v->body, p);
+    ir_instr *instr = entry->instr;
+    if ((instr->op != IR_LOAD && instr->op != IR_STORE) ||
+        strcmp(instr->var->name, var->name) != 0 || entry == store)
+      continue;
+    if (instr->op == IR_STORE || load || p > at)
+      return false;
+    load = entry;
+  }
+  if (!load)
+    return false;
+
+  *r = (vec_reduction){.vreg = SIZE_MAX,
+                       .var = var,
+                       .read = load->instr->dst.vreg};
+  ir_operand value = store->instr->a;
+
+  if (store->pred != SIZE_MAX) {
+    r->update = store->instr;
+    r->elem = value;
+    return min_max(v, store, r->read, r);
+  }
+
+  if (value.kind != IR_OPERAND_VREG || v->uses[value.vreg] != 1)
+    return false;
+  vec_entry *add = defining(v, value.vreg);
+  if (!add)
+    return false;
+  r->update = add->instr;
+  return sum(v, add, r->read, r);
+}
+
+/*
+ * @brief: keep the vector of a vreg until body position p.
+ */
+static void keep_until(vectorizer *v, ir_operand op, size_t p) {
+  if (op.kind == IR_OPERAND_VREG && v->last[op.vreg] < p)
+    v->last[op.vreg] = p;
+}
+
+/*
+ * @brief: give a reduction its vector of partial results, starting from
+ * the neutral value of every lane. SSE2 keeps min / max vectors biased.
+ */
+static bool start_reduction(vectorizer *v, vec_reduction *r) {
+  // what the update reads must live until it runs
+  for (size_t p = 0; p < v->body.count; p++) {
+    vec_entry *entry = dynamic_array_at(&v->body, p);
+    if (entry->instr != r->update)
+      continue;
+    for (size_t t = 0; t < r->term_count; t++)
+      keep_until(v, r->terms[t], p);
+    keep_until(v, r->cond, p);
+    keep_until(v, r->elem, p);
+  }
+
+  if (!pin(v, &r->reg))
+    return false;
+
+  ir_operand acc = ir_vec(r->reg);
+  long start = 0;
+  if (r->kind == VEC_MIN)
+    start = LANE_MAX;
+  if (r->kind != VEC_SUM && !v->avx2)
+    start ^= BIAS;
+
+  if (start == 0)
+    emit(v, &v->init, IR_VXOR, acc, acc, acc);
+  else
+    emit(v, &v->init, IR_VSPLAT, acc, ir_imm(start), (ir_operand){0});
+  dynamic_array_append(&v->reductions, r);
+  return true;
+}
+
+/*
+ * @brief: find every value carried from one iteration to the next, they
+ * must all be reductions.
+ */
+static bool find_reductions(vectorizer *v) {
+  size_t iv = v->cl->iv;
+
+  for (size_t p = 0; p < v->body.count; p++) {
+    vec_entry *entry = dynamic_array_at(&v->body, p);
+    ir_instr *instr = entry->instr;
+    vec_reduction r = {0};
+
+    if (instr->op == IR_STORE) {
+      if (!memory_reduction(v, p, &r))
+        return reject(v, "stores a variable that is not a reduction");
+      if (!start_reduction(v, &r))
+        return false;
+      continue;
+    }
+
+    if (instr->dst.kind != IR_OPERAND_VREG || instr->dst.vreg == iv)
+      continue;
+    size_t acc = instr->dst.vreg;
+    if (v->all_defs[acc] == 1 && !v->outside[acc])
+      continue;
+
+    r = (vec_reduction){.vreg = acc, .update = instr};
+    bool found = false;
+    if (v->defs[acc] == 1 && instr->op == IR_ADD)
+      found = sum(v, entry, acc, &r);
+    else if (v->defs[acc] == 1 &&
+             (instr->op == IR_MOV || instr->op == IR_LOAD_ELEM)) {
+      // an element loaded into the accumulator is its own value
+      r.elem = instr->op == IR_MOV ? instr->a : (ir_operand){0};
+      found = min_max(v, entry, acc, &r);
+    }
+    if (!found)
+      return reject(v, "carries a value from one iteration to the next");
+    if (!start_reduction(v, &r))
+      return false;
+  }
+  return true;
+}
+
+/*
+ * @brief: find the reduction an instruction belongs to.
+ */
+static vec_reduction *reduction_of(vectorizer *v, ir_instr *instr) {
+  for (size_t i = 0; i < v->reductions.count; i++) {
+    vec_reduction *r = dynamic_array_at(&v->reductions, i);
+    if (r->update == instr)
+      return r;
+    for (size_t c = 0; c < r->chain_count; c++)
+      if (r->chain[c] == instr)
+        return r;
+    if (r->var && instr->var && strcmp(r->var->name, instr->var->name) == 0 &&
+        (instr->op == IR_LOAD || instr->op == IR_STORE))
+      return r;
+  }
+  return NULL;
+}
+
+/*
+ * @brief: check whether an operand is the accumulator of a reduction.
+ */
+static bool is_accumulator(vectorizer *v, ir_operand op) {
+  for (size_t i = 0; i < v->reductions.count; i++) {
+    vec_reduction *r = dynamic_array_at(&v->reductions, i);
+    if (ir_is_vreg(op, r->vreg) || (r->var && ir_is_vreg(op, r->read)))
+      return true;
+  }
+  return false;
+}
+
+/*
+ * @brief: replace the lanes of a min / max reduction by the ones of x that
+ * win the compare.
+ */
+static bool reduce_lanes(vectorizer *v, vec_reduction *r, unsigned int reg) {
+  ir_operand acc = ir_vec(r->reg);
+  if (v->avx2) {
+    emit(v, &v->code, r->kind == VEC_MAX ? IR_VMAXU : IR_VMINU, acc, acc,
+         ir_vec(reg));
+    return true;
+  }
+
+  // acc = acc < x ? x : acc, for max, on biased lanes
+  unsigned int x, mask, take;
+  if (!biased_of(v, reg, &x) || !alloc(v, &mask))
+    return false;
+  if (!alloc(v, &take)) {
+    release(v, mask);
+    return false;
+  }
+  if (r->kind == VEC_MAX)
+    emit(v, &v->code, IR_VCMPGT, ir_vec(mask), ir_vec(x), acc);
+  else
+    emit(v, &v->code, IR_VCMPGT, ir_vec(mask), acc, ir_vec(x));
+  emit(v, &v->code, IR_VAND, ir_vec(take), ir_vec(mask), ir_vec(x));
+  emit(v, &v->code, IR_VANDN, ir_vec(mask), ir_vec(mask), acc);
+  emit(v, &v->code, IR_VOR, acc, ir_vec(take), ir_vec(mask));
+  release(v, take);
+  release(v, mask);
+  return true;
+}
+
+/*
+ * @brief: make the mask of the condition of an if: all ones in the lanes
+ * where it holds (or does not, when mask_negated is set).
+ */
+static bool condition(vectorizer *v, size_t index) {
+  vec_pred *pred = dynamic_array_at(&v->preds, index);
+  ir_instr *br = pred->br;
+
+  if (v->mask >= 0)
+    release(v, v->mask);
+  v->mask = -1;
+  v->mask_pred = index;
+
+  // a min / max reduction compares against its accumulator, there is no
+  // mask to make
+  if (is_accumulator(v, br->a) || is_accumulator(v, br->b))
+    return true;
+
+  vec_value a, b;
+  if (!compared_of(v, br->a, &a) || !compared_of(v, br->b, &b))
+    return false;
+
+  rel_kind rel = pred->negated ? ir_rel_negate(br->rel) : br->rel;
+  v->mask_negated =
+      rel == REL_NOT_EQUAL || rel == REL_LESS_THAN_OR_EQUAL ||
+      rel == REL_GREATER_THAN_OR_EQUAL;
+
+  unsigned int mask;
+  if (!alloc(v, &mask))
+    return false;
+  v->mask = mask;
+
+  if (rel == REL_IS_EQUAL || rel == REL_NOT_EQUAL) {
+    emit(v, &v->code, IR_VCMPEQ, ir_vec(mask), ir_vec(a.reg), ir_vec(b.reg));
+    return true;
+  }
+
+  unsigned int x, y;
+  if (!biased_of(v, a.reg, &x) || !biased_of(v, b.reg, &y))
+    return false;
+  // a > b, and a <= b as its negation; a < b is b > a
+  if (rel == REL_GREATER_THAN || rel == REL_LESS_THAN_OR_EQUAL)
+    emit(v, &v->code, IR_VCMPGT, ir_vec(mask), ir_vec(x), ir_vec(y));
+  else
+    emit(v, &v->code, IR_VCMPGT, ir_vec(mask), ir_vec(y), ir_vec(x));
+  return true;
+}
+
+/*
+ * @brief: give the result of an instruction its vector, forgotten at once
+ * when nothing reads it.
+ */
+static void define(vectorizer *v, ir_instr *instr, size_t p,
+                   vec_value value) {
+  size_t vreg = instr->dst.vreg;
+  if (v->last[vreg] <= p) {
+    release(v, value.reg);
+    return;
+  }
+  v->values[vreg] = value;
+}
+
+/*
+ * @brief: get the register an array was last loaded into or stored from.
+ */
+static bool cached_load(vectorizer *v, variable *var, unsigned int *reg) {
+  for (size_t i = 0; i < v->loads.count; i++) {
+    vec_cached *c = dynamic_array_at(&v->loads, i);
+    if (strcmp(c->var->name, var->name) == 0) {
+      *reg = c->reg;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * @brief: forget an array after a store to it.
+ */
+static void forget_load(vectorizer *v, variable *var) {
+  for (size_t i = v->loads.count; i-- > 0;) {
+    vec_cached *c = dynamic_array_at(&v->loads, i);
+    if (strcmp(c->var->name, var->name) == 0)
+      dynamic_array_remove(&v->loads, i);
+  }
+}
+
+/*
+ * @brief: check that an array access is to the element of the iteration.
+ */
+static bool own_element(vectorizer *v, ir_instr *instr) {
+  if (!ir_is_vreg(instr->a, v->cl->iv))
+    return reject(v, "accesses another element than the one of the "
+                     "iteration");
+  return true;
+}
+
+/*
+ * @brief: emit var[iv .. iv + lanes) = value, blended with what is there
+ * when the store is under a condition.
+ */
+static bool store_elem(vectorizer *v, vec_entry *entry) {
+  ir_instr *instr = entry->instr;
+  vec_value value;
+  if (!own_element(v, instr) || !vector_of(v, instr->b, &value))
+    return false;
+
+  ir_instr *store;
+  if (entry->pred == SIZE_MAX) {
+    store = emit(v, &v->code, IR_VSTORE, (ir_operand){0}, instr->a,
+                 ir_vec(value.reg));
+    store->var = instr->var;
+    forget_load(v, instr->var);
+    if (!v->pinned[value.reg]) {
+      vec_cached c = {.var = instr->var, .reg = value.reg};
+      dynamic_array_append(&v->loads, &c);
+    }
+    return true;
+  }
+
+  if (entry->pred != v->mask_pred || v->mask < 0)
+    return reject(v, "stores under a condition on a reduction");
+
+  unsigned int old, take, keep;
+  if (!cached_load(v, instr->var, &old)) {
+    if (!alloc(v, &old))
+      return false;
+    ir_instr *load =
+        emit(v, &v->code, IR_VLOAD, ir_vec(old), instr->a, (ir_operand){0});
+    load->var = instr->var;
+  } else {
+    v->refs[old]++;
+  }
+  if (!alloc(v, &take) || !alloc(v, &keep))
+    return false;
+
+  unsigned int yes = v->mask_negated ? old : value.reg;
+  unsigned int no = v->mask_negated ? value.reg : old;
+  emit(v, &v->code, IR_VAND, ir_vec(take), ir_vec(v->mask), ir_vec(yes));
+  emit(v, &v->code, IR_VANDN, ir_vec(keep), ir_vec(v->mask), ir_vec(no));
+  emit(v, &v->code, IR_VOR, ir_vec(take), ir_vec(take), ir_vec(keep));
+  store = emit(v, &v->code, IR_VSTORE, (ir_operand){0}, instr->a,
+               ir_vec(take));
+  store->var = instr->var;
+  forget_load(v, instr->var);
+
+  release(v, keep);
+  release(v, take);
+  release(v, old);
+  return true;
+}
+
+/*
+ * @brief: forget a vreg read for the last time at body position p.
+ */
+static void retire_operand(vectorizer *v, ir_operand op, size_t p) {
+  if (op.kind != IR_OPERAND_VREG)
+    return;
+  vec_value *value = &v->values[op.vreg];
+  if (!value->set || v->defs[op.vreg] == 0 || v->last[op.vreg] != p)
+    return;
+  value->set = false;
+  release(v, value->reg);
+}
+
+/*
+ * @brief: forget the vregs an instruction reads for the last time.
+ */
+static void retire(vectorizer *v, ir_instr *instr, size_t p) {
+  retire_operand(v, instr->a, p);
+  retire_operand(v, instr->b, p);
+}
+
+/*
+ * @brief: get the vector of the element of the iteration of an array.
+ *
+ * @return: false if the access is to another element, the register has a
+ * holder more otherwise.
+ */
+static bool load_elem(vectorizer *v, ir_instr *instr, vec_value *out) {
+  if (!own_element(v, instr))
+    return false;
+
+  *out = (vec_value){.set = true, .exact = true};
+  if (cached_load(v, instr->var, &out->reg)) {
+    v->refs[out->reg]++;
+    return true;
+  }
+  if (!alloc(v, &out->reg))
+    return false;
+  ir_instr *load = emit(v, &v->code, IR_VLOAD, ir_vec(out->reg), instr->a,
+                        (ir_operand){0});
+  load->var = instr->var;
+  vec_cached c = {.var = instr->var, .reg = out->reg};
+  dynamic_array_append(&v->loads, &c);
+  return true;
+}
+
+/*
+ * @brief: emit the update of a reduction for every lane.
+ */
+static bool reduce(vectorizer *v, vec_reduction *r, size_t p) {
+  ir_operand acc = ir_vec(r->reg);
+
+  if (r->kind == VEC_SUM) {
+    for (size_t t = 0; t < r->term_count; t++) {
+      vec_value term;
+      if (!vector_of(v, r->terms[t], &term))
+        return false;
+      if (!term.exact)
+        return reject(v, "reduces values wider than an element");
+      emit(v, &v->code, IR_VSUMQ, acc, acc, ir_vec(term.reg));
+      retire_operand(v, r->terms[t], p);
+    }
+    return true;
+  }
+
+  vec_value elem, cond;
+  bool loaded = r->update->op == IR_LOAD_ELEM;
+  if (loaded ? !load_elem(v, r->update, &elem)
+             : !vector_of(v, r->elem, &elem))
+    return false;
+  bool ok = vector_of(v, r->cond, &cond);
+  if (ok && (cond.reg != elem.reg || !elem.exact))
+    ok = reject(v, "replaces a reduction by another value than the one "
+                   "compared");
+  if (ok)
+    ok = reduce_lanes(v, r, elem.reg);
+
+  if (loaded)
+    release(v, elem.reg);
+  retire_operand(v, r->cond, p);
+  return ok;
+}
+
+/*
+ * @brief: emit an element-wise operation.
+ */
+static bool arith(vectorizer *v, ir_instr *instr, size_t p) {
+  vec_value a, b = {0};
+  if (!vector_of(v, instr->a, &a))
+    return false;
+
+  bool shift = instr->op == IR_SHL || instr->op == IR_SHR ||
+               instr->op == IR_SAR;
+  if (!shift && !vector_of(v, instr->b, &b))
+    return false;
+  if (shift && instr->op != IR_SHL && !a.exact)
+    return reject(v, "shifts right a value wider than an element");
+
+  ir_opcode op;
+  bool exact = false;
+  switch (instr->op) {
+  case IR_ADD:
+    op = IR_VADD;
+    break;
+  case IR_SUB:
+    op = IR_VSUB;
+    break;
+  case IR_MUL:
+    op = IR_VMUL;
+    break;
+  case IR_AND:
+    op = IR_VAND;
+    exact = a.exact || b.exact;
+    break;
+  case IR_SHL:
+    op = IR_VSHL;
+    break;
+  default:
+    // zero extended lanes are not negative: sar shifts in zeros too
+    op = IR_VSHR;
+    exact = true;
+    break;
+  }
+
+  // the operands may be dead now, the result can take one of their places
+  retire(v, instr, p);
+  vec_value result = {.set = true, .exact = exact};
+  if (!alloc(v, &result.reg))
+    return false;
+  emit(v, &v->code, op, ir_vec(result.reg), ir_vec(a.reg),
+       shift ? instr->b : ir_vec(b.reg));
+  define(v, instr, p, result);
+  return true;
+}
+
+/*
+ * @brief: emit the vector form of one body instruction.
+ */
+static bool translate(vectorizer *v, size_t p) {
+  vec_entry *entry = dynamic_array_at(&v->body, p);
+  ir_instr *instr = entry->instr;
+  vec_reduction *r = reduction_of(v, instr);
+
+  if (r && r->update == instr)
+    return reduce(v, r, p);
+  if (r)
+    return true; // <-- adds of a sum, load and store of a variable
+
+  switch (instr->op) {
+  case IR_NOP:
+    return true;
+
+  case IR_BR:
+    return condition(v, entry->pred);
+
+  case IR_LOAD_ELEM: {
+    vec_value value;
+    if (!load_elem(v, instr, &value))
+      return false;
+    define(v, instr, p, value);
+    return true;
+  }
+
+  case IR_STORE_ELEM:
+    return store_elem(v, entry);
+
+  case IR_LOAD: {
+    // the loop stores no variable but accumulators: load it once in front
+    ir_instr load = *instr;
+    load.dst = ir_new_vreg(v->ir, instr->type);
+    dynamic_array_append(&v->init, &load);
+
+    vec_value value = {.set = true};
+    if (!pin(v, &value.reg))
+      return false;
+    emit(v, &v->init, IR_VSPLAT, ir_vec(value.reg), load.dst,
+         (ir_operand){0});
+    v->values[instr->dst.vreg] = value;
+    return true;
+  }
+
+  case IR_MOV: {
+    vec_value value;
+    if (!vector_of(v, instr->a, &value))
+      return false;
+    v->refs[value.reg]++;
+    retire(v, instr, p);
+    define(v, instr, p, value);
+    return true;
+  }
+
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_AND:
+  case IR_SHL:
+  case IR_SHR:
+  case IR_SAR:
+    return arith(v, instr, p);
+
+  default:
+    return reject(v, "has an operation without a vector form");
+  }
+}
+
+/*
+ * @brief: turn the whole body into vector code, the update of the counter
+ * (the last instruction) excepted.
+ */
+static bool translate_body(vectorizer *v) {
+  vec_entry *update = dynamic_array_at(&v->body, v->body.count - 1);
+  if (!ir_is_vreg(update->instr->dst, v->cl->iv) ||
+      update->pred != SIZE_MAX)
+    return reject(v, "updates the loop counter before the end of the body");
+
+  for (size_t p = 0; p + 1 < v->body.count; p++) {
+    vec_entry *entry = dynamic_array_at(&v->body, p);
+    if (!translate(v, p))
+      return false;
+    retire(v, entry->instr, p);
+  }
+  return true;
+}
+
+/*
+ * @brief: append an instruction to a block.
+ */
+static void append(ir_block *block, ir_instr instr) {
+  dynamic_array_append(&block->instrs, &instr);
+}
+
+/*
+ * @brief: combine the lanes of the reductions into their accumulators once
+ * the vector loop is done.
+ *
+ * @return: the block the last combination ends in, still unterminated.
+ */
+static ir_block *finish_reductions(vectorizer *v, ir_block *done,
+                                   dynamic_array *added) {
+  ir_program *ir = v->ir;
+  ir_block *cur = done;
+  size_t line = v->cl->line;
+
+  for (size_t i = 0; i < v->reductions.count; i++) {
+    vec_reduction *r = dynamic_array_at(&v->reductions, i);
+    ir_operand acc = ir_vec(r->reg);
+    ir_operand lanes = ir_new_vreg(ir, TYPE_INT);
+
+    ir_opcode op = IR_VHSUM;
+    if (r->kind != VEC_SUM) {
+      op = r->kind == VEC_MAX ? IR_VHMAXU : IR_VHMINU;
+      if (!v->avx2) {
+        unsigned int bias;
+        splat_imm(v, BIAS, &bias); // <-- made by the biased compares
+        emit(v, &cur->instrs, IR_VXOR, acc, acc, ir_vec(bias));
+      }
+    }
+    emit(v, &cur->instrs, op, lanes, acc, (ir_operand){0});
+
+    // the current value of the accumulator
+    ir_operand value = {.kind = IR_OPERAND_VREG, .vreg = r->vreg};
+    if (r->var) {
+      value = ir_new_vreg(ir, r->var->type);
+      append(cur, (ir_instr){.op = IR_LOAD,
+                             .type = r->var->type,
+                             .line = line,
+                             .dst = value,
+                             .var = r->var});
+    }
+
+    ir_instr set = {.op = IR_MOV,
+                    .type = TYPE_INT,
+                    .line = line,
+                    .dst = value,
+                    .a = lanes};
+    if (r->kind == VEC_SUM) {
+      ir_operand total = r->var ? ir_new_vreg(ir, TYPE_INT) : value;
+      append(cur, (ir_instr){.op = IR_ADD,
+                             .type = TYPE_INT,
+                             .line = line,
+                             .dst = total,
+                             .a = value,
+                             .b = lanes});
+      set.a = total;
+    }
+    if (r->var)
+      set = (ir_instr){.op = IR_STORE,
+                       .type = r->var->type,
+                       .line = line,
+                       .var = r->var,
+                       .a = set.a};
+
+    if (r->kind == VEC_SUM) {
+      if (r->var)
+        append(cur, set);
+      continue;
+    }
+
+    // if lanes rel acc { acc = lanes }
+    ir_block *update = ir_block_new(ir, NULL);
+    ir_block *join = ir_block_new(ir, NULL);
+    append(cur, (ir_instr){.op = IR_BR,
+                           .type = TYPE_VOID,
+                           .line = line,
+                           .a = lanes,
+                           .b = value,
+                           .rel = r->rel,
+                           .target = update,
+                           .alt = join});
+    append(update, set);
+    append(update, (ir_instr){.op = IR_JMP,
+                              .type = TYPE_VOID,
+                              .line = line,
+                              .target = join});
+    dynamic_array_append(added, &update);
+    dynamic_array_append(added, &join);
+    cur = join;
+  }
+  return cur;
+}
+
+/*
+ * @brief: put the vector loop in front of the original one.
+ *
+ * guard:   br bound in range, ranges, loop   (bound in a vreg only)
+ * ranges:  br x >= 0 and br x <= 0xffffffff for every x compared as an
+ *          element, to loop if it is not
+ * pre:     limit = bound - (lanes - 1)
+ *          br iv rel limit, init, loop
+ * init:    splats and starting vectors of reductions
+ * body:    the vector loop, br iv rel limit, body, done
+ * done:    reductions combined
+ *          br iv rel bound, loop, exit
+ * loop:    the original loop, for the iterations left over
+ */
+static bool build(vectorizer *v) {
+  ir_program *ir = v->ir;
+  counted_loop *cl = v->cl;
+  ir_block *header = cl->blocks[cl->header];
+
+  ir_block *guard, *pre;
+  ir_operand limit;
+  if (!counted_enter(ir, cl, v->lanes - 1, &guard, &pre, &limit))
+    return reject(v, "has a bound too close to the end of the range");
+
+  dynamic_array added;
+  dynamic_array_init(&added, sizeof(ir_block *));
+  if (guard)
+    dynamic_array_append(&added, &guard);
+
+  ir_block *prev = guard;
+  ir_block *entry = guard;
+  for (size_t i = 0; i < v->ranged.count; i++) {
+    ir_operand x = {.kind = IR_OPERAND_VREG,
+                    .vreg = *(size_t *)dynamic_array_at(&v->ranged, i)};
+    ir_block *low = counted_test_block(ir, cl, x, REL_GREATER_THAN_OR_EQUAL,
+                                       ir_imm(0), NULL, header);
+    ir_block *high = counted_test_block(
+        ir, cl, x, REL_LESS_THAN_OR_EQUAL, ir_imm(LANE_MAX), NULL, header);
+    ir_terminator(low)->target = high;
+    if (prev)
+      ir_terminator(prev)->target = low;
+    else
+      entry = low;
+    prev = high;
+    dynamic_array_append(&added, &low);
+    dynamic_array_append(&added, &high);
+  }
+  if (prev)
+    ir_terminator(prev)->target = pre;
+  else
+    entry = pre;
+  dynamic_array_append(&added, &pre);
+
+  ir_block *init = ir_block_new(ir, NULL);
+  ir_block *body = ir_block_new(ir, NULL);
+  ir_block *done = ir_block_new(ir, NULL);
+  ir_terminator(pre)->target = init;
+  dynamic_array_append(&added, &init);
+  dynamic_array_append(&added, &body);
+  dynamic_array_append(&added, &done);
+
+  for (size_t i = 0; i < v->init.count; i++)
+    append(init, *(ir_instr *)dynamic_array_at(&v->init, i));
+  append(init, (ir_instr){.op = IR_JMP,
+                          .type = TYPE_VOID,
+                          .line = cl->line,
+                          .target = body});
+
+  ir_operand iv = {.kind = IR_OPERAND_VREG, .vreg = cl->iv};
+  for (size_t i = 0; i < v->code.count; i++)
+    append(body, *(ir_instr *)dynamic_array_at(&v->code, i));
+  append(body, (ir_instr){.op = IR_ADD,
+                          .type = ir_vreg_at(ir, cl->iv)->type,
+                          .line = cl->line,
+                          .dst = iv,
+                          .a = iv,
+                          .b = ir_imm(v->lanes)});
+  append(body, (ir_instr){.op = IR_BR,
+                          .type = TYPE_VOID,
+                          .line = cl->line,
+                          .a = iv,
+                          .b = limit,
+                          .rel = cl->rel,
+                          .target = body,
+                          .alt = done});
+
+  ir_block *last = finish_reductions(v, done, &added);
+  append(last, (ir_instr){.op = IR_BR,
+                          .type = TYPE_VOID,
+                          .line = cl->line,
+                          .a = iv,
+                          .b = cl->bound,
+                          .rel = cl->rel,
+                          .target = header,
+                          .alt = cl->exit});
+
+  counted_redirect_entries(ir, cl, entry);
+  counted_insert_before(ir, cl, (ir_block **)added.items, added.count);
+  dynamic_array_free(&added);
+  return true;
+}
+
+/*
+ * @brief: vectorize one loop if it can be.
+ *
+ * @return: why it was not, NULL if it was.
+ */
+static const char *vectorize_loop(ir_program *ir, cfg *g, size_t index,
+                                  bool avx2) {
+  counted_loop cl;
+  if (!counted_analyze(ir, g, index, &cl))
+    return "is not a counted loop";
+  if (cl.step != 1) {
+    counted_free(&cl);
+    return "does not count up by one";
+  }
+
+  vectorizer v = {.ir = ir,
+                  .cl = &cl,
+                  .avx2 = avx2,
+                  .lanes = avx2 ? 8 : 4,
+                  .mask = -1,
+                  .mask_pred = SIZE_MAX};
+  dynamic_array_init(&v.body, sizeof(vec_entry));
+  dynamic_array_init(&v.preds, sizeof(vec_pred));
+  dynamic_array_init(&v.reductions, sizeof(vec_reduction));
+  dynamic_array_init(&v.imms, sizeof(vec_cached));
+  dynamic_array_init(&v.loads, sizeof(vec_cached));
+  dynamic_array_init(&v.ranged, sizeof(size_t));
+  dynamic_array_init(&v.init, sizeof(ir_instr));
+  dynamic_array_init(&v.code, sizeof(ir_instr));
+  for (unsigned int r = 0; r < X86_VEC_SCRATCH; r++)
+    v.biased[r] = -1;
+
+  size_t vregs = ir->vregs.count;
+  if (linearize(&v) && v.body.count > 0) {
+    count(&v);
+    if (check_effects(&v) && find_reductions(&v) && translate_body(&v))
+      build(&v);
+  } else if (!v.reason) {
+    reject(&v, "has an empty body");
+  }
+
+  // vregs made for a loop that was not vectorized are never used
+  if (v.reason)
+    ir->vregs.count = vregs;
+
+  free(v.defs);
+  free(v.uses);
+  free(v.all_defs);
+  free(v.outside);
+  free(v.last);
+  free(v.values);
+  dynamic_array_free(&v.body);
+  dynamic_array_free(&v.preds);
+  dynamic_array_free(&v.reductions);
+  dynamic_array_free(&v.imms);
+  dynamic_array_free(&v.loads);
+  dynamic_array_free(&v.ranged);
+  dynamic_array_free(&v.init);
+  dynamic_array_free(&v.code);
+  counted_free(&cl);
+  return v.reason;
+}
+
+void vectorize_loops(ir_program *ir, bool avx2, vectorize_stats *stats) {
+  *stats = (vectorize_stats){.lanes = avx2 ? 8 : 4};
+  dynamic_array_init(&stats->loops, sizeof(vectorize_loop_stats));
+
+  // every transformation changes the graph, so loops are found again by
+  // their header
+  dynamic_array headers;
+  dynamic_array_init(&headers, sizeof(ir_block *));
+
+  cfg g;
+  cfg_build(ir, &g);
+  for (size_t i = 0; i < g.loops.count; i++)
+    if (counted_innermost(&g, i))
+      dynamic_array_append(&headers, &cfg_loop_at(&g, i)->header);
+  cfg_free(&g);
+
+  for (size_t h = 0; h < headers.count; h++) {
+    ir_block *header;
+    dynamic_array_get(&headers, h, &header);
+
+    cfg_build(ir, &g);
+    for (size_t i = 0; i < g.loops.count; i++) {
+      cfg_loop *loop = cfg_loop_at(&g, i);
+      if (loop->header != header)
+        continue;
+
+      size_t latch;
+      dynamic_array_get(&loop->latches, 0, &latch);
+      ir_instr *test = ir_terminator(ir_block_at(ir, latch));
+      vectorize_loop_stats entry = {
+          .line = test ? test->line : 0,
+          .reason = vectorize_loop(ir, &g, i, avx2)};
+      dynamic_array_append(&stats->loops, &entry);
+      if (entry.reason)
+        stats->rejected++;
+      else
+        stats->vectorized++;
+      break;
+    }
+    cfg_free(&g);
+  }
+
+  dynamic_array_free(&headers);
+}
+
+void vectorize_stats_free(vectorize_stats *stats) {
+  dynamic_array_free(&stats->loops);
+}
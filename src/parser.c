@@ -118,6 +118,7 @@ static expr_node *parse_factor(parser *p, unsigned int *errors) {
     expr_node *node = scu_checked_malloc(sizeof(expr_node));
     node->kind = EXPR_TERM;
     node->line = token.line;
+    node->term.line = token.line;
 
     if (token.kind == TOKEN_INT) {
       node->term.kind = TERM_INT;
@@ -311,6 +312,7 @@ static void parse_initialize(parser *p, instr_node *instr, type _type,
   instr->kind = INSTR_INITIALIZE;
   instr->initialize_variable.var.type = _type;
   instr->initialize_variable.var.name = _name;
+  instr->initialize_variable.var.line = instr->line;
   parser_advance(p);
 
   expr_node *expr = parse_expr(p, errors);
@@ -331,6 +333,7 @@ static void parse_initialize_array(parser *p, instr_node *instr, type _type,
   instr->kind = INSTR_INITIALIZE_ARRAY;
   instr->initialize_array.var.type = _type;
   instr->initialize_array.var.name = _name;
+  instr->initialize_array.var.line = instr->line;
   instr->initialize_array.size_expr = size_expr;
   parser_advance(p);
 
@@ -492,6 +495,7 @@ static void parse_assign(parser *p, instr_node *instr, unsigned int *errors) {
     instr->kind = INSTR_ASSIGN;
     instr->line = ident_line;
     instr->assign.identifier.name = ident_name;
+    instr->assign.identifier.line = ident_line;
 
     if (token.kind != TOKEN_ASSIGN) {
       scu_perror(errors, "Expected assign, found %s [line %d]\n",
@@ -1175,7 +1179,7 @@ void free_loops(program_node *program) {
   for (unsigned int i = 0; i < program->instrs.count; i++) {
     instr_node *instr = program->instrs.items + (i * program->instrs.item_size);
     if (instr->kind == INSTR_LOOP) {
-      program_node temp = {0, instr->loop.instrs};
+      program_node temp = {.instrs = instr->loop.instrs};
       free_if_instrs(&temp);
       free_expressions(&temp);
       free_loops(&temp);
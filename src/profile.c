@@ -0,0 +1,162 @@
+#include "profile.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Jumps through blocks added after IR generation profile_edge follows to
+ * find the successor a profile knows.
+ */
+#define PROFILE_MAX_HOPS 4
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+/*
+ * @brief: mix the bytes of a value into an FNV-1a hash.
+ */
+static uint64_t hash(uint64_t h, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    h ^= (value >> (8 * i)) & 0xff;
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+uint64_t profile_checksum(ir_program *ir) {
+  uint64_t h = hash(FNV_OFFSET, ir->blocks.count);
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    h = hash(h, block->id);
+    h = hash(h, block->instrs.count);
+
+    ir_instr *term = ir_terminator(block);
+    if (!term)
+      continue;
+    h = hash(h, term->op);
+    h = hash(h, term->rel);
+
+    ir_block *succ[2];
+    size_t count = ir_successors(block, succ);
+    for (size_t s = 0; s < count; s++)
+      h = hash(h, succ[s]->id);
+  }
+
+  return h;
+}
+
+size_t profile_instrument(ir_program *ir) {
+  size_t n = ir->block_count;
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    ir_instr count = {.op = IR_COUNT, .type = TYPE_VOID, .a = ir_imm(block->id)};
+    dynamic_array_insert(&block->instrs, 0, &count);
+
+    ir_instr *term = ir_terminator(block);
+    if (term && term->op == IR_BR && term->target != term->alt)
+      term->counter = n + block->id;
+  }
+
+  return 2 * n;
+}
+
+/*
+ * @brief: read one u64 of a profile.
+ */
+static bool read_u64(FILE *f, uint64_t *value) {
+  return fread(value, sizeof(uint64_t), 1, f) == 1;
+}
+
+bool profile_read(const char *path, profile *prof) {
+  *prof = (profile){0};
+
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+
+  uint64_t magic, n;
+  bool ok = read_u64(f, &magic) && magic == PROFILE_MAGIC &&
+            read_u64(f, &prof->checksum) && read_u64(f, &n) && n > 0 &&
+            n < SIZE_MAX / (2 * sizeof(uint64_t));
+  if (ok) {
+    prof->block_count = n;
+    prof->runs = scu_checked_malloc(n * sizeof(uint64_t));
+    prof->taken = scu_checked_malloc(n * sizeof(uint64_t));
+    ok = fread(prof->runs, sizeof(uint64_t), n, f) == n &&
+         fread(prof->taken, sizeof(uint64_t), n, f) == n && fgetc(f) == EOF;
+  }
+
+  fclose(f);
+  if (!ok)
+    profile_free(prof);
+  return ok;
+}
+
+bool profile_match(profile *prof, ir_program *ir) {
+  if (prof->checksum != profile_checksum(ir) ||
+      prof->block_count != ir->block_count)
+    return false;
+
+  size_t n = prof->block_count;
+  prof->target = scu_checked_malloc(n * sizeof(size_t));
+  prof->alt = scu_checked_malloc(n * sizeof(size_t));
+  for (size_t b = 0; b < n; b++) {
+    prof->target[b] = SIZE_MAX;
+    prof->alt[b] = SIZE_MAX;
+  }
+
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    ir_instr *term = ir_terminator(block);
+    if (term && term->op == IR_BR && term->target != term->alt) {
+      prof->target[block->id] = term->target->id;
+      prof->alt[block->id] = term->alt->id;
+    }
+  }
+  return true;
+}
+
+void profile_free(profile *prof) {
+  free(prof->runs);
+  free(prof->taken);
+  free(prof->target);
+  free(prof->alt);
+  *prof = (profile){0};
+}
+
+bool profile_runs(const profile *prof, const ir_block *block, uint64_t *runs) {
+  if (!prof || block->origin >= prof->block_count)
+    return false;
+
+  *runs = prof->runs[block->origin];
+  return true;
+}
+
+bool profile_edge(const profile *prof, const ir_block *block, ir_block *to,
+                  uint64_t *count) {
+  if (!prof || !prof->target || block->origin >= prof->block_count)
+    return false;
+
+  // blocks added in between (preheaders, guards) only jump on
+  for (int hops = 0; to->origin >= prof->block_count; hops++) {
+    ir_instr *term = ir_terminator(to);
+    if (hops == PROFILE_MAX_HOPS || !term || term->op != IR_JMP)
+      return false;
+    to = term->target;
+  }
+
+  size_t b = block->origin;
+  if (to->origin == prof->target[b])
+    *count = prof->taken[b];
+  else if (to->origin == prof->alt[b])
+    *count = prof->runs[b] - prof->taken[b];
+  else
+    return false;
+  return true;
+}
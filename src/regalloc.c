@@ -0,0 +1,315 @@
+#include "regalloc.h"
+#include "cfg.h"
+#include "ds/bitset.h"
+#include "ds/dynamic_array.h"
+#include "ir.h"
+#include "opt/layout.h"
+#include "opt/liveness.h"
+#include "profile.h"
+#include "utils.h"
+#include "x86.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Allocation order: the scratch registers first (no save / restore needed),
+ * then the callee-saved ones, which are pushed in the prologue. rax is kept
+ * out of the pool, codegen uses it to stage memory and immediate operands.
+ */
+static const x86_reg pool[] = {RCX, RDX, RSI, RDI, R8,  R9,  R10,
+                               R11, RBX, R12, R13, R14, R15};
+
+#define POOL_SIZE (sizeof(pool) / sizeof(pool[0]))
+
+/*
+ * @struct interval: live range of one vreg, in instruction positions. Every
+ * instruction k reads its operands at 2k and writes its result at 2k + 1.
+ */
+typedef struct interval {
+  size_t vreg;
+  size_t start;
+  size_t end;
+  unsigned int forbidden; // <-- mask of registers this interval may not use
+  double weight; // <-- uses and definitions, each weighted by how often its
+                 //     block runs (profile guided builds only)
+} interval;
+
+/*
+ * @brief: widen an interval so it covers pos.
+ */
+static void extend(interval *iv, size_t pos) {
+  if (pos < iv->start)
+    iv->start = pos;
+  if (pos > iv->end)
+    iv->end = pos;
+}
+
+/*
+ * @struct clobber_site: an instruction that overwrites registers.
+ */
+typedef struct clobber_site {
+  size_t pos;
+  unsigned int regs;
+} clobber_site;
+
+/*
+ * @brief: mask of the registers a fasm statement may overwrite.
+ */
+static unsigned int fasm_clobbers(void) {
+  unsigned int regs = 0;
+  for (int reg = 0; reg < X86_REG_COUNT; reg++)
+    if (!x86_survives_fasm(reg))
+      regs |= 1u << reg;
+  return regs;
+}
+
+/*
+ * @brief: forbid the registers of a clobber site for every interval live
+ * across it (live both before and after the instruction).
+ */
+static void clobber(ir_program *ir, interval *ivs, clobber_site *site) {
+  for (size_t v = 0; v < ir->vregs.count; v++)
+    if (ivs[v].start <= site->pos && ivs[v].end > site->pos + 1)
+      ivs[v].forbidden |= site->regs;
+}
+
+/*
+ * @brief: check whether an instruction is lowered to idiv or one operand
+ * imul, which work in rdx:rax.
+ */
+static bool uses_rdx_rax(ir_opcode op) {
+  return op == IR_DIV || op == IR_MOD || op == IR_MULHI;
+}
+
+/*
+ * @brief: idiv and one operand imul can only take their second operand from
+ * a register or memory, so put immediates in a vreg of their own.
+ */
+static void legalize_divisors(ir_program *ir) {
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    for (size_t j = 0; j < block->instrs.count; j++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+      if (!uses_rdx_rax(instr->op) || instr->b.kind != IR_OPERAND_IMM)
+        continue;
+
+      ir_instr mov = {.op = IR_MOV,
+                      .type = instr->type,
+                      .line = instr->line,
+                      .dst = ir_new_vreg(ir, instr->type),
+                      .a = instr->b};
+      instr->b = mov.dst;
+      dynamic_array_insert(&block->instrs, j++, &mov);
+    }
+  }
+}
+
+/*
+ * @brief: build one interval per vreg, then apply the register constraints:
+ * fasm may clobber every register but r12-r15, and idiv / wide imul write
+ * rdx (the divisor is read after cqo has overwritten it, so it may not be
+ * in rdx either).
+ */
+static void build_intervals(ir_program *ir, const double *freq,
+                            interval *ivs, dynamic_array *clobbers) {
+  liveness lv;
+  liveness_compute(ir, &lv);
+
+  for (size_t v = 0; v < ir->vregs.count; v++)
+    ivs[v] = (interval){.vreg = v, .start = SIZE_MAX, .end = 0};
+
+  size_t k = 0;
+  for (size_t i = 0; i < ir->blocks.count; i++) {
+    ir_block *block = ir_block_at(ir, i);
+    size_t first = 2 * k;
+    size_t last = 2 * (k + block->instrs.count - 1) + 1;
+
+    for (size_t j = 0; j < block->instrs.count; j++, k++) {
+      ir_instr *instr = dynamic_array_at(&block->instrs, j);
+
+      if (instr->a.kind == IR_OPERAND_VREG)
+        extend(&ivs[instr->a.vreg], 2 * k);
+      if (instr->b.kind == IR_OPERAND_VREG)
+        extend(&ivs[instr->b.vreg], 2 * k);
+      if (instr->dst.kind == IR_OPERAND_VREG)
+        extend(&ivs[instr->dst.vreg], 2 * k + 1);
+
+      if (freq) {
+        ir_operand ops[3] = {instr->a, instr->b, instr->dst};
+        for (int o = 0; o < 3; o++)
+          if (ops[o].kind == IR_OPERAND_VREG)
+            ivs[ops[o].vreg].weight += freq[i];
+      }
+
+      if (instr->op == IR_FASM) {
+        clobber_site site = {.pos = 2 * k, .regs = fasm_clobbers()};
+        dynamic_array_append(clobbers, &site);
+      }
+
+      if (uses_rdx_rax(instr->op)) {
+        clobber_site site = {.pos = 2 * k, .regs = 1u << RDX};
+        dynamic_array_append(clobbers, &site);
+        if (instr->op != IR_MULHI && instr->b.kind == IR_OPERAND_VREG)
+          ivs[instr->b.vreg].forbidden |= 1u << RDX;
+      }
+    }
+
+    for (size_t v = 0; v < ir->vregs.count; v++) {
+      if (bitset_test(&lv.live_in[i], v))
+        extend(&ivs[v], first);
+      if (bitset_test(&lv.live_out[i], v))
+        extend(&ivs[v], last);
+    }
+  }
+
+  liveness_free(&lv);
+
+  for (size_t c = 0; c < clobbers->count; c++)
+    clobber(ir, ivs, dynamic_array_at(clobbers, c));
+}
+
+static int by_start(const void *a, const void *b) {
+  const interval *x = a;
+  const interval *y = b;
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  return x->vreg < y->vreg ? -1 : x->vreg > y->vreg;
+}
+
+/*
+ * @brief: get how often every block runs by the profile, indexed by layout
+ * position.
+ */
+static double *block_frequencies(ir_program *ir, const profile *prof) {
+  cfg g;
+  cfg_build(ir, &g);
+  block_weights w;
+  layout_estimate(ir, &g, prof, &w);
+
+  double *freq = scu_checked_malloc((ir->blocks.count + 1) * sizeof(double));
+  for (size_t i = 0; i < ir->blocks.count; i++)
+    freq[i] = w.freq[ir_block_at(ir, i)->id];
+
+  block_weights_free(&w);
+  cfg_free(&g);
+  return freq;
+}
+
+/*
+ * @brief: check whether interval a should rather be spilled than b: the
+ * one used less often by the profile, or else the one ending later.
+ */
+static bool spill_first(interval *a, interval *b, bool weighted) {
+  if (weighted && a->weight != b->weight)
+    return a->weight < b->weight;
+  return a->end > b->end;
+}
+
+/*
+ * @brief: check whether an interval may live in reg.
+ */
+static bool fits(interval *iv, x86_reg reg) {
+  return !(iv->forbidden & (1u << reg));
+}
+
+/*
+ * @brief: give a vreg its own frame slot.
+ */
+static void spill(ir_program *ir, size_t vreg) {
+  ir_vreg *info = ir_vreg_at(ir, vreg);
+  info->reg = -1;
+  ir->frame_size += 8;
+  info->stack_offset = ir->frame_size;
+}
+
+void regalloc_linear_scan(ir_program *ir, const profile *prof,
+                          regalloc_stats *stats) {
+  legalize_divisors(ir);
+
+  size_t n = ir->vregs.count;
+  interval *ivs = scu_checked_malloc((n + 1) * sizeof(interval));
+  dynamic_array clobbers;
+  dynamic_array_init(&clobbers, sizeof(clobber_site));
+  double *freq = prof ? block_frequencies(ir, prof) : NULL;
+  build_intervals(ir, freq, ivs, &clobbers);
+  bool weighted = freq != NULL;
+  free(freq);
+
+  qsort(ivs, n, sizeof(interval), by_start);
+
+  // active intervals, kept sorted by increasing end
+  interval **active = scu_checked_malloc((POOL_SIZE + 1) * sizeof(interval *));
+  size_t active_count = 0;
+  bool used[X86_REG_COUNT] = {0};
+
+  for (size_t i = 0; i < n && ivs[i].start != SIZE_MAX; i++) {
+    interval *cur = &ivs[i];
+
+    // expire the intervals that ended before this one starts
+    size_t kept = 0;
+    for (size_t a = 0; a < active_count; a++) {
+      if (active[a]->end < cur->start)
+        used[ir_vreg_at(ir, active[a]->vreg)->reg] = false;
+      else
+        active[kept++] = active[a];
+    }
+    active_count = kept;
+
+    int reg = -1;
+    for (size_t p = 0; p < POOL_SIZE && reg < 0; p++)
+      if (!used[pool[p]] && fits(cur, pool[p]))
+        reg = pool[p];
+
+    if (reg < 0) {
+      // steal the register of the usable active interval ending last (or
+      // used least often, with a profile)
+      size_t victim = active_count;
+      for (size_t a = active_count; a-- > 0;) {
+        if (fits(cur, ir_vreg_at(ir, active[a]->vreg)->reg) &&
+            (victim == active_count ||
+             spill_first(active[a], active[victim], weighted)))
+          victim = a;
+      }
+
+      if (victim == active_count ||
+          !spill_first(active[victim], cur, weighted)) {
+        spill(ir, cur->vreg);
+        continue;
+      }
+
+      reg = ir_vreg_at(ir, active[victim]->vreg)->reg;
+      spill(ir, active[victim]->vreg);
+      for (size_t a = victim; a + 1 < active_count; a++)
+        active[a] = active[a + 1];
+      active_count--;
+    }
+
+    ir_vreg_at(ir, cur->vreg)->reg = reg;
+    used[reg] = true;
+
+    size_t at = active_count++;
+    while (at > 0 && active[at - 1]->end > cur->end) {
+      active[at] = active[at - 1];
+      at--;
+    }
+    active[at] = cur;
+  }
+
+  ir->frame_size = (ir->frame_size + 15) / 16 * 16;
+
+  if (stats) {
+    *stats = (regalloc_stats){0};
+    for (size_t i = 0; i < n && ivs[i].start != SIZE_MAX; i++) {
+      stats->intervals++;
+      if (ir_vreg_at(ir, ivs[i].vreg)->reg >= 0)
+        stats->in_registers++;
+      else
+        stats->spilled++;
+    }
+  }
+
+  free(active);
+  free(ivs);
+  dynamic_array_free(&clobbers);
+}
@@ -18,15 +18,53 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "asm.h"
+#include "cfg.h"
 #include "codegen.h"
+#include "cost.h"
 #include "cstate.h"
+#include "frame.h"
+#include "irgen.h"
 #include "lexer.h"
+#include "opt/fold.h"
+#include "opt/licm.h"
+#include "opt/pipeline.h"
+#include "opt/remarks.h"
+#include "opt/vectorize.h"
+#include "profile.h"
+#include "regalloc.h"
 #include "semantic.h"
 #include "utils.h"
 
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+/*
+ * @brief: run the passes after dce on a copy of the IR and measure the code
+ * it turns into, so --stats can tell how many bytes dead code elimination
+ * saved.
+ */
+static size_t code_bytes_without_dce(ir_program *ir, pipeline *p,
+                                     size_t dce,
+                                     const codegen_options *options) {
+  ir_program *copy = ir_clone(ir);
+
+  pipeline_run(p, copy, dce + 1, p->count, NULL);
+  regalloc_stats ra_stats;
+  regalloc_linear_scan(copy, options->profile, &ra_stats);
+
+  dynamic_array code;
+  codegen_build(copy, &code, options, NULL);
+  size_t bytes = asm_code_size(&code);
+
+  asm_free(&code);
+  ir_free(copy);
+  return bytes;
+}
+
 int main(int argc, char *argv[]) {
   // Initialize compiler state
   cstate *state = cstate_create_from_args(argc, argv);
@@ -59,9 +97,111 @@ int main(int argc, char *argv[]) {
   if (state->options.verbose)
     scu_pdebug("Semantic Analysis Complete\n");
 
+  // AST Optimizations
+  if (state->options.opt_level > 0)
+    fold_program(state->program);
+
+  // Frame Layout
+  frame_layout(state->program);
+
+  // IR Generation
+  state->ir = ir_from_ast(state->program);
+
+  // Profile Guided Optimization
+  codegen_options cg_options = {.branchless = state->options.branchless};
+  char *default_profile = NULL;
+  profile prof = {0};
+
+  if (state->options.profile_generate) {
+    cg_options.profile_file = state->options.profile_file;
+    if (!cg_options.profile_file)
+      cg_options.profile_file = default_profile =
+          scu_format_string("%s.profile", state->output_filename);
+    cg_options.checksum = profile_checksum(state->ir);
+    cg_options.counters = profile_instrument(state->ir);
+  }
+
+  if (state->options.profile_use) {
+    if (!profile_read(state->options.profile_use, &prof)) {
+      scu_perror(&state->error_count, "Failed to read profile: %s\n",
+                 state->options.profile_use);
+      exit(1);
+    }
+    if (!profile_match(&prof, state->ir)) {
+      scu_pwarning("Profile %s is stale, it was recorded for another "
+                   "version of %s; ignoring it\n",
+                   state->options.profile_use, state->filename);
+      profile_free(&prof);
+    } else {
+      cg_options.profile = &prof;
+    }
+  }
+
+  // IR Optimizations
+  pipeline passes;
+  pipeline_init(&passes, state->options.opt_level, state->options.passes);
+  passes.unroll_factor = state->options.unroll_factor;
+  passes.unroll_budget = state->options.unroll_budget;
+  passes.avx2 = state->options.avx2;
+  passes.profile = cg_options.profile;
+  cg_options.align_loops =
+      pipeline_position(&passes, PASS_ALIGN) < passes.count;
+  cg_options.peephole =
+      pipeline_position(&passes, PASS_PEEPHOLE) < passes.count;
+  if (state->options.print_after)
+    passes.print_after = pipeline_find_pass(state->options.print_after,
+                                            strlen(state->options.print_after));
+
+  pipeline_stats opt;
+  pipeline_stats_init(&opt);
+  size_t dce = pipeline_position(&passes, PASS_DCE);
+  size_t bytes_before_dce = 0;
+  if (state->options.stats && dce < passes.count) {
+    pipeline_run(&passes, state->ir, 0, dce, &opt);
+    bytes_before_dce =
+        code_bytes_without_dce(state->ir, &passes, dce, &cg_options);
+    pipeline_run(&passes, state->ir, dce, passes.count, &opt);
+  } else {
+    pipeline_run(&passes, state->ir, 0, passes.count, &opt);
+  }
+
+  // IR Debug Statements
+  if (state->options.emit_ir)
+    ir_print(state->ir);
+
+  if (state->options.emit_cfg) {
+    cfg g;
+    cfg_build(state->ir, &g);
+    cfg_print_dot(state->ir, &g);
+    cfg_free(&g);
+  }
+
+  // Register Allocation
+  regalloc_stats ra_stats;
+  regalloc_linear_scan(state->ir, cg_options.profile, &ra_stats);
+
+  if (state->options.verbose)
+    scu_pdebug("Register Allocation: %zu variables promoted, %zu of %zu "
+               "vregs in registers, %zu spilled\n",
+               opt.promoted, ra_stats.in_registers, ra_stats.intervals,
+               ra_stats.spilled);
+
+  // Codegen Debug Statements
+  if (passes.print_after >= 0 && pipeline_in_codegen(passes.print_after) &&
+      pipeline_position(&passes, passes.print_after) < passes.count) {
+    codegen_options upto = cg_options;
+    if (passes.print_after == PASS_ALIGN)
+      upto.peephole = false;
+    dynamic_array code;
+    codegen_build(state->ir, &code, &upto, NULL);
+    printf("Code after %s:\n", pipeline_pass_name(passes.print_after));
+    asm_print(&code);
+    asm_free(&code);
+  }
+
   // Codegen & Assembler
-  instrs_to_asm(state->program, state->variables, state->loops,
-                state->output_filename, &state->error_count);
+  codegen_stats cg_stats;
+  ir_to_asm(state->ir, state->output_filename, &cg_options, &cg_stats);
 
   end = clock();
   time_taken = (double)(end - start) / CLOCKS_PER_SEC;
@@ -71,11 +211,128 @@ int main(int argc, char *argv[]) {
 
   scu_psuccess("%.2fs %s\n", time_taken, state->filename);
 
+  // Optimization Remarks
+  if (state->options.rpass || state->options.rpass_missed)
+    remarks_print(&opt.remarks, state->filename, state->options.rpass,
+                  state->options.rpass_missed);
+
+  if (state->options.remarks_json &&
+      !remarks_write_json(&opt.remarks, state->filename,
+                          state->options.remarks_json))
+    scu_perror(&state->error_count, "Failed to write remarks: %s\n",
+               state->options.remarks_json);
+
+  // Optimization Statistics
+  if (state->options.stats) {
+    printf("Register allocation: %zu variables promoted, %zu of %zu vregs in "
+           "registers, %zu spilled\n",
+           opt.promoted, ra_stats.in_registers, ra_stats.intervals,
+           ra_stats.spilled);
+    if (opt.ran[PASS_FUSE])
+      printf("Branch fusion: %zu compares moved into their branch\n",
+             opt.fused);
+    if (opt.ran[PASS_ROTATE])
+      printf("Loop rotation: %zu loops rotated\n", opt.rotated);
+    if (opt.ran[PASS_SCCP])
+      printf("SCCP: %zu constants propagated, %zu instructions folded, %zu "
+             "branches pruned (%zu phis, %zu copies)\n",
+             opt.sccp.constants, opt.sccp.folded, opt.sccp.branches,
+             opt.sccp.phis, opt.sccp.copies);
+    if (opt.ran[PASS_DCE])
+      printf("Dead code: %zu branches folded, %zu blocks, %zu stores and %zu "
+             "instructions removed, %zu -> %zu bytes\n",
+             opt.dce.branches, opt.dce.blocks, opt.dce.stores, opt.dce.instrs,
+             bytes_before_dce, cg_stats.code_bytes);
+    if (opt.ran[PASS_UNROLL])
+      printf("Unrolling: %zu loops fully, %zu partially, %zu instructions "
+             "added\n",
+             opt.unroll.full, opt.unroll.partial, opt.unroll.added);
+    if (opt.ran[PASS_VECTORIZE])
+      printf("Vectorization: %zu loops vectorized, %zu rejected (%u lanes)\n",
+             opt.vectorize.vectorized, opt.vectorize.rejected,
+             opt.vectorize.lanes);
+    for (size_t i = 0; i < opt.vectorize.loops.count; i++) {
+      vectorize_loop_stats *loop = dynamic_array_at(&opt.vectorize.loops, i);
+      if (loop->reason)
+        printf("  loop at line %zu: not vectorized, %s\n", loop->line,
+               loop->reason);
+      else
+        printf("  loop at line %zu: vectorized\n", loop->line);
+    }
+    if (opt.ran[PASS_STRENGTH])
+      printf("Strength reduction: %zu operations\n", opt.reduced);
+    if (opt.ran[PASS_GVN])
+      printf("GVN: %zu values reused, %zu from the same block, %zu from a "
+             "dominating block\n",
+             opt.gvn.local + opt.gvn.global, opt.gvn.local, opt.gvn.global);
+    if (opt.ran[PASS_LICM])
+      printf("LICM: %zu instructions hoisted, %zu preheaders inserted\n",
+             opt.licm.hoisted, opt.licm.preheaders);
+    for (size_t i = 0; i < opt.licm.loops.count; i++) {
+      licm_loop_stats *loop = dynamic_array_at(&opt.licm.loops, i);
+      printf("  loop at line %zu (depth %zu): %zu hoisted\n", loop->line,
+             loop->depth, loop->hoisted);
+    }
+    if (opt.ran[PASS_INDVARS])
+      printf("Induction variables: %zu multiplications replaced by additions, "
+             "%zu counters eliminated\n",
+             opt.indvars.reduced, opt.indvars.eliminated);
+    if (opt.ran[PASS_LAYOUT])
+      printf("Block layout: %zu cold blocks moved to the end, %.1f%% -> "
+             "%.1f%% of the jumps falling through\n",
+             opt.layout.cold, 100 * opt.layout.fall_before,
+             100 * opt.layout.fall_after);
+    if (cg_options.profile_file)
+      printf("Profile: %zu counters, written to %s on exit\n",
+             cg_options.counters, cg_options.profile_file);
+    if (cg_options.profile)
+      printf("Profile: %s, %zu blocks measured, entry ran %" PRIu64
+             " times\n",
+             state->options.profile_use, prof.block_count, prof.runs[0]);
+    printf("Branchless: %zu ifs lowered to cmov / setcc\n",
+           cg_stats.branchless);
+    if (cg_options.peephole) {
+      printf("Peephole: %zu -> %zu instructions\n", cg_stats.peephole.before,
+             cg_stats.peephole.after);
+      for (int p = 0; p < PEEPHOLE_PATTERN_COUNT; p++)
+        printf("  %-12s %zu\n", peephole_pattern_name(p),
+               cg_stats.peephole.hits[p]);
+    }
+    printf("Code size: %zu bytes\n", cg_stats.code_bytes);
+
+    double total = 0;
+    for (size_t i = 0; i < opt.timings.count; i++)
+      total += ((pipeline_timing *)dynamic_array_at(&opt.timings, i))->ms;
+    printf("Passes: %zu run in %.3f ms\n", opt.timings.count, total);
+    for (size_t i = 0; i < opt.timings.count; i++) {
+      pipeline_timing *t = dynamic_array_at(&opt.timings, i);
+      printf("  %-10s %8.3f ms  %zu -> %zu instructions, %zu -> %zu blocks\n",
+             pipeline_pass_name(t->pass), t->ms, t->instrs_before,
+             t->instrs_after, t->blocks_before, t->blocks_after);
+    }
+  }
+
+  // Cost Model
+  if (state->options.analyze_cost) {
+    dynamic_array code;
+    codegen_build(state->ir, &code, &cg_options, NULL);
+    cost_report report;
+    cost_analyze(state->ir, &code, cost_find_arch(state->options.analyze_cost),
+                 &report);
+    cost_print(&report);
+    cost_report_free(&report);
+    asm_free(&code);
+  }
+
   // Codegen & Assembler Debug Statements
   if (state->options.verbose)
     scu_pdebug("Codegen & Assembling Complete\n");
 
   // Free memory
+  free(default_profile);
+  profile_free(&prof);
+  pipeline_stats_free(&opt);
+  pipeline_free(&passes);
   fflush(stdout);
   fclose(stdout);
   cstate_free(state);
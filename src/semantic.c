@@ -1,6 +1,5 @@
 #include "semantic.h"
 #include "ast.h"
-#include "codegen.h"
 #include "ds/dynamic_array.h"
 #include "ds/ht.h"
 #include "utils.h"
@@ -11,19 +10,69 @@
 #include <string.h>
 
 /*
- * @brief: check for types in an instr_node (declaration)
+ * @brief: check an instr_node (declaration)
  *
  * @param instr: pointer to an instr_node.
  * @param variables: pointer to the variables hash table.
+ * @param labels: pointer to the dynamic_array of declared label names.
+ * @param gotos: pointer to the dynamic_array of goto instructions to resolve.
  * @param errors: counter variable to increment when an error is encountered.
  */
-static void instr_typecheck(instr_node *instr, ht *variables,
-                            unsigned int *errors);
+static void instr_check(instr_node *instr, ht *variables, dynamic_array *labels,
+                        dynamic_array *gotos, unsigned int *errors);
 
 /*
- * @brief: running stack offset counter for allocating variables and arrays.
+ * @brief: evaluate a constant expression to extract integer value
+ *
+ * @param expr: pointer to an expr_node
+ * @param errors: counter variable to increment when an error is encountered.
+ *
+ * @return: the integer value of the constant expression
  */
-static size_t current_stack_offset = 0;
+static int evaluate_const_expr(expr_node *expr, unsigned int *errors) {
+  if (expr == NULL) {
+    return 0;
+  }
+
+  switch (expr->kind) {
+  case EXPR_TERM:
+    if (expr->term.kind == TERM_INT) {
+      return expr->term.value.integer;
+    }
+    scu_perror(errors, "Array size must be a constant expression\n");
+    return 0;
+
+  case EXPR_ADD:
+    return evaluate_const_expr(expr->binary.left, errors) +
+           evaluate_const_expr(expr->binary.right, errors);
+
+  case EXPR_SUBTRACT:
+    return evaluate_const_expr(expr->binary.left, errors) -
+           evaluate_const_expr(expr->binary.right, errors);
+
+  case EXPR_MULTIPLY:
+    return evaluate_const_expr(expr->binary.left, errors) *
+           evaluate_const_expr(expr->binary.right, errors);
+
+  case EXPR_DIVIDE: {
+    int right = evaluate_const_expr(expr->binary.right, errors);
+    if (right == 0) {
+      scu_perror(errors, "Division by zero in array size\n");
+      return 0;
+    }
+    return evaluate_const_expr(expr->binary.left, errors) / right;
+  }
+
+  case EXPR_MODULO: {
+    int right = evaluate_const_expr(expr->binary.right, errors);
+    if (right == 0) {
+      scu_perror(errors, "Division by zero in array size\n");
+      return 0;
+    }
+    return evaluate_const_expr(expr->binary.left, errors) % right;
+  }
+  }
+}
 
 /*
  * @brief: insert a new variable into the variables hash table.
@@ -36,12 +85,15 @@ static void declare_variables(variable *var_to_declare, ht *variables) {
     return;
 
   variable *var = ht_search(variables, var_to_declare->name);
-  if (var)
+  if (var) {
+    var_to_declare->symbol = var;
     return;
+  }
 
-  var_to_declare->stack_offset = current_stack_offset;
-  current_stack_offset += 1;
+  var_to_declare->size = 8;
+  var_to_declare->align = 8;
   ht_insert(variables, var_to_declare->name, var_to_declare);
+  var_to_declare->symbol = ht_search(variables, var_to_declare->name);
 }
 
 /*
@@ -57,158 +109,159 @@ static void declare_array(variable *arr_to_declare, expr_node *size_expr,
     return;
 
   variable *var = ht_search(variables, arr_to_declare->name);
-  if (var)
+  if (var) {
+    arr_to_declare->symbol = var;
     return;
+  }
 
   int array_size = evaluate_const_expr(size_expr, errors);
-  size_t size_bytes = array_size * 4;
-  arr_to_declare->stack_offset = current_stack_offset;
-  current_stack_offset += size_bytes;
+  if (array_size < 0) {
+    scu_perror(errors, "Array size must not be negative: %s [line %u]\n",
+               arr_to_declare->name, arr_to_declare->line);
+    array_size = 0;
+  }
+
+  arr_to_declare->is_array = true;
+  arr_to_declare->dimensions = 1;
+  arr_to_declare->size = (size_t)array_size * 4;
+  arr_to_declare->align = 16;
 
   ht_insert(variables, arr_to_declare->name, arr_to_declare);
+  arr_to_declare->symbol = ht_search(variables, arr_to_declare->name);
+}
+
+/*
+ * @brief: convert a type enumeration to its string representation.
+ */
+static const char *type_to_str(type type) {
+  switch (type) {
+  case TYPE_INT:
+    return "int";
+  case TYPE_CHAR:
+    return "char";
+  case TYPE_POINTER:
+    return "ptr";
+  case TYPE_VOID:
+    return "void";
+  }
+  return "unknown";
 }
 
 /*
- * @brief: check variables in terms
+ * @brief: resolve and type an expr_node (declaration)
+ *
+ * @param expr: pointer to an expr_node.
+ * @param variables: pointer to the variables hash table.
+ * @param errors: counter variable to increment when an error is encountered.
+ *
+ * @return: the type of the expression, also cached in expr->type.
+ */
+static type expr_check(expr_node *expr, ht *variables, unsigned int *errors);
+
+/*
+ * @brief: resolve the variables in a term_node and compute its type.
  *
  * @param term: pointer to a term_node.
  * @param variables: pointer to the variables hash table.
  * @param errors: counter variable to increment when an error is encountered.
+ *
+ * @return: the type of the term, also cached in term->type.
  */
-static void term_check_variables(term_node *term, ht *variables,
-                                 unsigned int *errors) {
+static type term_check(term_node *term, ht *variables, unsigned int *errors) {
+  variable *var;
+
   switch (term->kind) {
+  case TERM_INT:
+    term->type = TYPE_INT;
+    break;
+
+  case TERM_CHAR:
+    term->type = TYPE_CHAR;
+    break;
+
+  case TERM_POINTER:
+  case TERM_DEREF:
+  case TERM_ADDOF:
   case TERM_IDENTIFIER:
-    variable *var = ht_search(variables, term->identifier.name);
-    if (!var) {
-      scu_perror(errors, "Use of undeclared variable: %s [line %u]\n",
-                 term->identifier.name, term->identifier.line);
+    var = resolve_variable(variables, &term->identifier, errors);
+    term->type = var ? var->type : (type)-1;
+    break;
+
+  case TERM_ARRAY_ACCESS: {
+    var = resolve_variable(variables, &term->array_access.array_var, errors);
+    type index_type =
+        expr_check(term->array_access.index_expr, variables, errors);
+    if (index_type != TYPE_INT) {
+      scu_perror(errors,
+                 "Array index must be of type int, got type at [line %zu]\n",
+                 term->line);
     }
+    term->type = var ? var->type : (type)-1;
     break;
-  default:
+  }
+
+  case TERM_ARRAY_LITERAL:
+    scu_perror(errors,
+               "Array literal cannot be used in expressions [line %zu]\n",
+               term->line);
+    term->type = -1;
     break;
   }
+
+  return term->type;
 }
 
 /*
- * @brief: check variables in expressions
+ * @brief: resolve and type an expr_node (definition)
  *
  * @param expr: pointer to an expr_node.
  * @param variables: pointer to the variables hash table.
  * @param errors: counter variable to increment when an error is encountered.
+ *
+ * @return: the type of the expression, also cached in expr->type.
  */
-static void expr_check_variables(expr_node *expr, ht *variables,
-                                 unsigned int *errors) {
+static type expr_check(expr_node *expr, ht *variables, unsigned int *errors) {
+  type lhs, rhs;
+
   switch (expr->kind) {
   case EXPR_TERM:
-    term_check_variables(&expr->term, variables, errors);
-    break;
+    expr->type = term_check(&expr->term, variables, errors);
+    return expr->type;
   case EXPR_ADD:
   case EXPR_SUBTRACT:
   case EXPR_MULTIPLY:
   case EXPR_DIVIDE:
   case EXPR_MODULO:
-    expr_check_variables(expr->binary.left, variables, errors);
-    expr_check_variables(expr->binary.right, variables, errors);
+    lhs = expr_check(expr->binary.left, variables, errors);
+    rhs = expr_check(expr->binary.right, variables, errors);
     break;
   }
-}
 
-/*
- * @brief: check variables in relational expressions
- *
- * @param rel: pointer to a rel_node.
- * @param variables: pointer to the variables hash table.
- * @param errors: counter variable to increment when an error is encountered.
- */
-static void rel_check_variables(rel_node *rel, ht *variables,
-                                unsigned int *errors) {
-  term_check_variables(&rel->comparison.lhs, variables, errors);
-  term_check_variables(&rel->comparison.rhs, variables, errors);
+  if (lhs != rhs) {
+    scu_perror(errors,
+               "Type mismatch in arithmetic expression: %s vs %s [line %u]\n",
+               type_to_str(lhs), type_to_str(rhs), expr->line);
+  }
+
+  expr->type = lhs;
+  return lhs;
 }
 
 /*
- * @brief: check variables in an individual instruction
+ * @brief: resolve and type check a rel_node.
  *
- * @param instr: pointer to an instr_node.
+ * @param rel: pointer to a rel_node.
  * @param variables: pointer to the variables hash table.
  * @param errors: counter variable to increment when an error is encountered.
  */
-static void instr_check_variables(instr_node *instr, ht *variables,
-                                  unsigned int *errors) {
-  switch (instr->kind) {
-  case INSTR_DECLARE:
-    declare_variables(&instr->declare_variable, variables);
-    break;
-
-  case INSTR_INITIALIZE:
-    expr_check_variables(&instr->initialize_variable.expr, variables, errors);
-    declare_variables(&instr->initialize_variable.var, variables);
-    break;
+static void rel_check(rel_node *rel, ht *variables, unsigned int *errors) {
+  type lhs = term_check(&rel->comparison.lhs, variables, errors);
+  type rhs = term_check(&rel->comparison.rhs, variables, errors);
 
-  case INSTR_DECLARE_ARRAY:
-    declare_array(&instr->declare_array.var, instr->declare_array.size_expr,
-                  variables, errors);
-    break;
-
-  case INSTR_INITIALIZE_ARRAY:
-    declare_array(&instr->initialize_array.var,
-                  instr->initialize_array.size_expr, variables, errors);
-    for (size_t i = 0; i < instr->initialize_array.literal.elements.count;
-         i++) {
-      expr_node elem;
-      dynamic_array_get(&instr->initialize_array.literal.elements, i, &elem);
-      expr_check_variables(&elem, variables, errors);
-    }
-    break;
-
-  case INSTR_ASSIGN_TO_ARRAY_SUBSCRIPT:
-    variable *arr =
-        ht_search(variables, instr->assign_to_array_subscript.var.name);
-    if (!arr) {
-      scu_perror(errors, "Use of undeclared array: %s [line %u]\n",
-                 instr->assign_to_array_subscript.var.name,
-                 instr->assign_to_array_subscript.var.line);
-    }
-    expr_check_variables(instr->assign_to_array_subscript.index_expr, variables,
-                         errors);
-    expr_check_variables(&instr->assign_to_array_subscript.expr_to_assign,
-                         variables, errors);
-    break;
-
-  case INSTR_ASSIGN:
-    expr_check_variables(&instr->assign.expr, variables, errors);
-    break;
-
-  case INSTR_IF:
-    rel_check_variables(&instr->if_.rel, variables, errors);
-    instr_check_variables(instr->if_.instr, variables, errors);
-    break;
-
-  case INSTR_FASM:
-    if (instr->fasm.kind == FASM_PAR) {
-      variable *var = ht_search(variables, instr->fasm.argument.name);
-      if (!var) {
-        scu_perror(errors, "Use of undeclared variable: %s [line %u]\n",
-                   instr->fasm.argument.name, instr->fasm.argument.line);
-      }
-    }
-    break;
-
-  case INSTR_LOOP:
-    if (instr->loop.kind == LOOP_WHILE) {
-      rel_check_variables(&instr->loop.break_condition, variables, errors);
-    }
-    for (size_t i = 0; i < instr->loop.instrs.count; i++) {
-      instr_node instr_;
-      dynamic_array_get(&instr->loop.instrs, i, &instr_);
-      instr_check_variables(&instr_, variables, errors);
-      instr_typecheck(&instr_, variables, errors);
-    }
-    break;
-
-  default:
-    break;
+  if (lhs != rhs) {
+    scu_perror(errors,
+               "Type mismatch in conditional statement: %s vs %s [line %u]\n",
+               type_to_str(lhs), type_to_str(rhs), rel->line);
   }
 }
 
@@ -259,284 +312,152 @@ static void check_goto(dynamic_array *labels, instr_node *instr,
 }
 
 /*
- * @brief: check for declaration of labels AND the use of labels in goto
- * instructions
+ * @brief: check every instruction of a block, in place.
  *
- * @param instr: pointer to an instr_node.
- * @param labels: pointer to the labels dynamic_array.
- * @param errors: counter variable to increment when an error is encountered.
- */
-static void instrs_check_labels(dynamic_array *instrs, dynamic_array *labels,
-                                unsigned int *errors) {
-  // check labels first
-  for (unsigned int i = 0; i < instrs->count; i++) {
-    instr_node instr;
-    dynamic_array_get(instrs, i, &instr);
-
-    if (instr.kind == INSTR_LABEL) {
-      check_label(labels, &instr, errors);
-    }
-  }
-
-  // then check goto
-  for (unsigned int i = 0; i < instrs->count; i++) {
-    instr_node instr;
-    dynamic_array_get(instrs, i, &instr);
-
-    if (instr.kind == INSTR_GOTO) {
-      check_goto(labels, &instr, errors);
-    }
-  }
-
-  // then check if
-  for (unsigned int i = 0; i < instrs->count; i++) {
-    instr_node instr;
-    dynamic_array_get(instrs, i, &instr);
-
-    if (instr.kind == INSTR_IF) {
-      switch (instr.if_.instr->kind) {
-      case INSTR_GOTO:
-        check_goto(labels, instr.if_.instr, errors);
-        break;
-      case INSTR_LABEL:
-        check_label(labels, instr.if_.instr, errors);
-        break;
-      default:
-        break;
-      }
-    }
-  }
-}
-
-/*
- * @brief: check for types in an expr_node (declaration)
- *
- * @param expr: pointer to an expr_node.
- * @param target_type: type enumeration for the type which is required in the
- * instruction.
- * @param variables: pointer to the variables hash table.
- * @param errors: counter variable to increment when an error is encountered.
- */
-static type expr_type(expr_node *expr, type target_type, ht *variables,
-                      unsigned int *errors);
-
-/*
- * @brief: check for types in a term_node
- *
- * @param term: pointer to a term_node.
- * @param target_type: type enumeration for the type which is required in the
- * instruction.
- * @param variables: pointer to the variables hash table.
- * @param errors: counter variable to increment when an error is encountered.
- * @param line: where the term is situated in the source buffer.
- */
-static type term_type(term_node *term, ht *variables, unsigned int *errors) {
-  switch (term->kind) {
-  case TERM_INT:
-    return TYPE_INT;
-
-  case TERM_CHAR:
-    return TYPE_CHAR;
-
-  case TERM_POINTER:
-  case TERM_DEREF:
-  case TERM_ADDOF:
-  case TERM_IDENTIFIER:
-    return get_var_type(variables, &term->identifier, errors);
-
-  case TERM_ARRAY_ACCESS:
-    type array_type =
-        get_var_type(variables, &term->array_access.array_var, errors);
-    if (array_type == TYPE_VOID) {
-      scu_perror(errors, "Array '%s' not declared [line %zu]\n",
-                 term->array_access.array_var.name, term->line);
-      return TYPE_VOID;
-    }
-    type index_type =
-        expr_type(term->array_access.index_expr, TYPE_INT, variables, errors);
-    if (index_type != TYPE_INT) {
-      scu_perror(errors,
-                 "Array index must be of type int, got type at [line %zu]\n",
-                 term->line);
-    }
-    return array_type;
-
-  case TERM_ARRAY_LITERAL:
-    scu_perror(errors,
-               "Array literal cannot be used in expressions [line %zu]\n",
-               term->line);
-    return -1;
-    break;
-  }
-}
-
-/*
- * @brief: convert a type enumeration to its string representation.
- */
-static const char *type_to_str(type type) {
-  switch (type) {
-  case TYPE_INT:
-    return "int";
-  case TYPE_CHAR:
-    return "char";
-  case TYPE_POINTER:
-    return "ptr";
-  case TYPE_VOID:
-    return "void";
-  }
-}
-
-/*
- * @brief: check for types in an expr_node (definition)
- *
- * @param expr: pointer to an expr_node.
- * @param target_type: type enumeration for the type which is required in the
- * instruction.
- * @param variables: pointer to the variables hash table.
- * @param errors: counter variable to increment when an error is encountered.
- */
-static type expr_type(expr_node *expr, type target_type, ht *variables,
-                      unsigned int *errors) {
-  type lhs, rhs;
-
-  switch (expr->kind) {
-  case EXPR_TERM:
-    return term_type(&expr->term, variables, errors);
-  case EXPR_ADD:
-  case EXPR_SUBTRACT:
-  case EXPR_MULTIPLY:
-  case EXPR_DIVIDE:
-  case EXPR_MODULO:
-    lhs = expr_type(expr->binary.left, target_type, variables, errors);
-    rhs = expr_type(expr->binary.right, target_type, variables, errors);
-    break;
-  }
-
-  if (lhs != rhs) {
-    const char *lhs_type_str = type_to_str(lhs);
-    const char *rhs_type_str = type_to_str(rhs);
-    scu_perror(errors,
-               "Type mismatch in arithmetic expression: %s vs %s [line %u]\n",
-               lhs_type_str, rhs_type_str, expr->line);
-  }
-  return lhs;
-}
-
-/*
- * @brief: check for types in a rel_node
- *
- * @param rel: pointer to a rel_node.
+ * @param instrs: pointer to the dynamic_array of instructions.
  * @param variables: pointer to the variables hash table.
+ * @param labels: pointer to the dynamic_array of declared label names.
+ * @param gotos: pointer to the dynamic_array of goto instructions to resolve.
  * @param errors: counter variable to increment when an error is encountered.
  */
-static void rel_typecheck(rel_node *rel, ht *variables, unsigned int *errors) {
-  type lhs, rhs;
-
-  lhs = term_type(&rel->comparison.lhs, variables, errors);
-  rhs = term_type(&rel->comparison.rhs, variables, errors);
-
-  if (lhs != rhs) {
-    const char *lhs_type_str = type_to_str(lhs);
-    const char *rhs_type_str = type_to_str(rhs);
-    scu_perror(errors,
-               "Type mismatch in conditional statement: %s vs %s [line %u]\n",
-               lhs_type_str, rhs_type_str, rel->line);
+static void instrs_check(dynamic_array *instrs, ht *variables,
+                         dynamic_array *labels, dynamic_array *gotos,
+                         unsigned int *errors) {
+  for (size_t i = 0; i < instrs->count; i++) {
+    instr_check(dynamic_array_at(instrs, i), variables, labels, gotos, errors);
   }
 }
 
 /*
- * @brief: check for types in an instr_node
+ * @brief: check an instr_node (definition). Declares, resolves and type checks
+ * in one go, caching the results on the nodes themselves.
  *
  * @param instr: pointer to an instr_node.
  * @param variables: pointer to the variables hash table.
+ * @param labels: pointer to the dynamic_array of declared label names.
+ * @param gotos: pointer to the dynamic_array of goto instructions to resolve.
  * @param errors: counter variable to increment when an error is encountered.
  */
-static void instr_typecheck(instr_node *instr, ht *variables,
-                            unsigned int *errors) {
+static void instr_check(instr_node *instr, ht *variables, dynamic_array *labels,
+                        dynamic_array *gotos, unsigned int *errors) {
   switch (instr->kind) {
+  case INSTR_DECLARE:
+    declare_variables(&instr->declare_variable, variables);
+    break;
+
   case INSTR_INITIALIZE: {
     type target_type = instr->initialize_variable.var.type;
-    type expr_result = expr_type(&instr->initialize_variable.expr, target_type,
-                                 variables, errors);
-    if (target_type == TYPE_POINTER) {
-      return;
-    } else if (target_type != expr_result) {
-      const char *target_type_str = type_to_str(target_type);
-      const char *expr_result_str = type_to_str(expr_result);
+    type expr_result =
+        expr_check(&instr->initialize_variable.expr, variables, errors);
+    declare_variables(&instr->initialize_variable.var, variables);
+    if (target_type != TYPE_POINTER && target_type != expr_result) {
       scu_perror(errors,
                  "Type mismatch in initialization to %s - %s to %s [line %u]\n",
-                 instr->assign.identifier.name, expr_result_str,
-                 target_type_str, instr->line);
+                 instr->initialize_variable.var.name, type_to_str(expr_result),
+                 type_to_str(target_type), instr->line);
     }
     break;
   }
 
+  case INSTR_DECLARE_ARRAY:
+    declare_array(&instr->declare_array.var, instr->declare_array.size_expr,
+                  variables, errors);
+    break;
+
   case INSTR_INITIALIZE_ARRAY: {
+    declare_array(&instr->initialize_array.var,
+                  instr->initialize_array.size_expr, variables, errors);
     type array_type = instr->initialize_array.var.type;
     for (size_t i = 0; i < instr->initialize_array.literal.elements.count;
          i++) {
-      expr_node elem;
-      dynamic_array_get(&instr->initialize_array.literal.elements, i, &elem);
-      type elem_type = expr_type(&elem, array_type, variables, errors);
+      expr_node *elem =
+          dynamic_array_at(&instr->initialize_array.literal.elements, i);
+      type elem_type = expr_check(elem, variables, errors);
       if (array_type != elem_type && array_type != TYPE_POINTER) {
-        const char *array_type_str = type_to_str(array_type);
-        const char *elem_type_str = type_to_str(elem_type);
         scu_perror(errors,
                    "Type mismatch in array initialization - element %zu is %s "
                    "but array is %s [line %u]\n",
-                   i, elem_type_str, array_type_str, instr->line);
+                   i, type_to_str(elem_type), type_to_str(array_type),
+                   instr->line);
       }
     }
     break;
   }
 
-  case INSTR_ASSIGN: {
-    type target_type =
-        get_var_type(variables, &instr->assign.identifier, errors);
-    type expr_result =
-        expr_type(&instr->assign.expr, target_type, variables, errors);
-    if (target_type == TYPE_POINTER) {
-      return;
-    } else if (target_type != expr_result) {
-      const char *target_type_str = type_to_str(target_type);
-      const char *expr_result_str = type_to_str(expr_result);
-      scu_perror(errors,
-                 "Type mismatch in assignment to %s - %s to %s [line %u]\n",
-                 instr->assign.identifier.name, expr_result_str,
-                 target_type_str, instr->line);
-    }
-    break;
-  }
-
   case INSTR_ASSIGN_TO_ARRAY_SUBSCRIPT: {
-    type array_type =
-        get_var_type(variables, &instr->assign_to_array_subscript.var, errors);
+    assign_to_array_subscript_node *node = &instr->assign_to_array_subscript;
+    variable *arr = ht_search(variables, node->var.name);
+    if (!arr) {
+      scu_perror(errors, "Use of undeclared array: %s [line %u]\n",
+                 node->var.name, node->var.line);
+    }
+    node->var.symbol = arr;
 
-    type index_type = expr_type(instr->assign_to_array_subscript.index_expr,
-                                TYPE_INT, variables, errors);
+    type index_type = expr_check(node->index_expr, variables, errors);
     if (index_type != TYPE_INT) {
       scu_perror(errors, "Array index must be of type int, got %s [line %u]\n",
                  type_to_str(index_type), instr->line);
     }
 
-    type expr_result =
-        expr_type(&instr->assign_to_array_subscript.expr_to_assign, array_type,
-                  variables, errors);
-    if (array_type != expr_result && array_type != TYPE_POINTER) {
-      const char *array_type_str = type_to_str(array_type);
-      const char *expr_result_str = type_to_str(expr_result);
+    type array_type = arr ? arr->type : (type)-1;
+    type expr_result = expr_check(&node->expr_to_assign, variables, errors);
+    if (arr && array_type != expr_result && array_type != TYPE_POINTER) {
       scu_perror(
           errors,
           "Type mismatch in array assignment to %s - %s to %s [line %u]\n",
-          instr->assign_to_array_subscript.var.name, expr_result_str,
-          array_type_str, instr->line);
+          node->var.name, type_to_str(expr_result), type_to_str(array_type),
+          instr->line);
+    }
+    break;
+  }
+
+  case INSTR_ASSIGN: {
+    variable *var =
+        resolve_variable(variables, &instr->assign.identifier, errors);
+    type target_type = var ? var->type : (type)-1;
+    type expr_result = expr_check(&instr->assign.expr, variables, errors);
+    if (var && target_type != TYPE_POINTER && target_type != expr_result) {
+      scu_perror(errors,
+                 "Type mismatch in assignment to %s - %s to %s [line %u]\n",
+                 instr->assign.identifier.name, type_to_str(expr_result),
+                 type_to_str(target_type), instr->line);
     }
     break;
   }
 
   case INSTR_IF:
-    rel_typecheck(&instr->if_.rel, variables, errors);
+    rel_check(&instr->if_.rel, variables, errors);
+    switch (instr->if_.kind) {
+    case IF_SINGLE_INSTR:
+      instr_check(instr->if_.instr, variables, labels, gotos, errors);
+      break;
+    case IF_MULTI_INSTR:
+      instrs_check(&instr->if_.instrs, variables, labels, gotos, errors);
+      break;
+    }
+    break;
+
+  case INSTR_GOTO:
+    dynamic_array_append(gotos, &instr);
     break;
+
+  case INSTR_LABEL:
+    check_label(labels, instr, errors);
+    break;
+
+  case INSTR_FASM:
+    if (instr->fasm.kind == FASM_PAR) {
+      resolve_variable(variables, &instr->fasm.argument, errors);
+    }
+    break;
+
+  case INSTR_LOOP:
+    if (instr->loop.kind != LOOP_UNCONDITIONAL) {
+      rel_check(&instr->loop.break_condition, variables, errors);
+    }
+    instrs_check(&instr->loop.instrs, variables, labels, gotos, errors);
+    break;
+
   default:
     break;
   }
@@ -544,19 +465,23 @@ static void instr_typecheck(instr_node *instr, ht *variables,
 
 void check_semantics(dynamic_array *instrs, ht *variables,
                      unsigned int *errors) {
-  // Semantic Analysis - Check variables and their types
-  for (unsigned int i = 0; i < instrs->count; i++) {
-    instr_node instr;
-    dynamic_array_get(instrs, i, &instr);
-    instr_check_variables(&instr, variables, errors);
-    instr_typecheck(&instr, variables, errors);
-  }
-
-  // Semantic Analysis - Check labels
   dynamic_array labels;
   dynamic_array_init(&labels, sizeof(char *));
-  instrs_check_labels(instrs, &labels, errors);
+  dynamic_array gotos;
+  dynamic_array_init(&gotos, sizeof(instr_node *));
+
+  // Semantic Analysis - Declare, resolve and type check in a single pass
+  instrs_check(instrs, variables, &labels, &gotos, errors);
+
+  // Semantic Analysis - Gotos may jump forward, so resolve them last
+  for (size_t i = 0; i < gotos.count; i++) {
+    instr_node *instr;
+    dynamic_array_get(&gotos, i, &instr);
+    check_goto(&labels, instr, errors);
+  }
+
   dynamic_array_free(&labels);
+  dynamic_array_free(&gotos);
 
   scu_check_errors(errors);
 }
@@ -0,0 +1,44 @@
+#include "x86.h"
+
+static const char *names64[X86_REG_COUNT] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+static const char *names32[X86_REG_COUNT] = {
+    "eax", "ecx", "edx",  "ebx",  "esp",  "ebp",  "esi",  "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+};
+
+static const char *names8[X86_REG_COUNT] = {
+    "al",  "cl",  "dl",   "bl",   "spl",  "bpl",  "sil",  "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+};
+
+static const char *names_xmm[X86_VEC_COUNT] = {
+    "xmm0", "xmm1", "xmm2",  "xmm3",  "xmm4",  "xmm5",  "xmm6",  "xmm7",
+    "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
+};
+
+static const char *names_ymm[X86_VEC_COUNT] = {
+    "ymm0", "ymm1", "ymm2",  "ymm3",  "ymm4",  "ymm5",  "ymm6",  "ymm7",
+    "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15",
+};
+
+const char *x86_reg64(x86_reg reg) { return names64[reg]; }
+
+const char *x86_reg32(x86_reg reg) { return names32[reg]; }
+
+const char *x86_reg8(x86_reg reg) { return names8[reg]; }
+
+const char *x86_vec(unsigned int reg, unsigned int lanes) {
+  return lanes == 8 ? names_ymm[reg] : names_xmm[reg];
+}
+
+bool x86_is_callee_saved(x86_reg reg) {
+  return reg == RBX || reg == RBP || (reg >= R12 && reg <= R15);
+}
+
+bool x86_survives_fasm(x86_reg reg) {
+  return reg == RSP || reg == RBP || (reg >= R12 && reg <= R15);
+}
@@ -0,0 +1,98 @@
+#!/bin/sh
+#
+# gen_fold: print an scl program that checks the rewrites of the AST
+# folding pass (opt/fold.c). Every folded expression is compared with the
+# same expression on variables pinned to memory by a fasm statement, which
+# the pass leaves alone, for every x in [-range, range]:
+# - constant int and char subtrees, and char sums that do not fit a char.
+# - x + 0, 0 + x, x - 0, x * 1, 1 * x and x / 1.
+# - x * 0, 0 * x and x - x.
+# - constants of + and * moved to the right, and the chains that collapse
+#   after that.
+#
+# The program prints the number of mismatches (expected 0) and a checksum.
+# Built with --passes=promote --emit-ir, its IR should show none of the
+# folded operations (see the test target of the Makefile).
+#
+# Usage: gen_fold.sh [range] > fold.scl
+#
+
+RANGE=${1:-1000}
+
+echo '-include "io.scl"'
+echo
+
+# pinned copies of the constants
+for c in 0 1 2 3 4 5 6 7 9 42 100; do
+  echo "int k$c = $c"
+  echo "fasm \"cmp qword [rbp - %d], 0\", k$c"
+done
+for c in A a b z space; do
+  case $c in
+  space) echo "char c$c = ' '" ;;
+  *) echo "char c$c = '$c'" ;;
+  esac
+  echo "fasm \"cmp qword [rbp - %d], 0\", c$c"
+done
+
+echo "int bad = 0"
+echo "int sum = 0"
+
+# constant subtrees: type | folded | reference
+n=0
+while IFS='|' read -r t folded ref; do
+  echo "$t f$n = $folded"
+  echo "$t g$n = $ref"
+  echo "if f$n != g$n {"
+  echo "  bad = bad + 1"
+  echo "}"
+  n=$((n + 1))
+done <<'EOF'
+int|6 * 7 + 100 / 7 - 9 % 4|k6 * k7 + k100 / k7 - k9 % k4
+char|'A' + ' '|cA + cspace
+char|'z' - 'a'|cz - ca
+char|'a' + 'b'|ca + cb
+EOF
+
+echo "int x = 0 - $RANGE"
+echo "while x <= $RANGE {"
+echo "  int y = x * 3 + 1"
+
+# x is a variable: folded | reference
+while IFS='|' read -r folded ref; do
+  echo "  int f = $folded"
+  echo "  int g = $ref"
+  echo "  if f != g {"
+  echo "    bad = bad + 1"
+  echo "  }"
+  echo "  sum = sum + f"
+done <<'EOF'
+x + 0|x + k0
+0 + x|k0 + x
+x - 0|x - k0
+x * 1|x * k1
+1 * x|k1 * x
+x / 1|x / k1
+(x + y) * 1 + 0|(x + y) * k1 + k0
+x * 0|x * k0
+0 * x|k0 * x
+x - x|k0
+(x + y) - (x + y)|k0
+y - y + x * 0 + 5|k5
+2 * x|k2 * x
+42 + x|k42 + x
+(x + 1) + 2|(x + k1) + k2
+3 + x + 4|k3 + x + k4
+(x * 2) * 3|(x * k2) * k3
+2 * (x * 5)|k2 * (x * k5)
+1 + (2 + x) + 3|k1 + (k2 + x) + k3
+(6 * 7) * x + y * (1 + 1)|(k6 * k7) * x + y * (k1 + k1)
+x / (2 + 1)|x / k3
+x % (3 + 4)|x % k7
+EOF
+
+echo "  x = x + 1"
+echo "}"
+echo
+echo 'fasm "output_int %d", bad'
+echo 'fasm "output_int %d", sum'
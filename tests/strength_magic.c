@@ -0,0 +1,186 @@
+/*
+ * strength_magic: check strength_signed_magic against C division. Every
+ * magic number is run through a model of the sequence strength_reduce
+ * emits (mulhi on __int128, the add or sub of x, sar and the sign fix-up)
+ * and compared with x / d and x % d for dividends around the edges of the
+ * range, around the multiples of d and at random.
+ *
+ * By default every divisor in [-2^17, 2^17], the divisors next to powers
+ * of two, the ends of the 32 and 64 bit ranges and 2M random 32 and 64 bit
+ * divisors are checked. With --full every 32 bit divisor and 100M random
+ * 64 bit divisors are, which takes a while.
+ *
+ * Usage: strength_magic [--full]
+ */
+
+#include "opt/strength.h"
+#include "utils.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// mismatches printed before giving up
+#define MAX_REPORTS 16
+
+// random dividends per divisor, next to the fixed edge dividends
+#define RANDOM_DIVIDENDS 4
+
+/*
+ * @struct magic_check: counts of a run.
+ */
+typedef struct magic_check {
+  unsigned int errors; // <-- mismatches, and divisors with a wrong verdict
+  uint64_t divisors;   // <-- divisors given a magic number
+  uint64_t checks;     // <-- quotients and remainders compared
+  uint64_t seed;       // <-- state of the random number generator
+} magic_check;
+
+/*
+ * @brief: next value of a xorshift64* generator, the same sequence on every
+ * run.
+ */
+static uint64_t next_random(magic_check *c) {
+  c->seed ^= c->seed >> 12;
+  c->seed ^= c->seed << 25;
+  c->seed ^= c->seed >> 27;
+  return c->seed * 0x2545f4914f6cdd1dull;
+}
+
+/*
+ * @brief: x / d the way strength_reduce computes it, with wrapping 64 bit
+ * arithmetic like the emitted code.
+ */
+static long model_quotient(long x, long d, long m, unsigned int s) {
+  long q = (long)(((__int128)x * m) >> 64);
+  if (d > 0 && m < 0)
+    q = (long)((uint64_t)q + (uint64_t)x);
+  else if (d < 0 && m > 0)
+    q = (long)((uint64_t)q - (uint64_t)x);
+  q >>= s;
+  return (long)((uint64_t)q + ((uint64_t)q >> 63));
+}
+
+/*
+ * @brief: compare the model with C for one dividend.
+ */
+static void check_dividend(magic_check *c, long x, long d, long m,
+                           unsigned int s) {
+  long q = model_quotient(x, d, m, s);
+  long r = (long)((uint64_t)x - (uint64_t)q * (uint64_t)d);
+  c->checks++;
+
+  if (q == x / d && r == x % d)
+    return;
+  if (c->errors < MAX_REPORTS)
+    scu_perror(&c->errors,
+               "%ld / %ld: got %ld rem %ld, expected %ld rem %ld (magic %ld, "
+               "shift %u)\n",
+               x, d, q, r, x / d, x % d, m, s);
+  else
+    c->errors++;
+}
+
+/*
+ * @brief: check whether strength_signed_magic should take a divisor:
+ * |d| >= 3 and not a power of two.
+ */
+static bool takes_divisor(long d) {
+  if (d == LONG_MIN || (d >= -2 && d <= 2))
+    return false;
+  uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+  return (ad & (ad - 1)) != 0;
+}
+
+/*
+ * @brief: check the magic number of one divisor.
+ */
+static void check_divisor(magic_check *c, long d) {
+  long m;
+  unsigned int s;
+  bool took = strength_signed_magic(d, &m, &s);
+  if (took != takes_divisor(d)) {
+    scu_perror(&c->errors, "%ld: strength_signed_magic returned %s\n", d,
+               took ? "true" : "false");
+    return;
+  }
+  if (!took)
+    return;
+  c->divisors++;
+
+  // d + 1 and -d + 1 wrap at the ends of the range
+  uint64_t ud = (uint64_t)d;
+  long top = LONG_MAX / d * d; // <-- multiples of d closest to the ends
+  long bottom = LONG_MIN / d * d;
+  long edges[] = {
+      0,        1,            -1,       2,            -2,
+      (long)(ud - 1),         d,        (long)(ud + 1),
+      (long)(1 - ud),         -d,       (long)(-ud - 1),
+      LONG_MAX, LONG_MAX - 1, LONG_MIN, LONG_MIN + 1,
+      top,      top - 1,      bottom,   bottom + 1,
+      INT32_MAX, INT32_MIN,
+  };
+  for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+    check_dividend(c, edges[i], d, m, s);
+
+  for (int i = 0; i < RANDOM_DIVIDENDS; i++)
+    check_dividend(c, (long)next_random(c), d, m, s);
+}
+
+/*
+ * @brief: check every divisor in [from, to].
+ */
+static void check_range(magic_check *c, long from, long to) {
+  for (long d = from;; d++) {
+    check_divisor(c, d);
+    if (d == to)
+      break;
+  }
+}
+
+/*
+ * @brief: check divisors at random, n of them 64 bit and n 32 bit.
+ */
+static void check_random(magic_check *c, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    check_divisor(c, (long)next_random(c));
+    check_divisor(c, (int32_t)next_random(c));
+  }
+}
+
+int main(int argc, char **argv) {
+  bool full = argc > 1 && strcmp(argv[1], "--full") == 0;
+  magic_check c = {.seed = 0x9e3779b97f4a7c15ull};
+
+  // the divisors strength_signed_magic turns down, and those next to them
+  check_range(&c, -(1l << 17), 1l << 17);
+  for (int k = 2; k < 63; k++)
+    for (long delta = -3; delta <= 3; delta++) {
+      check_divisor(&c, (1l << k) + delta);
+      check_divisor(&c, -(1l << k) + delta);
+    }
+
+  check_range(&c, INT32_MIN, INT32_MIN + 1000);
+  check_range(&c, INT32_MAX - 1000, INT32_MAX);
+  check_range(&c, LONG_MIN, LONG_MIN + 1000);
+  check_range(&c, LONG_MAX - 1000, LONG_MAX);
+
+  if (full) {
+    check_range(&c, INT32_MIN, INT32_MAX);
+    check_random(&c, 100000000);
+  } else {
+    check_random(&c, 1000000);
+  }
+
+  if (c.errors > 0) {
+    scu_pwarning("%u mismatch(es) in %" PRIu64 " checks\n", c.errors,
+                 c.checks);
+    return 1;
+  }
+  scu_psuccess("%" PRIu64 " divisors, %" PRIu64 " checks, 0 mismatches\n",
+               c.divisors, c.checks);
+  return 0;
+}